@@ -0,0 +1,87 @@
+#include "BenchSupport.h"
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <cstdlib>
+
+double elapsedSeconds(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+SOCKET listenOn(int port, int backlog) {
+    SOCKET fd = socket(AF_INET, SOCK_STREAM, 0);
+    int enable = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&enable), sizeof(enable));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<uint16_t>(port));
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(fd, backlog) != 0) {
+        std::cerr << "cannot listen on port " << port << std::endl;
+        std::exit(1);
+    }
+    return fd;
+}
+
+SOCKET connectTo(int port) {
+    SOCKET fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<uint16_t>(port));
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        closesocket(fd);
+        return INVALID_SOCKET;
+    }
+    int noDelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&noDelay), sizeof(noDelay));
+    return fd;
+}
+
+bool sendAll(SOCKET fd, const char* data, size_t length) {
+    while (length > 0) {
+        int sent = send(fd, data, static_cast<int>(length), MSG_NOSIGNAL);
+        if (sent <= 0) return false;
+        data += sent;
+        length -= static_cast<size_t>(sent);
+    }
+    return true;
+}
+
+bool readRequestHead(SOCKET fd, std::string& input) {
+    char buffer[4096];
+    while (input.find("\r\n\r\n") == std::string::npos) {
+        int received = recv(fd, buffer, sizeof(buffer), 0);
+        if (received <= 0) return false;
+        input.append(buffer, static_cast<size_t>(received));
+    }
+    return true;
+}
+
+void runBackend(SOCKET listener, const std::atomic<bool>& running, std::function<void(SOCKET)> serveOne) {
+    while (running.load()) {
+        SOCKET fd = accept(listener, nullptr, nullptr);
+        if (fd == INVALID_SOCKET) continue;
+        std::thread(serveOne, fd).detach();
+    }
+}
+
+void writeConfig(const std::string& path, const BenchConfig& config) {
+    std::ofstream out(path);
+    out << "{\n"
+        << "  \"server\": { \"port\": " << config.proxyPort;
+    if (!config.server.empty()) out << ", " << config.server;
+    out << " },\n"
+        << config.sections
+        << "  \"admission\": { \"enabled\": false },\n"
+        << "  \"admin\": { \"enabled\": false },\n"
+        << "  \"logging\": { \"file\": \"\", \"level\": \"ERROR\", \"console\": false },\n"
+        << "  \"load_balancer\": { \"algorithm\": \"ROUND_ROBIN\", \"backends\": [\n";
+    for (size_t i = 0; i < config.backendPorts.size(); i++) {
+        out << "    { \"host\": \"127.0.0.1\", \"port\": " << config.backendPorts[i]
+            << ", \"weight\": 1, \"enabled\": true }" << (i + 1 < config.backendPorts.size() ? ",\n" : "\n");
+    }
+    out << "  ] },\n"
+        << "  \"health_check\": { \"enabled\": false }\n"
+        << "}\n";
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include "Platform.h"
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Loopback plumbing shared by the end-to-end benches that run the real
+// Server against an in-process backend: sockets, the backend accept loop
+// and the proxy configuration file.
+
+double elapsedSeconds(std::chrono::steady_clock::time_point start);
+
+// Listening socket on 127.0.0.1; exits the process when the port is taken
+SOCKET listenOn(int port, int backlog = 512);
+
+// TCP_NODELAY connection to 127.0.0.1, or INVALID_SOCKET
+SOCKET connectTo(int port);
+
+bool sendAll(SOCKET fd, const char* data, size_t length);
+
+// Reads until the end of a request head; false when the peer goes away first
+bool readRequestHead(SOCKET fd, std::string& input);
+
+// Accepts until running turns false, serving each connection on a detached
+// thread; serveOne owns (and closes) the socket
+void runBackend(SOCKET listener, const std::atomic<bool>& running, std::function<void(SOCKET)> serveOne);
+
+// What a bench sets in the proxy configuration. Everything else is fixed:
+// admission, admin and health checks off, ERROR logging to no file, and
+// ROUND_ROBIN over the backends on 127.0.0.1.
+struct BenchConfig {
+    int proxyPort = 0;
+    std::string server;              // more "server" fields, e.g. "\"workers\": 1"
+    std::string sections;            // more top-level sections, each ending in ",\n"
+    std::vector<int> backendPorts;
+};
+
+void writeConfig(const std::string& path, const BenchConfig& config);
@@ -0,0 +1,348 @@
+// Compares the coroutine request pipeline with the callback one, in three
+// steps: coroutine frame allocation from a worker's FramePool against the
+// heap; a ping-pong over a loopback TCP pair on one EventLoop, driven once
+// by IoHandler callbacks and once by AsyncSocket co_awaits; and the real
+// Server on a loopback port with each pipeline, closed-loop clients on
+// keep-alive connections against an in-process backend. Needs a C++20
+// build. Arguments: requests, client threads, ping-pong round trips.
+#include "Coroutine.h"
+#include "Server.h"
+#include "Logger.h"
+#include "LoadBalancer.h"
+#include "Platform.h"
+#include "BenchSupport.h"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+#ifndef PROXY_HAS_COROUTINES
+int main() {
+    std::cerr << "coroutine_bench needs a C++20 build (REVERSE_PROXY_COROUTINES=ON)" << std::endl;
+    return 1;
+}
+#else
+
+namespace {
+
+constexpr int kProxyPort = 18890;
+constexpr int kBackendPort = 18011;
+
+std::atomic<bool> backendRunning{true};
+
+double elapsedNs(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+// --- Frame allocation ---
+
+Task<long> leaf(long value) {
+    co_return value + 1;
+}
+
+Task<long> middle(long value) {
+    long result = co_await leaf(value);
+    co_return result * 2;
+}
+
+Task<void> root(long value, long& sink) {
+    sink += co_await middle(value);
+}
+
+void benchFrames(size_t iterations) {
+    std::cout << "=== Frame Allocation (spawn + 3 nested frames, run to completion) ===" << std::endl;
+    long sink = 0;
+    TaskGroup tasks;
+
+    FramePool::setCurrent(nullptr);
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; i++) {
+        tasks.spawn(root(static_cast<long>(i), sink));
+    }
+    double heapNs = elapsedNs(start) / static_cast<double>(iterations);
+
+    FramePool pool;
+    FramePool::setCurrent(&pool);
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; i++) {
+        tasks.spawn(root(static_cast<long>(i), sink));
+    }
+    double poolNs = elapsedNs(start) / static_cast<double>(iterations);
+    FramePool::setCurrent(nullptr);
+
+    const FramePool::Stats& stats = pool.getStats();
+    std::cout << std::fixed << std::setprecision(1)
+              << "  heap:       " << std::setw(7) << heapNs << " ns/request" << std::endl
+              << "  frame pool: " << std::setw(7) << poolNs << " ns/request" << std::endl
+              << "  pool: " << stats.allocations << " frames, " << stats.reused << " reused, "
+              << stats.heapFallbacks << " heap fallbacks, " << stats.slabBytes / 1024 << " KB of slabs"
+              << " (sink " << sink % 10 << ")" << std::endl;
+}
+
+// --- Event loop ping-pong ---
+
+bool socketPair(SOCKET& a, SOCKET& b) {
+    SOCKET listener = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    socklen_t length = sizeof(addr);
+    if (bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(listener, 1) != 0 ||
+        getsockname(listener, reinterpret_cast<sockaddr*>(&addr), &length) != 0) {
+        closesocket(listener);
+        return false;
+    }
+    a = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(a, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        closesocket(listener);
+        return false;
+    }
+    b = accept(listener, nullptr, nullptr);
+    closesocket(listener);
+    int enable = 1;
+    setsockopt(a, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&enable), sizeof(enable));
+    setsockopt(b, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&enable), sizeof(enable));
+    return b != INVALID_SOCKET && setNonBlocking(a) && setNonBlocking(b);
+}
+
+// Each side answers every byte it reads with one byte, until `rounds`
+class PingPongHandler : public IoHandler {
+public:
+    PingPongHandler(EventLoop& l, SOCKET s, size_t& c, size_t r) : loop(l), fd(s), count(c), rounds(r) {}
+
+    void onEvent(uint32_t events) override {
+        if (!(events & EventLoop::Readable)) return;
+        char byte;
+        while (recv(fd, &byte, 1, 0) == 1) {
+            if (++count >= rounds) {
+                loop.stop();
+                return;
+            }
+            send(fd, &byte, 1, MSG_NOSIGNAL);
+        }
+    }
+
+private:
+    EventLoop& loop;
+    SOCKET fd;
+    size_t& count;
+    size_t rounds;
+};
+
+Task<void> pingPong(EventLoop& loop, AsyncSocket& socket, size_t& count, size_t rounds, bool serve) {
+    char byte = 'x';
+    if (!serve) co_await socket.write(&byte, 1);
+    while (count < rounds) {
+        IoResult result = co_await socket.read(&byte, 1);
+        if (result.bytes != 1) break;
+        if (++count >= rounds) break;
+        co_await socket.write(&byte, 1);
+    }
+    loop.stop();
+}
+
+void benchPingPong(size_t rounds) {
+    std::cout << "\n=== Event Loop Ping-Pong (1-byte messages, loopback TCP pair) ===" << std::endl;
+    std::atomic<bool> running{true};
+
+    SOCKET a, b;
+    if (!socketPair(a, b)) {
+        std::cerr << "cannot create socket pair" << std::endl;
+        return;
+    }
+    double callbackNs;
+    {
+        EventLoop loop;
+        size_t count = 0;
+        PingPongHandler left(loop, a, count, rounds);
+        PingPongHandler right(loop, b, count, rounds);
+        loop.add(a, EventLoop::Readable, &left);
+        loop.add(b, EventLoop::Readable, &right);
+        char byte = 'x';
+        send(a, &byte, 1, MSG_NOSIGNAL);
+        auto start = std::chrono::steady_clock::now();
+        loop.run(running);
+        callbackNs = elapsedNs(start) / static_cast<double>(count);
+        loop.remove(a);
+        loop.remove(b);
+    }
+    closesocket(a);
+    closesocket(b);
+
+    if (!socketPair(a, b)) {
+        std::cerr << "cannot create socket pair" << std::endl;
+        return;
+    }
+    double coroutineNs;
+    FramePool pool;
+    FramePool::setCurrent(&pool);
+    {
+        EventLoop loop;
+        AsyncSocket left(loop, a);
+        AsyncSocket right(loop, b);
+        size_t count = 0;
+        TaskGroup tasks;
+        auto start = std::chrono::steady_clock::now();
+        tasks.spawn(pingPong(loop, right, count, rounds, true));
+        tasks.spawn(pingPong(loop, left, count, rounds, false));
+        loop.run(running);
+        coroutineNs = elapsedNs(start) / static_cast<double>(count);
+        tasks.destroyAll();
+    }
+    FramePool::setCurrent(nullptr);
+
+    std::cout << std::fixed << std::setprecision(0)
+              << "  callbacks:  " << std::setw(7) << callbackNs << " ns/message" << std::endl
+              << "  coroutines: " << std::setw(7) << coroutineNs << " ns/message ("
+              << std::showpos << std::setprecision(1) << (coroutineNs / callbackNs - 1.0) * 100.0 << std::noshowpos
+              << "%)" << std::endl;
+}
+
+// --- Proxy end to end ---
+
+// The proxy opens one backend connection per request
+void serveOne(SOCKET fd) {
+    static const std::string response = "HTTP/1.1 200 OK\r\nContent-Length: 512\r\nContent-Type: text/plain\r\n\r\n" +
+                                        std::string(512, 'x');
+    std::string input;
+    if (readRequestHead(fd, input)) send(fd, response.data(), response.size(), MSG_NOSIGNAL);
+    closesocket(fd);
+}
+
+// One keep-alive exchange; false on a transport error or a non-200
+bool exchange(SOCKET fd, std::string& input) {
+    static const char kRequest[] = "GET /bench HTTP/1.1\r\nHost: bench\r\n\r\n";
+    if (send(fd, kRequest, sizeof(kRequest) - 1, MSG_NOSIGNAL) != static_cast<int>(sizeof(kRequest) - 1)) {
+        return false;
+    }
+
+    input.clear();
+    char buffer[4096];
+    size_t headEnd = std::string::npos;
+    size_t total = 0;
+    while (headEnd == std::string::npos || input.size() < total) {
+        int received = recv(fd, buffer, sizeof(buffer), 0);
+        if (received <= 0) return false;
+        input.append(buffer, received);
+        if (headEnd == std::string::npos && (headEnd = input.find("\r\n\r\n")) != std::string::npos) {
+            size_t field = input.find("Content-Length: ");
+            if (field == std::string::npos || field > headEnd) return false;
+            total = headEnd + 4 + std::strtoul(input.c_str() + field + 16, nullptr, 10);
+        }
+    }
+    return input.compare(0, 12, "HTTP/1.1 200") == 0;
+}
+
+BenchConfig benchConfig(const char* pipeline) {
+    BenchConfig config;
+    config.proxyPort = kProxyPort;
+    config.server = std::string("\"max_connections\": 1000, \"workers\": 1, \"keep_alive\": true, \"pipeline\": \"") +
+                    pipeline + "\"";
+    config.backendPorts = {kBackendPort};
+    return config;
+}
+
+void runProxy(const char* pipeline, size_t requests, unsigned threadCount) {
+    const std::string configPath = "coroutine_bench_config.json";
+    writeConfig(configPath, benchConfig(pipeline));
+
+    Logger logger("", false, LogLevel::ERROR);
+    LoadBalancer loadBalancer(LoadBalancingAlgorithm::ROUND_ROBIN);
+    Server server(logger, loadBalancer);
+    std::streambuf* saved = std::cout.rdbuf(nullptr);   // silence configuration dump
+    bool configured = server.configure(configPath);
+    std::cout.rdbuf(saved);
+    std::remove(configPath.c_str());
+    if (!configured) {
+        std::cerr << "configuration failed" << std::endl;
+        std::exit(1);
+    }
+
+    std::thread serverThread([&] {
+        std::streambuf* quiet = std::cout.rdbuf(nullptr);
+        server.start();
+        std::cout.rdbuf(quiet);
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+
+    std::vector<std::vector<double>> latencies(threadCount);
+    std::atomic<size_t> next{0};
+    std::atomic<size_t> failures{0};
+    std::vector<std::thread> clients;
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned t = 0; t < threadCount; t++) {
+        clients.emplace_back([&, t] {
+            SOCKET fd = connectTo(kProxyPort);
+            std::string input;
+            while (next.fetch_add(1) < requests) {
+                auto sent = std::chrono::steady_clock::now();
+                if (fd == INVALID_SOCKET || !exchange(fd, input)) {
+                    failures++;
+                    if (fd != INVALID_SOCKET) closesocket(fd);
+                    fd = connectTo(kProxyPort);
+                    continue;
+                }
+                latencies[t].push_back(elapsedNs(sent) / 1000.0);
+            }
+            if (fd != INVALID_SOCKET) closesocket(fd);
+        });
+    }
+    for (auto& client : clients) {
+        client.join();
+    }
+    double seconds = elapsedNs(start) / 1e9;
+
+    server.requestStop();
+    serverThread.join();
+
+    std::vector<double> all;
+    for (const auto& samples : latencies) {
+        all.insert(all.end(), samples.begin(), samples.end());
+    }
+    std::sort(all.begin(), all.end());
+    auto percentile = [&all](double q) {
+        return all.empty() ? 0.0 : all[static_cast<size_t>(q * static_cast<double>(all.size() - 1))];
+    };
+
+    std::cout << std::left << std::setw(12) << pipeline << std::right << std::fixed << std::setprecision(0)
+              << std::setw(8) << static_cast<double>(all.size()) / seconds << " req/s"
+              << std::setprecision(1)
+              << "  p50 " << std::setw(7) << percentile(0.50) << " us"
+              << "  p99 " << std::setw(7) << percentile(0.99) << " us"
+              << "  p999 " << std::setw(7) << percentile(0.999) << " us"
+              << "  failures " << failures.load() << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    size_t requests = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 20000;
+    unsigned threadCount = argc > 2 ? static_cast<unsigned>(std::atoi(argv[2])) : 4;
+    size_t rounds = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 200000;
+
+    benchFrames(2000000);
+    benchPingPong(rounds);
+
+    SOCKET listener = listenOn(kBackendPort);
+    std::thread backend(runBackend, listener, std::cref(backendRunning), serveOne);
+
+    std::cout << "\n=== Proxy End to End (" << requests << " requests, " << threadCount
+              << " keep-alive clients, 512-byte responses) ===" << std::endl;
+    runProxy("callback", requests, threadCount);
+    runProxy("coroutine", requests, threadCount);
+    runProxy("callback", requests, threadCount);
+    runProxy("coroutine", requests, threadCount);
+
+    // The backend thread blocks in accept; the process exit reclaims it
+    backendRunning.store(false);
+    backend.detach();
+    return 0;
+}
+
+#endif // PROXY_HAS_COROUTINES
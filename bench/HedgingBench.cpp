@@ -0,0 +1,197 @@
+// Measures tail latency through the proxy with and without retries and
+// hedging. Backends run in-process: most requests are answered after about
+// a millisecond, a small fraction stall (a GC pause, a slow disk). A second
+// scenario adds a configured backend that refuses connections. Each case
+// runs the real Server on a loopback port and reports status counts and
+// p50/p99/p999 as seen by a closed-loop client. Arguments: requests,
+// client threads, stall probability.
+#include "Server.h"
+#include "Logger.h"
+#include "LoadBalancer.h"
+#include "Platform.h"
+#include "BenchSupport.h"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <random>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+constexpr int kProxyPort = 18888;
+constexpr int kBackendPorts[] = {18001, 18002, 18003};
+constexpr int kDeadPort = 18009;
+constexpr int kFastDelayMs = 1;
+constexpr int kStallDelayMs = 60;
+
+std::atomic<bool> backendsRunning{true};
+double stallProbability = 0.02;
+
+std::mutex randomMutex;
+std::mt19937 stallRandom(1);
+
+bool stalls() {
+    std::lock_guard<std::mutex> lock(randomMutex);
+    return std::uniform_real_distribution<double>(0.0, 1.0)(stallRandom) < stallProbability;
+}
+
+// Reads one request head, waits, answers and closes (the proxy sends
+// Connection: close upstream)
+void serveOne(SOCKET fd) {
+    std::string input;
+    if (!readRequestHead(fd, input)) {
+        closesocket(fd);
+        return;
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(stalls() ? kStallDelayMs : kFastDelayMs));
+    static const char kResponse[] = "HTTP/1.1 200 OK\r\nContent-Length: 3\r\nContent-Type: text/plain\r\n\r\nok\n";
+    send(fd, kResponse, sizeof(kResponse) - 1, MSG_NOSIGNAL);
+    closesocket(fd);
+}
+
+// Returns the status code, or 0 on a transport error
+int request(const char* path) {
+    SOCKET fd = connectTo(kProxyPort);
+    if (fd == INVALID_SOCKET) return 0;
+
+    std::string head = std::string("GET ") + path + " HTTP/1.1\r\nHost: bench\r\nConnection: close\r\n\r\n";
+    send(fd, head.data(), head.size(), MSG_NOSIGNAL);
+
+    std::string response;
+    char buffer[4096];
+    int received;
+    while ((received = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+        response.append(buffer, received);
+    }
+    closesocket(fd);
+
+    if (response.compare(0, 9, "HTTP/1.1 ") != 0 || response.size() < 12) return 0;
+    return std::atoi(response.c_str() + 9);
+}
+
+BenchConfig benchConfig(bool retries, bool hedging, bool deadBackend) {
+    BenchConfig config;
+    config.proxyPort = kProxyPort;
+    config.server = "\"max_connections\": 1000, \"workers\": 1, \"keep_alive\": false";
+    config.sections = std::string("  \"retries\": { \"enabled\": ") + (retries ? "true" : "false") +
+                      ", \"max_retries\": 1, \"budget_percent\": 20, \"min_retries_per_second\": 10" +
+                      ", \"hedge_enabled\": " + (hedging ? "true" : "false") +
+                      ", \"hedge_percentile\": 95, \"hedge_min_delay_ms\": 2 },\n";
+    config.backendPorts.assign(std::begin(kBackendPorts), std::end(kBackendPorts));
+    if (deadBackend) config.backendPorts.push_back(kDeadPort);
+    return config;
+}
+
+double percentile(const std::vector<double>& sorted, double q) {
+    size_t index = static_cast<size_t>(q * static_cast<double>(sorted.size() - 1));
+    return sorted[index];
+}
+
+void runCase(const char* name, bool retries, bool hedging, bool deadBackend, size_t requests, unsigned threadCount) {
+    const std::string configPath = "hedging_bench_config.json";
+    writeConfig(configPath, benchConfig(retries, hedging, deadBackend));
+
+    Logger logger("", false, LogLevel::ERROR);
+    LoadBalancer loadBalancer(LoadBalancingAlgorithm::ROUND_ROBIN);
+    Server server(logger, loadBalancer);
+    std::streambuf* saved = std::cout.rdbuf(nullptr);   // silence configuration dump
+    bool configured = server.configure(configPath);
+    std::cout.rdbuf(saved);
+    std::remove(configPath.c_str());
+    if (!configured) {
+        std::cerr << "configuration failed" << std::endl;
+        std::exit(1);
+    }
+
+    std::thread serverThread([&] {
+        std::streambuf* quiet = std::cout.rdbuf(nullptr);
+        server.start();
+        std::cout.rdbuf(quiet);
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+
+    std::vector<std::vector<double>> latencies(threadCount);
+    std::vector<std::vector<size_t>> statuses(threadCount, std::vector<size_t>(600, 0));
+    std::atomic<size_t> next{0};
+    std::vector<std::thread> clients;
+    for (unsigned t = 0; t < threadCount; t++) {
+        clients.emplace_back([&, t] {
+            while (next.fetch_add(1) < requests) {
+                auto start = std::chrono::steady_clock::now();
+                int status = request("/bench");
+                auto end = std::chrono::steady_clock::now();
+                latencies[t].push_back(std::chrono::duration<double, std::milli>(end - start).count());
+                statuses[t][status >= 0 && status < 600 ? status : 0]++;
+            }
+        });
+    }
+    for (auto& client : clients) {
+        client.join();
+    }
+
+    server.requestStop();
+    serverThread.join();
+
+    std::vector<double> all;
+    std::vector<size_t> counts(600, 0);
+    for (unsigned t = 0; t < threadCount; t++) {
+        all.insert(all.end(), latencies[t].begin(), latencies[t].end());
+        for (size_t s = 0; s < counts.size(); s++) counts[s] += statuses[t][s];
+    }
+    std::sort(all.begin(), all.end());
+
+    std::cout << std::left << std::setw(20) << name << std::right << std::fixed << std::setprecision(2)
+              << " p50 " << std::setw(7) << percentile(all, 0.50) << " ms"
+              << "  p99 " << std::setw(7) << percentile(all, 0.99) << " ms"
+              << "  p999 " << std::setw(7) << percentile(all, 0.999) << " ms"
+              << "  statuses:";
+    for (size_t s = 0; s < counts.size(); s++) {
+        if (counts[s] != 0) std::cout << " " << s << "x" << counts[s];
+    }
+    RetryStats& stats = server.getRetryControl().getStats();
+    std::cout << "  (retries " << stats.retries.load() << ", hedges " << stats.hedges.load()
+              << ", hedge wins " << stats.hedgeWins.load() << ", budget denials " << stats.budgetExhausted.load()
+              << ")" << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    size_t requests = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 20000;
+    unsigned threadCount = argc > 2 ? static_cast<unsigned>(std::atoi(argv[2])) : 4;
+    if (argc > 3) stallProbability = std::atof(argv[3]);
+
+    std::vector<std::thread> backends;
+    for (size_t i = 0; i < sizeof(kBackendPorts) / sizeof(kBackendPorts[0]); i++) {
+        SOCKET listener = listenOn(kBackendPorts[i]);
+        backends.emplace_back(runBackend, listener, std::cref(backendsRunning), serveOne);
+    }
+
+    std::cout << "Requests: " << requests << ", client threads: " << threadCount
+              << ", stall probability: " << stallProbability << " (" << kStallDelayMs << " ms)" << std::endl;
+
+    std::cout << "\nSlow backends (3 backends, occasional stalls)" << std::endl;
+    runCase("no hedging", true, false, false, requests, threadCount);
+    runCase("hedging", true, true, false, requests, threadCount);
+
+    std::cout << "\nFailing backend (one of 4 refuses connections)" << std::endl;
+    runCase("no retries", false, false, true, requests, threadCount);
+    runCase("retries", true, false, true, requests, threadCount);
+    runCase("retries + hedging", true, true, true, requests, threadCount);
+
+    // Backend threads block in accept; the process exit reclaims them
+    backendsRunning.store(false);
+    for (auto& backend : backends) {
+        backend.detach();
+    }
+    return 0;
+}
@@ -0,0 +1,588 @@
+// Compares the HTTP/2 frontend with the HTTP/1.1 path it replaces for
+// concurrent clients: request throughput with C requests in flight, as C
+// streams on one h2c connection against C keep-alive connections, and the
+// memory each active request costs while N of them wait on a backend that
+// holds its responses (process RSS, which includes the in-process client
+// and backend, plus TCP sockets open machine-wide). Every case runs in a
+// forked child so freed heap from one case does not hide the next one's.
+// Arguments: requests, concurrency, held requests.
+#include "Server.h"
+#include "Logger.h"
+#include "LoadBalancer.h"
+#include "Hpack.h"
+#include "Http2.h"
+#include "Platform.h"
+#include "BenchSupport.h"
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifndef __linux__
+int main() {
+    std::cerr << "http2_bench needs Linux (epoll, fork and /proc)" << std::endl;
+    return 1;
+}
+#else
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+namespace {
+
+constexpr int kProxyPort = 18893;
+constexpr int kBackendPort = 18031;
+
+std::atomic<size_t> heldRequests{0};
+int releasePipe[2] = {-1, -1};
+
+size_t residentBytes() {
+    std::ifstream statm("/proc/self/statm");
+    size_t size = 0;
+    size_t resident = 0;
+    statm >> size >> resident;
+    return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
+
+// TCP sockets in use across the machine (the client, proxy and backend here)
+long tcpSockets() {
+    std::ifstream sockstat("/proc/net/sockstat");
+    std::string line;
+    while (std::getline(sockstat, line)) {
+        if (line.compare(0, 4, "TCP:") != 0) continue;
+        std::istringstream fields(line.substr(4));
+        std::string name;
+        long value = 0;
+        while (fields >> name >> value) {
+            if (name == "inuse") return value;
+        }
+    }
+    return 0;
+}
+
+// One epoll thread: GET /small is answered at once, GET /hold waits until
+// something is written to releasePipe. The proxy sends one request per
+// backend connection, so every answer ends with a close.
+void runBackend() {
+    SOCKET listener = listenOn(kBackendPort, 4096);
+    setNonBlocking(listener);
+
+    int epoll = epoll_create1(0);
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.fd = listener;
+    epoll_ctl(epoll, EPOLL_CTL_ADD, listener, &event);
+    event.data.fd = releasePipe[0];
+    epoll_ctl(epoll, EPOLL_CTL_ADD, releasePipe[0], &event);
+
+    static const char kResponse[] = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\nConnection: close\r\n\r\nok";
+    std::vector<std::string> inputs;
+    std::vector<SOCKET> held;
+    epoll_event events[256];
+    while (true) {
+        int count = epoll_wait(epoll, events, 256, -1);
+        for (int i = 0; i < count; i++) {
+            int fd = events[i].data.fd;
+            if (fd == listener) {
+                SOCKET client;
+                while ((client = accept(listener, nullptr, nullptr)) != INVALID_SOCKET) {
+                    if (static_cast<size_t>(client) >= inputs.size()) inputs.resize(client + 1);
+                    inputs[client].clear();
+                    event.data.fd = client;
+                    epoll_ctl(epoll, EPOLL_CTL_ADD, client, &event);
+                }
+                continue;
+            }
+            if (fd == releasePipe[0]) {
+                char byte;
+                if (read(releasePipe[0], &byte, 1) != 1) continue;
+                for (SOCKET client : held) {
+                    sendAll(client, kResponse, sizeof(kResponse) - 1);
+                    closesocket(client);
+                }
+                held.clear();
+                heldRequests.store(0);
+                continue;
+            }
+
+            char buffer[4096];
+            int received = recv(fd, buffer, sizeof(buffer), 0);
+            if (received <= 0) {
+                epoll_ctl(epoll, EPOLL_CTL_DEL, fd, nullptr);
+                closesocket(fd);
+                continue;
+            }
+            std::string& input = inputs[fd];
+            input.append(buffer, static_cast<size_t>(received));
+            if (input.find("\r\n\r\n") == std::string::npos) continue;
+
+            epoll_ctl(epoll, EPOLL_CTL_DEL, fd, nullptr);
+            if (input.compare(0, 9, "GET /hold") == 0) {
+                held.push_back(fd);
+                heldRequests.fetch_add(1);
+            } else {
+                sendAll(fd, kResponse, sizeof(kResponse) - 1);
+                closesocket(fd);
+            }
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Minimal h2c client: GET requests, responses counted at END_STREAM
+
+class Http2Client {
+public:
+    bool open() {
+        fd = connectTo(kProxyPort);
+        if (fd == INVALID_SOCKET) return false;
+        output.assign(Http2::kPreface, Http2::kPrefaceLength);
+        // INITIAL_WINDOW_SIZE 16 MB, and a 1 GB connection window
+        const char settings[] = {0x00, 0x04, 0x01, 0x00, 0x00, 0x00};
+        appendFrame(0x4, 0, 0, settings, sizeof(settings));
+        appendWindowUpdate(1u << 30);
+        return flush();
+    }
+
+    void close() {
+        if (fd != INVALID_SOCKET) closesocket(fd);
+        fd = INVALID_SOCKET;
+    }
+
+    void request(const std::string& path) {
+        std::string block;
+        encoder.beginBlock(block);
+        encoder.encode(":method", "GET", block);
+        encoder.encode(":scheme", "http", block);
+        encoder.encode(":path", path, block);
+        encoder.encode(":authority", "bench", block);
+        appendFrame(0x1, 0x5, nextStreamId, block.data(), block.size());
+        nextStreamId += 2;
+    }
+
+    bool flush() {
+        bool ok = sendAll(fd, output.data(), output.size());
+        output.clear();
+        return ok;
+    }
+
+    // Reads what is available (blocking for at least one frame) and returns
+    // the streams finished, counting resets in failures; -1 when the
+    // connection is gone
+    long poll(size_t& failures) {
+        char buffer[64 * 1024];
+        int received = recv(fd, buffer, sizeof(buffer), 0);
+        if (received <= 0) return -1;
+        input.append(buffer, static_cast<size_t>(received));
+
+        long finished = 0;
+        size_t offset = 0;
+        while (input.size() - offset >= 9) {
+            const uint8_t* frame = reinterpret_cast<const uint8_t*>(input.data()) + offset;
+            size_t length = (static_cast<size_t>(frame[0]) << 16) | (frame[1] << 8) | frame[2];
+            if (input.size() - offset < 9 + length) break;
+            uint8_t type = frame[3];
+            uint8_t flags = frame[4];
+            offset += 9 + length;
+
+            if (type == 0x0) {
+                consumed += length;
+                if (flags & 0x1) finished++;
+            } else if (type == 0x1) {
+                // Decoded to keep the dynamic table in step; the fields are not needed
+                HeaderList fields;
+                if (decoder.decode(frame + 9, length, fields, 1 << 20) == HpackDecoder::Result::Invalid) return -1;
+                if (flags & 0x1) finished++;
+            } else if (type == 0x3) {
+                failures++;
+                finished++;
+            } else if (type == 0x4 && !(flags & 0x1)) {
+                appendFrame(0x4, 0x1, 0, nullptr, 0);
+            } else if (type == 0x7) {
+                return -1;
+            }
+        }
+        input.erase(0, offset);
+
+        if (consumed >= (1u << 29)) {
+            appendWindowUpdate(static_cast<uint32_t>(consumed));
+            consumed = 0;
+        }
+        if (!output.empty() && !flush()) return -1;
+        return finished;
+    }
+
+private:
+    SOCKET fd = INVALID_SOCKET;
+    HpackEncoder encoder;
+    HpackDecoder decoder;
+    std::string input;
+    std::string output;
+    uint32_t nextStreamId = 1;
+    size_t consumed = 0;
+
+    void appendFrame(uint8_t type, uint8_t flags, uint32_t streamId, const char* payload, size_t length) {
+        const char header[9] = {static_cast<char>(length >> 16), static_cast<char>(length >> 8),
+                                static_cast<char>(length), static_cast<char>(type), static_cast<char>(flags),
+                                static_cast<char>(streamId >> 24), static_cast<char>(streamId >> 16),
+                                static_cast<char>(streamId >> 8), static_cast<char>(streamId)};
+        output.append(header, sizeof(header));
+        if (length > 0) output.append(payload, length);
+    }
+
+    void appendWindowUpdate(uint32_t increment) {
+        const char payload[4] = {static_cast<char>(increment >> 24), static_cast<char>(increment >> 16),
+                                 static_cast<char>(increment >> 8), static_cast<char>(increment)};
+        appendFrame(0x8, 0, 0, payload, sizeof(payload));
+    }
+};
+
+// ---------------------------------------------------------------------------
+// HTTP/1.1 keep-alive client connections, one request outstanding each
+
+// True once a full response is buffered; it is removed from input
+bool takeResponse(std::string& input, bool& ok) {
+    size_t end = input.find("\r\n\r\n");
+    if (end == std::string::npos) return false;
+    size_t length = 0;
+    size_t header = input.find("Content-Length: ");
+    if (header != std::string::npos && header < end) length = std::strtoul(input.c_str() + header + 16, nullptr, 10);
+    if (input.size() < end + 4 + length) return false;
+    ok = input.compare(9, 3, "200") == 0;
+    input.erase(0, end + 4 + length);
+    return true;
+}
+
+std::string getRequest(const std::string& path) {
+    return "GET " + path + " HTTP/1.1\r\nHost: bench\r\n\r\n";
+}
+
+// Sends one request on every connection, then waits for all answers
+bool http1Round(std::vector<SOCKET>& sockets, const std::string& path, size_t& failures) {
+    const std::string request = getRequest(path);
+    for (SOCKET fd : sockets) {
+        if (!sendAll(fd, request.data(), request.size())) return false;
+    }
+    for (SOCKET fd : sockets) {
+        std::string input;
+        char buffer[4096];
+        bool ok = false;
+        while (!takeResponse(input, ok)) {
+            int received = recv(fd, buffer, sizeof(buffer), 0);
+            if (received <= 0) return false;
+            input.append(buffer, static_cast<size_t>(received));
+        }
+        if (!ok) failures++;
+    }
+    return true;
+}
+
+double runHttp1Throughput(size_t requests, size_t concurrency, size_t& failures) {
+    std::vector<SOCKET> sockets;
+    for (size_t i = 0; i < concurrency; i++) {
+        SOCKET fd = connectTo(kProxyPort);
+        if (fd == INVALID_SOCKET) return 0;
+        sockets.push_back(fd);
+    }
+    int epoll = epoll_create1(0);
+    for (SOCKET fd : sockets) {
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &event);
+    }
+
+    const std::string request = getRequest("/small");
+    std::vector<std::string> inputs(static_cast<size_t>(*std::max_element(sockets.begin(), sockets.end())) + 1);
+    auto start = std::chrono::steady_clock::now();
+    size_t issued = 0;
+    size_t completed = 0;
+    for (SOCKET fd : sockets) {
+        if (issued < requests && sendAll(fd, request.data(), request.size())) issued++;
+    }
+    epoll_event events[256];
+    while (completed < issued) {
+        int count = epoll_wait(epoll, events, 256, 10000);
+        if (count <= 0) break;
+        for (int i = 0; i < count; i++) {
+            SOCKET fd = events[i].data.fd;
+            char buffer[16 * 1024];
+            int received = recv(fd, buffer, sizeof(buffer), 0);
+            if (received <= 0) {
+                epoll_ctl(epoll, EPOLL_CTL_DEL, fd, nullptr);
+                continue;
+            }
+            inputs[fd].append(buffer, static_cast<size_t>(received));
+            bool ok = false;
+            while (takeResponse(inputs[fd], ok)) {
+                completed++;
+                if (!ok) failures++;
+                if (issued < requests && sendAll(fd, request.data(), request.size())) issued++;
+            }
+        }
+    }
+    double seconds = elapsedSeconds(start);
+    failures += requests - completed;
+
+    closesocket(epoll);
+    for (SOCKET fd : sockets) {
+        closesocket(fd);
+    }
+    return static_cast<double>(completed) / seconds;
+}
+
+double runHttp2Throughput(size_t requests, size_t concurrency, size_t& failures) {
+    Http2Client client;
+    if (!client.open()) return 0;
+
+    auto start = std::chrono::steady_clock::now();
+    size_t issued = 0;
+    size_t completed = 0;
+    for (; issued < std::min(requests, concurrency); issued++) {
+        client.request("/small");
+    }
+    client.flush();
+    while (completed < issued) {
+        long finished = client.poll(failures);
+        if (finished < 0) break;
+        completed += static_cast<size_t>(finished);
+        for (long i = 0; i < finished && issued < requests; i++, issued++) {
+            client.request("/small");
+        }
+        if (!client.flush()) break;
+    }
+    double seconds = elapsedSeconds(start);
+    failures += requests - completed;
+    client.close();
+    return static_cast<double>(completed) / seconds;
+}
+
+bool waitForHeld(size_t count) {
+    auto start = std::chrono::steady_clock::now();
+    while (heldRequests.load() < count) {
+        if (elapsedSeconds(start) > 30) return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    // Let the last buffers settle before sampling
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    return true;
+}
+
+void releaseHeld() {
+    char byte = 1;
+    if (write(releasePipe[1], &byte, 1) != 1) {
+        std::cerr << "cannot release held requests" << std::endl;
+    }
+}
+
+struct Footprint {
+    size_t requests = 0;
+    long rssBytes = 0;
+    long sockets = 0;
+    size_t failures = 0;
+};
+
+Footprint holdHttp1(size_t count) {
+    Footprint footprint;
+    std::vector<SOCKET> warm(1, connectTo(kProxyPort));
+    http1Round(warm, "/small", footprint.failures);
+    closesocket(warm[0]);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    size_t rssBefore = residentBytes();
+    long socketsBefore = tcpSockets();
+
+    std::vector<SOCKET> sockets;
+    const std::string request = getRequest("/hold");
+    for (size_t i = 0; i < count; i++) {
+        SOCKET fd = connectTo(kProxyPort);
+        if (fd == INVALID_SOCKET || !sendAll(fd, request.data(), request.size())) break;
+        sockets.push_back(fd);
+    }
+    if (waitForHeld(sockets.size())) {
+        footprint.requests = sockets.size();
+        footprint.rssBytes = static_cast<long>(residentBytes()) - static_cast<long>(rssBefore);
+        footprint.sockets = tcpSockets() - socketsBefore;
+    }
+
+    releaseHeld();
+    for (SOCKET fd : sockets) {
+        std::string input;
+        char buffer[4096];
+        bool ok = false;
+        while (!takeResponse(input, ok)) {
+            int received = recv(fd, buffer, sizeof(buffer), 0);
+            if (received <= 0) break;
+            input.append(buffer, static_cast<size_t>(received));
+        }
+        if (!ok) footprint.failures++;
+        closesocket(fd);
+    }
+    return footprint;
+}
+
+Footprint holdHttp2(size_t count) {
+    Footprint footprint;
+    Http2Client client;
+    if (!client.open()) return footprint;
+    client.request("/small");
+    client.flush();
+    while (client.poll(footprint.failures) == 0) {
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    size_t rssBefore = residentBytes();
+    long socketsBefore = tcpSockets();
+
+    for (size_t i = 0; i < count; i++) {
+        client.request("/hold");
+    }
+    client.flush();
+    if (waitForHeld(count)) {
+        footprint.requests = count;
+        footprint.rssBytes = static_cast<long>(residentBytes()) - static_cast<long>(rssBefore);
+        footprint.sockets = tcpSockets() - socketsBefore;
+    }
+
+    releaseHeld();
+    size_t completed = 0;
+    while (completed < count) {
+        long finished = client.poll(footprint.failures);
+        if (finished < 0) break;
+        completed += static_cast<size_t>(finished);
+    }
+    footprint.failures += count - completed;
+    client.close();
+    return footprint;
+}
+
+BenchConfig benchConfig(size_t streams) {
+    BenchConfig config;
+    config.proxyPort = kProxyPort;
+    config.server = "\"max_connections\": " + std::to_string(streams * 4 + 100) +
+                    ", \"workers\": 1, \"keep_alive\": true";
+    config.sections = "  \"http2\": { \"enabled\": true, \"max_concurrent_streams\": " + std::to_string(streams) +
+                      " },\n"
+                      "  \"timeouts\": { \"upstream_first_byte_ms\": 600000, \"request_total_ms\": 600000 },\n";
+    config.backendPorts = {kBackendPort};
+    return config;
+}
+
+// Runs body() in a child process with its own backend and proxy
+template <typename Body>
+void inChild(size_t streams, Body body) {
+    std::cout.flush();
+    pid_t child = fork();
+    if (child < 0) {
+        std::cerr << "fork failed" << std::endl;
+        std::exit(1);
+    }
+    if (child > 0) {
+        int status = 0;
+        waitpid(child, &status, 0);
+        return;
+    }
+
+    if (pipe(releasePipe) != 0) std::_Exit(1);
+    std::thread(runBackend).detach();
+
+    const std::string configPath = "http2_bench_config.json";
+    writeConfig(configPath, benchConfig(streams));
+    Logger logger("", false, LogLevel::ERROR);
+    LoadBalancer loadBalancer(LoadBalancingAlgorithm::ROUND_ROBIN);
+    Server server(logger, loadBalancer);
+    std::streambuf* saved = std::cout.rdbuf(nullptr);   // silence configuration dump
+    bool configured = server.configure(configPath);
+    std::remove(configPath.c_str());
+    if (!configured) {
+        std::cout.rdbuf(saved);
+        std::cerr << "configuration failed" << std::endl;
+        std::_Exit(1);
+    }
+    std::thread serverThread([&] { server.start(); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    std::cout.rdbuf(saved);
+
+    body();
+    std::cout.flush();
+
+    std::cout.rdbuf(nullptr);
+    server.requestStop();
+    serverThread.join();
+    std::cout.rdbuf(saved);
+    // The backend thread blocks in epoll_wait; the exit reclaims it
+    std::_Exit(0);
+}
+
+void printThroughput(const char* name, double rate, size_t failures) {
+    std::cout << std::left << std::setw(30) << name << std::right << std::fixed << std::setprecision(0)
+              << std::setw(9) << rate << " req/s";
+    if (failures > 0) std::cout << "  (" << failures << " failed)";
+    std::cout << std::endl;
+}
+
+void printFootprint(const char* name, const Footprint& footprint, size_t expected) {
+    if (footprint.requests < expected) {
+        std::cout << std::left << std::setw(30) << name << "only " << footprint.requests << " of " << expected
+                  << " requests reached the backend" << std::endl;
+        return;
+    }
+    double perRequest = static_cast<double>(footprint.rssBytes) / static_cast<double>(footprint.requests);
+    std::cout << std::left << std::setw(30) << name << std::right << std::fixed << std::setprecision(1)
+              << std::setw(8) << perRequest / 1024 << " KB RSS per request  " << std::setprecision(2)
+              << std::setw(5) << static_cast<double>(footprint.sockets) / static_cast<double>(footprint.requests)
+              << " TCP sockets per request";
+    if (footprint.failures > 0) std::cout << "  (" << footprint.failures << " failed)";
+    std::cout << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    size_t requests = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 100000;
+    size_t concurrency = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 64;
+    size_t held = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 1000;
+
+    signal(SIGPIPE, SIG_IGN);
+    // Four descriptors per held HTTP/1.1 request: client, proxy (both sides) and backend
+    rlimit limit{};
+    getrlimit(RLIMIT_NOFILE, &limit);
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+    if (limit.rlim_cur < held * 4 + 256) {
+        std::cerr << "descriptor limit " << limit.rlim_cur << " is too low for " << held << " held requests"
+                  << std::endl;
+        return 1;
+    }
+
+    std::cout << "Requests: " << requests << ", concurrency: " << concurrency << ", held requests: " << held
+              << std::endl;
+
+    std::cout << "\nThroughput (" << concurrency << " requests in flight, 2-byte responses)" << std::endl;
+    size_t streams = std::max(concurrency, held);
+    inChild(streams, [&] {
+        size_t failures = 0;
+        double rate = runHttp1Throughput(requests, concurrency, failures);
+        printThroughput(("HTTP/1.1, " + std::to_string(concurrency) + " connections").c_str(), rate, failures);
+    });
+    inChild(streams, [&] {
+        size_t failures = 0;
+        double rate = runHttp2Throughput(requests, concurrency, failures);
+        printThroughput("HTTP/2, 1 connection", rate, failures);
+    });
+
+    std::cout << "\nMemory per active request (" << held << " waiting on the backend)" << std::endl;
+    inChild(streams, [&] { printFootprint("HTTP/1.1 connections", holdHttp1(held), held); });
+    inChild(streams, [&] { printFootprint("HTTP/2 streams", holdHttp2(held), held); });
+    return 0;
+}
+
+#endif
@@ -0,0 +1,248 @@
+// Google Benchmark suite for LoadBalancer::getNextBackend, for every
+// LoadBalancingAlgorithm. The "Pick" runs are single-threaded and sweep pool
+// size (2 to 10,000 backends), healthy fraction and weight profile (uniform,
+// or skewed Zipf-like). They report ns per pick and fairness: the most and
+// least picked healthy backend's share of picks divided by its target share
+// (its weight share for WEIGHTED_ROUND_ROBIN, an equal share otherwise), so
+// 1.0/1.0 is perfect. IP_HASH also reports the fraction of clients remapped
+// when one more backend goes down, next to the ideal 1/healthy.
+// LEAST_CONNECTIONS fairness is measured with 64 requests in flight.
+// The "Contended" runs share one balancer between 1 to 64 threads; the
+// "Sharded" ones give each thread its own selection state, as workers get
+// with affinity.per_worker_balancer.
+// Standard Google Benchmark flags apply, e.g. --benchmark_filter=IP_HASH.
+#include "LoadBalancer.h"
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace {
+
+enum class Weights { Uniform, Skewed };
+
+struct Scenario {
+    LoadBalancingAlgorithm algorithm;
+    int backends;
+    int healthyPercent;
+    Weights weights;
+};
+
+struct Fairness {
+    double maxShare = 0.0;
+    double minShare = 0.0;
+    double remap = -1.0;        // IP_HASH only
+    double remapIdeal = -1.0;
+};
+
+constexpr size_t kClientCount = 65536;   // power of two
+constexpr size_t kInFlight = 64;
+constexpr uint64_t kFairnessPicks = 200000;
+
+std::vector<std::string> clientIPs;
+
+const char* algorithmName(LoadBalancingAlgorithm algorithm) {
+    switch (algorithm) {
+        case LoadBalancingAlgorithm::ROUND_ROBIN: return "ROUND_ROBIN";
+        case LoadBalancingAlgorithm::WEIGHTED_ROUND_ROBIN: return "WEIGHTED_ROUND_ROBIN";
+        case LoadBalancingAlgorithm::LEAST_CONNECTIONS: return "LEAST_CONNECTIONS";
+        case LoadBalancingAlgorithm::IP_HASH: return "IP_HASH";
+    }
+    return "UNKNOWN";
+}
+
+std::string dottedQuad(uint32_t address) {
+    return std::to_string(address >> 24) + "." + std::to_string((address >> 16) & 255) + "." +
+           std::to_string((address >> 8) & 255) + "." + std::to_string(address & 255);
+}
+
+int weightFor(int rank, Weights weights) {
+    // A few heavy backends and a long tail of weight 1
+    return weights == Weights::Uniform ? 1 : std::max(1, 1000 / (rank + 1));
+}
+
+std::unique_ptr<LoadBalancer> build(const Scenario& scenario) {
+    std::unique_ptr<LoadBalancer> lb(new LoadBalancer(scenario.algorithm));
+    for (int i = 0; i < scenario.backends; i++) {
+        lb->addBackend(dottedQuad(0x0A000000u + static_cast<uint32_t>(i)), 8080, weightFor(i, scenario.weights));
+    }
+
+    // Take a spread-out subset down; backend 0 always stays up
+    for (int i = 1; i < scenario.backends; i++) {
+        uint32_t hash = static_cast<uint32_t>(i) * 2654435761u;
+        if ((hash >> 16) % 100 >= static_cast<uint32_t>(scenario.healthyPercent)) {
+            lb->getBackend(static_cast<size_t>(i))->isHealthy = false;
+        }
+    }
+    return lb;
+}
+
+Fairness measureFairness(const Scenario& scenario) {
+    std::unique_ptr<LoadBalancer> lb = build(scenario);
+    size_t count = lb->getBackendCount();
+    bool weighted = scenario.algorithm == LoadBalancingAlgorithm::WEIGHTED_ROUND_ROBIN;
+
+    std::vector<double> target(count, 0.0);
+    uint64_t targetTotal = 0;
+    size_t healthy = 0;
+    for (size_t i = 0; i < count; i++) {
+        const BackendServer* backend = lb->getBackend(i);
+        if (!backend->isHealthy) continue;
+        target[i] = weighted ? backend->weight : 1;
+        targetTotal += static_cast<uint64_t>(target[i]);
+        healthy++;
+    }
+
+    // Whole weighted rounds, one pick per client for IP_HASH
+    uint64_t picks = std::max<uint64_t>(1, kFairnessPicks / targetTotal) * targetTotal;
+    if (scenario.algorithm == LoadBalancingAlgorithm::IP_HASH) picks = kClientCount;
+
+    std::vector<uint64_t> counts(count, 0);
+    std::vector<size_t> mapping(kClientCount, 0);
+    std::deque<BackendServer*> inFlight;
+    for (uint64_t p = 0; p < picks; p++) {
+        size_t client = static_cast<size_t>(p) & (kClientCount - 1);
+        BackendServer* backend = lb->getNextBackend(clientIPs[client]);
+        size_t index = lb->indexOf(backend);
+        counts[index]++;
+        mapping[client] = index;
+
+        if (scenario.algorithm == LoadBalancingAlgorithm::LEAST_CONNECTIONS) {
+            backend->activeConnections.fetch_add(1);
+            inFlight.push_back(backend);
+            if (inFlight.size() > kInFlight) {
+                inFlight.front()->activeConnections.fetch_sub(1);
+                inFlight.pop_front();
+            }
+        }
+    }
+
+    Fairness result;
+    result.minShare = 1e300;
+    for (size_t i = 0; i < count; i++) {
+        if (target[i] == 0.0) continue;
+        double share = (static_cast<double>(counts[i]) / static_cast<double>(picks)) /
+                       (target[i] / static_cast<double>(targetTotal));
+        result.maxShare = std::max(result.maxShare, share);
+        result.minShare = std::min(result.minShare, share);
+    }
+
+    if (scenario.algorithm == LoadBalancingAlgorithm::IP_HASH && healthy > 1) {
+        lb->getBackend(0)->isHealthy = false;
+        size_t moved = 0;
+        for (size_t client = 0; client < kClientCount; client++) {
+            if (lb->indexOf(lb->getNextBackend(clientIPs[client])) != mapping[client]) moved++;
+        }
+        result.remap = static_cast<double>(moved) / kClientCount;
+        result.remapIdeal = 1.0 / static_cast<double>(healthy);
+    }
+    return result;
+}
+
+// Benchmarks are re-run while the iteration count is tuned; measure once
+const Fairness& fairnessFor(const Scenario& scenario) {
+    static std::mutex mutex;
+    static std::map<std::tuple<int, int, int, int>, Fairness> cache;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto key = std::make_tuple(static_cast<int>(scenario.algorithm), scenario.backends,
+                               scenario.healthyPercent, static_cast<int>(scenario.weights));
+    auto found = cache.find(key);
+    if (found == cache.end()) {
+        found = cache.emplace(key, measureFairness(scenario)).first;
+    }
+    return found->second;
+}
+
+void pick(benchmark::State& state, LoadBalancer& lb) {
+    size_t client = static_cast<size_t>(state.thread_index()) * 7919;
+    for (auto _ : state) {
+        BackendServer* backend = lb.getNextBackend(clientIPs[client++ & (kClientCount - 1)]);
+        benchmark::DoNotOptimize(backend);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_Pick(benchmark::State& state, Scenario scenario) {
+    std::unique_ptr<LoadBalancer> lb = build(scenario);
+    pick(state, *lb);
+
+    const Fairness& fairness = fairnessFor(scenario);
+    state.counters["max_share"] = fairness.maxShare;
+    state.counters["min_share"] = fairness.minShare;
+    if (fairness.remap >= 0.0) {
+        state.counters["remap"] = fairness.remap;
+        state.counters["remap_ideal"] = fairness.remapIdeal;
+    }
+}
+
+void BM_Contended(benchmark::State& state, std::shared_ptr<LoadBalancer> lb) {
+    pick(state, *lb);
+}
+
+void BM_Sharded(benchmark::State& state, std::shared_ptr<LoadBalancer> lb) {
+    LoadBalancer::setThreadShard(state.thread_index());
+    pick(state, *lb);
+    LoadBalancer::setThreadShard(-1);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    clientIPs.reserve(kClientCount);
+    for (size_t i = 0; i < kClientCount; i++) {
+        // Spread over many /16s, like real client populations
+        clientIPs.push_back(dottedQuad(static_cast<uint32_t>(i) * 2654435761u));
+    }
+
+    const LoadBalancingAlgorithm algorithms[] = {
+        LoadBalancingAlgorithm::ROUND_ROBIN,
+        LoadBalancingAlgorithm::WEIGHTED_ROUND_ROBIN,
+        LoadBalancingAlgorithm::LEAST_CONNECTIONS,
+        LoadBalancingAlgorithm::IP_HASH
+    };
+
+    for (LoadBalancingAlgorithm algorithm : algorithms) {
+        for (int backends : {2, 16, 128, 1024, 10000}) {
+            for (int healthyPercent : {100, 50}) {
+                for (Weights weights : {Weights::Uniform, Weights::Skewed}) {
+                    Scenario scenario{algorithm, backends, healthyPercent, weights};
+                    std::string name = std::string("Pick/") + algorithmName(algorithm) +
+                                       "/backends:" + std::to_string(backends) +
+                                       "/healthy:" + std::to_string(healthyPercent) +
+                                       (weights == Weights::Uniform ? "/uniform" : "/skewed");
+                    benchmark::RegisterBenchmark(name.c_str(), BM_Pick, scenario);
+                }
+            }
+        }
+
+        for (int backends : {16, 1024}) {
+            // One balancer shared by every thread of the run
+            std::shared_ptr<LoadBalancer> lb(build(Scenario{algorithm, backends, 100, Weights::Uniform}));
+            std::string name = std::string("Contended/") + algorithmName(algorithm) +
+                               "/backends:" + std::to_string(backends);
+            benchmark::RegisterBenchmark(name.c_str(), BM_Contended, lb)
+                ->Threads(1)->Threads(4)->Threads(16)->Threads(64)->UseRealTime();
+
+            std::shared_ptr<LoadBalancer> sharded(build(Scenario{algorithm, backends, 100, Weights::Uniform}));
+            sharded->setShardCount(64);
+            for (size_t shard = 0; shard < 64; shard++) {
+                sharded->createShard(shard);
+            }
+            name = std::string("Sharded/") + algorithmName(algorithm) + "/backends:" + std::to_string(backends);
+            benchmark::RegisterBenchmark(name.c_str(), BM_Sharded, sharded)
+                ->Threads(1)->Threads(4)->Threads(16)->Threads(64)->UseRealTime();
+        }
+    }
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -0,0 +1,604 @@
+// Discrete-event simulator for choosing a load balancing algorithm offline.
+// Replays a request trace through the real LoadBalancer against modelled
+// backends. Each backend has a relative speed, a weight and a number of
+// concurrent slots with a FIFO queue in front. Backends can fail (requests in
+// flight are lost, and new ones fail until the outage is detected) or slow
+// down for a window of simulated time. For every algorithm it reports
+// per-backend utilization, queueing delay percentiles and the imbalance
+// between backends, so configurations can be swept without a real fleet.
+//
+// Trace format: one JSON object per line, arrivals in order,
+//   {"t_us": 1250, "client": "10.1.2.3", "service_us": 840}
+// where service_us is the time the request takes on a backend of speed 1.0.
+// Without --trace a Poisson trace is generated; --write-trace saves it.
+//
+//   load_balancer_simulator --speeds 1,1,1,0.5 [--weights 2,2,2,1] [--concurrency 8]
+//       [--trace file.jsonl | --requests 2000000 --rate 20000 --clients 10000
+//        --service-ms 1 --service-sigma 0.5 --seed 1] [--write-trace file.jsonl]
+//       [--fail BACKEND:START_S:END_S] [--slow BACKEND:START_S:END_S:FACTOR]
+//       [--detect-ms 2000] [--algorithm ALL|ROUND_ROBIN|...] [--json results.json]
+#include "LoadBalancer.h"
+#include "Metrics.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <queue>
+#include <random>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+struct TraceRequest {
+    double arrivalUs;
+    double serviceUs;
+    uint32_t client;    // index into Trace::clients
+};
+
+struct Trace {
+    std::vector<std::string> clients;
+    std::vector<TraceRequest> requests;
+};
+
+struct Fault {
+    size_t backend;
+    double startUs;
+    double endUs;
+    double factor;      // 0 = down, otherwise service time multiplier
+};
+
+struct Options {
+    std::vector<double> speeds{1.0, 1.0, 1.0, 1.0};
+    std::vector<int> weights;
+    int concurrency = 8;
+    std::string traceFile;
+    std::string writeTrace;
+    size_t requests = 1000000;
+    double rate = 20000.0;
+    size_t clients = 10000;
+    double serviceMs = 1.0;
+    double serviceSigma = 0.5;
+    uint64_t seed = 1;
+    std::vector<Fault> faults;
+    double detectMs = 2000.0;
+    std::string algorithm = "ALL";
+    std::string jsonFile;
+};
+
+struct BackendResult {
+    uint64_t requests = 0;
+    uint64_t failed = 0;
+    double busyUs = 0.0;
+    double utilization = 0.0;
+    HistogramSnapshot queueDelay;
+};
+
+struct RunResult {
+    std::string algorithm;
+    uint64_t completed = 0;
+    uint64_t failed = 0;
+    uint64_t rejected = 0;      // no healthy backend
+    double simulatedUs = 0.0;
+    double wallSeconds = 0.0;
+    double imbalance = 0.0;     // max / mean utilization
+    HistogramSnapshot queueDelay;
+    HistogramSnapshot responseTime;
+    std::vector<BackendResult> backends;
+};
+
+// ---- Trace input and generation ----
+
+bool readNumber(const std::string& line, const char* key, double& value) {
+    size_t pos = line.find(key);
+    if (pos == std::string::npos) return false;
+    pos = line.find(':', pos + strlen(key));
+    if (pos == std::string::npos) return false;
+    value = std::strtod(line.c_str() + pos + 1, nullptr);
+    return true;
+}
+
+bool readText(const std::string& line, const char* key, std::string& value) {
+    size_t pos = line.find(key);
+    if (pos == std::string::npos) return false;
+    size_t open = line.find('"', line.find(':', pos + strlen(key)));
+    size_t close = open == std::string::npos ? open : line.find('"', open + 1);
+    if (close == std::string::npos) return false;
+    value.assign(line, open + 1, close - open - 1);
+    return true;
+}
+
+bool loadTrace(const std::string& path, Trace& trace) {
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "Cannot open trace " << path << std::endl;
+        return false;
+    }
+    std::unordered_map<std::string, uint32_t> clientIndex;
+    std::string line;
+    std::string client;
+    size_t lineNumber = 0;
+    double previous = 0.0;
+    while (std::getline(file, line)) {
+        lineNumber++;
+        if (line.find('{') == std::string::npos) continue;
+        TraceRequest request;
+        if (!readNumber(line, "\"t_us\"", request.arrivalUs) ||
+            !readNumber(line, "\"service_us\"", request.serviceUs)) {
+            std::cerr << path << ":" << lineNumber << ": expected t_us and service_us" << std::endl;
+            return false;
+        }
+        if (request.arrivalUs < previous) {
+            std::cerr << path << ":" << lineNumber << ": arrivals must be in time order" << std::endl;
+            return false;
+        }
+        previous = request.arrivalUs;
+        if (!readText(line, "\"client\"", client)) client = "0.0.0.0";
+        auto inserted = clientIndex.emplace(client, static_cast<uint32_t>(trace.clients.size()));
+        if (inserted.second) trace.clients.push_back(client);
+        request.client = inserted.first->second;
+        trace.requests.push_back(request);
+    }
+    return true;
+}
+
+void generateTrace(const Options& options, Trace& trace) {
+    std::mt19937_64 random(options.seed);
+    std::exponential_distribution<double> gap(options.rate / 1e6);
+    std::lognormal_distribution<double> service(std::log(options.serviceMs * 1000.0), options.serviceSigma);
+
+    // Zipf-like client popularity: a few heavy clients, a long tail
+    std::vector<double> popularity(options.clients);
+    for (size_t i = 0; i < options.clients; i++) popularity[i] = 1.0 / static_cast<double>(i + 1);
+    std::discrete_distribution<uint32_t> pickClient(popularity.begin(), popularity.end());
+
+    trace.clients.reserve(options.clients);
+    for (size_t i = 0; i < options.clients; i++) {
+        uint32_t address = static_cast<uint32_t>(i + 1) * 2654435761u;
+        trace.clients.push_back(std::to_string(address >> 24) + "." + std::to_string((address >> 16) & 255) + "." +
+                                std::to_string((address >> 8) & 255) + "." + std::to_string(address & 255));
+    }
+    trace.requests.reserve(options.requests);
+    double now = 0.0;
+    for (size_t i = 0; i < options.requests; i++) {
+        now += gap(random);
+        trace.requests.push_back(TraceRequest{now, service(random), pickClient(random)});
+    }
+}
+
+bool writeTrace(const std::string& path, const Trace& trace) {
+    std::ofstream file(path);
+    if (!file) {
+        std::cerr << "Cannot write " << path << std::endl;
+        return false;
+    }
+    file << std::fixed << std::setprecision(1);
+    for (const TraceRequest& request : trace.requests) {
+        file << "{\"t_us\": " << request.arrivalUs << ", \"client\": \"" << trace.clients[request.client]
+             << "\", \"service_us\": " << request.serviceUs << "}\n";
+    }
+    return true;
+}
+
+// ---- Simulation ----
+
+/**
+ * One modelled backend: `slots` requests in service, the rest queued FIFO
+ */
+struct SimBackend {
+    double speed = 1.0;
+    int slots = 1;
+    int busy = 0;
+    bool down = false;
+    double slowFactor = 1.0;
+    uint32_t epoch = 0;                 // bumped on failure; stale completions are ignored
+    std::deque<std::pair<double, double>> queue;   // arrival, service at speed 1
+    uint64_t requests = 0;
+    uint64_t failed = 0;
+    double busyUs = 0.0;
+    LatencyHistogram queueDelay;
+};
+
+struct Completion {
+    double timeUs;
+    uint32_t backend;
+    uint32_t epoch;
+    double arrivalUs;
+    bool operator>(const Completion& other) const { return timeUs > other.timeUs; }
+};
+
+// A fault's start or end, or the moment a failure is noticed
+struct FaultEvent {
+    double timeUs;
+    size_t backend;
+    enum Kind { Down, Detected, Up, SlowStart, SlowEnd } kind;
+    double factor;
+    bool operator<(const FaultEvent& other) const { return timeUs < other.timeUs; }
+};
+
+class Simulation {
+public:
+    Simulation(const Options& o, const Trace& t, LoadBalancingAlgorithm algorithm)
+        : options(o), trace(t), balancer(algorithm), sim(o.speeds.size()) {
+        for (size_t i = 0; i < sim.size(); i++) {
+            int weight = i < options.weights.size() ? options.weights[i] : 1;
+            balancer.addBackend("10.0.0." + std::to_string(i + 1), 8080, weight);
+            sim[i].speed = options.speeds[i];
+            sim[i].slots = options.concurrency;
+        }
+        for (const Fault& fault : options.faults) {
+            if (fault.factor == 0.0) {
+                double detected = std::min(fault.endUs, fault.startUs + options.detectMs * 1000.0);
+                faultEvents.push_back(FaultEvent{fault.startUs, fault.backend, FaultEvent::Down, 0.0});
+                faultEvents.push_back(FaultEvent{detected, fault.backend, FaultEvent::Detected, 0.0});
+                faultEvents.push_back(FaultEvent{fault.endUs, fault.backend, FaultEvent::Up, 0.0});
+            } else {
+                faultEvents.push_back(FaultEvent{fault.startUs, fault.backend, FaultEvent::SlowStart, fault.factor});
+                faultEvents.push_back(FaultEvent{fault.endUs, fault.backend, FaultEvent::SlowEnd, 1.0});
+            }
+        }
+        std::stable_sort(faultEvents.begin(), faultEvents.end());
+    }
+
+    RunResult run() {
+        auto wallStart = std::chrono::steady_clock::now();
+        for (const TraceRequest& request : trace.requests) {
+            advanceTo(request.arrivalUs);
+            arrive(request);
+        }
+        advanceTo(1e300);
+
+        RunResult result;
+        result.simulatedUs = endUs;
+        result.wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+        result.completed = completed;
+        result.failed = failed;
+        result.rejected = rejected;
+        result.responseTime.add(responseTime);
+
+        double totalUtilization = 0.0;
+        double maxUtilization = 0.0;
+        for (const SimBackend& backend : sim) {
+            BackendResult entry;
+            entry.requests = backend.requests;
+            entry.failed = backend.failed;
+            entry.busyUs = backend.busyUs;
+            entry.utilization = endUs > 0.0 ? backend.busyUs / (backend.slots * endUs) : 0.0;
+            entry.queueDelay.add(backend.queueDelay);
+            result.queueDelay.add(backend.queueDelay);
+            totalUtilization += entry.utilization;
+            maxUtilization = std::max(maxUtilization, entry.utilization);
+            result.backends.push_back(entry);
+        }
+        double mean = totalUtilization / static_cast<double>(sim.size());
+        result.imbalance = mean > 0.0 ? maxUtilization / mean : 0.0;
+        return result;
+    }
+
+private:
+    const Options& options;
+    const Trace& trace;
+    LoadBalancer balancer;
+    std::vector<SimBackend> sim;
+    std::vector<FaultEvent> faultEvents;
+    size_t nextFault = 0;
+    std::priority_queue<Completion, std::vector<Completion>, std::greater<Completion>> completions;
+    LatencyHistogram responseTime;
+    uint64_t completed = 0;
+    uint64_t failed = 0;
+    uint64_t rejected = 0;
+    double endUs = 0.0;
+
+    // Runs completions and fault transitions up to time, in time order
+    void advanceTo(double timeUs) {
+        while (true) {
+            bool haveCompletion = !completions.empty() && completions.top().timeUs <= timeUs;
+            bool haveFault = nextFault < faultEvents.size() && faultEvents[nextFault].timeUs <= timeUs;
+            if (!haveCompletion && !haveFault) return;
+            if (haveFault && (!haveCompletion || faultEvents[nextFault].timeUs <= completions.top().timeUs)) {
+                applyFault(faultEvents[nextFault++]);
+            } else {
+                Completion completion = completions.top();
+                completions.pop();
+                complete(completion);
+            }
+        }
+    }
+
+    void arrive(const TraceRequest& request) {
+        endUs = std::max(endUs, request.arrivalUs);
+        BackendServer* picked = balancer.getNextBackend(trace.clients[request.client]);
+        if (picked == nullptr) {
+            rejected++;
+            return;
+        }
+        size_t index = balancer.indexOf(picked);
+        SimBackend& backend = sim[index];
+        backend.requests++;
+        if (backend.down) {
+            // Dead but not yet noticed: the connection attempt fails
+            backend.failed++;
+            failed++;
+            return;
+        }
+        picked->activeConnections.fetch_add(1, std::memory_order_relaxed);
+        if (backend.busy < backend.slots) {
+            start(index, request.arrivalUs, request.arrivalUs, request.serviceUs);
+        } else {
+            backend.queue.emplace_back(request.arrivalUs, request.serviceUs);
+        }
+    }
+
+    void start(size_t index, double nowUs, double arrivalUs, double serviceUs) {
+        SimBackend& backend = sim[index];
+        double duration = serviceUs * backend.slowFactor / backend.speed;
+        backend.busy++;
+        backend.busyUs += duration;
+        backend.queueDelay.record(static_cast<uint64_t>(nowUs - arrivalUs));
+        completions.push(Completion{nowUs + duration, static_cast<uint32_t>(index), backend.epoch, arrivalUs});
+    }
+
+    void complete(const Completion& completion) {
+        SimBackend& backend = sim[completion.backend];
+        if (completion.epoch != backend.epoch) return;   // lost in a failure
+        endUs = std::max(endUs, completion.timeUs);
+        backend.busy--;
+        balancer.getBackend(completion.backend)->activeConnections.fetch_sub(1, std::memory_order_relaxed);
+        responseTime.record(static_cast<uint64_t>(completion.timeUs - completion.arrivalUs));
+        completed++;
+        if (!backend.queue.empty()) {
+            std::pair<double, double> next = backend.queue.front();
+            backend.queue.pop_front();
+            start(completion.backend, completion.timeUs, next.first, next.second);
+        }
+    }
+
+    void applyFault(const FaultEvent& event) {
+        SimBackend& backend = sim[event.backend];
+        BackendServer* server = balancer.getBackend(event.backend);
+        switch (event.kind) {
+            case FaultEvent::Down: {
+                // Everything in service or queued is lost; busy time stops accruing
+                uint64_t lost = static_cast<uint64_t>(backend.busy) + backend.queue.size();
+                backend.failed += lost;
+                failed += lost;
+                server->activeConnections.fetch_sub(static_cast<int>(lost), std::memory_order_relaxed);
+                backend.busy = 0;
+                backend.queue.clear();
+                backend.epoch++;
+                backend.down = true;
+                break;
+            }
+            case FaultEvent::Detected:
+                server->isHealthy = false;
+                break;
+            case FaultEvent::Up:
+                backend.down = false;
+                server->isHealthy = true;
+                break;
+            case FaultEvent::SlowStart:
+            case FaultEvent::SlowEnd:
+                backend.slowFactor = event.factor;
+                break;
+        }
+    }
+};
+
+// ---- Reporting ----
+
+const char* algorithmName(LoadBalancingAlgorithm algorithm) {
+    switch (algorithm) {
+        case LoadBalancingAlgorithm::ROUND_ROBIN: return "ROUND_ROBIN";
+        case LoadBalancingAlgorithm::WEIGHTED_ROUND_ROBIN: return "WEIGHTED_ROUND_ROBIN";
+        case LoadBalancingAlgorithm::LEAST_CONNECTIONS: return "LEAST_CONNECTIONS";
+        case LoadBalancingAlgorithm::IP_HASH: return "IP_HASH";
+    }
+    return "UNKNOWN";
+}
+
+void printResult(const RunResult& result, const Options& options) {
+    std::cout << "\n=== " << result.algorithm << " ===" << std::endl;
+    std::cout << "Requests: " << result.completed << " completed, " << result.failed << " failed, "
+              << result.rejected << " rejected (no healthy backend)" << std::endl;
+    std::cout << "Response time: p50 " << result.responseTime.getQuantile(0.5) << "us, p99 "
+              << result.responseTime.getQuantile(0.99) << "us, p99.9 " << result.responseTime.getQuantile(0.999)
+              << "us" << std::endl;
+    std::cout << "Queueing delay: p50 " << result.queueDelay.getQuantile(0.5) << "us, p99 "
+              << result.queueDelay.getQuantile(0.99) << "us, p99.9 " << result.queueDelay.getQuantile(0.999)
+              << "us" << std::endl;
+    std::cout << "Imbalance (max/mean utilization): " << std::fixed << std::setprecision(2) << result.imbalance
+              << std::endl;
+    std::cout << "  backend  speed  weight  requests    share  failed   util  queue p50/p99/p99.9 (us)" << std::endl;
+    uint64_t total = 0;
+    for (const BackendResult& backend : result.backends) total += backend.requests;
+    for (size_t i = 0; i < result.backends.size(); i++) {
+        const BackendResult& backend = result.backends[i];
+        int weight = i < options.weights.size() ? options.weights[i] : 1;
+        std::cout << "  " << std::setw(7) << i << "  " << std::setw(5) << std::setprecision(2) << options.speeds[i]
+                  << "  " << std::setw(6) << weight << "  " << std::setw(8) << backend.requests << "  "
+                  << std::setw(6) << std::setprecision(1)
+                  << (total > 0 ? 100.0 * static_cast<double>(backend.requests) / static_cast<double>(total) : 0.0)
+                  << "%  " << std::setw(6) << backend.failed << "  " << std::setw(4) << std::setprecision(0)
+                  << backend.utilization * 100.0 << "%  " << backend.queueDelay.getQuantile(0.5) << "/"
+                  << backend.queueDelay.getQuantile(0.99) << "/" << backend.queueDelay.getQuantile(0.999) << std::endl;
+    }
+    std::cout << std::setprecision(2) << "Simulated " << result.simulatedUs / 1e6 << "s in " << result.wallSeconds
+              << "s wall (" << std::setprecision(1)
+              << static_cast<double>(result.completed + result.failed + result.rejected) / result.wallSeconds / 1e6
+              << "M requests/s)" << std::endl;
+    std::cout.unsetf(std::ios::fixed);
+    std::cout << std::setprecision(6);
+}
+
+std::string quantilesJson(const HistogramSnapshot& snapshot) {
+    std::ostringstream out;
+    out << "{\"p50\": " << snapshot.getQuantile(0.5) << ", \"p99\": " << snapshot.getQuantile(0.99)
+        << ", \"p999\": " << snapshot.getQuantile(0.999) << "}";
+    return out.str();
+}
+
+bool writeJson(const std::string& path, const std::vector<RunResult>& results) {
+    std::ofstream file(path);
+    if (!file) {
+        std::cerr << "Cannot write " << path << std::endl;
+        return false;
+    }
+    file << "[\n";
+    for (size_t r = 0; r < results.size(); r++) {
+        const RunResult& result = results[r];
+        file << "  {\"algorithm\": \"" << result.algorithm << "\", \"completed\": " << result.completed
+             << ", \"failed\": " << result.failed << ", \"rejected\": " << result.rejected
+             << ", \"simulated_s\": " << result.simulatedUs / 1e6 << ", \"imbalance\": " << result.imbalance
+             << ",\n   \"response_time_us\": " << quantilesJson(result.responseTime)
+             << ", \"queue_delay_us\": " << quantilesJson(result.queueDelay) << ",\n   \"backends\": [";
+        for (size_t i = 0; i < result.backends.size(); i++) {
+            const BackendResult& backend = result.backends[i];
+            file << (i > 0 ? ",\n     " : "\n     ") << "{\"requests\": " << backend.requests
+                 << ", \"failed\": " << backend.failed << ", \"utilization\": " << backend.utilization
+                 << ", \"queue_delay_us\": " << quantilesJson(backend.queueDelay) << "}";
+        }
+        file << "]}" << (r + 1 < results.size() ? ",\n" : "\n");
+    }
+    file << "]\n";
+    return true;
+}
+
+// ---- Command line ----
+
+template <typename T>
+std::vector<T> parseList(const std::string& value) {
+    std::vector<T> items;
+    std::stringstream stream(value);
+    std::string item;
+    while (std::getline(stream, item, ',')) items.push_back(static_cast<T>(std::atof(item.c_str())));
+    return items;
+}
+
+bool parseFault(const std::string& value, bool slow, size_t backends, Fault& fault) {
+    std::string commas = value;
+    std::replace(commas.begin(), commas.end(), ':', ',');
+    std::vector<double> parts = parseList<double>(commas);
+    if (parts.size() != (slow ? 4u : 3u) || parts[0] < 0 || parts[0] >= backends || parts[2] < parts[1]) {
+        return false;
+    }
+    fault.backend = static_cast<size_t>(parts[0]);
+    fault.startUs = parts[1] * 1e6;
+    fault.endUs = parts[2] * 1e6;
+    fault.factor = slow ? parts[3] : 0.0;
+    return !slow || fault.factor > 0.0;
+}
+
+void usage() {
+    std::cerr << "usage: load_balancer_simulator [--speeds 1,1,0.5] [--weights 2,2,1] [--concurrency N]\n"
+                 "         [--trace FILE | --requests N --rate RPS --clients N --service-ms MS\n"
+                 "          --service-sigma S --seed N] [--write-trace FILE]\n"
+                 "         [--fail BACKEND:START_S:END_S] [--slow BACKEND:START_S:END_S:FACTOR]\n"
+                 "         [--detect-ms MS] [--algorithm ALL|ROUND_ROBIN|WEIGHTED_ROUND_ROBIN|\n"
+                 "          LEAST_CONNECTIONS|IP_HASH] [--json FILE]" << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    Options options;
+    std::vector<std::pair<std::string, bool>> faultSpecs;
+    if (argc % 2 == 0) {
+        usage();
+        return 1;
+    }
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string flag = argv[i];
+        std::string value = argv[i + 1];
+        if (flag == "--speeds") options.speeds = parseList<double>(value);
+        else if (flag == "--weights") options.weights = parseList<int>(value);
+        else if (flag == "--concurrency") options.concurrency = std::atoi(value.c_str());
+        else if (flag == "--trace") options.traceFile = value;
+        else if (flag == "--write-trace") options.writeTrace = value;
+        else if (flag == "--requests") options.requests = static_cast<size_t>(std::atoll(value.c_str()));
+        else if (flag == "--rate") options.rate = std::atof(value.c_str());
+        else if (flag == "--clients") options.clients = static_cast<size_t>(std::atoll(value.c_str()));
+        else if (flag == "--service-ms") options.serviceMs = std::atof(value.c_str());
+        else if (flag == "--service-sigma") options.serviceSigma = std::atof(value.c_str());
+        else if (flag == "--seed") options.seed = static_cast<uint64_t>(std::atoll(value.c_str()));
+        else if (flag == "--fail") faultSpecs.emplace_back(value, false);
+        else if (flag == "--slow") faultSpecs.emplace_back(value, true);
+        else if (flag == "--detect-ms") options.detectMs = std::atof(value.c_str());
+        else if (flag == "--algorithm") options.algorithm = value;
+        else if (flag == "--json") options.jsonFile = value;
+        else {
+            usage();
+            return 1;
+        }
+    }
+
+    bool valid = !options.speeds.empty() && options.concurrency > 0 && options.rate > 0.0 &&
+                 options.clients > 0 && options.serviceMs > 0.0 && options.detectMs >= 0.0;
+    for (double speed : options.speeds) valid = valid && speed > 0.0;
+    for (int weight : options.weights) valid = valid && weight > 0;
+    for (const auto& spec : faultSpecs) {
+        Fault fault;
+        valid = valid && parseFault(spec.first, spec.second, options.speeds.size(), fault);
+        options.faults.push_back(fault);
+    }
+    if (!valid) {
+        usage();
+        return 1;
+    }
+
+    std::vector<LoadBalancingAlgorithm> algorithms;
+    const LoadBalancingAlgorithm all[] = {
+        LoadBalancingAlgorithm::ROUND_ROBIN,
+        LoadBalancingAlgorithm::WEIGHTED_ROUND_ROBIN,
+        LoadBalancingAlgorithm::LEAST_CONNECTIONS,
+        LoadBalancingAlgorithm::IP_HASH
+    };
+    for (LoadBalancingAlgorithm algorithm : all) {
+        if (options.algorithm == "ALL" || options.algorithm == algorithmName(algorithm)) {
+            algorithms.push_back(algorithm);
+        }
+    }
+    if (algorithms.empty()) {
+        usage();
+        return 1;
+    }
+
+    Trace trace;
+    if (!options.traceFile.empty()) {
+        if (!loadTrace(options.traceFile, trace)) return 1;
+    } else {
+        generateTrace(options, trace);
+    }
+    if (!options.writeTrace.empty() && !writeTrace(options.writeTrace, trace)) return 1;
+
+    std::cout << "=== Load Balancer Simulation ===" << std::endl;
+    std::cout << "Trace: " << trace.requests.size() << " requests from " << trace.clients.size() << " clients"
+              << (options.traceFile.empty() ? " (generated)" : " from " + options.traceFile) << std::endl;
+    std::cout << "Backends: " << options.speeds.size() << " x " << options.concurrency << " slots" << std::endl;
+    for (const Fault& fault : options.faults) {
+        std::cout << "Fault: backend " << fault.backend << " ";
+        if (fault.factor == 0.0) {
+            std::cout << "down";
+        } else {
+            std::cout << "slowed x" << fault.factor;
+        }
+        std::cout << " from " << fault.startUs / 1e6 << "s to " << fault.endUs / 1e6 << "s" << std::endl;
+    }
+
+    std::vector<RunResult> results;
+    for (LoadBalancingAlgorithm algorithm : algorithms) {
+        Simulation simulation(options, trace, algorithm);
+        results.push_back(simulation.run());
+        results.back().algorithm = algorithmName(algorithm);
+        printResult(results.back(), options);
+    }
+
+    if (!options.jsonFile.empty() && !writeJson(options.jsonFile, results)) return 1;
+    return 0;
+}
@@ -0,0 +1,544 @@
+// Open-loop HTTP/1.1 load generator. Requests are scheduled at a constant
+// arrival rate whether or not earlier ones have finished, and each latency
+// is measured from the request's intended start time, not from when a free
+// connection finally sent it. A stalled server therefore shows up in the
+// percentiles instead of silently lowering the offered load (coordinated
+// omission). The time from the actual send is reported too, as
+// service_time_us, so the queueing inside the generator stays visible.
+// Connections are kept alive for the whole run unless
+// --requests-per-connection closes them after that many requests (the last
+// one says Connection: close), which puts connection setup back into every
+// N-th request; --fast-open 1 connects with TCP Fast Open. Linux only.
+//
+//   load_generator --target 127.0.0.1:8080 --rate 5000 --duration 10
+//                  [--path /] [--warmup 2] [--connections 64] [--threads 1]
+//                  [--requests-per-connection 0] [--fast-open 0]
+//                  [--timeout-ms 2000] [--json results.json]
+#include "Http.h"
+#include "Metrics.h"
+#include "Platform.h"
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <arpa/inet.h>
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+uint64_t nowUs() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+struct Options {
+    std::string host = "127.0.0.1";
+    int port = 8080;
+    std::string path = "/";
+    double rate = 1000.0;
+    double duration = 10.0;
+    double warmup = 2.0;
+    int connections = 64;
+    int threads = 1;
+    int requestsPerConnection = 0;   // 0: keep-alive for the whole run
+    bool fastOpen = false;
+    uint64_t timeoutMs = 2000;
+    std::string jsonFile;
+};
+
+struct Totals {
+    uint64_t scheduled = 0;
+    uint64_t completed = 0;
+    uint64_t ok = 0;          // 2xx and 3xx
+    uint64_t errors = 0;      // 4xx and 5xx responses
+    uint64_t failed = 0;      // connect or protocol failures
+    uint64_t timedOut = 0;
+    uint64_t maxLatencyUs = 0;
+    uint64_t maxServiceUs = 0;
+
+    void add(const Totals& other) {
+        scheduled += other.scheduled;
+        completed += other.completed;
+        ok += other.ok;
+        errors += other.errors;
+        failed += other.failed;
+        timedOut += other.timedOut;
+        maxLatencyUs = std::max(maxLatencyUs, other.maxLatencyUs);
+        maxServiceUs = std::max(maxServiceUs, other.maxServiceUs);
+    }
+};
+
+/**
+ * One thread's share of the schedule, connections and results
+ */
+class LoadThread {
+public:
+    LoadThread(const Options& o, const sockaddr_in& target, double threadRate, int maxConnections)
+        : options(o), address(target), intervalUs(1e6 / threadRate), connectionLimit(maxConnections),
+          epollFd(epoll_create1(0)), timerFd(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK)) {
+        request = "GET " + options.path + " HTTP/1.1\r\nHost: " + options.host + ":" +
+                  std::to_string(options.port) + "\r\nUser-Agent: load_generator\r\n\r\n";
+        closingRequest = request.substr(0, request.size() - 2) + "Connection: close\r\n\r\n";
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.ptr = nullptr;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, timerFd, &event);
+    }
+
+    ~LoadThread() {
+        for (auto& connection : connections) {
+            if (connection->fd >= 0) ::close(connection->fd);
+        }
+        ::close(timerFd);
+        ::close(epollFd);
+    }
+
+    void run(uint64_t startUs, uint64_t measureFromUs, uint64_t endUs) {
+        measureFrom = measureFromUs;
+        uint64_t timeoutUs = options.timeoutMs * 1000;
+        uint64_t drainUntil = endUs + timeoutUs;
+        uint64_t next = 0;
+        epoll_event events[256];
+
+        while (true) {
+            uint64_t now = nowUs();
+
+            // Everything due by now joins the backlog, however busy we are
+            while (true) {
+                uint64_t intended = startUs + static_cast<uint64_t>(static_cast<double>(next) * intervalUs);
+                if (intended > now || intended >= endUs) break;
+                backlog.push_back(intended);
+                if (intended >= measureFrom) totals.scheduled++;
+                next++;
+            }
+            dispatch(now);
+            expire(now, timeoutUs);
+
+            uint64_t intended = startUs + static_cast<uint64_t>(static_cast<double>(next) * intervalUs);
+            bool scheduling = intended < endUs;
+            if (!scheduling && (inFlight() == 0 || now >= drainUntil)) break;
+            armTimer(scheduling ? intended : std::min(drainUntil, now + 10000));
+
+            int count = epoll_wait(epollFd, events, 256, 100);
+            for (int i = 0; i < count; i++) {
+                if (events[i].data.ptr == nullptr) {
+                    uint64_t expirations;
+                    while (::read(timerFd, &expirations, sizeof(expirations)) > 0) {}
+                } else {
+                    onEvent(*static_cast<Conn*>(events[i].data.ptr), events[i].events);
+                }
+            }
+        }
+
+        // Whatever is left never got an answer in time
+        for (uint64_t intended : backlog) {
+            if (intended >= measureFrom) totals.timedOut++;
+        }
+        for (auto& connection : connections) {
+            if (connection->busy && connection->intendedUs >= measureFrom) totals.timedOut++;
+        }
+    }
+
+    const Totals& getTotals() const { return totals; }
+    const LatencyHistogram& getLatency() const { return latency; }
+    const LatencyHistogram& getServiceTime() const { return serviceTime; }
+
+private:
+    struct Conn {
+        int fd = -1;
+        bool connecting = false;
+        bool busy = false;
+        bool last = false;        // the request in flight closes the connection
+        int served = 0;
+        uint64_t intendedUs = 0;
+        uint64_t sentUs = 0;
+        size_t sentBytes = 0;
+        std::string input;
+    };
+
+    const Options& options;
+    sockaddr_in address;
+    double intervalUs;
+    size_t connectionLimit;
+    int epollFd;
+    int timerFd;
+    uint64_t measureFrom = 0;
+    std::string request;
+    std::string closingRequest;
+    std::deque<uint64_t> backlog;                // intended start times not yet sent
+    std::vector<std::unique_ptr<Conn>> connections;
+    Totals totals;
+    LatencyHistogram latency;
+    LatencyHistogram serviceTime;
+
+    size_t inFlight() const {
+        size_t busy = backlog.size();
+        for (const auto& connection : connections) {
+            if (connection->busy) busy++;
+        }
+        return busy;
+    }
+
+    void armTimer(uint64_t atUs) {
+        itimerspec spec{};
+        spec.it_value.tv_sec = static_cast<time_t>(atUs / 1000000);
+        spec.it_value.tv_nsec = static_cast<long>((atUs % 1000000) * 1000);
+        if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0) spec.it_value.tv_nsec = 1;
+        timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &spec, nullptr);
+    }
+
+    // Hands backlog entries to idle connections, opening more up to the limit
+    void dispatch(uint64_t now) {
+        for (auto& connection : connections) {
+            if (backlog.empty()) return;
+            if (connection->busy) continue;
+            if (connection->fd < 0 && !openConnection(*connection)) continue;
+            start(*connection, now);
+        }
+        while (!backlog.empty() && connections.size() < connectionLimit) {
+            connections.emplace_back(new Conn());
+            if (!openConnection(*connections.back())) return;
+            start(*connections.back(), now);
+        }
+    }
+
+    bool openConnection(Conn& connection) {
+        connection.fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (connection.fd < 0) return false;
+        setNonBlocking(connection.fd);
+        int on = 1;
+        setsockopt(connection.fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        // With a cookie cached, connect() returns at once and the request rides in the SYN
+        if (options.fastOpen) {
+            setsockopt(connection.fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &on, sizeof(on));
+        }
+        connection.served = 0;
+        int result = connect(connection.fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address));
+        if (result != 0 && errno != EINPROGRESS) {
+            ::close(connection.fd);
+            connection.fd = -1;
+            if (!backlog.empty()) {
+                if (backlog.front() >= measureFrom) totals.failed++;
+                backlog.pop_front();
+            }
+            return false;
+        }
+        connection.connecting = result != 0;
+        connection.input.clear();
+        epoll_event event{};
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP;
+        event.data.ptr = &connection;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, connection.fd, &event);
+        return true;
+    }
+
+    void start(Conn& connection, uint64_t now) {
+        connection.busy = true;
+        connection.intendedUs = backlog.front();
+        backlog.pop_front();
+        connection.sentUs = now;
+        connection.sentBytes = 0;
+        connection.last = options.requestsPerConnection > 0 && connection.served + 1 >= options.requestsPerConnection;
+        if (!connection.connecting) writeRequest(connection);
+    }
+
+    const std::string& requestFor(const Conn& connection) const {
+        return connection.last ? closingRequest : request;
+    }
+
+    void writeRequest(Conn& connection) {
+        const std::string& payload = requestFor(connection);
+        while (connection.sentBytes < payload.size()) {
+            ssize_t sent = send(connection.fd, payload.data() + connection.sentBytes,
+                                payload.size() - connection.sentBytes, MSG_NOSIGNAL);
+            if (sent > 0) {
+                connection.sentBytes += static_cast<size_t>(sent);
+                continue;
+            }
+            if (sent < 0 && errno == EINTR) continue;
+            if (sent < 0 && errno == EAGAIN) return;
+            fail(connection);
+            return;
+        }
+    }
+
+    void onEvent(Conn& connection, uint32_t events) {
+        if (connection.fd < 0) return;
+        if (connection.connecting && (events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+            int error = 0;
+            socklen_t length = sizeof(error);
+            getsockopt(connection.fd, SOL_SOCKET, SO_ERROR, &error, &length);
+            if (error != 0) {
+                fail(connection);
+                return;
+            }
+            connection.connecting = false;
+        }
+        if (connection.busy && !connection.connecting && connection.sentBytes < requestFor(connection).size()) {
+            writeRequest(connection);
+            if (connection.fd < 0) return;
+        }
+        if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+            readResponse(connection);
+        }
+    }
+
+    void readResponse(Conn& connection) {
+        char buffer[16384];
+        bool closed = false;
+        while (true) {
+            ssize_t received = recv(connection.fd, buffer, sizeof(buffer), 0);
+            if (received > 0) {
+                connection.input.append(buffer, static_cast<size_t>(received));
+                continue;
+            }
+            if (received < 0 && (errno == EAGAIN || errno == EINTR)) break;
+            closed = true;
+            break;
+        }
+
+        if (connection.busy) {
+            HttpHead response;
+            ParseResult result = Http::parseResponseHead(connection.input.data(), connection.input.size(), response);
+            if (result == ParseResult::Invalid) {
+                fail(connection);
+                return;
+            }
+            if (result == ParseResult::Complete) {
+                long long length = response.contentLength();
+                // Without Content-Length the body runs to the end of the connection
+                bool done = length >= 0 ? connection.input.size() >= response.headLength + static_cast<size_t>(length)
+                                        : closed;
+                if (done) {
+                    complete(connection, response.statusCode);
+                    if (length >= 0 && response.wantsKeepAlive() && !closed && !connection.last) {
+                        connection.input.clear();
+                        dispatch(nowUs());
+                        return;
+                    }
+                    disconnect(connection);
+                    return;
+                }
+            }
+        }
+        if (closed) fail(connection);
+    }
+
+    void complete(Conn& connection, int statusCode) {
+        connection.busy = false;
+        connection.served++;
+        if (connection.intendedUs < measureFrom) return;
+        uint64_t now = nowUs();
+        uint64_t latencyUs = now - connection.intendedUs;
+        uint64_t serviceUs = now - connection.sentUs;
+        latency.record(latencyUs);
+        serviceTime.record(serviceUs);
+        totals.maxLatencyUs = std::max(totals.maxLatencyUs, latencyUs);
+        totals.maxServiceUs = std::max(totals.maxServiceUs, serviceUs);
+        totals.completed++;
+        if (statusCode < 400) {
+            totals.ok++;
+        } else {
+            totals.errors++;
+        }
+    }
+
+    void fail(Conn& connection) {
+        if (connection.busy && connection.intendedUs >= measureFrom) totals.failed++;
+        connection.busy = false;
+        disconnect(connection);
+    }
+
+    void disconnect(Conn& connection) {
+        if (connection.fd >= 0) {
+            epoll_ctl(epollFd, EPOLL_CTL_DEL, connection.fd, nullptr);
+            ::close(connection.fd);
+        }
+        connection.fd = -1;
+        connection.connecting = false;
+        connection.input.clear();
+    }
+
+    void expire(uint64_t now, uint64_t timeoutUs) {
+        for (auto& connection : connections) {
+            if (!connection->busy || now - connection->intendedUs < timeoutUs) continue;
+            if (connection->intendedUs >= measureFrom) totals.timedOut++;
+            connection->busy = false;
+            disconnect(*connection);
+        }
+        while (!backlog.empty() && now - backlog.front() >= timeoutUs) {
+            if (backlog.front() >= measureFrom) totals.timedOut++;
+            backlog.pop_front();
+        }
+    }
+};
+
+// Bucket upper bounds can overshoot the largest sample; never report past it
+uint64_t quantile(const HistogramSnapshot& snapshot, double q, uint64_t maxUs) {
+    return std::min(snapshot.getQuantile(q), maxUs);
+}
+
+std::string quantilesJson(const HistogramSnapshot& snapshot, uint64_t maxUs) {
+    std::ostringstream out;
+    double mean = snapshot.getCount() > 0
+                      ? static_cast<double>(snapshot.getSum()) / static_cast<double>(snapshot.getCount())
+                      : 0.0;
+    out << "{\"p50\": " << quantile(snapshot, 0.50, maxUs)
+        << ", \"p90\": " << quantile(snapshot, 0.90, maxUs)
+        << ", \"p99\": " << quantile(snapshot, 0.99, maxUs)
+        << ", \"p999\": " << quantile(snapshot, 0.999, maxUs)
+        << ", \"max\": " << maxUs
+        << ", \"mean\": " << std::fixed << std::setprecision(1) << mean << "}";
+    return out.str();
+}
+
+void printQuantiles(const char* label, const HistogramSnapshot& snapshot, uint64_t maxUs) {
+    std::cout << label << "p50 " << quantile(snapshot, 0.50, maxUs) << "us, p90 " << quantile(snapshot, 0.90, maxUs)
+              << "us, p99 " << quantile(snapshot, 0.99, maxUs) << "us, p99.9 " << quantile(snapshot, 0.999, maxUs)
+              << "us, max " << maxUs << "us" << std::endl;
+}
+
+void usage() {
+    std::cerr << "usage: load_generator --target HOST:PORT --rate RPS --duration SECONDS\n"
+                 "                      [--path /] [--warmup SECONDS] [--connections N] [--threads N]\n"
+                 "                      [--requests-per-connection N] [--fast-open 0|1]\n"
+                 "                      [--timeout-ms MS] [--json FILE]" << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    Options options;
+    if (argc % 2 == 0) {
+        usage();
+        return 1;
+    }
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string flag = argv[i];
+        std::string value = argv[i + 1];
+        if (flag == "--target") {
+            size_t colon = value.rfind(':');
+            if (colon == std::string::npos) {
+                usage();
+                return 1;
+            }
+            options.host = value.substr(0, colon);
+            options.port = std::atoi(value.substr(colon + 1).c_str());
+        }
+        else if (flag == "--path") options.path = value;
+        else if (flag == "--rate") options.rate = std::atof(value.c_str());
+        else if (flag == "--duration") options.duration = std::atof(value.c_str());
+        else if (flag == "--warmup") options.warmup = std::atof(value.c_str());
+        else if (flag == "--connections") options.connections = std::atoi(value.c_str());
+        else if (flag == "--threads") options.threads = std::atoi(value.c_str());
+        else if (flag == "--requests-per-connection") options.requestsPerConnection = std::atoi(value.c_str());
+        else if (flag == "--fast-open") options.fastOpen = std::atoi(value.c_str()) != 0;
+        else if (flag == "--timeout-ms") options.timeoutMs = static_cast<uint64_t>(std::atoll(value.c_str()));
+        else if (flag == "--json") options.jsonFile = value;
+        else {
+            usage();
+            return 1;
+        }
+    }
+
+    sockaddr_in target{};
+    target.sin_family = AF_INET;
+    target.sin_port = htons(static_cast<uint16_t>(options.port));
+    if (inet_pton(AF_INET, options.host.c_str(), &target.sin_addr) != 1 || options.rate <= 0.0 ||
+        options.duration <= 0.0 || options.warmup < 0.0 || options.threads < 1 ||
+        options.connections < options.threads || options.requestsPerConnection < 0) {
+        usage();
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    std::vector<std::unique_ptr<LoadThread>> loaders;
+    for (int i = 0; i < options.threads; i++) {
+        int share = options.connections / options.threads + (i < options.connections % options.threads ? 1 : 0);
+        loaders.emplace_back(new LoadThread(options, target, options.rate / options.threads, share));
+    }
+
+    std::cout << "=== Load Test ===" << std::endl;
+    std::cout << "Target: " << options.host << ":" << options.port << options.path << std::endl;
+    std::cout << "Rate: " << options.rate << " req/s for " << options.duration << "s after "
+              << options.warmup << "s warmup, " << options.connections << " connections, "
+              << options.threads << " threads" << std::endl;
+    if (options.requestsPerConnection > 0 || options.fastOpen) {
+        std::cout << "Connections: ";
+        if (options.requestsPerConnection > 0) {
+            std::cout << "closed after " << options.requestsPerConnection << " requests";
+        } else {
+            std::cout << "kept alive";
+        }
+        std::cout << (options.fastOpen ? ", TCP Fast Open" : "") << std::endl;
+    }
+
+    // Threads share one schedule start, offset by a fraction of the interval
+    uint64_t startUs = nowUs() + 10000;
+    uint64_t measureFromUs = startUs + static_cast<uint64_t>(options.warmup * 1e6);
+    uint64_t endUs = measureFromUs + static_cast<uint64_t>(options.duration * 1e6);
+    double intervalUs = 1e6 * options.threads / options.rate;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < options.threads; i++) {
+        uint64_t offset = static_cast<uint64_t>(intervalUs * i / options.threads);
+        threads.emplace_back(&LoadThread::run, loaders[static_cast<size_t>(i)].get(),
+                             startUs + offset, measureFromUs, endUs);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    Totals totals;
+    HistogramSnapshot latency;
+    HistogramSnapshot serviceTime;
+    for (auto& loader : loaders) {
+        totals.add(loader->getTotals());
+        latency.add(loader->getLatency());
+        serviceTime.add(loader->getServiceTime());
+    }
+    double throughput = static_cast<double>(totals.completed) / options.duration;
+
+    std::cout << "Requests: " << totals.scheduled << " scheduled, " << totals.completed << " completed ("
+              << totals.ok << " ok, " << totals.errors << " error responses), " << totals.failed
+              << " failed, " << totals.timedOut << " timed out" << std::endl;
+    std::cout << "Throughput: " << std::fixed << std::setprecision(1) << throughput << " req/s" << std::endl;
+    printQuantiles("Latency (from intended start): ", latency, totals.maxLatencyUs);
+    printQuantiles("Service time (from send):      ", serviceTime, totals.maxServiceUs);
+
+    if (!options.jsonFile.empty()) {
+        std::ofstream file(options.jsonFile);
+        if (!file) {
+            std::cerr << "Cannot write " << options.jsonFile << std::endl;
+            return 1;
+        }
+        file << "{\n"
+             << "  \"target\": \"" << options.host << ":" << options.port << options.path << "\",\n"
+             << "  \"rate\": " << options.rate << ",\n"
+             << "  \"duration_s\": " << options.duration << ",\n"
+             << "  \"warmup_s\": " << options.warmup << ",\n"
+             << "  \"connections\": " << options.connections << ",\n"
+             << "  \"threads\": " << options.threads << ",\n"
+             << "  \"requests_per_connection\": " << options.requestsPerConnection << ",\n"
+             << "  \"fast_open\": " << (options.fastOpen ? "true" : "false") << ",\n"
+             << "  \"requests\": {\"scheduled\": " << totals.scheduled << ", \"completed\": " << totals.completed
+             << ", \"ok\": " << totals.ok << ", \"errors\": " << totals.errors << ", \"failed\": " << totals.failed
+             << ", \"timed_out\": " << totals.timedOut << "},\n"
+             << "  \"throughput_rps\": " << std::fixed << std::setprecision(1) << throughput << ",\n"
+             << "  \"latency_us\": " << quantilesJson(latency, totals.maxLatencyUs) << ",\n"
+             << "  \"service_time_us\": " << quantilesJson(serviceTime, totals.maxServiceUs) << "\n"
+             << "}\n";
+    }
+    return 0;
+}
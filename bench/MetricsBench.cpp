@@ -0,0 +1,101 @@
+// Measures the cost of recording metrics on the request path: a per-thread
+// MetricsShard counter, a LatencyHistogram sample, and a full request record
+// (status counter + histogram), next to the shared std::atomic fetch_add
+// they replace. Every thread records into its own shard, as workers do.
+// Arguments: operations per thread, threads.
+#include "Metrics.h"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <cstdlib>
+
+namespace {
+
+std::atomic<uint64_t> sharedCounter{0};
+
+// Runs body(threadIndex, iteration) on every thread; returns ns per call
+double run(unsigned threadCount, size_t operations, const std::function<void(unsigned, size_t)>& body) {
+    std::vector<std::thread> threads;
+    std::atomic<unsigned> ready{0};
+    std::atomic<bool> go{false};
+
+    for (unsigned t = 0; t < threadCount; t++) {
+        threads.emplace_back([&, t] {
+            ready.fetch_add(1);
+            while (!go.load()) {}
+            for (size_t i = 0; i < operations; i++) {
+                body(t, i);
+            }
+        });
+    }
+    while (ready.load() < threadCount) {}
+    auto start = std::chrono::steady_clock::now();
+    go.store(true);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    // Threads run concurrently; report the wall time one call costs a thread
+    return std::chrono::duration<double, std::nano>(end - start).count() / static_cast<double>(operations);
+}
+
+void report(const char* name, double nanoseconds) {
+    std::cout << "  " << std::left << std::setw(34) << name << std::right << std::fixed << std::setprecision(2)
+              << std::setw(8) << nanoseconds << " ns/op" << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    size_t operations = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 20000000;
+    unsigned maxThreads = argc > 2 ? static_cast<unsigned>(std::atoi(argv[2])) : std::thread::hardware_concurrency();
+    if (maxThreads == 0) maxThreads = 1;
+
+    MetricsRegistry registry;
+    registry.configure({"/api/", "/static/"}, {"10.0.0.1:80", "10.0.0.2:80"}, {"default"});
+    std::vector<MetricsShard*> shards;
+    for (unsigned t = 0; t < maxThreads; t++) {
+        shards.push_back(&registry.getShard(t));
+    }
+
+    // Latencies spread over a few decades so bucket lookups vary
+    std::vector<uint64_t> latencies(4096);
+    uint64_t seed = 88172645463325252ULL;
+    for (auto& latency : latencies) {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        latency = 50 + seed % 200000;
+    }
+
+    for (unsigned threads = 1; threads <= maxThreads; threads *= 2) {
+        std::cout << "Threads: " << threads << std::endl;
+        report("shared atomic fetch_add", run(threads, operations, [](unsigned, size_t) {
+            sharedCounter.fetch_add(1, std::memory_order_relaxed);
+        }));
+        report("shard counter add", run(threads, operations, [&](unsigned t, size_t) {
+            shards[t]->add(Counter::Requests);
+        }));
+        report("shard upstream latency record", run(threads, operations, [&](unsigned t, size_t i) {
+            shards[t]->recordUpstreamLatency(i & 1, latencies[i & 4095]);
+        }));
+        report("shard request record", run(threads, operations, [&](unsigned t, size_t i) {
+            shards[t]->recordRequest(i & 1, 200, latencies[i & 4095]);
+        }));
+    }
+
+    std::string exposition;
+    PrometheusWriter writer(exposition);
+    auto start = std::chrono::steady_clock::now();
+    registry.render(writer);
+    auto end = std::chrono::steady_clock::now();
+    std::cout << "Scrape render (" << maxThreads << " shards): "
+              << std::chrono::duration<double, std::micro>(end - start).count() << " us, "
+              << exposition.size() << " bytes" << std::endl;
+    return 0;
+}
@@ -0,0 +1,135 @@
+// Measures the per-request cost of RateLimiter (key hash + bucket update)
+// at a few working-set sizes, from a hot handful of clients to millions of
+// distinct keys, including a key space larger than the table so every
+// pass evicts. Keys are IPv4 strings like the ones getClientIP returns.
+#include "RateLimiter.h"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <thread>
+#include <random>
+#include <algorithm>
+#include <cstdlib>
+
+namespace {
+
+std::vector<std::string> makeKeys(size_t count) {
+    std::vector<std::string> keys;
+    keys.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        uint32_t address = static_cast<uint32_t>(0x0a000000u + i);
+        keys.push_back(std::to_string(address >> 24) + "." + std::to_string((address >> 16) & 0xff) + "." +
+                       std::to_string((address >> 8) & 0xff) + "." + std::to_string(address & 0xff));
+    }
+    std::shuffle(keys.begin(), keys.end(), std::mt19937(42));
+    return keys;
+}
+
+// Runs passes over keys from each thread (each thread starts at a different
+// offset) and returns nanoseconds per check
+double run(RateLimiter& limiter, const RateLimiter::Policy& policy, const std::vector<std::string>& keys,
+           size_t checksPerThread, unsigned threadCount, uint64_t& allowed) {
+    std::vector<uint64_t> allowedPerThread(threadCount, 0);
+    std::vector<std::thread> threads;
+
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned t = 0; t < threadCount; t++) {
+        threads.emplace_back([&, t] {
+            uint64_t ok = 0;
+            uint32_t retryAfterMs = 0;
+            size_t index = (keys.size() / threadCount) * t;
+            for (size_t i = 0; i < checksPerThread; i++) {
+                const std::string& key = keys[index];
+                if (++index == keys.size()) index = 0;
+                // Advance the clock every 1024 checks like the cached loop time does
+                uint64_t nowMs = 1000 + (i >> 10);
+                uint64_t hash = RateLimiter::hashKey(7, key.data(), key.length());
+                ok += limiter.tryAcquire(hash, policy, nowMs, retryAfterMs);
+            }
+            allowedPerThread[t] = ok;
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    double elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    allowed = 0;
+    for (uint64_t ok : allowedPerThread) allowed += ok;
+    return elapsed / static_cast<double>(checksPerThread);
+}
+
+bool checkBucketSemantics() {
+    RateLimiter limiter(1024, 4);
+    RateLimiter::Policy policy(10.0, 5);
+    uint64_t hash = RateLimiter::hashKey(0, "192.0.2.1", 9);
+    uint32_t retryAfterMs = 0;
+
+    int allowed = 0;
+    for (int i = 0; i < 20; i++) {
+        allowed += limiter.tryAcquire(hash, policy, 5000, retryAfterMs);
+    }
+    if (allowed != 5 || retryAfterMs == 0 || retryAfterMs > 100) {
+        std::cout << "burst check failed: allowed " << allowed << ", retry after " << retryAfterMs << "ms" << std::endl;
+        return false;
+    }
+
+    // 10/s refills one token every 100ms; checks every 10ms must not lose the fractions
+    allowed = 0;
+    for (uint64_t now = 5010; now <= 6000; now += 10) {
+        allowed += limiter.tryAcquire(hash, policy, now, retryAfterMs);
+    }
+    if (allowed < 9 || allowed > 11) {
+        std::cout << "refill check failed: allowed " << allowed << " in 1s at 10/s" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    size_t distinctKeys = argc > 1 ? std::stoul(argv[1]) : 4000000;
+    unsigned threadCount = argc > 2 ? static_cast<unsigned>(std::stoul(argv[2]))
+                                    : std::max(1u, std::thread::hardware_concurrency());
+
+    if (!checkBucketSemantics()) {
+        return 1;
+    }
+
+    std::cout << "Generating " << distinctKeys << " client keys..." << std::endl;
+    std::vector<std::string> allKeys = makeKeys(distinctKeys);
+    RateLimiter::Policy policy(100.0, 200);
+
+    struct Case {
+        const char* name;
+        size_t keys;
+        size_t capacity;
+    };
+    const Case cases[] = {
+        {"hot (1k keys)", 1000, 1u << 20},
+        {"warm (64k keys)", 65536, 1u << 20},
+        {"large (all keys, fits)", distinctKeys, distinctKeys * 2},
+        {"churn (all keys, 1/4 fits)", distinctKeys, distinctKeys / 4},
+    };
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "Threads: " << threadCount << std::endl;
+    for (const Case& c : cases) {
+        std::vector<std::string> keys(allKeys.begin(), allKeys.begin() + std::min(c.keys, allKeys.size()));
+        RateLimiter limiter(c.capacity, 64);
+        size_t checks = std::max<size_t>(4000000, keys.size() * 2);
+
+        uint64_t allowed = 0;
+        run(limiter, policy, keys, keys.size(), threadCount, allowed);   // populate the table
+        double ns = run(limiter, policy, keys, checks, threadCount, allowed);
+
+        std::cout << std::left << std::setw(30) << c.name << std::right
+                  << std::setw(8) << ns << " ns/check"
+                  << "  (table " << (limiter.getCapacity() * 16 >> 20) << " MiB, "
+                  << limiter.getKeyCount() << " keys, " << limiter.getEvictions() << " evictions)" << std::endl;
+    }
+    return 0;
+}
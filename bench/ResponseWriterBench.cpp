@@ -0,0 +1,127 @@
+// Compares ResponseWriter against the ostringstream-based createHttpResponse()
+// it replaced: response assembly alone, and assembly + send over a socketpair.
+#include "ResponseWriter.h"
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <string>
+
+namespace {
+
+// Verbatim copy of the previous Server::createHttpResponse()
+std::string legacyCreateHttpResponse(int statusCode, const std::string& body) {
+    std::string statusText;
+    switch (statusCode) {
+        case 200: statusText = "OK"; break;
+        case 400: statusText = "Bad Request"; break;
+        case 503: statusText = "Service Unavailable"; break;
+        default: statusText = "Unknown"; break;
+    }
+
+    std::ostringstream response;
+    response << "HTTP/1.1 " << statusCode << " " << statusText << "\r\n";
+    response << "Content-Type: application/json\r\n";
+    response << "Content-Length: " << body.length() << "\r\n";
+    response << "Connection: close\r\n";
+    response << "Server: ReverseProxy/1.0\r\n";
+    response << "\r\n";
+    response << body;
+
+    return response.str();
+}
+
+volatile size_t sink = 0;
+
+template <typename Fn>
+double nanosPerOp(size_t iterations, Fn&& fn) {
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; i++) {
+        fn();
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+}
+
+void printRow(const std::string& name, size_t bodySize, double legacy, double writer) {
+    std::cout << std::left << std::setw(12) << name
+              << std::right << std::setw(10) << bodySize
+              << std::setw(14) << std::fixed << std::setprecision(1) << legacy
+              << std::setw(14) << writer
+              << std::setw(10) << std::setprecision(2) << (legacy / writer) << "x" << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    size_t iterations = argc > 1 ? std::stoul(argv[1]) : 200000;
+    std::vector<size_t> bodySizes = {0, 256, 4096, 65536};
+
+    std::cout << "ResponseWriter vs legacy createHttpResponse (" << iterations << " iterations)" << std::endl;
+    std::cout << std::left << std::setw(12) << "mode"
+              << std::right << std::setw(10) << "body"
+              << std::setw(14) << "legacy ns/op"
+              << std::setw(14) << "writer ns/op"
+              << std::setw(11) << "speedup" << std::endl;
+
+    for (size_t bodySize : bodySizes) {
+        std::string body(bodySize, 'x');
+
+        double legacy = nanosPerOp(iterations, [&] {
+            std::string response = legacyCreateHttpResponse(200, body);
+            sink = sink + response.size();
+        });
+        double writer = nanosPerOp(iterations, [&] {
+            ResponseWriter::Frame frame;
+            ResponseWriter::build(frame, 200, body.data(), body.size());
+            sink = sink + frame.totalLength;
+        });
+        printRow("assemble", bodySize, legacy, writer);
+    }
+
+#ifndef _WIN32
+    for (size_t bodySize : bodySizes) {
+        std::string body(bodySize, 'x');
+
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+            std::cerr << "socketpair failed" << std::endl;
+            return 1;
+        }
+
+        std::atomic<bool> done{false};
+        std::thread drain([&] {
+            char buffer[65536];
+            while (!done.load()) {
+                if (recv(fds[1], buffer, sizeof(buffer), 0) <= 0) break;
+            }
+        });
+
+        size_t sendIterations = iterations / 4;
+        double legacy = nanosPerOp(sendIterations, [&] {
+            std::string response = legacyCreateHttpResponse(200, body);
+            size_t offset = 0;
+            while (offset < response.size()) {
+                ssize_t sent = send(fds[0], response.data() + offset, response.size() - offset, MSG_NOSIGNAL);
+                if (sent <= 0) break;
+                offset += static_cast<size_t>(sent);
+            }
+        });
+        double writer = nanosPerOp(sendIterations, [&] {
+            ResponseWriter::send(fds[0], 200, body);
+        });
+        printRow("send", bodySize, legacy, writer);
+
+        done.store(true);
+        shutdown(fds[0], SHUT_RDWR);
+        drain.join();
+        close(fds[0]);
+        close(fds[1]);
+    }
+#endif
+
+    return 0;
+}
@@ -0,0 +1,414 @@
+// Minimal HTTP/1.1 backend for load tests. Answers every request with a
+// fixed-size body after a delay drawn from a latency distribution, and with
+// a 500 at a configurable rate. Each thread runs its own epoll loop on its
+// own SO_REUSEPORT listener; delays are kept in a heap and fired by a
+// timerfd, so sub-millisecond latencies are honoured without spinning.
+// Linux only.
+//
+//   stub_backend --port 3001 [--threads 1] [--size 1024]
+//                [--latency fixed:MS | uniform:MIN:MAX | exp:MEAN | lognormal:MEDIAN:SIGMA]
+//                [--error-rate 0.0] [--fast-open QUEUE]
+#include "Http.h"
+#include "Platform.h"
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <queue>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+std::atomic<bool> running{true};
+
+void handleSignal(int) {
+    running.store(false);
+}
+
+uint64_t nowUs() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+struct Options {
+    int port = 3001;
+    int threads = 1;
+    size_t size = 1024;
+    std::string latency = "fixed:0";
+    double errorRate = 0.0;
+    int fastOpenQueue = 0;   // TCP_FASTOPEN on the listener; 0 = off
+};
+
+/**
+ * Response delay in microseconds, drawn from the configured distribution
+ */
+class LatencyModel {
+public:
+    bool parse(const std::string& spec) {
+        std::vector<double> values;
+        size_t colon = spec.find(':');
+        kind = spec.substr(0, colon);
+        while (colon != std::string::npos) {
+            size_t next = spec.find(':', colon + 1);
+            values.push_back(std::atof(spec.substr(colon + 1, next - colon - 1).c_str()));
+            colon = next;
+        }
+        if (kind == "fixed" && values.size() == 1) { a = values[0]; return a >= 0; }
+        if (kind == "uniform" && values.size() == 2) { a = values[0]; b = values[1]; return a >= 0 && b >= a; }
+        if (kind == "exp" && values.size() == 1) { a = values[0]; return a > 0; }
+        if (kind == "lognormal" && values.size() == 2) { a = values[0]; b = values[1]; return a > 0 && b >= 0; }
+        return false;
+    }
+
+    uint64_t sampleUs(std::mt19937_64& random) const {
+        double ms = a;
+        if (kind == "uniform") {
+            ms = std::uniform_real_distribution<double>(a, b)(random);
+        } else if (kind == "exp") {
+            ms = std::exponential_distribution<double>(1.0 / a)(random);
+        } else if (kind == "lognormal") {
+            ms = std::lognormal_distribution<double>(std::log(a), b)(random);
+        }
+        return static_cast<uint64_t>(ms * 1000.0);
+    }
+
+private:
+    std::string kind;
+    double a = 0.0;
+    double b = 0.0;
+};
+
+class StubThread {
+public:
+    StubThread(const Options& o, const LatencyModel& l, int index)
+        : options(o), latency(l), random(0x5eed + static_cast<uint64_t>(index)),
+          epollFd(-1), timerFd(-1), listenFd(-1), nextGeneration(1), armedFor(0) {
+        okResponse = "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\nContent-Length: " +
+                     std::to_string(options.size) + "\r\n\r\n" + std::string(options.size, 'x');
+        errorResponse = "HTTP/1.1 500 Internal Server Error\r\nContent-Type: text/plain\r\n"
+                        "Content-Length: 13\r\n\r\nstub failure\n";
+    }
+
+    ~StubThread() {
+        for (auto& entry : connections) ::close(entry.first);
+        if (listenFd >= 0) ::close(listenFd);
+        if (timerFd >= 0) ::close(timerFd);
+        if (epollFd >= 0) ::close(epollFd);
+    }
+
+    bool open() {
+        listenFd = socket(AF_INET, SOCK_STREAM, 0);
+        int on = 1;
+        setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        setsockopt(listenFd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+        if (options.fastOpenQueue > 0) {
+            setsockopt(listenFd, IPPROTO_TCP, TCP_FASTOPEN, &options.fastOpenQueue, sizeof(options.fastOpenQueue));
+        }
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(static_cast<uint16_t>(options.port));
+        if (bind(listenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(listenFd, 1024) != 0) {
+            std::cerr << "stub_backend: cannot listen on port " << options.port << ": " << strerror(errno) << std::endl;
+            return false;
+        }
+        setNonBlocking(listenFd);
+
+        epollFd = epoll_create1(0);
+        timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.fd = listenFd;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &event);
+        event.data.fd = timerFd;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, timerFd, &event);
+        return true;
+    }
+
+    void run() {
+        epoll_event events[256];
+        while (running.load()) {
+            int count = epoll_wait(epollFd, events, 256, 100);
+            for (int i = 0; i < count; i++) {
+                int fd = events[i].data.fd;
+                if (fd == listenFd) {
+                    acceptAll();
+                } else if (fd == timerFd) {
+                    uint64_t expirations;
+                    while (read(timerFd, &expirations, sizeof(expirations)) > 0) {}
+                    armedFor = 0;
+                } else {
+                    onConnection(fd, events[i].events);
+                }
+            }
+            fireDue();
+        }
+    }
+
+private:
+    struct Connection {
+        uint64_t generation;
+        std::string input;
+        std::string output;
+        size_t outputOffset = 0;
+        bool waiting = false;         // a delayed response is pending
+        bool closeAfterOutput = false;
+        bool writable = false;        // EPOLLOUT registered
+        bool readingBody = false;     // head parsed, body still arriving
+        bool keepAlive = true;
+        BodyDecoder body;
+        std::string discard;          // request bodies are read and dropped
+    };
+
+    struct Pending {
+        uint64_t dueUs;
+        int fd;
+        uint64_t generation;
+        bool error;
+        bool close;
+        bool operator>(const Pending& other) const { return dueUs > other.dueUs; }
+    };
+
+    const Options& options;
+    const LatencyModel& latency;
+    std::mt19937_64 random;
+    int epollFd;
+    int timerFd;
+    int listenFd;
+    uint64_t nextGeneration;
+    uint64_t armedFor;
+    std::string okResponse;
+    std::string errorResponse;
+    std::unordered_map<int, Connection> connections;
+    std::priority_queue<Pending, std::vector<Pending>, std::greater<Pending>> pending;
+
+    void acceptAll() {
+        while (true) {
+            int fd = accept(listenFd, nullptr, nullptr);
+            if (fd < 0) return;
+            setNonBlocking(fd);
+            int on = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+            epoll_event event{};
+            event.events = EPOLLIN | EPOLLRDHUP;
+            event.data.fd = fd;
+            epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+            connections[fd].generation = nextGeneration++;
+        }
+    }
+
+    void closeConnection(int fd) {
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+        ::close(fd);
+        connections.erase(fd);
+    }
+
+    void onConnection(int fd, uint32_t events) {
+        auto found = connections.find(fd);
+        if (found == connections.end()) return;
+        Connection& connection = found->second;
+
+        if (events & EPOLLOUT) {
+            if (!flush(fd, connection)) return;
+        }
+        if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+            char buffer[16384];
+            while (true) {
+                ssize_t received = recv(fd, buffer, sizeof(buffer), 0);
+                if (received > 0) {
+                    connection.input.append(buffer, static_cast<size_t>(received));
+                    continue;
+                }
+                if (received < 0 && (errno == EAGAIN || errno == EINTR)) break;
+                closeConnection(fd);   // EOF or error
+                return;
+            }
+            process(fd, connection);
+        }
+    }
+
+    // Parses buffered requests, answering or delaying each in order
+    void process(int fd, Connection& connection) {
+        while (!connection.waiting && !connection.closeAfterOutput) {
+            if (!connection.readingBody) {
+                HttpHead request;
+                ParseResult result = Http::parseRequestHead(connection.input.data(), connection.input.size(),
+                                                            request);
+                if (result == ParseResult::Incomplete) break;
+                if (result == ParseResult::Invalid) {
+                    closeConnection(fd);
+                    return;
+                }
+                connection.input.erase(0, request.headLength);
+                long long length = request.contentLength();
+                if (request.isChunked()) {
+                    connection.body.reset(BodyDecoder::Framing::Chunked);
+                } else if (length > 0) {
+                    connection.body.reset(BodyDecoder::Framing::Length, length);
+                } else {
+                    connection.body.reset(BodyDecoder::Framing::None);
+                }
+                connection.keepAlive = request.wantsKeepAlive();
+                connection.readingBody = true;
+            }
+
+            connection.discard.clear();
+            size_t consumed = connection.body.decode(connection.input.data(), connection.input.size(),
+                                                     connection.discard, false);
+            connection.input.erase(0, consumed);
+            if (connection.body.isInvalid()) {
+                closeConnection(fd);
+                return;
+            }
+            if (!connection.body.isComplete()) break;
+            connection.readingBody = false;
+
+            bool error = options.errorRate > 0.0 &&
+                         std::uniform_real_distribution<double>(0.0, 1.0)(random) < options.errorRate;
+            bool close = !connection.keepAlive;
+            uint64_t delayUs = latency.sampleUs(random);
+            if (delayUs == 0) {
+                respond(connection, error, close);
+                continue;
+            }
+            connection.waiting = true;
+            pending.push(Pending{nowUs() + delayUs, fd, connection.generation, error, close});
+        }
+        flush(fd, connection);
+        armTimer();
+    }
+
+    void respond(Connection& connection, bool error, bool close) {
+        connection.output += error ? errorResponse : okResponse;
+        connection.closeAfterOutput = close;
+    }
+
+    void fireDue() {
+        uint64_t now = nowUs();
+        while (!pending.empty() && pending.top().dueUs <= now) {
+            Pending due = pending.top();
+            pending.pop();
+            auto found = connections.find(due.fd);
+            if (found == connections.end() || found->second.generation != due.generation) continue;
+            found->second.waiting = false;
+            respond(found->second, due.error, due.close);
+            process(due.fd, found->second);
+        }
+        armTimer();
+    }
+
+    void armTimer() {
+        if (pending.empty() || pending.top().dueUs == armedFor) return;
+        armedFor = pending.top().dueUs;
+        uint64_t now = nowUs();
+        uint64_t delay = armedFor > now ? armedFor - now : 1;
+        itimerspec spec{};
+        spec.it_value.tv_sec = static_cast<time_t>(delay / 1000000);
+        spec.it_value.tv_nsec = static_cast<long>((delay % 1000000) * 1000);
+        timerfd_settime(timerFd, 0, &spec, nullptr);
+    }
+
+    // Returns false once the connection has been closed
+    bool flush(int fd, Connection& connection) {
+        while (connection.outputOffset < connection.output.size()) {
+            ssize_t sent = send(fd, connection.output.data() + connection.outputOffset,
+                                connection.output.size() - connection.outputOffset, MSG_NOSIGNAL);
+            if (sent > 0) {
+                connection.outputOffset += static_cast<size_t>(sent);
+                continue;
+            }
+            if (sent < 0 && errno == EINTR) continue;
+            if (sent < 0 && errno == EAGAIN) {
+                setWritable(fd, connection, true);
+                return true;
+            }
+            closeConnection(fd);
+            return false;
+        }
+        connection.output.clear();
+        connection.outputOffset = 0;
+        setWritable(fd, connection, false);
+        if (connection.closeAfterOutput) {
+            closeConnection(fd);
+            return false;
+        }
+        return true;
+    }
+
+    void setWritable(int fd, Connection& connection, bool writable) {
+        if (connection.writable == writable) return;
+        connection.writable = writable;
+        epoll_event event{};
+        event.events = EPOLLIN | EPOLLRDHUP | (writable ? EPOLLOUT : 0u);
+        event.data.fd = fd;
+        epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &event);
+    }
+};
+
+void usage() {
+    std::cerr << "usage: stub_backend --port N [--threads N] [--size BYTES]\n"
+                 "                    [--latency fixed:MS|uniform:MIN:MAX|exp:MEAN|lognormal:MEDIAN:SIGMA]\n"
+                 "                    [--error-rate FRACTION] [--fast-open QUEUE]" << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    Options options;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string flag = argv[i];
+        std::string value = argv[i + 1];
+        if (flag == "--port") options.port = std::atoi(value.c_str());
+        else if (flag == "--threads") options.threads = std::atoi(value.c_str());
+        else if (flag == "--size") options.size = static_cast<size_t>(std::atoll(value.c_str()));
+        else if (flag == "--latency") options.latency = value;
+        else if (flag == "--error-rate") options.errorRate = std::atof(value.c_str());
+        else if (flag == "--fast-open") options.fastOpenQueue = std::atoi(value.c_str());
+        else {
+            usage();
+            return 1;
+        }
+    }
+    if (argc % 2 == 0) {
+        usage();
+        return 1;
+    }
+
+    LatencyModel latency;
+    if (!latency.parse(options.latency) || options.threads < 1) {
+        usage();
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, handleSignal);
+    signal(SIGTERM, handleSignal);
+
+    std::vector<std::unique_ptr<StubThread>> stubs;
+    for (int i = 0; i < options.threads; i++) {
+        stubs.emplace_back(new StubThread(options, latency, i));
+        if (!stubs.back()->open()) return 1;
+    }
+    std::cout << "stub_backend listening on 127.0.0.1:" << options.port << " (" << options.threads
+              << " threads, " << options.size << " byte bodies, latency " << options.latency
+              << ", error rate " << options.errorRate << ")" << std::endl;
+
+    std::vector<std::thread> threads;
+    for (auto& stub : stubs) {
+        threads.emplace_back(&StubThread::run, stub.get());
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    return 0;
+}
@@ -0,0 +1,330 @@
+// Measures the TLS listener: handshakes per second, full against resumed
+// (TLS 1.3 stateless tickets, TLS 1.2 session ids served from the sharded
+// cache), and bulk download throughput with kernel TLS off and on, once
+// as an HTTP response (written with SSL_write) and once through an
+// upgraded tunnel (spliced into the socket when the kernel encrypts).
+// The real Server runs on loopback ports with an in-process backend and a
+// self-signed certificate generated at startup. Arguments: handshakes per
+// case, bulk megabytes, client threads.
+#include "Server.h"
+#include "Logger.h"
+#include "LoadBalancer.h"
+#include "Platform.h"
+#include "BenchSupport.h"
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <iterator>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifndef PROXY_HAS_TLS
+int main() {
+    std::cerr << "tls_bench needs a build with OpenSSL (REVERSE_PROXY_TLS=ON)" << std::endl;
+    return 1;
+}
+#else
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+
+namespace {
+
+constexpr int kProxyPort = 18891;
+constexpr int kTlsPort = 18892;
+constexpr int kBackendPort = 18021;
+const char* const kCertificate = "tls_bench_cert.pem";
+const char* const kPrivateKey = "tls_bench_key.pem";
+
+std::atomic<bool> backendRunning{true};
+size_t bulkBytes = 256u << 20;
+
+// P-256 key and a self-signed certificate for localhost
+bool writeCertificate() {
+    EVP_PKEY* key = nullptr;
+    EVP_PKEY_CTX* keyContext = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
+    if (keyContext == nullptr || EVP_PKEY_keygen_init(keyContext) <= 0 ||
+        EVP_PKEY_CTX_set_ec_paramgen_curve_nid(keyContext, NID_X9_62_prime256v1) <= 0 ||
+        EVP_PKEY_keygen(keyContext, &key) <= 0) {
+        EVP_PKEY_CTX_free(keyContext);
+        return false;
+    }
+    EVP_PKEY_CTX_free(keyContext);
+
+    X509* certificate = X509_new();
+    X509_set_version(certificate, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(certificate), 1);
+    X509_gmtime_adj(X509_getm_notBefore(certificate), 0);
+    X509_gmtime_adj(X509_getm_notAfter(certificate), 24 * 3600);
+    X509_set_pubkey(certificate, key);
+    X509_NAME* name = X509_get_subject_name(certificate);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, reinterpret_cast<const unsigned char*>("localhost"), -1, -1, 0);
+    X509_set_issuer_name(certificate, name);
+    bool ok = X509_sign(certificate, key, EVP_sha256()) > 0;
+
+    FILE* keyFile = std::fopen(kPrivateKey, "w");
+    FILE* certificateFile = std::fopen(kCertificate, "w");
+    ok = ok && keyFile != nullptr && certificateFile != nullptr &&
+         PEM_write_PrivateKey(keyFile, key, nullptr, nullptr, 0, nullptr, nullptr) == 1 &&
+         PEM_write_X509(certificateFile, certificate) == 1;
+    if (keyFile != nullptr) std::fclose(keyFile);
+    if (certificateFile != nullptr) std::fclose(certificateFile);
+    X509_free(certificate);
+    EVP_PKEY_free(key);
+    return ok;
+}
+
+// GET /small answers two bytes; /bulk answers bulkBytes as a response
+// body; an upgrade request to /tunnel gets 101 and then bulkBytes raw
+void serveOne(SOCKET fd) {
+    std::string input;
+    if (!readRequestHead(fd, input)) {
+        closesocket(fd);
+        return;
+    }
+
+    static const std::string payload(1 << 20, 'x');
+    if (input.compare(0, 10, "GET /small") == 0) {
+        static const char kResponse[] = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok";
+        sendAll(fd, kResponse, sizeof(kResponse) - 1);
+    } else {
+        bool tunnel = input.compare(0, 11, "GET /tunnel") == 0;
+        std::string head = tunnel ? "HTTP/1.1 101 Switching Protocols\r\nUpgrade: bench\r\nConnection: Upgrade\r\n\r\n"
+                                  : "HTTP/1.1 200 OK\r\nContent-Length: " + std::to_string(bulkBytes) + "\r\n\r\n";
+        bool ok = sendAll(fd, head.data(), head.size());
+        for (size_t left = bulkBytes; ok && left > 0;) {
+            size_t length = std::min(left, payload.size());
+            ok = sendAll(fd, payload.data(), length);
+            left -= length;
+        }
+#ifdef _WIN32
+        shutdown(fd, SD_SEND);
+#else
+        shutdown(fd, SHUT_WR);
+#endif
+        // Wait for the proxy to hang up so the tail is not reset away
+        char buffer[4096];
+        while (recv(fd, buffer, sizeof(buffer), 0) > 0) {
+        }
+    }
+    closesocket(fd);
+}
+
+SSL_CTX* clientContext(int version, bool tickets) {
+    SSL_CTX* context = SSL_CTX_new(TLS_client_method());
+    SSL_CTX_set_min_proto_version(context, version);
+    SSL_CTX_set_max_proto_version(context, version);
+    // Sessions are handed over by hand; a client cache would retire used TLS 1.3 tickets
+    SSL_CTX_set_session_cache_mode(context, SSL_SESS_CACHE_OFF);
+    if (!tickets) SSL_CTX_set_options(context, SSL_OP_NO_TICKET);
+    return context;
+}
+
+// Handshake and (optionally) one request read to the end; returns the
+// bytes of response after the head, or -1 on failure
+long exchange(SSL_CTX* context, SSL_SESSION* session, const char* request, bool& resumed, SSL_SESSION** saved) {
+    SOCKET fd = connectTo(kTlsPort);
+    if (fd == INVALID_SOCKET) return -1;
+    SSL* ssl = SSL_new(context);
+    SSL_set_fd(ssl, fd);
+    if (session != nullptr) SSL_set_session(ssl, session);
+
+    long body = -1;
+    if (SSL_connect(ssl) == 1) {
+        resumed = SSL_session_reused(ssl) == 1;
+        body = 0;
+        if (request != nullptr) {
+            SSL_write(ssl, request, static_cast<int>(std::strlen(request)));
+            std::string head;
+            char buffer[64 * 1024];
+            int received;
+            while ((received = SSL_read(ssl, buffer, sizeof(buffer))) > 0) {
+                if (head.size() < 4096 && head.find("\r\n\r\n") == std::string::npos) {
+                    head.append(buffer, static_cast<size_t>(received));
+                    size_t end = head.find("\r\n\r\n");
+                    if (end != std::string::npos) body += static_cast<long>(head.size() - end - 4);
+                } else {
+                    body += received;
+                }
+            }
+            // TLS 1.3 tickets arrive after the handshake; read by now
+            if (saved != nullptr) *saved = SSL_get1_session(ssl);
+        }
+    }
+    // An unclean close would mark the session unresumable
+    if (body >= 0) SSL_shutdown(ssl);
+    ERR_clear_error();
+    SSL_free(ssl);
+    closesocket(fd);
+    return body;
+}
+
+BenchConfig benchConfig(bool ktls) {
+    BenchConfig config;
+    config.proxyPort = kProxyPort;
+    config.server = "\"max_connections\": 2000, \"workers\": 1, \"keep_alive\": false";
+    config.sections = std::string("  \"tls\": { \"enabled\": true, \"port\": ") + std::to_string(kTlsPort) +
+                      ", \"certificate\": \"" + kCertificate + "\", \"private_key\": \"" + kPrivateKey +
+                      "\", \"session_tickets\": true, \"ktls\": " + (ktls ? "true" : "false") + " },\n" +
+                      "  \"timeouts\": { \"request_total_ms\": 600000 },\n";
+    config.backendPorts = {kBackendPort};
+    return config;
+}
+
+// Runs the proxy for the duration of body()
+template <typename Body>
+void withServer(bool ktls, Body body) {
+    const std::string configPath = "tls_bench_config.json";
+    writeConfig(configPath, benchConfig(ktls));
+
+    Logger logger("", false, LogLevel::ERROR);
+    LoadBalancer loadBalancer(LoadBalancingAlgorithm::ROUND_ROBIN);
+    Server server(logger, loadBalancer);
+    std::streambuf* saved = std::cout.rdbuf(nullptr);   // silence configuration dump
+    bool configured = server.configure(configPath);
+    std::cout.rdbuf(saved);
+    std::remove(configPath.c_str());
+    if (!configured) {
+        std::cerr << "configuration failed" << std::endl;
+        std::exit(1);
+    }
+
+    // Quiet while the server prints its banner and, at the end, its status
+    std::cout.rdbuf(nullptr);
+    std::thread serverThread([&] { server.start(); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    std::cout.rdbuf(saved);
+    if (server.getTls() == nullptr) {
+        std::cerr << "TLS listener did not start" << std::endl;
+        std::exit(1);
+    }
+
+    body(*server.getTls());
+
+    std::cout.rdbuf(nullptr);
+    server.requestStop();
+    serverThread.join();
+    std::cout.rdbuf(saved);
+}
+
+void runHandshakes(const char* name, int version, bool tickets, bool resume, size_t count, unsigned threadCount) {
+    SSL_CTX* context = clientContext(version, tickets);
+    SSL_SESSION* session = nullptr;
+    if (resume) {
+        bool resumed = false;
+        if (exchange(context, nullptr, "GET /small HTTP/1.1\r\nHost: bench\r\n\r\n", resumed, &session) < 0 ||
+            session == nullptr) {
+            std::cerr << "no session to resume" << std::endl;
+            std::exit(1);
+        }
+    }
+
+    std::atomic<size_t> next{0};
+    std::atomic<size_t> resumedCount{0};
+    std::atomic<size_t> failures{0};
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> clients;
+    for (unsigned t = 0; t < threadCount; t++) {
+        clients.emplace_back([&] {
+            while (next.fetch_add(1) < count) {
+                bool resumed = false;
+                if (exchange(context, session, nullptr, resumed, nullptr) < 0) {
+                    failures.fetch_add(1);
+                } else if (resumed) {
+                    resumedCount.fetch_add(1);
+                }
+            }
+        });
+    }
+    for (auto& client : clients) {
+        client.join();
+    }
+    double seconds = elapsedSeconds(start);
+
+    std::cout << std::left << std::setw(28) << name << std::right << std::fixed << std::setprecision(0)
+              << std::setw(8) << static_cast<double>(count) / seconds << " handshakes/s  (" << resumedCount.load()
+              << " resumed, " << failures.load() << " failed)" << std::endl;
+    SSL_SESSION_free(session);
+    SSL_CTX_free(context);
+}
+
+void runBulk(const char* name, const char* request, TlsContext& tls) {
+    SSL_CTX* context = clientContext(TLS1_3_VERSION, true);
+    uint64_t offloadsBefore = tls.getStats().kernelSend.load();
+    bool resumed = false;
+    auto start = std::chrono::steady_clock::now();
+    long received = exchange(context, nullptr, request, resumed, nullptr);
+    double seconds = elapsedSeconds(start);
+    bool kernel = tls.getStats().kernelSend.load() > offloadsBefore;
+
+    std::cout << std::left << std::setw(28) << name << std::right << std::fixed << std::setprecision(1)
+              << std::setw(8) << static_cast<double>(received) / seconds / (1 << 20) << " MB/s  ("
+              << received << " bytes, " << (kernel ? "kernel" : "user-space") << " encryption)";
+    if (received != static_cast<long>(bulkBytes)) std::cout << "  SHORT";
+    std::cout << std::endl;
+    SSL_CTX_free(context);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    size_t handshakes = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 2000;
+    bulkBytes = (argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 256) << 20;
+    unsigned threadCount = argc > 3 ? static_cast<unsigned>(std::atoi(argv[3])) : 2;
+
+#ifndef _WIN32
+    signal(SIGPIPE, SIG_IGN);
+#endif
+    if (!writeCertificate()) {
+        std::cerr << "cannot generate a certificate" << std::endl;
+        return 1;
+    }
+    SOCKET listener = listenOn(kBackendPort);
+    std::thread backend(runBackend, listener, std::cref(backendRunning), serveOne);
+
+    std::cout << "Handshakes: " << handshakes << " per case, client threads: " << threadCount
+              << ", bulk: " << (bulkBytes >> 20) << " MB" << std::endl;
+
+    std::cout << "\nHandshakes (ECDSA P-256)" << std::endl;
+    withServer(false, [&](TlsContext&) {
+        runHandshakes("TLS 1.3 full", TLS1_3_VERSION, true, false, handshakes, threadCount);
+        runHandshakes("TLS 1.3 resumed (ticket)", TLS1_3_VERSION, true, true, handshakes, threadCount);
+        runHandshakes("TLS 1.2 full", TLS1_2_VERSION, false, false, handshakes, threadCount);
+        runHandshakes("TLS 1.2 resumed (cache)", TLS1_2_VERSION, false, true, handshakes, threadCount);
+    });
+
+    std::cout << "\nBulk download (one connection)" << std::endl;
+    const std::string bulk = "GET /bulk HTTP/1.1\r\nHost: bench\r\n\r\n";
+    const std::string tunnel = "GET /tunnel HTTP/1.1\r\nHost: bench\r\nConnection: Upgrade\r\nUpgrade: bench\r\n\r\n";
+    for (bool ktls : {false, true}) {
+        withServer(ktls, [&](TlsContext& tls) {
+            runBulk(ktls ? "response, ktls on" : "response, ktls off", bulk.c_str(), tls);
+            runBulk(ktls ? "tunnel, ktls on" : "tunnel, ktls off", tunnel.c_str(), tls);
+        });
+    }
+#ifdef __linux__
+    std::ifstream ulps("/proc/sys/net/ipv4/tcp_available_ulp");
+    std::string available((std::istreambuf_iterator<char>(ulps)), std::istreambuf_iterator<char>());
+    if (available.find("tls") == std::string::npos) {
+        std::cout << "(kernel TLS unavailable here: load the tls module to compare)" << std::endl;
+    }
+#endif
+
+    std::remove(kCertificate);
+    std::remove(kPrivateKey);
+    // The backend thread blocks in accept; the process exit reclaims it
+    backendRunning.store(false);
+    backend.detach();
+    return 0;
+}
+
+#endif
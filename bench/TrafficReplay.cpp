@@ -0,0 +1,504 @@
+// Replays request heads captured by the proxy ("capture" in config.json)
+// against a proxy instance. Requests keep their captured connections: each
+// captured client connection is replayed on its own connection, in order,
+// one request at a time, so keep-alive reuse matches production. At --speed
+// 1 (or N) every request is scheduled at its captured offset (divided by N)
+// and latency is measured from that scheduled time, so a slow server is not
+// hidden by the replay falling behind. At --speed max the timing is dropped:
+// up to --max-open connections replay back to back.
+// Request bodies are not captured; a body of the captured length is sent.
+// Linux only.
+//
+//   traffic_replay --target 127.0.0.1:8888 [--speed 1|N|max] [--max-open 256]
+//                  [--timeout-ms 5000] [--json results.json] captures/ [more.rpcap ...]
+#include "Http.h"
+#include "Metrics.h"
+#include "Platform.h"
+#include "TrafficCapture.h"
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <dirent.h>
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <queue>
+#include <string>
+#include <vector>
+
+namespace {
+
+uint64_t nowUs() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+struct Options {
+    std::string host = "127.0.0.1";
+    int port = 8888;
+    double speed = 1.0;         // 0 = as fast as possible
+    size_t maxOpen = 256;
+    uint64_t timeoutMs = 5000;
+    std::string jsonFile;
+    std::vector<std::string> inputs;
+};
+
+bool loadCaptures(const std::vector<std::string>& inputs, std::vector<CapturedRequest>& requests) {
+    std::vector<std::string> files;
+    for (const std::string& input : inputs) {
+        DIR* directory = opendir(input.c_str());
+        if (directory == nullptr) {
+            files.push_back(input);
+            continue;
+        }
+        while (dirent* entry = readdir(directory)) {
+            std::string name = entry->d_name;
+            if (name.size() > 6 && name.compare(name.size() - 6, 6, ".rpcap") == 0) {
+                files.push_back(input + "/" + name);
+            }
+        }
+        closedir(directory);
+    }
+    std::sort(files.begin(), files.end());
+    for (const std::string& file : files) {
+        std::string error;
+        if (!CaptureReader::readSegment(file, requests, error)) {
+            std::cerr << error << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Response framing for HTTP/1.1: Content-Length, chunked, or until close
+ */
+class ResponseParser {
+public:
+    // Bytes of input the complete response occupies, or 0 if incomplete
+    static size_t complete(const std::string& input, bool headRequest, bool closed, int& status, bool& keepAlive) {
+        HttpHead head;
+        if (Http::parseResponseHead(input.data(), input.size(), head) != ParseResult::Complete) return 0;
+        status = head.statusCode;
+        keepAlive = head.wantsKeepAlive();
+        if (headRequest || status == 204 || status == 304 || status < 200) return head.headLength;
+        if (head.isChunked()) return chunkedEnd(input, head.headLength);
+        long long length = head.contentLength();
+        if (length >= 0) {
+            size_t end = head.headLength + static_cast<size_t>(length);
+            return input.size() >= end ? end : 0;
+        }
+        keepAlive = false;
+        return closed ? input.size() : 0;
+    }
+
+private:
+    static size_t chunkedEnd(const std::string& input, size_t offset) {
+        while (true) {
+            size_t lineEnd = input.find("\r\n", offset);
+            if (lineEnd == std::string::npos) return 0;
+            size_t size = std::strtoul(input.c_str() + offset, nullptr, 16);
+            offset = lineEnd + 2;
+            if (size == 0) {
+                // Trailers end with an empty line
+                size_t end = input.find("\r\n\r\n", offset - 2);
+                return end == std::string::npos ? 0 : end + 4;
+            }
+            offset += size + 2;
+            if (offset > input.size()) return 0;
+        }
+    }
+};
+
+class Replay {
+public:
+    Replay(const Options& o, const std::vector<CapturedRequest>& r, const sockaddr_in& target)
+        : options(o), requests(r), address(target),
+          epollFd(epoll_create1(0)), timerFd(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK)) {
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.ptr = nullptr;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, timerFd, &event);
+
+        // Captured connections in order of their first request
+        std::map<uint64_t, size_t> byId;
+        for (size_t i = 0; i < requests.size(); i++) {
+            auto found = byId.find(requests[i].connectionId);
+            if (found == byId.end()) {
+                found = byId.emplace(requests[i].connectionId, conns.size()).first;
+                conns.emplace_back(new Conn());
+            }
+            conns[found->second]->requests.push_back(i);
+        }
+        for (auto& conn : conns) {
+            std::sort(conn->requests.begin(), conn->requests.end(), [this](size_t a, size_t b) {
+                return requests[a].requestIndex < requests[b].requestIndex;
+            });
+        }
+        std::sort(conns.begin(), conns.end(), [this](const std::unique_ptr<Conn>& a, const std::unique_ptr<Conn>& b) {
+            return requests[a->requests.front()].timestampUs < requests[b->requests.front()].timestampUs;
+        });
+        for (size_t i = 0; i < conns.size(); i++) conns[i]->slot = i;
+    }
+
+    ~Replay() {
+        for (auto& conn : conns) {
+            if (conn->fd >= 0) ::close(conn->fd);
+        }
+        ::close(timerFd);
+        ::close(epollFd);
+    }
+
+    void run() {
+        firstCapturedUs = requests.empty() ? 0 : requests[conns.front()->requests.front()].timestampUs;
+        startUs = nowUs() + 10000;
+        for (size_t i = 0; i < conns.size(); i++) due.push(Due{scheduledFor(*conns[i]), i});
+
+        epoll_event events[256];
+        while (finished < conns.size()) {
+            uint64_t now = nowUs();
+            while (!due.empty() && due.top().atUs <= now) {
+                if (options.speed == 0.0 && open >= options.maxOpen && conns[due.top().conn]->fd < 0) break;
+                size_t index = due.top().conn;
+                due.pop();
+                send(*conns[index], now);
+            }
+            expire(now);
+            if (!due.empty() && (options.speed != 0.0 || open < options.maxOpen)) armTimer(due.top().atUs);
+
+            int count = epoll_wait(epollFd, events, 256, 100);
+            for (int i = 0; i < count; i++) {
+                if (events[i].data.ptr == nullptr) {
+                    uint64_t expirations;
+                    while (::read(timerFd, &expirations, sizeof(expirations)) > 0) {}
+                } else {
+                    onEvent(*static_cast<Conn*>(events[i].data.ptr), events[i].events);
+                }
+            }
+        }
+        elapsedUs = nowUs() - startUs;
+    }
+
+    void report() const {
+        HistogramSnapshot latencySnapshot;
+        HistogramSnapshot lateSnapshot;
+        latencySnapshot.add(latency);
+        lateSnapshot.add(lateness);
+        double seconds = static_cast<double>(elapsedUs) / 1e6;
+        double capturedSeconds = static_cast<double>(capturedSpanUs()) / 1e6;
+
+        std::cout << "Replayed: " << sent << " requests on " << conns.size() << " connections ("
+                  << reconnects << " reconnects) in " << std::fixed << std::setprecision(2) << seconds
+                  << "s; captured span " << capturedSeconds << "s" << std::endl;
+        std::cout << "Responses: 2xx " << statusClasses[2] << ", 3xx " << statusClasses[3] << ", 4xx "
+                  << statusClasses[4] << ", 5xx " << statusClasses[5] << "; " << failed << " failed, "
+                  << timedOut << " timed out" << std::endl;
+        std::cout << "Rate: " << std::setprecision(1) << (seconds > 0 ? static_cast<double>(sent) / seconds : 0.0)
+                  << " req/s" << std::endl;
+        std::cout << "Latency: p50 " << latencySnapshot.getQuantile(0.5) << "us, p99 "
+                  << latencySnapshot.getQuantile(0.99) << "us, p99.9 " << latencySnapshot.getQuantile(0.999)
+                  << "us" << std::endl;
+        if (options.speed != 0.0) {
+            std::cout << "Send lateness behind schedule: p50 " << lateSnapshot.getQuantile(0.5) << "us, p99 "
+                      << lateSnapshot.getQuantile(0.99) << "us" << std::endl;
+        }
+
+        if (options.jsonFile.empty()) return;
+        std::ofstream file(options.jsonFile);
+        file << std::fixed << std::setprecision(1)
+             << "{\n  \"requests\": " << sent << ",\n  \"connections\": " << conns.size()
+             << ",\n  \"speed\": " << (options.speed == 0.0 ? std::string("\"max\"") : std::to_string(options.speed))
+             << ",\n  \"elapsed_s\": " << seconds << ",\n  \"captured_span_s\": " << capturedSeconds
+             << ",\n  \"status\": {\"2xx\": " << statusClasses[2] << ", \"3xx\": " << statusClasses[3]
+             << ", \"4xx\": " << statusClasses[4] << ", \"5xx\": " << statusClasses[5] << "}"
+             << ",\n  \"failed\": " << failed << ",\n  \"timed_out\": " << timedOut
+             << ",\n  \"latency_us\": {\"p50\": " << latencySnapshot.getQuantile(0.5) << ", \"p99\": "
+             << latencySnapshot.getQuantile(0.99) << ", \"p999\": " << latencySnapshot.getQuantile(0.999) << "}"
+             << ",\n  \"lateness_us\": {\"p50\": " << lateSnapshot.getQuantile(0.5) << ", \"p99\": "
+             << lateSnapshot.getQuantile(0.99) << "}\n}\n";
+    }
+
+private:
+    struct Conn {
+        std::vector<size_t> requests;   // indices into the capture, in connection order
+        size_t slot = 0;                // position in conns
+        size_t next = 0;                // request being (or about to be) sent
+        int fd = -1;
+        bool connecting = false;
+        bool waiting = false;           // request sent, response pending
+        uint64_t scheduledUs = 0;
+        std::string output;
+        size_t outputOffset = 0;
+        std::string input;
+    };
+
+    struct Due {
+        uint64_t atUs;
+        size_t conn;
+        bool operator>(const Due& other) const { return atUs > other.atUs; }
+    };
+
+    const Options& options;
+    const std::vector<CapturedRequest>& requests;
+    sockaddr_in address;
+    int epollFd;
+    int timerFd;
+    std::vector<std::unique_ptr<Conn>> conns;
+    std::priority_queue<Due, std::vector<Due>, std::greater<Due>> due;
+    uint64_t firstCapturedUs = 0;
+    uint64_t startUs = 0;
+    uint64_t elapsedUs = 0;
+    size_t open = 0;
+    size_t finished = 0;
+    uint64_t sent = 0;
+    uint64_t failed = 0;
+    uint64_t timedOut = 0;
+    uint64_t reconnects = 0;
+    uint64_t statusClasses[6] = {};
+    LatencyHistogram latency;
+    LatencyHistogram lateness;
+
+    uint64_t capturedSpanUs() const {
+        uint64_t last = firstCapturedUs;
+        for (const CapturedRequest& request : requests) last = std::max(last, request.timestampUs);
+        return last - firstCapturedUs;
+    }
+
+    uint64_t scheduledFor(const Conn& conn) const {
+        if (options.speed == 0.0) return startUs;
+        uint64_t offset = requests[conn.requests[conn.next]].timestampUs - firstCapturedUs;
+        return startUs + static_cast<uint64_t>(static_cast<double>(offset) / options.speed);
+    }
+
+    void armTimer(uint64_t atUs) {
+        itimerspec spec{};
+        spec.it_value.tv_sec = static_cast<time_t>(atUs / 1000000);
+        spec.it_value.tv_nsec = static_cast<long>((atUs % 1000000) * 1000);
+        timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &spec, nullptr);
+    }
+
+    bool connectTo(Conn& conn) {
+        conn.fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (conn.fd < 0) return false;
+        setNonBlocking(conn.fd);
+        int on = 1;
+        setsockopt(conn.fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        int result = connect(conn.fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address));
+        if (result != 0 && errno != EINPROGRESS) {
+            ::close(conn.fd);
+            conn.fd = -1;
+            return false;
+        }
+        conn.connecting = result != 0;
+        epoll_event event{};
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP;
+        event.data.ptr = &conn;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, conn.fd, &event);
+        open++;
+        return true;
+    }
+
+    void send(Conn& conn, uint64_t now) {
+        const CapturedRequest& request = requests[conn.requests[conn.next]];
+        conn.scheduledUs = options.speed == 0.0 ? now : scheduledFor(conn);
+        lateness.record(now > conn.scheduledUs ? now - conn.scheduledUs : 0);
+        if (conn.fd < 0) {
+            if (conn.next > 0) reconnects++;
+            if (!connectTo(conn)) {
+                fail(conn);
+                return;
+            }
+        }
+        conn.output = request.head;
+        conn.output.append(static_cast<size_t>(request.bodyLength), 'x');
+        conn.outputOffset = 0;
+        conn.input.clear();
+        conn.waiting = true;
+        sent++;
+        if (!conn.connecting) flush(conn);
+    }
+
+    void flush(Conn& conn) {
+        while (conn.outputOffset < conn.output.size()) {
+            ssize_t written = ::send(conn.fd, conn.output.data() + conn.outputOffset,
+                                     conn.output.size() - conn.outputOffset, MSG_NOSIGNAL);
+            if (written > 0) {
+                conn.outputOffset += static_cast<size_t>(written);
+                continue;
+            }
+            if (written < 0 && errno == EINTR) continue;
+            if (written < 0 && errno == EAGAIN) return;
+            fail(conn);
+            return;
+        }
+    }
+
+    void onEvent(Conn& conn, uint32_t events) {
+        if (conn.fd < 0) return;
+        if (conn.connecting && (events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+            int error = 0;
+            socklen_t length = sizeof(error);
+            getsockopt(conn.fd, SOL_SOCKET, SO_ERROR, &error, &length);
+            if (error != 0) {
+                fail(conn);
+                return;
+            }
+            conn.connecting = false;
+        }
+        if (conn.waiting && !conn.connecting && conn.outputOffset < conn.output.size()) {
+            flush(conn);
+            if (conn.fd < 0) return;
+        }
+        if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) receive(conn);
+    }
+
+    void receive(Conn& conn) {
+        char buffer[16384];
+        bool closed = false;
+        while (true) {
+            ssize_t received = recv(conn.fd, buffer, sizeof(buffer), 0);
+            if (received > 0) {
+                conn.input.append(buffer, static_cast<size_t>(received));
+                continue;
+            }
+            if (received < 0 && (errno == EAGAIN || errno == EINTR)) break;
+            closed = true;
+            break;
+        }
+        if (!conn.waiting) {
+            if (closed) disconnect(conn);   // idle keep-alive connection closed by the server
+            return;
+        }
+
+        int status = 0;
+        bool keepAlive = false;
+        bool headRequest = requests[conn.requests[conn.next]].head.compare(0, 5, "HEAD ") == 0;
+        size_t end = ResponseParser::complete(conn.input, headRequest, closed, status, keepAlive);
+        if (end == 0) {
+            if (closed) fail(conn);
+            return;
+        }
+        statusClasses[std::min(status / 100, 5)]++;
+        latency.record(nowUs() - conn.scheduledUs);
+        conn.waiting = false;
+        if (!keepAlive || closed) disconnect(conn);
+        advance(conn);
+    }
+
+    // Moves to the connection's next request, or retires it
+    void advance(Conn& conn) {
+        conn.next++;
+        if (conn.next < conn.requests.size()) {
+            due.push(Due{options.speed == 0.0 ? nowUs() : scheduledFor(conn), conn.slot});
+            return;
+        }
+        disconnect(conn);
+        finished++;
+    }
+
+    void fail(Conn& conn, bool timeout = false) {
+        if (timeout) {
+            timedOut++;
+        } else {
+            failed++;
+        }
+        conn.waiting = false;
+        disconnect(conn);
+        advance(conn);
+    }
+
+    void disconnect(Conn& conn) {
+        if (conn.fd < 0) return;
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, conn.fd, nullptr);
+        ::close(conn.fd);
+        conn.fd = -1;
+        conn.connecting = false;
+        open--;
+    }
+
+    void expire(uint64_t now) {
+        uint64_t timeoutUs = options.timeoutMs * 1000;
+        for (auto& conn : conns) {
+            if (!conn->waiting || now - conn->scheduledUs < timeoutUs) continue;
+            fail(*conn, true);
+        }
+    }
+};
+
+void usage() {
+    std::cerr << "usage: traffic_replay --target HOST:PORT [--speed 1|N|max] [--max-open N]\n"
+                 "                      [--timeout-ms MS] [--json FILE] CAPTURE_DIR_OR_FILE..." << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        std::string flag = argv[i];
+        if (flag.compare(0, 2, "--") != 0) {
+            options.inputs.push_back(flag);
+            continue;
+        }
+        if (i + 1 >= argc) {
+            usage();
+            return 1;
+        }
+        std::string value = argv[++i];
+        if (flag == "--target") {
+            size_t colon = value.rfind(':');
+            if (colon == std::string::npos) {
+                usage();
+                return 1;
+            }
+            options.host = value.substr(0, colon);
+            options.port = std::atoi(value.substr(colon + 1).c_str());
+        }
+        else if (flag == "--speed") options.speed = value == "max" ? 0.0 : std::atof(value.c_str());
+        else if (flag == "--max-open") options.maxOpen = static_cast<size_t>(std::atoll(value.c_str()));
+        else if (flag == "--timeout-ms") options.timeoutMs = static_cast<uint64_t>(std::atoll(value.c_str()));
+        else if (flag == "--json") options.jsonFile = value;
+        else {
+            usage();
+            return 1;
+        }
+    }
+
+    sockaddr_in target{};
+    target.sin_family = AF_INET;
+    target.sin_port = htons(static_cast<uint16_t>(options.port));
+    if (options.inputs.empty() || inet_pton(AF_INET, options.host.c_str(), &target.sin_addr) != 1 ||
+        options.speed < 0.0 || options.maxOpen == 0) {
+        usage();
+        return 1;
+    }
+
+    std::vector<CapturedRequest> requests;
+    if (!loadCaptures(options.inputs, requests)) return 1;
+    if (requests.empty()) {
+        std::cerr << "No captured requests found" << std::endl;
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    std::cout << "=== Traffic Replay ===" << std::endl;
+    std::cout << "Target: " << options.host << ":" << options.port << ", speed ";
+    if (options.speed == 0.0) {
+        std::cout << "max";
+    } else {
+        std::cout << options.speed << "x";
+    }
+    std::cout << ", " << requests.size() << " captured requests" << std::endl;
+
+    Replay replay(options, requests, target);
+    replay.run();
+    replay.report();
+    return 0;
+}
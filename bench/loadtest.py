@@ -0,0 +1,331 @@
+#!/usr/bin/env python3
+"""End-to-end load test: N stub backends behind the proxy, driven open-loop.
+
+Starts stub_backend processes, writes a config.json pointing the proxy at
+them, starts reverse_proxy, runs load_generator against it and records
+throughput, latency percentiles (coordinated-omission corrected) and the
+proxy's CPU time per request. Results are saved as JSON so two runs can be
+diffed; --baseline prints the change against an earlier result. --perf adds
+hardware counters of the proxy over the measured run (cache misses, NUMA
+node loads), --affinity pins the workers, for before/after comparisons.
+--sockets passes a "sockets" object to the proxy; --sweep-sockets runs
+once per socket option (defer accept, Fast Open, quickack, ...) and prints
+them side by side, with the kernel's TCP counters for each run.
+
+  python3 bench/loadtest.py --build build --rate 5000 --duration 10
+  python3 bench/loadtest.py --build build --rate 5000 --baseline loadtest-results/old.json
+  python3 bench/loadtest.py --build build --rate 20000 --perf --affinity all --baseline loadtest-results/old.json
+  python3 bench/loadtest.py --build build --rate 5000 --requests-per-connection 1 --sweep-sockets
+
+Linux only (reads /proc/<pid>/stat for CPU time, /proc/net/netstat for TCP counters).
+"""
+import argparse
+import datetime
+import json
+import os
+import shutil
+import signal
+import socket
+import subprocess
+import sys
+import tempfile
+import time
+
+# Hardware events counted with --perf; node-load-misses are loads served by another socket's memory
+PERF_EVENTS = ["cycles", "instructions", "cache-references", "cache-misses", "LLC-load-misses",
+               "node-loads", "node-load-misses"]
+
+# TcpExt counters from /proc/net/netstat recorded around each run
+TCP_COUNTERS = ["TCPFastOpenActive", "TCPFastOpenActiveFail", "TCPFastOpenPassive", "TCPFastOpenPassiveFail",
+                "TCPFastOpenCookieReqd", "DelayedACKs", "TCPDeferAcceptDrop", "ListenOverflows", "ListenDrops",
+                "BusyPollRxPackets"]
+
+# --sweep-sockets: one run per option, each against the defaults
+FAST_OPEN = {"listener": {"fast_open_queue": 1024}, "upstream": {"fast_open": True}}
+SOCKET_VARIANTS = [
+    ("defaults", {}),
+    ("no_delay off", {"listener": {"no_delay": False}, "upstream": {"no_delay": False}}),
+    ("quick_ack", {"listener": {"quick_ack": True}, "upstream": {"quick_ack": True}}),
+    ("defer_accept 1s", {"listener": {"defer_accept_s": 1}}),
+    ("fast_open", FAST_OPEN),
+    ("buffers 64KB", {"listener": {"send_buffer_kb": 64, "receive_buffer_kb": 64},
+                      "upstream": {"send_buffer_kb": 64, "receive_buffer_kb": 64}}),
+    ("busy_poll 50us", {"listener": {"busy_poll_us": 50}}),
+]
+
+
+def wait_for_port(port, timeout=10.0):
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        try:
+            with socket.create_connection(("127.0.0.1", port), timeout=0.2):
+                return True
+        except OSError:
+            time.sleep(0.05)
+    return False
+
+
+def cpu_seconds(pid):
+    """User + system CPU time of a process, from /proc/<pid>/stat."""
+    with open("/proc/%d/stat" % pid) as f:
+        fields = f.read().rsplit(")", 1)[1].split()
+    ticks = os.sysconf("SC_CLK_TCK")
+    return (int(fields[11]) + int(fields[12])) / ticks   # utime, stime
+
+
+def tcp_counters():
+    """System-wide TcpExt counters; empty where /proc/net/netstat is missing."""
+    try:
+        with open("/proc/net/netstat") as f:
+            lines = f.read().splitlines()
+    except OSError:
+        return {}
+    counters = {}
+    for names, values in zip(lines[0::2], lines[1::2]):
+        if names.startswith("TcpExt:"):
+            counters.update(zip(names.split()[1:], (int(v) for v in values.split()[1:])))
+    return {name: counters[name] for name in TCP_COUNTERS if name in counters}
+
+
+def start_perf(pid, output):
+    """perf stat attached to the proxy; None (with a note) when perf is missing."""
+    perf = shutil.which("perf")
+    if not perf:
+        print("perf not found; running without hardware counters")
+        return None
+    return subprocess.Popen([perf, "stat", "-x", ",", "-o", output, "-e", ",".join(PERF_EVENTS), "-p", str(pid)],
+                            stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+
+
+def stop_perf(process, output):
+    """Counter totals by event name; events the machine lacks are left out."""
+    process.send_signal(signal.SIGINT)
+    process.wait(timeout=10)
+    counters = {}
+    with open(output) as f:
+        for line in f:
+            fields = line.strip().split(",")
+            if line.startswith("#") or len(fields) < 3:
+                continue
+            try:
+                counters[fields[2]] = int(float(fields[0]))
+            except ValueError:
+                pass   # <not supported> or <not counted>
+    return counters
+
+
+def git_commit(repo):
+    try:
+        return subprocess.check_output(["git", "rev-parse", "--short", "HEAD"], cwd=repo,
+                                       stderr=subprocess.DEVNULL, text=True).strip()
+    except (OSError, subprocess.CalledProcessError):
+        return "unknown"
+
+
+def proxy_config(args, workdir, sockets):
+    backends = [{"host": "127.0.0.1", "port": args.backend_port + i, "weight": 1, "enabled": True}
+                for i in range(args.backends)]
+    return {
+        "server": {"port": args.proxy_port, "max_connections": 100000, "connection_timeout": 30,
+                   "keep_alive": True, "workers": args.workers},
+        "admission": {"enabled": False},
+        "admin": {"enabled": True, "address": "127.0.0.1", "port": args.admin_port},
+        "logging": {"file": os.path.join(workdir, "proxy.log"), "level": "WARNING", "console": False},
+        "load_balancer": {"algorithm": args.algorithm, "backends": backends},
+        "health_check": {"enabled": False},
+        "affinity": {"enabled": bool(args.affinity), "cpus": "" if args.affinity in (None, "all") else args.affinity,
+                     "per_worker_balancer": bool(args.affinity)},
+        "sockets": sockets,
+    }
+
+
+def print_delta(result, baseline):
+    print("=== Change vs %s ===" % baseline.get("commit", "baseline"))
+    rows = [("throughput_rps", result["loadgen"]["throughput_rps"], baseline["loadgen"]["throughput_rps"])]
+    for q in ("p50", "p99", "p999"):
+        rows.append(("latency " + q + " (us)", result["loadgen"]["latency_us"][q],
+                     baseline["loadgen"]["latency_us"][q]))
+    rows.append(("proxy cpu us/request", result["proxy_cpu"]["us_per_request"],
+                 baseline["proxy_cpu"]["us_per_request"]))
+    for event in PERF_EVENTS:
+        if event in result.get("perf", {}) and event in baseline.get("perf", {}):
+            rows.append((event + "/req", result["perf"][event] / result["requests"],
+                         baseline["perf"][event] / baseline["requests"]))
+    for name, new, old in rows:
+        change = (new - old) / old * 100.0 if old else 0.0
+        print("%-22s %12.1f -> %12.1f  (%+.1f%%)" % (name, old, new, change))
+
+
+def run_once(args, binaries, workdir, sockets, fast_open):
+    """Starts the proxy with this "sockets" object, drives it and stops it; returns the result."""
+    stub, loadgen, proxy = binaries
+    config = os.path.join(workdir, "config.json")
+    with open(config, "w") as f:
+        json.dump(proxy_config(args, workdir, sockets), f, indent=1)
+    proxy_process = subprocess.Popen([proxy, config], cwd=workdir, stdout=subprocess.DEVNULL)
+    try:
+        if not wait_for_port(args.proxy_port):
+            sys.exit("proxy did not start; see %s" % os.path.join(workdir, "proxy.log"))
+
+        loadgen_json = os.path.join(workdir, "loadgen.json")
+        perf_output = os.path.join(workdir, "perf.csv")
+        perf_process = start_perf(proxy_process.pid, perf_output) if args.perf else None
+        cpu_before = cpu_seconds(proxy_process.pid)
+        tcp_before = tcp_counters()
+        subprocess.check_call([loadgen, "--target", "127.0.0.1:%d" % args.proxy_port, "--path", args.path,
+                               "--rate", str(args.rate), "--duration", str(args.duration),
+                               "--warmup", str(args.warmup), "--connections", str(args.connections),
+                               "--threads", str(args.threads), "--json", loadgen_json,
+                               "--requests-per-connection", str(args.requests_per_connection),
+                               "--fast-open", "1" if fast_open else "0"])
+        tcp_after = tcp_counters()
+        cpu_used = cpu_seconds(proxy_process.pid) - cpu_before
+        perf_counters = stop_perf(perf_process, perf_output) if perf_process else {}
+    finally:
+        proxy_process.terminate()
+        try:
+            proxy_process.wait(timeout=5)
+        except subprocess.TimeoutExpired:
+            proxy_process.kill()
+    with open(loadgen_json) as f:
+        loadgen_result = json.load(f)
+
+    # CPU covers warmup and drain too, so divide by every request sent
+    total_requests = loadgen_result["rate"] * (args.duration + args.warmup)
+    wall = args.duration + args.warmup
+    result = {
+        "timestamp": datetime.datetime.now().isoformat(timespec="seconds"),
+        "commit": git_commit(os.path.dirname(os.path.dirname(os.path.abspath(__file__)))),
+        "cpus": os.cpu_count(),
+        "requests": total_requests,
+        "params": {key: value for key, value in vars(args).items() if key not in ("output", "baseline", "build")},
+        "sockets": sockets,
+        "loadgen": loadgen_result,
+        "proxy_cpu": {
+            "seconds": round(cpu_used, 3),
+            "us_per_request": round(cpu_used * 1e6 / total_requests, 2) if total_requests else 0.0,
+            "utilisation": round(cpu_used / wall, 3),
+        },
+        # System-wide: the stubs' and load generator's sockets count as well
+        "tcp": {name: tcp_after[name] - tcp_before.get(name, 0) for name in tcp_after},
+    }
+    print("Proxy CPU: %.2fs, %.1fus per request, %.0f%% of one core"
+          % (cpu_used, result["proxy_cpu"]["us_per_request"], result["proxy_cpu"]["utilisation"] * 100))
+    if perf_counters:
+        result["perf"] = perf_counters
+        for event, count in sorted(perf_counters.items()):
+            print("  %-18s %14d  (%.1f per request)" % (event, count, count / total_requests))
+        if perf_counters.get("node-loads"):
+            print("  remote node loads: %.1f%%"
+                  % (100.0 * perf_counters.get("node-load-misses", 0) / perf_counters["node-loads"]))
+    changed = {name: count for name, count in result["tcp"].items() if count}
+    if changed:
+        print("TCP counters: " + ", ".join("%s %d" % item for item in sorted(changed.items())))
+    return result
+
+
+def print_sweep(results):
+    print("=== Socket options ===")
+    print("%-16s %10s %9s %9s %9s %8s %8s %8s" % ("variant", "rps", "p50 us", "p99 us", "p999 us", "cpu us",
+                                                 "TFO", "dACKs"))
+    for name, result in results:
+        latency = result["loadgen"]["latency_us"]
+        tcp = result["tcp"]
+        print("%-16s %10.0f %9.0f %9.0f %9.0f %8.1f %8d %8d"
+              % (name, result["loadgen"]["throughput_rps"], latency["p50"], latency["p99"], latency["p999"],
+                 result["proxy_cpu"]["us_per_request"],
+                 tcp.get("TCPFastOpenPassive", 0) + tcp.get("TCPFastOpenActive", 0), tcp.get("DelayedACKs", 0)))
+
+
+def main():
+    repo = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--build", default=os.path.join(repo, "build"), help="CMake build directory")
+    parser.add_argument("--backends", type=int, default=4)
+    parser.add_argument("--backend-port", type=int, default=19001)
+    parser.add_argument("--backend-threads", type=int, default=1)
+    parser.add_argument("--size", type=int, default=1024, help="response body bytes")
+    parser.add_argument("--latency", default="exp:1", help="stub latency, e.g. fixed:2 or lognormal:1:0.5 (ms)")
+    parser.add_argument("--error-rate", type=float, default=0.0)
+    parser.add_argument("--proxy-port", type=int, default=18888)
+    parser.add_argument("--admin-port", type=int, default=19901)
+    parser.add_argument("--workers", type=int, default=os.cpu_count() or 1, help="proxy workers")
+    parser.add_argument("--algorithm", default="ROUND_ROBIN")
+    parser.add_argument("--rate", type=float, default=2000.0, help="requests per second")
+    parser.add_argument("--duration", type=float, default=10.0)
+    parser.add_argument("--warmup", type=float, default=2.0)
+    parser.add_argument("--connections", type=int, default=64)
+    parser.add_argument("--threads", type=int, default=1, help="load generator threads")
+    parser.add_argument("--path", default="/")
+    parser.add_argument("--requests-per-connection", type=int, default=0,
+                        help="close client connections after this many requests (0 = keep-alive)")
+    parser.add_argument("--sockets", default="{}", help="JSON for the proxy's \"sockets\" object")
+    parser.add_argument("--fast-open", action="store_true", help="load generator connects with TCP Fast Open")
+    parser.add_argument("--sweep-sockets", action="store_true", help="one run per socket option, compared")
+    parser.add_argument("--output", help="result file (default loadtest-results/<timestamp>.json)")
+    parser.add_argument("--baseline", help="earlier result to compare against")
+    parser.add_argument("--perf", action="store_true", help="record hardware counters with perf stat")
+    parser.add_argument("--affinity", help="pin workers to these CPUs (taskset list, or 'all') with "
+                                           "per-worker balancer state")
+    args = parser.parse_args()
+
+    build = os.path.abspath(args.build)
+    bench = os.path.join(build, "bench")
+    stub = os.path.join(bench, "stub_backend")
+    loadgen = os.path.join(bench, "load_generator")
+    proxy = os.path.join(build, "reverse_proxy")
+    for binary in (stub, loadgen, proxy):
+        if not os.access(binary, os.X_OK):
+            sys.exit("missing %s; build with: cmake --build %s" % (binary, args.build))
+    sockets = json.loads(args.sockets)
+
+    workdir = tempfile.mkdtemp(prefix="loadtest-")
+    processes = []
+    try:
+        # The stubs accept Fast Open either way; it only matters when the proxy asks for it
+        for i in range(args.backends):
+            port = args.backend_port + i
+            processes.append(subprocess.Popen(
+                [stub, "--port", str(port), "--threads", str(args.backend_threads), "--size", str(args.size),
+                 "--latency", args.latency, "--error-rate", str(args.error_rate), "--fast-open", "1024"],
+                stdout=subprocess.DEVNULL))
+            if not wait_for_port(port):
+                sys.exit("stub backend on port %d did not start" % port)
+
+        binaries = (stub, loadgen, proxy)
+        if args.sweep_sockets:
+            results = []
+            for name, variant in SOCKET_VARIANTS:
+                print("=== %s ===" % name)
+                results.append((name, run_once(args, binaries, workdir, variant, variant is FAST_OPEN)))
+            print_sweep(results)
+            result = {"sweep": [{"variant": name, **result} for name, result in results]}
+        else:
+            result = run_once(args, binaries, workdir, sockets, args.fast_open)
+
+        output = args.output
+        if not output:
+            os.makedirs(os.path.join(repo, "loadtest-results"), exist_ok=True)
+            output = os.path.join(repo, "loadtest-results",
+                                  datetime.datetime.now().strftime("%Y%m%d-%H%M%S") + ".json")
+        with open(output, "w") as f:
+            json.dump(result, f, indent=2)
+            f.write("\n")
+        print("Results written to %s" % output)
+
+        if args.baseline and not args.sweep_sockets:
+            with open(args.baseline) as f:
+                print_delta(result, json.load(f))
+    finally:
+        for process in reversed(processes):
+            process.terminate()
+        for process in processes:
+            try:
+                process.wait(timeout=5)
+            except subprocess.TimeoutExpired:
+                process.kill()
+        shutil.rmtree(workdir, ignore_errors=True)
+
+
+if __name__ == "__main__":
+    main()
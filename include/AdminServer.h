@@ -0,0 +1,86 @@
+#pragma once
+#include <string>
+#include <map>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <unordered_set>
+#include "EventLoop.h"
+#include "TimerWheel.h"
+#include "Platform.h"
+
+class Logger;
+struct AdminConfig;
+
+/**
+ * AdminServer - HTTP listener for operational endpoints (/metrics, ...)
+ * Runs on its own thread and event loop so scrapes never delay proxied
+ * traffic. Every exchange is one GET answered with Connection: close.
+ */
+class AdminServer {
+public:
+    using Handler = std::function<std::string()>;
+
+    explicit AdminServer(Logger& logger);
+    ~AdminServer();
+
+    AdminServer(const AdminServer&) = delete;
+    AdminServer& operator=(const AdminServer&) = delete;
+
+    // Register before start(); handlers run on the admin thread
+    void addEndpoint(const std::string& path, const std::string& contentType, Handler handler);
+
+    bool start(const AdminConfig& config, const std::atomic<bool>& running);
+    // Closes the listener ahead of the server (hot restart frees the port)
+    void stop() { loop.stop(); }
+    void join();
+
+private:
+    static constexpr size_t kMaxRequest = 8 * 1024;
+    static constexpr uint64_t kSessionTimeoutMs = 5000;
+
+    struct Endpoint {
+        std::string contentType;
+        Handler handler;
+    };
+
+    class Acceptor : public IoHandler {
+    public:
+        explicit Acceptor(AdminServer& s) : server(s) {}
+        void onEvent(uint32_t events) override;
+    private:
+        AdminServer& server;
+    };
+
+    class Session : public IoHandler {
+    public:
+        Session(AdminServer& server, SOCKET socket);
+        void onEvent(uint32_t events) override;
+        void close();
+
+    private:
+        AdminServer& server;
+        SOCKET socket;
+        std::string input;
+        std::string output;
+        size_t outputOffset;
+        bool responding;
+        TimerWheel::Timer timer;
+
+        void respond();
+        void flush();
+    };
+
+    Logger& logger;
+    std::map<std::string, Endpoint> endpoints;
+    SOCKET listenSocket;
+    EventLoop loop;
+    Acceptor acceptor;
+    std::unordered_set<Session*> sessions;
+    std::thread thread;
+    const std::atomic<bool>* runningFlag;
+
+    void run();
+    void acceptSessions();
+    void release(Session* session);
+};
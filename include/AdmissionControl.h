@@ -0,0 +1,172 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include "Config.h"
+
+class LoadBalancer;
+struct BackendServer;
+struct HttpHead;
+
+/**
+ * Adaptive concurrency limit (gradient with AIMD back-off)
+ * tryAcquire() is a lock-free check against the current limit. Each
+ * completed request feeds its latency back: the limit grows while latency
+ * stays near the long-term baseline and shrinks as queueing inflates it.
+ * Failures and timeouts cut the limit multiplicatively.
+ *
+ * Releases only add their sample to the current window with atomic adds;
+ * the release that fills a window folds it into the limit on its own, so
+ * no worker waits on another to finish a request.
+ */
+class ConcurrencyLimiter {
+public:
+    struct Settings {
+        bool adaptive = true;
+        int initialLimit = 20;
+        int minLimit = 4;
+        int maxLimit = 1000;
+    };
+
+    explicit ConcurrencyLimiter(const Settings& settings);
+
+    bool tryAcquire();
+    void release(uint64_t latencyUs, bool dropped);
+    void releaseWithoutSample();
+
+    int getLimit() const { return limit.load(std::memory_order_relaxed); }
+    int getInFlight() const { return inFlight.load(std::memory_order_relaxed); }
+
+private:
+    Settings settings;
+    std::atomic<int> limit;
+    std::atomic<int> inFlight;
+
+    // Current sampling window, written by every release
+    std::atomic<uint32_t> windowSamples;
+    std::atomic<uint32_t> windowDrops;
+    std::atomic<uint64_t> windowLatencyUs;     // successful samples only
+    std::atomic<int> windowPeakInFlight;
+    std::atomic<bool> updating;                // a release is folding the window
+
+    // Only touched by the release holding updating
+    double estimatedLimit;
+    double longRttUs;
+
+    void addSample(uint64_t latencyUs, bool dropped, int inFlightAtRelease);
+    void updateLimit();
+};
+
+/**
+ * CoDel-style overload detector for a wait queue
+ * Once the head-of-queue wait has stayed above target for a full interval
+ * the queue is "shedding": new arrivals are rejected immediately and stale
+ * entries are dropped, until the wait falls back under target.
+ */
+class CoDelState {
+public:
+    CoDelState(uint64_t targetMs, uint64_t intervalMs);
+
+    // Feed the current head-of-queue wait (0 when the queue drained)
+    void update(uint64_t sojournMs, uint64_t nowMs);
+    bool isShedding() const { return shedding; }
+    uint64_t getTargetMs() const { return targetMs; }
+
+private:
+    uint64_t targetMs;
+    uint64_t intervalMs;
+    uint64_t firstAboveMs;
+    bool shedding;
+};
+
+struct AdmissionStats {
+    std::atomic<uint64_t> admitted{0};
+    std::atomic<uint64_t> queued{0};
+    std::atomic<uint64_t> rejectedConnections{0};
+    std::atomic<uint64_t> rejectedQueueFull{0};
+    std::atomic<uint64_t> shed{0};
+    std::atomic<uint64_t> queueTimeouts{0};
+};
+
+// Per priority class; the queue outcomes of AdmissionStats, split by class
+struct PriorityClassStats {
+    std::atomic<uint64_t> admitted{0};
+    std::atomic<uint64_t> queued{0};
+    std::atomic<uint64_t> rejectedQueueFull{0};
+    std::atomic<uint64_t> shed{0};
+    std::atomic<uint64_t> queueTimeouts{0};
+};
+
+/**
+ * PriorityClassifier - sorts requests into the configured priority classes
+ * Classes are tried in order and the first one matching wins: a class
+ * matches when the path starts with one of its prefixes, the request
+ * carries its header (with its value, when one is given) or the client
+ * address is in one of its networks. Requests nothing matches go to the
+ * default class. Read-only after configure(), shared by all workers.
+ */
+class PriorityClassifier {
+public:
+    struct Network {
+        int family;                // AF_INET or AF_INET6
+        unsigned char address[16];
+        int prefixBits;
+    };
+
+    void configure(const AdmissionConfig& config);
+
+    size_t classify(const HttpHead& request, const std::string& clientIP) const;
+
+    size_t getClassCount() const { return classes.size(); }
+    const PriorityClassConfig& getClass(size_t index) const { return classes[index].config; }
+
+    // "10.0.0.0/8,fd00::/8"; a bare address is a full-length prefix
+    static bool parseNetworks(const std::string& list, std::vector<Network>& networks);
+
+private:
+    struct Class {
+        PriorityClassConfig config;
+        std::vector<std::string> paths;
+        std::string headerName;
+        std::string headerValue;   // empty: any value
+        std::vector<Network> networks;
+    };
+
+    std::vector<Class> classes;    // never empty once configured
+    size_t defaultClass = 0;
+    bool matchesAddresses = false;  // some class has networks
+
+    static bool contains(const Network& network, int family, const unsigned char* address);
+};
+
+/**
+ * AdmissionController - global and per-backend in-flight limits
+ * Shared by all workers; each worker keeps its own wait queues, one per
+ * priority class.
+ */
+class AdmissionController {
+public:
+    AdmissionController();
+
+    void configure(const Config& config, LoadBalancer& loadBalancer);
+
+    bool isEnabled() const { return enabled; }
+    ConcurrencyLimiter& getGlobalLimiter() { return *globalLimiter; }
+    ConcurrencyLimiter* getBackendLimiter(const BackendServer* backend);
+
+    AdmissionStats& getStats() { return stats; }
+    const PriorityClassifier& getClassifier() const { return classifier; }
+    PriorityClassStats& getClassStats(size_t priorityClass) { return classStats[priorityClass]; }
+    void printStatus() const;
+
+private:
+    bool enabled;
+    LoadBalancer* loadBalancer;
+    std::unique_ptr<ConcurrencyLimiter> globalLimiter;
+    std::vector<std::unique_ptr<ConcurrencyLimiter>> backendLimiters;  // by backend index
+    AdmissionStats stats;
+    PriorityClassifier classifier;
+    std::unique_ptr<PriorityClassStats[]> classStats;
+};
@@ -0,0 +1,35 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "Platform.h"
+
+/**
+ * CpuAffinity - worker placement on multi-socket hosts: pins threads to
+ * CPUs, points their page allocations at the CPU's NUMA node and steers
+ * new connections to the listener of the worker running on the CPU that
+ * received the packet (a classic BPF program on the SO_REUSEPORT group).
+ *
+ * Linux only; elsewhere allowedCpus() is empty and the rest report failure.
+ */
+class CpuAffinity {
+public:
+    static constexpr int kMaxCpus = 1024;
+
+    // taskset-style list ("0-7,16-23,32"); false when malformed or empty
+    static bool parseCpuList(const std::string& list, std::vector<int>& cpus);
+    // CPUs this process may run on, ascending
+    static std::vector<int> allowedCpus();
+    // NUMA node of a CPU; -1 when unknown
+    static int nodeOfCpu(int cpu);
+
+    static bool pinCurrentThread(int cpu);
+    // Pages the calling thread touches first from now on come from node
+    // (preferred, so a full node still falls back to the others); -1
+    // restores the default of the node the thread runs on
+    static bool setMemoryNode(int node);
+
+    // listeners: one SO_REUSEPORT group, in the order they joined it.
+    // Connections whose packets arrive on cpus[i] are accepted on
+    // listeners[i]; other CPUs fall back to the kernel's hash
+    static bool steerByCpu(const std::vector<SOCKET>& listeners, const std::vector<int>& cpus);
+};
@@ -16,6 +16,213 @@ struct BackendConfig {
         : host(h), port(p), weight(w), enabled(e) {}
 };
 
+// Requests go to the first class whose paths, header or client networks
+// match; each class waits in its own queue when the backends are saturated
+struct PriorityClassConfig {
+    std::string name;
+    int weight;            // queued requests dispatched per round-robin turn
+    int deadlineMs;        // longest wait in the queue
+    int queueSize;         // per worker
+    int queueTargetMs;     // CoDel target for this class's queue
+    std::string paths;     // comma-separated path prefixes
+    std::string header;    // "Name" (present) or "Name: value"
+    std::string cidrs;     // comma-separated client networks, IPv4 or IPv6
+    
+    PriorityClassConfig() : weight(1), deadlineMs(0), queueSize(0), queueTargetMs(0) {}
+    bool hasRules() const { return !paths.empty() || !header.empty() || !cidrs.empty(); }
+};
+
+struct AdmissionConfig {
+    bool enabled;
+    bool adaptive;
+    int maxInFlight;          // global in-flight ceiling
+    int backendMaxInFlight;   // per-backend in-flight ceiling
+    int initialLimit;
+    int minLimit;
+    int queueSize;
+    int queueTargetMs;
+    int queueIntervalMs;
+    int queueTimeoutMs;
+    std::vector<PriorityClassConfig> classes;   // empty: one queue for everything
+    std::string defaultClass;                   // for unmatched requests; empty: the last class
+    
+    AdmissionConfig() 
+        : enabled(true), adaptive(true), maxInFlight(1000), backendMaxInFlight(200),
+          initialLimit(20), minLimit(4), queueSize(1000), queueTargetMs(50),
+          queueIntervalMs(100), queueTimeoutMs(1000) {}
+};
+
+struct RetryConfig {
+    bool enabled;
+    int maxRetries;              // extra attempts per request after a failure
+    double budgetPercent;        // retries + hedges as a share of requests
+    int minRetriesPerSecond;
+    bool hedgeEnabled;
+    double hedgePercentile;      // hedge once a request outlives this latency percentile
+    int hedgeMinDelayMs;
+    
+    RetryConfig()
+        : enabled(true), maxRetries(1), budgetPercent(10.0), minRetriesPerSecond(5),
+          hedgeEnabled(false), hedgePercentile(95.0), hedgeMinDelayMs(5) {}
+};
+
+// Admin listener serving /metrics; keep it off public interfaces
+struct AdminConfig {
+    bool enabled;
+    std::string address;
+    int port;
+    
+    AdminConfig() : enabled(true), address("127.0.0.1"), port(9901) {}
+};
+
+// Slow-request tracing: per-phase timestamps on every request, the slowest
+// ones kept for inspection
+struct TracingConfig {
+    bool enabled;
+    int slowRequestMs;     // requests at least this slow are kept
+    int slowRequestLogSize;
+    
+    TracingConfig() : enabled(true), slowRequestMs(500), slowRequestLogSize(128) {}
+};
+
+// Sampled request heads and timing, written to disk for replay
+struct CaptureConfig {
+    bool enabled;
+    std::string directory;
+    double sampleRate;      // fraction of client connections captured
+    int segmentSizeMb;
+    int maxSegments;        // per worker; the oldest are deleted
+    
+    CaptureConfig() : enabled(false), directory("captures"), sampleRate(1.0), segmentSizeMb(64), maxSegments(16) {}
+};
+
+// TLS listener: terminated here, forwarded to backends in plain HTTP
+struct TlsConfig {
+    bool enabled;
+    int port;
+    std::string certificate;     // PEM chain
+    std::string privateKey;      // PEM
+    int sessionCacheSize;        // resumable sessions kept across all workers
+    int sessionCacheShards;
+    int sessionTimeoutS;
+    bool sessionTickets;         // stateless resumption; off = server-side cache only
+    bool ktls;                   // hand record encryption to the kernel after the handshake
+    
+    TlsConfig()
+        : enabled(false), port(8443), certificate(""), privateKey(""), sessionCacheSize(20480),
+          sessionCacheShards(16), sessionTimeoutS(300), sessionTickets(true), ktls(true) {}
+};
+
+// HTTP/2 frontend: h2c with prior knowledge, and ALPN "h2" on the TLS listener
+struct Http2Config {
+    bool enabled;
+    int maxConcurrentStreams;    // per client connection
+    int initialWindowKb;         // per-stream receive window for request bodies
+    int maxHeaderListKb;         // decoded request header block limit
+    
+    Http2Config() : enabled(true), maxConcurrentStreams(128), initialWindowKb(64), maxHeaderListKb(16) {}
+};
+
+// Hot restart: a new process takes the listening sockets over a Unix socket
+// while the old one drains its connections
+struct HotRestartConfig {
+    bool enabled;
+    std::string socketPath;
+    int drainTimeoutMs;          // the old process exits by then, busy or not
+    bool transferStats;          // counters carried over to the new process
+    
+    HotRestartConfig()
+        : enabled(false), socketPath("/tmp/reverse_proxy.sock"), drainTimeoutMs(30000), transferStats(true) {}
+};
+
+// Worker placement on multi-socket hosts
+struct AffinityConfig {
+    bool enabled;
+    std::string cpus;            // taskset-style list ("0-7,16-23"); empty = every CPU we may run on
+    bool numaLocal;              // worker state allocated on its CPU's NUMA node
+    bool steerConnections;       // accept on the worker pinned to the CPU that took the packet
+    bool perWorkerBalancer;      // selection state kept per worker, merged only for reporting
+    
+    AffinityConfig() : enabled(false), numaLocal(true), steerConnections(true), perWorkerBalancer(false) {}
+};
+
+// Backend hostnames, re-resolved in the background (getaddrinfo reports no TTL)
+struct ResolverConfig {
+    int refreshS;
+    int retryS;                  // after a failed lookup
+    std::string family;          // "any", "ipv4" or "ipv6"
+    
+    ResolverConfig() : refreshS(30), retryS(5), family("any") {}
+};
+
+// Open descriptors and stat results of files served by static routes
+struct StaticFilesConfig {
+    int maxOpenFiles;            // cached files across all shards
+    int cacheShards;
+    int mmapMaxKb;               // files up to this size are also mapped; 0 = never
+    
+    StaticFilesConfig() : maxOpenFiles(1024), cacheShards(16), mmapMaxKb(0) {}
+};
+
+// Options of one listening socket; accepted connections inherit all but quickAck
+struct ListenerSocketConfig {
+    int deferAcceptS;            // TCP_DEFER_ACCEPT: accept once the client has sent data; 0 = off
+    int fastOpenQueue;           // TCP_FASTOPEN: SYNs with data pending accept; 0 = off
+    bool noDelay;                // TCP_NODELAY
+    bool quickAck;               // TCP_QUICKACK re-armed after every read
+    int sendBufferKb;            // SO_SNDBUF; 0 = kernel autotuning
+    int receiveBufferKb;         // SO_RCVBUF; 0 = kernel autotuning
+    int busyPollUs;              // SO_BUSY_POLL; 0 = off
+    
+    ListenerSocketConfig()
+        : deferAcceptS(0), fastOpenQueue(0), noDelay(true), quickAck(false), sendBufferKb(0), receiveBufferKb(0),
+          busyPollUs(0) {}
+};
+
+// Options of backend connections (HTTP mode)
+struct UpstreamSocketConfig {
+    bool fastOpen;               // TCP_FASTOPEN_CONNECT: the request rides in the SYN once a cookie is cached
+    bool noDelay;
+    bool quickAck;
+    int sendBufferKb;
+    int receiveBufferKb;
+    
+    UpstreamSocketConfig() : fastOpen(false), noDelay(true), quickAck(false), sendBufferKb(0), receiveBufferKb(0) {}
+};
+
+struct SocketConfig {
+    ListenerSocketConfig listener;
+    ListenerSocketConfig tlsListener;   // defaults to listener's values
+    UpstreamSocketConfig upstream;
+};
+
+struct RateLimitConfig {
+    bool enabled;
+    double requestsPerSecond;
+    int burst;
+    std::string keyHeader;    // bucket key; empty = client IP
+    
+    RateLimitConfig() : enabled(false), requestsPerSecond(0.0), burst(0), keyHeader("") {}
+};
+
+// Files under root answer a route's requests instead of a backend
+struct StaticRouteConfig {
+    std::string root;         // the path after the route prefix is looked up here; empty = proxied
+    std::string index;        // served for paths ending in '/'
+    
+    StaticRouteConfig() : root(""), index("index.html") {}
+};
+
+// Requests are matched to the route with the longest matching path prefix
+struct RouteConfig {
+    std::string prefix;
+    RateLimitConfig rateLimit;
+    StaticRouteConfig staticFiles;
+    
+    RouteConfig() : prefix("/") {}
+    bool isStatic() const { return !staticFiles.root.empty(); }
+};
+
 enum class LoadBalancingAlgorithm {
     ROUND_ROBIN,
     WEIGHTED_ROUND_ROBIN,
@@ -41,11 +248,53 @@ private:
     int maxConnections;
     int connectionTimeout;
     bool keepAlive;
+    int workerCount;
+    std::string mode;         // "http" or "tcp" (passthrough, no HTTP parsing)
+    std::string pipeline;     // "callback" or "coroutine"
+    int connectionBufferKb;   // per-direction body buffering before backpressure
+    
+    // Per-phase timeouts in milliseconds
+    int clientHeaderTimeout;
+    int idleKeepAliveTimeout;
+    int upstreamConnectTimeout;
+    int upstreamFirstByteTimeout;
+    int requestTimeout;
+    int tunnelIdleTimeout;
+    
+    AdmissionConfig admission;
+    RetryConfig retry;
+    AdminConfig admin;
+    TracingConfig tracing;
+    CaptureConfig capture;
+    TlsConfig tls;
+    Http2Config http2;
+    HotRestartConfig hotRestart;
+    AffinityConfig affinity;
+    ResolverConfig resolver;
+    StaticFilesConfig staticFiles;
+    SocketConfig sockets;
+    
+    std::vector<RouteConfig> routes;
+    int rateLimitMaxKeys;
+    int rateLimitShards;
     
     bool parseJson(const std::string& jsonContent);
     LoadBalancingAlgorithm parseAlgorithm(const std::string& algo);
     LogLevel parseLogLevel(const std::string& level);
     
+    // Helpers for reading flat values out of one JSON object
+    static std::string extractObject(const std::string& json, const std::string& key);
+    static bool readInt(const std::string& json, const std::string& key, int& value);
+    static bool readBool(const std::string& json, const std::string& key, bool& value);
+    static bool readString(const std::string& json, const std::string& key, std::string& value);
+    static bool readDouble(const std::string& json, const std::string& key, double& value);
+    static std::vector<std::string> splitObjects(const std::string& array);
+    static RouteConfig parseRoute(const std::string& json);
+    static void parseListenerSockets(const std::string& json, ListenerSocketConfig& listener);
+    static bool validListenerSockets(const ListenerSocketConfig& listener);
+    static PriorityClassConfig parsePriorityClass(const std::string& json, const AdmissionConfig& admission);
+    static bool validPriorityClasses(const AdmissionConfig& admission);
+    
 public:
     Config();
     
@@ -68,6 +317,35 @@ public:
     int getMaxConnections() const { return maxConnections; }
     int getConnectionTimeout() const { return connectionTimeout; }
     bool isKeepAliveEnabled() const { return keepAlive; }
+    int getWorkerCount() const { return workerCount; }
+    const std::string& getMode() const { return mode; }
+    bool isTcpMode() const { return mode == "tcp"; }
+    const std::string& getPipeline() const { return pipeline; }
+    size_t getConnectionBufferSize() const { return static_cast<size_t>(connectionBufferKb) * 1024; }
+    
+    int getClientHeaderTimeout() const { return clientHeaderTimeout; }
+    int getIdleKeepAliveTimeout() const { return idleKeepAliveTimeout; }
+    int getUpstreamConnectTimeout() const { return upstreamConnectTimeout; }
+    int getUpstreamFirstByteTimeout() const { return upstreamFirstByteTimeout; }
+    int getRequestTimeout() const { return requestTimeout; }
+    int getTunnelIdleTimeout() const { return tunnelIdleTimeout; }
+    
+    const AdmissionConfig& getAdmission() const { return admission; }
+    const RetryConfig& getRetry() const { return retry; }
+    const AdminConfig& getAdmin() const { return admin; }
+    const TracingConfig& getTracing() const { return tracing; }
+    const CaptureConfig& getCapture() const { return capture; }
+    const TlsConfig& getTls() const { return tls; }
+    const Http2Config& getHttp2() const { return http2; }
+    const HotRestartConfig& getHotRestart() const { return hotRestart; }
+    const AffinityConfig& getAffinity() const { return affinity; }
+    const ResolverConfig& getResolver() const { return resolver; }
+    const StaticFilesConfig& getStaticFiles() const { return staticFiles; }
+    const SocketConfig& getSockets() const { return sockets; }
+    
+    const std::vector<RouteConfig>& getRoutes() const { return routes; }
+    int getRateLimitMaxKeys() const { return rateLimitMaxKeys; }
+    int getRateLimitShards() const { return rateLimitShards; }
     
     std::string algorithmToString() const;
     std::string logLevelToString() const;
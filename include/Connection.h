@@ -0,0 +1,242 @@
+#pragma once
+#include <string>
+#include <list>
+#include <memory>
+#include <cstdint>
+#include "EventLoop.h"
+#include "TimerWheel.h"
+#include "Http.h"
+#include "Exchange.h"
+#include "Platform.h"
+
+class Worker;
+struct BackendServer;
+struct StaticFile;
+class ConcurrencyLimiter;
+class TlsContext;
+class TlsStream;
+
+/**
+ * Connection - one client socket plus, while a request is in flight, its
+ * upstream attempts. A non-blocking state machine driven by the owning
+ * worker's EventLoop; timeouts come from the loop's TimerWheel.
+ *
+ * A request normally has one upstream attempt. A failed attempt may be
+ * retried on another backend, and a slow one may be hedged with a second
+ * attempt; whichever answers first is relayed and the other is dropped.
+ *
+ * Bodies are streamed in both directions through buffers bounded by the
+ * configured connection buffer: reading from the fast side pauses above
+ * the high watermark and resumes below the low one. A request body that
+ * fits is held whole so it can be replayed; a larger one is sent while it
+ * is read, and can no longer be retried once part of it has gone out.
+ *
+ * When a backend accepts an upgrade request with 101 Switching Protocols
+ * (WebSocket and the like), both sockets are handed to a TcpTunnel and
+ * the connection retires without closing them.
+ *
+ * A client from the TLS listener completes its handshake before the first
+ * request is read; all client bytes then go through its TlsStream.
+ *
+ * Requests on static routes are answered from StaticFiles without an
+ * upstream: the file body follows the head with sendfile(), or through
+ * clientOutput a chunk at a time when user-space TLS has to encrypt it.
+ *
+ * The request itself (parsing, routing, framing, retries, keep-alive and
+ * accounting) is handled by the Exchange it is built on, which it shares
+ * with the coroutine RequestPipeline.
+ */
+class Connection : private Exchange {
+public:
+    Connection(Worker& worker, SOCKET clientSocket, TlsContext* tlsContext = nullptr);
+    ~Connection();
+
+    Connection(const Connection&) = delete;
+    Connection& operator=(const Connection&) = delete;
+
+    bool start();
+    // Hot restart: an idle keep-alive connection closes after a short grace
+    void drain();
+
+    // Admission control (driven by the worker's wait queue)
+    enum class Admission {
+        Admitted,
+        Saturated,
+        NoBackend
+    };
+    Admission tryAdmit();
+    void admitQueued(Admission result);
+    void rejectQueued(const std::string& reason);
+    uint64_t getQueuedAt() const { return queuedAtMs; }
+
+private:
+    enum class State {
+        ReadingRequest,
+        Forwarding,          // upstream attempts in flight, no response yet
+        RelayingResponse,
+        Closing
+    };
+
+    // Which client-side timeout the phase timer is currently armed for
+    enum class Phase {
+        None,
+        ClientHeader,
+        IdleKeepAlive
+    };
+
+    struct Upstream;
+
+    class Endpoint : public IoHandler {
+    public:
+        Endpoint(Connection& c, Upstream* u) : connection(c), upstream(u) {}
+        void onEvent(uint32_t events) override;
+    private:
+        Connection& connection;
+        Upstream* upstream;   // nullptr for the client socket
+    };
+
+    // One attempt at getting the response from a backend
+    struct Upstream {
+        enum class Stage {
+            Idle,
+            Connecting,
+            Sending,
+            Awaiting,
+            Relaying
+        };
+
+        explicit Upstream(Connection& c) : endpoint(c, this) {}
+
+        SOCKET socket = INVALID_SOCKET;
+        Endpoint endpoint;
+        uint32_t events = 0;
+        Stage stage = Stage::Idle;
+        bool readPaused = false;   // client backlog above the high watermark
+        bool writeClosed = false;  // backend answered and stopped taking the body
+        bool deferredConnect = false;  // Fast Open: the SYN leaves with the first send()
+        BackendServer* backend = nullptr;
+        ConcurrencyLimiter* limiter = nullptr;
+        std::string url;
+        std::string output;
+        size_t outputOffset = 0;
+        uint64_t startUs = 0;
+        uint64_t startTsc = 0;     // trace marks for this attempt
+        uint64_t connectedTsc = 0;
+        uint64_t sentTsc = 0;
+        bool hedge = false;
+        TimerWheel::Timer timer;   // connect timeout, then first-byte timeout
+
+        bool isActive() const { return stage != Stage::Idle; }
+        size_t pendingOutput() const { return output.size() - outputOffset; }
+    };
+
+    static constexpr size_t kReadChunk = 16 * 1024;
+
+    size_t highWatermark;          // connection buffer size, per direction
+    size_t lowWatermark;
+
+    SOCKET clientSocket;
+    Endpoint clientEndpoint;
+    uint32_t clientEvents;
+    std::unique_ptr<TlsStream> tls;   // null for plain-text clients
+    bool handshaking;
+    bool tlsReadScheduled;         // decrypted input is waiting in the TLS layer
+    bool clientQuickAck;           // the listener's quick_ack policy
+
+    State state;
+    Phase phase;
+    TimerWheel::Timer phaseTimer;
+    TimerWheel::Timer deadlineTimer;
+    bool closed;
+
+    // Request side (the rest is in Exchange)
+    bool requestHeadParsed;
+    bool upgraded;                 // sockets and connection slot handed to a TcpTunnel or Http2Session
+
+    // Upstream side
+    Upstream primary;
+    Upstream secondary;
+    Upstream* active;              // attempt whose response is being relayed
+    std::string upstreamInput;
+    bool responseHeadParsed;
+    BodyDecoder responseDecoder;
+    bool responseChunked;          // relayed to the client with chunked framing
+    bool responseComplete;
+    uint64_t responseLatencyUs;    // winning attempt's time to first byte
+    int responseStatus;
+
+    TimerWheel::Timer hedgeTimer;
+
+    // Admission state: global slot held while the request is in flight
+    bool globalAdmitted;
+    bool queued;
+    size_t priorityClass;
+    std::list<Connection*>::iterator queuePosition;
+    uint64_t queuedAtMs;
+    uint64_t queuedAtUs;
+
+    // Client output (response bytes not yet accepted by the kernel)
+    std::string clientOutput;
+    size_t clientOutputOffset;
+    bool responseStarted;
+    std::shared_ptr<const StaticFile> staticFile;   // static route body, sent after clientOutput
+    uint64_t staticOffset;
+    uint64_t staticRemaining;
+
+    void onClientEvent(uint32_t events);
+    void continueHandshake();
+    // recv()/send() on the client, through TLS when there is a session
+    long clientRecv(char* buffer, size_t length);
+    long clientSend(const char* data, size_t length);
+    void onUpstreamEvent(Upstream& upstream, uint32_t events);
+
+    void readRequest();
+    void processRequestBuffer();
+    bool decodeRequestBody();
+    void pumpRequestBody(Upstream& upstream);
+    bool requestFullySent() const;
+    bool checkRateLimit();
+    void dispatchRequest();
+    void forwardToBackend();
+    void serveStatic();
+    bool readStaticChunk();
+    void startUpstream(Upstream& upstream);
+    void buildUpstreamRequest(Upstream& upstream);
+    void onUpstreamConnected(Upstream& upstream);
+    void writeUpstream(Upstream& upstream);
+    void readUpstream(Upstream& upstream);
+    void promote(Upstream& upstream);
+    bool processResponseHead();
+    void upgradeToTunnel(Upstream& upstream, const HttpHead& response);
+    void upgradeToHttp2();
+    bool appendResponseBody(const char* data, size_t length);
+    void flushClient();
+    void finishExchange();
+
+    void upstreamFailed(Upstream& upstream, int statusCode, const std::string& body, bool retryable);
+    void scheduleHedge();
+    void launchHedge();
+    void onUpstreamTimeout(Upstream& upstream);
+
+    void armPhase(Phase next);
+    void onPhaseTimeout();
+    void onDeadline();
+
+    void adoptAttemptTrace(const Upstream& upstream);
+    void sendErrorResponse(int statusCode, const std::string& body, const std::string& extraHeaders = "");
+    void releaseUpstream(Upstream& upstream, bool sample, bool dropped);
+    void releaseUpstreams(bool sample, bool dropped);
+    void releaseAdmission(bool sample, bool dropped);
+    bool wantsClientInput() const;
+    size_t clientInputLimit() const;
+    void updateClientEvents();
+    void updateUpstreamEvents(Upstream& upstream);
+    void setClientEvents(uint32_t events);
+    void setUpstreamEvents(Upstream& upstream, uint32_t events);
+    void close();
+
+    Upstream& otherThan(Upstream& upstream) { return &upstream == &primary ? secondary : primary; }
+    Upstream* sendingUpstream() { return primary.isActive() ? &primary : secondary.isActive() ? &secondary : nullptr; }
+    size_t pendingClientOutput() const { return clientOutput.size() - clientOutputOffset; }
+    bool hasClientBacklog() const { return pendingClientOutput() > 0 || staticRemaining > 0; }
+};
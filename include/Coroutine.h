@@ -0,0 +1,433 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cerrno>
+#include <vector>
+#include "EventLoop.h"
+#include "TimerWheel.h"
+#include "Platform.h"
+
+/**
+ * FramePool - per-worker allocator for coroutine frames
+ * Frames are carved from 64 KB slabs in 128-byte size classes and recycled
+ * through free lists, so starting a request coroutine does not call malloc
+ * once the pool is warm. Each block carries a 16-byte header naming its
+ * pool; frames larger than the biggest class, or created on a thread with
+ * no pool installed, fall back to the heap. Not thread-safe: a frame must
+ * be freed on its worker's thread (or after that thread has been joined).
+ */
+class FramePool {
+public:
+    static constexpr size_t kGranularity = 128;
+    static constexpr size_t kClasses = 16;          // pooled blocks up to 2 KB
+    static constexpr size_t kSlabSize = 64 * 1024;
+    static constexpr size_t kHeaderSize = 16;       // keeps frames 16-byte aligned
+
+    struct Stats {
+        uint64_t allocations = 0;
+        uint64_t reused = 0;         // served from a free list
+        uint64_t heapFallbacks = 0;  // oversized, or no pool on the thread
+        size_t live = 0;
+        size_t peakLive = 0;
+        size_t slabBytes = 0;
+    };
+
+    FramePool();
+    ~FramePool();
+
+    FramePool(const FramePool&) = delete;
+    FramePool& operator=(const FramePool&) = delete;
+
+    void* allocate(size_t size);
+    void deallocate(void* block, size_t size);
+
+    // Pool used for frames created on the calling thread (nullptr = heap)
+    static void setCurrent(FramePool* pool);
+    static FramePool* current();
+
+    // Used by promise types' operator new/delete
+    static void* allocateFrame(size_t size);
+    static void releaseFrame(void* frame, size_t size);
+
+    const Stats& getStats() const { return stats; }
+
+private:
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    FreeBlock* freeLists[kClasses];
+    std::vector<char*> slabs;
+    char* slabCursor;
+    size_t slabRemaining;
+    Stats stats;
+
+    static size_t classFor(size_t size) { return (size - 1) / kGranularity; }
+};
+
+// Coroutines need C++20; C++17 builds keep the callback request path only
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#define PROXY_HAS_COROUTINES 1
+#endif
+#endif
+
+#ifdef PROXY_HAS_COROUTINES
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+template <typename T = void>
+class Task;
+
+namespace detail {
+
+struct PromiseBase {
+    std::coroutine_handle<> continuation;
+    std::exception_ptr exception;
+
+    struct FinalAwaiter {
+        bool await_ready() noexcept { return false; }
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> self) noexcept {
+            // Symmetric transfer back to the awaiting coroutine: no stack growth
+            std::coroutine_handle<> next = self.promise().continuation;
+            return next ? next : std::noop_coroutine();
+        }
+        void await_resume() noexcept {}
+    };
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    FinalAwaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception() { exception = std::current_exception(); }
+
+    static void* operator new(size_t size) { return FramePool::allocateFrame(size); }
+    static void operator delete(void* frame, size_t size) { FramePool::releaseFrame(frame, size); }
+};
+
+template <typename T>
+struct Promise : PromiseBase {
+    std::optional<T> value;
+
+    Task<T> get_return_object();
+    template <typename U>
+    void return_value(U&& result) { value.emplace(std::forward<U>(result)); }
+
+    T take() {
+        if (exception) std::rethrow_exception(exception);
+        return std::move(*value);
+    }
+};
+
+template <>
+struct Promise<void> : PromiseBase {
+    Task<void> get_return_object();
+    void return_void() {}
+
+    void take() {
+        if (exception) std::rethrow_exception(exception);
+    }
+};
+
+} // namespace detail
+
+/**
+ * Task - a lazily started coroutine producing a T
+ * Runs when first awaited and resumes its awaiter when it finishes. The
+ * Task owns the frame: destroying a suspended Task destroys the whole
+ * chain of coroutines it is waiting on.
+ */
+template <typename T>
+class Task {
+public:
+    using promise_type = detail::Promise<T>;
+    using Handle = std::coroutine_handle<promise_type>;
+
+    Task() = default;
+    explicit Task(Handle h) : handle(h) {}
+    Task(Task&& other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            if (handle) handle.destroy();
+            handle = std::exchange(other.handle, nullptr);
+        }
+        return *this;
+    }
+    ~Task() {
+        if (handle) handle.destroy();
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    bool await_ready() const noexcept { return !handle || handle.done(); }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept {
+        handle.promise().continuation = awaiter;
+        return handle;
+    }
+    T await_resume() { return handle.promise().take(); }
+
+    Handle release() { return std::exchange(handle, nullptr); }
+
+private:
+    Handle handle;
+};
+
+namespace detail {
+
+template <typename T>
+Task<T> Promise<T>::get_return_object() {
+    return Task<T>(std::coroutine_handle<Promise<T>>::from_promise(*this));
+}
+
+inline Task<void> Promise<void>::get_return_object() {
+    return Task<void>(std::coroutine_handle<Promise<void>>::from_promise(*this));
+}
+
+} // namespace detail
+
+/**
+ * TaskGroup - owner of a worker's detached coroutines (one per client)
+ * A spawned task starts immediately and frees itself when it finishes;
+ * whatever is still suspended when the group is destroyed is destroyed
+ * with it, which closes its sockets.
+ */
+class TaskGroup {
+public:
+    TaskGroup() : head(nullptr), count(0) {}
+    ~TaskGroup() { destroyAll(); }
+
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+    void spawn(Task<void> task);
+    void destroyAll();
+    size_t size() const { return count; }
+
+private:
+    struct Root {
+        struct promise_type {
+            TaskGroup* group = nullptr;
+            promise_type* prev = nullptr;   // intrusive list: spawning never allocates
+            promise_type* next = nullptr;
+
+            Root get_return_object() { return Root{std::coroutine_handle<promise_type>::from_promise(*this)}; }
+            std::suspend_always initial_suspend() noexcept { return {}; }
+            std::suspend_never final_suspend() noexcept { return {}; }
+            void return_void() {}
+            void unhandled_exception() {}
+            ~promise_type();
+
+            static void* operator new(size_t size) { return FramePool::allocateFrame(size); }
+            static void operator delete(void* frame, size_t size) { FramePool::releaseFrame(frame, size); }
+        };
+        std::coroutine_handle<promise_type> handle;
+    };
+
+    Root::promise_type* head;
+    size_t count;
+
+    static Root run(Task<void> task);
+};
+
+/**
+ * Outcome of an awaited socket operation
+ * bytes > 0 is data moved; a read of 0 bytes with no error is EOF.
+ */
+struct IoResult {
+    long bytes = 0;
+    int error = 0;
+    bool timedOut = false;
+
+    bool ok() const { return error == 0 && !timedOut; }
+};
+
+class AsyncSocket;
+struct StaticFile;
+
+/**
+ * One pending socket operation, living in the awaiting coroutine's frame
+ * The I/O itself is done from the readiness callback; the coroutine is
+ * resumed from the loop's deferred queue, after the dispatch round, so it
+ * may close sockets or finish (freeing its frame) without leaving stale
+ * handlers behind in the current epoll batch.
+ */
+class SocketOperation {
+public:
+    explicit SocketOperation(AsyncSocket& s) : socket(s) {}
+    ~SocketOperation();
+
+    // Movable until awaited (withTimeout takes the operation by value)
+    SocketOperation(SocketOperation&& other) noexcept : socket(other.socket), result(other.result) {}
+    SocketOperation& operator=(const SocketOperation&) = delete;
+
+    bool await_ready();
+    bool await_suspend(std::coroutine_handle<> awaiter);
+    IoResult await_resume() { return result; }
+
+    // Abandon the wait (used by withTimeout); the awaiter sees timedOut
+    void cancel();
+
+protected:
+    friend class AsyncSocket;
+
+    AsyncSocket& socket;
+    IoResult result;
+    std::coroutine_handle<> waiter;
+
+    // One non-blocking attempt; false when the socket is not ready yet
+    virtual bool attempt() = 0;
+    virtual bool isWrite() const = 0;
+    void complete();
+};
+
+/**
+ * AsyncSocket - a non-blocking socket with awaitable operations
+ * At most one read and one write may be pending at a time. Readiness
+ * interest is added when an operation has to wait and dropped lazily, when
+ * an event arrives that nothing is waiting for.
+ */
+class AsyncSocket : public IoHandler {
+public:
+    class ReadOperation : public SocketOperation {
+    public:
+        ReadOperation(AsyncSocket& s, char* b, size_t l) : SocketOperation(s), buffer(b), length(l) {}
+    private:
+        char* buffer;
+        size_t length;
+        bool attempt() override;
+        bool isWrite() const override { return false; }
+    };
+
+    // Completes once every byte is written (or on error)
+    class WriteOperation : public SocketOperation {
+    public:
+        WriteOperation(AsyncSocket& s, const char* d, size_t l) : SocketOperation(s), data(d), length(l) {}
+    private:
+        const char* data;
+        size_t length;
+        bool attempt() override;
+        bool isWrite() const override { return true; }
+    };
+
+    // A static file's bytes from offset, sent without copying through user
+    // space (see StaticFiles::send); completes once all are sent or on error
+    class SendFileOperation : public SocketOperation {
+    public:
+        SendFileOperation(AsyncSocket& s, const StaticFile& f, uint64_t o, uint64_t l)
+            : SocketOperation(s), file(f), offset(o), length(l) {}
+    private:
+        const StaticFile& file;
+        uint64_t offset;
+        uint64_t length;
+        bool attempt() override;
+        bool isWrite() const override { return true; }
+    };
+
+    class ConnectOperation : public SocketOperation {
+    public:
+        ConnectOperation(AsyncSocket& s, const SocketAddress& a) : SocketOperation(s), address(a), started(false) {}
+    private:
+        SocketAddress address;
+        bool started;
+        bool attempt() override;
+        bool isWrite() const override { return true; }
+    };
+
+    AsyncSocket(EventLoop& loop, SOCKET fd = INVALID_SOCKET);
+    ~AsyncSocket() override;
+
+    AsyncSocket(const AsyncSocket&) = delete;
+    AsyncSocket& operator=(const AsyncSocket&) = delete;
+
+    // New non-blocking TCP socket; false if it cannot be created
+    bool open(int family = AF_INET);
+    void close();
+    // Gives the socket up unclosed, out of the loop; nothing may be pending on it
+    SOCKET release();
+    SOCKET get() const { return fd; }
+    bool isOpen() const { return fd != INVALID_SOCKET; }
+    // TCP_QUICKACK again after every read that returns data
+    void setQuickAck(bool on) { quickAck = on; }
+
+    ReadOperation read(char* buffer, size_t length) { return ReadOperation(*this, buffer, length); }
+    WriteOperation write(const char* data, size_t length) { return WriteOperation(*this, data, length); }
+    SendFileOperation sendFile(const StaticFile& file, uint64_t offset, uint64_t length) {
+        return SendFileOperation(*this, file, offset, length);
+    }
+    ConnectOperation connect(const SocketAddress& address) { return ConnectOperation(*this, address); }
+
+    void onEvent(uint32_t events) override;
+
+private:
+    friend class SocketOperation;
+
+    EventLoop& loop;
+    SOCKET fd;
+    bool registered;
+    bool hungUp;              // error/hang-up seen: operations no longer wait
+    bool readMayHaveData;     // last read filled its buffer; try before waiting
+    bool quickAck;
+    uint32_t interest;
+    SocketOperation* reader;
+    SocketOperation* writer;
+
+    void updateInterest(uint32_t events);
+};
+
+/**
+ * Sleep - resumes the awaiting coroutine after delayMs (timer wheel ticks)
+ */
+class Sleep {
+public:
+    Sleep(EventLoop& l, uint64_t ms) : loop(l), delayMs(ms) {}
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> awaiter);
+    void await_resume() noexcept {}
+
+private:
+    EventLoop& loop;
+    uint64_t delayMs;
+    TimerWheel::Timer timer;
+};
+
+inline Sleep sleepFor(EventLoop& loop, uint64_t delayMs) {
+    return Sleep(loop, delayMs);
+}
+
+/**
+ * Bounds a socket operation: if it has not completed after timeoutMs it
+ * is cancelled and resumes with IoResult::timedOut set
+ */
+template <typename Operation>
+class WithTimeout {
+public:
+    WithTimeout(EventLoop& l, uint64_t ms, Operation op) : loop(l), timeoutMs(ms), operation(std::move(op)) {}
+
+    bool await_ready() { return operation.await_ready(); }
+    bool await_suspend(std::coroutine_handle<> awaiter) {
+        if (!operation.await_suspend(awaiter)) return false;
+        timer.setCallback([this] { operation.cancel(); });
+        loop.timers().schedule(timer, timeoutMs);
+        return true;
+    }
+    IoResult await_resume() {
+        timer.cancel();
+        return operation.await_resume();
+    }
+
+private:
+    EventLoop& loop;
+    uint64_t timeoutMs;
+    Operation operation;
+    TimerWheel::Timer timer;
+};
+
+template <typename Operation>
+WithTimeout<Operation> withTimeout(EventLoop& loop, uint64_t timeoutMs, Operation operation) {
+    return WithTimeout<Operation>(loop, timeoutMs, std::move(operation));
+}
+
+#endif // PROXY_HAS_COROUTINES
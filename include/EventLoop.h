@@ -0,0 +1,84 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <functional>
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+#include "Platform.h"
+#include "TimerWheel.h"
+
+/**
+ * Receives readiness notifications for one registered socket
+ */
+class IoHandler {
+public:
+    virtual ~IoHandler() = default;
+    virtual void onEvent(uint32_t events) = 0;
+};
+
+/**
+ * EventLoop - readiness loop for one worker thread
+ * Uses epoll on Linux and poll()/WSAPoll() elsewhere. Each loop owns a
+ * TimerWheel that is advanced before every dispatch round.
+ */
+class EventLoop {
+public:
+    enum Events : uint32_t {
+        Readable = 1u << 0,
+        Writable = 1u << 1,
+        Closed   = 1u << 2   // error or hang-up
+    };
+
+    EventLoop();
+    ~EventLoop();
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    bool isValid() const;
+
+    bool add(SOCKET fd, uint32_t events, IoHandler* handler);
+    bool modify(SOCKET fd, uint32_t events, IoHandler* handler);
+    void remove(SOCKET fd);
+
+    // Run until stop() is called or running becomes false
+    void run(const std::atomic<bool>& running);
+    void stop() { stopRequested.store(true); }
+
+    // Queue work to run after the current dispatch round (safe object teardown)
+    void defer(std::function<void()> task);
+    // From any thread: runs on the loop thread within one wait (kMaxWaitMs)
+    void post(std::function<void()> task);
+
+    TimerWheel& timers() { return timerWheel; }
+    uint64_t now() const { return cachedNowMs; }
+    static uint64_t monotonicMs();
+    static uint64_t monotonicUs();
+
+private:
+    static constexpr int kMaxEvents = 256;
+    static constexpr int kMaxWaitMs = 100;
+
+#ifdef __linux__
+    int epollFd;
+#else
+    struct Registration {
+        uint32_t events;
+        IoHandler* handler;
+    };
+    std::unordered_map<SOCKET, Registration> registrations;
+#endif
+
+    TimerWheel timerWheel;
+    uint64_t cachedNowMs;
+    std::atomic<bool> stopRequested{false};
+    std::vector<std::function<void()>> deferred;
+    std::mutex postedMutex;
+    std::vector<std::function<void()>> posted;
+    std::atomic<bool> hasPosted{false};
+
+    void runDeferred();
+    void takePosted();
+    int pollOnce(int timeoutMs);
+};
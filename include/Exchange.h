@@ -0,0 +1,105 @@
+#pragma once
+#include <string>
+#include <cstdint>
+#include "Http.h"
+#include "RequestTrace.h"
+#include "Platform.h"
+
+class Worker;
+class Server;
+class Logger;
+struct BackendServer;
+struct Route;
+class ConcurrencyLimiter;
+class SlowRequestLog;
+
+/**
+ * Exchange - the request-level half of serving an HTTP/1.1 client, shared
+ * by the callback Connection and the coroutine RequestPipeline. It holds
+ * the request in flight and makes every decision that does not depend on
+ * how the sockets are driven: head parsing and capture, routing and rate
+ * limits, request body framing, backend selection and retries, response
+ * framing and keep-alive, and the accounting when a request ends. Each
+ * owner does its own I/O and timeouts around these calls.
+ */
+class Exchange {
+public:
+    enum class HeadStatus {
+        Incomplete,
+        Invalid,
+        Http2Preface,    // prior-knowledge h2c instead of a first request
+        Parsed
+    };
+
+    enum class Selection {
+        Selected,
+        Saturated,
+        NoBackend
+    };
+
+    static constexpr char kContinue[] = "HTTP/1.1 100 Continue\r\n\r\n";
+
+    // probeId is what the USDT probes report for this client (its owner)
+    Exchange(Worker& worker, SOCKET clientSocket, const void* probeId);
+
+    Exchange(const Exchange&) = delete;
+    Exchange& operator=(const Exchange&) = delete;
+
+    // Request side
+    void beginRequest();
+    HeadStatus parseRequestHead();
+    bool checkRateLimit(uint32_t& retryAfterSeconds);
+    void startRequestBody();
+    bool decodeRequestBody();
+    bool requestBodyReady();
+    bool wantsContinue() const;
+    void onRequestRead();
+
+    // Forwarding
+    Selection selectBackend(BackendServer*& backend, ConcurrencyLimiter*& limiter);
+    bool selectAlternateBackend(const BackendServer* avoid, const BackendServer* busy, BackendServer*& backend,
+                                ConcurrencyLimiter*& limiter);
+    bool retryAfterFailure(bool retryable, const BackendServer* failed, const BackendServer* busy,
+                           const std::string& failedUrl, BackendServer*& backend, ConcurrencyLimiter*& limiter);
+    std::string beginAttempt(BackendServer* backend, bool hedge);
+    void appendUpstreamRequest(std::string& output) const;
+    void recordFirstByte(const BackendServer* backend, const std::string& url, uint64_t latencyUs);
+    void countDeadline();
+
+    // Response side
+    bool startResponse(const HttpHead& response, BodyDecoder& decoder, std::string& output);
+    bool decodeResponseBody(BodyDecoder& decoder, bool chunked, const char* data, size_t length, std::string& output);
+    void endResponseAtEof(const BodyDecoder& decoder, bool chunked, std::string& output);
+
+    void recordRequestEnd(int statusCode);
+    void resetRequest();
+    size_t routeSlot() const;
+
+    Worker& worker;
+    Server& server;
+    Logger& logger;
+    const void* probeId;
+    std::string clientIP;
+    size_t bufferSize;             // request body held before it is streamed instead
+
+    std::string requestBuffer;     // client bytes not decoded yet (the head is dropped once parsed)
+    HttpHead request;
+    BodyDecoder requestDecoder;
+    std::string requestBody;       // body as sent upstream, not yet handed to an attempt
+    bool requestStreaming;         // body too large to hold: forwarded while it is read
+    bool requestBodySent;          // part of a streamed body went out; no more retries
+    bool keepAlive;                // for the client connection, after this response
+    bool http2Candidate;           // no request yet: an h2c preface switches to HTTP/2
+    const Route* route;
+    uint64_t requestStartUs;       // first request byte; 0 between requests
+    bool requestActive;            // counted in the active-requests gauge
+    RequestTrace trace;
+    uint64_t captureId;            // 0 unless this connection is being captured
+    uint32_t capturedRequests;
+    std::string backendUrl;
+    int retriesUsed;
+    bool hedged;
+
+private:
+    void recordSlowRequest(SlowRequestLog& log, int statusCode, uint64_t totalUs);
+};
@@ -0,0 +1,77 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "Platform.h"
+
+class Logger;
+struct HotRestartConfig;
+
+/**
+ * HotRestart - hands the listening sockets from a running proxy to its
+ * replacement over a Unix domain socket (SCM_RIGHTS), so the listen queues
+ * are never closed during a deploy.
+ *
+ * The exchange, new process first:
+ *   new -> old  Hello
+ *   old -> new  Listeners (proxy and TLS sockets attached)
+ *   new -> old  Ready     (new workers accept on the same sockets)
+ *   old -> new  Draining  (old stopped accepting and released the admin port)
+ *   old -> new  Stats     (once drained, just before it exits)
+ *
+ * Every process listens on socket_path for its own successor. POSIX only;
+ * elsewhere nothing is inherited and no successor is accepted.
+ */
+class HotRestart {
+public:
+    HotRestart(const HotRestartConfig& config, Logger& logger);
+    ~HotRestart();
+
+    HotRestart(const HotRestart&) = delete;
+    HotRestart& operator=(const HotRestart&) = delete;
+
+    // New process: takes the listeners of a process running on socket_path;
+    // false (with nothing inherited) when none answers
+    bool inherit(std::vector<SOCKET>& listeners, std::vector<SOCKET>& tlsListeners);
+    // Tells the predecessor our workers are accepting; true once it has
+    // stopped accepting and closed its admin listener
+    bool confirmInherited();
+    // Stats the predecessor sent on exit; false while it is still draining
+    // (or when it left without any)
+    bool pollStats(std::string& stats);
+
+    // Binds socket_path, replacing the predecessor's name for it
+    bool listen();
+    // Old process, every main-loop tick: hands the listeners to a successor
+    // that connected; true once the successor's workers are accepting
+    bool pollSuccessor(const std::vector<SOCKET>& listeners, const std::vector<SOCKET>& tlsListeners);
+    // After pollSuccessor: the admin port is free, draining has begun
+    void notifyDraining();
+    // Last words to the successor before exiting
+    void sendStats(const std::string& stats);
+
+    bool hasPredecessor() const { return predecessor != INVALID_SOCKET; }
+
+private:
+    enum class Message : uint8_t {
+        Hello = 1,
+        Listeners,
+        Ready,
+        Draining,
+        Stats
+    };
+
+    static constexpr int kHandoffTimeoutMs = 5000;
+    static constexpr size_t kMaxMessage = 16 * 1024 * 1024;
+
+    const HotRestartConfig& config;
+    Logger& logger;
+    SOCKET listenSocket;    // for our successor
+    SOCKET predecessor;     // connection to the process we replaced
+    SOCKET successor;       // connection to the process replacing us
+
+    bool send(SOCKET socket, Message type, const std::string& payload, const std::vector<SOCKET>& fds = {});
+    // Blocks up to kHandoffTimeoutMs; attached descriptors are appended to fds
+    bool receive(SOCKET socket, Message& type, std::string& payload, std::vector<SOCKET>* fds = nullptr);
+    static void closeSocket(SOCKET& socket);
+};
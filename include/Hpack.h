@@ -0,0 +1,115 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <deque>
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+
+// Header fields in block order; names are lower case on the HTTP/2 side
+using HeaderList = std::vector<std::pair<std::string, std::string>>;
+
+namespace Hpack {
+
+// SETTINGS_HEADER_TABLE_SIZE until a peer announces otherwise
+constexpr size_t kDefaultTableSize = 4096;
+
+// Huffman string coding (RFC 7541 Appendix B)
+size_t huffmanLength(const std::string& value);
+void huffmanEncode(const std::string& value, std::string& output);
+// False on an EOS symbol or padding that is not a prefix of EOS
+bool huffmanDecode(const uint8_t* data, size_t length, std::string& output);
+
+// Credential headers (Authorization, Cookie, ...): never indexed, and
+// redacted in traffic captures. The name is matched case-insensitively.
+bool isSensitive(const char* name, size_t length);
+
+} // namespace Hpack
+
+/**
+ * HpackTable - the static table followed by one side's dynamic table,
+ * addressed by the 1-based indices used on the wire. Entries are evicted
+ * oldest first to stay within the size limit (name + value + 32 each).
+ */
+class HpackTable {
+public:
+    static constexpr size_t kStaticEntries = 61;
+
+    explicit HpackTable(size_t maxSize = Hpack::kDefaultTableSize);
+
+    // nullptr when index is 0 or past the end of the dynamic table
+    const std::pair<std::string, std::string>* get(size_t index) const;
+    void add(const std::string& name, const std::string& value);
+    void setMaxSize(size_t size);
+
+    // Index of an exact match, or 0 with nameIndex set to an entry with the
+    // same name (0 when there is none)
+    size_t find(const std::string& name, const std::string& value, size_t& nameIndex) const;
+
+    size_t getSize() const { return size; }
+    size_t getMaxSize() const { return maxSize; }
+    size_t getEntryCount() const { return entries.size(); }
+
+    static size_t entrySize(const std::string& name, const std::string& value) {
+        return name.size() + value.size() + 32;
+    }
+
+private:
+    std::deque<std::pair<std::string, std::string>> entries;   // newest first
+    size_t size;
+    size_t maxSize;
+
+    void evict(size_t limit);
+};
+
+/**
+ * HpackDecoder - header blocks from the peer, in the order they were sent
+ * Every block must be decoded, even for streams about to be refused, or the
+ * dynamic table drifts out of step with the encoder's.
+ */
+class HpackDecoder {
+public:
+    enum class Result {
+        Ok,
+        Oversized,   // decoded in full, but the list exceeded the limit and was cut short
+        Invalid      // compression error: the connection cannot continue
+    };
+
+    explicit HpackDecoder(size_t maxTableSize = Hpack::kDefaultTableSize);
+
+    Result decode(const uint8_t* data, size_t length, HeaderList& headers, size_t maxListSize);
+
+    // Our SETTINGS_HEADER_TABLE_SIZE: the most the encoder may resize to
+    void setMaxTableSize(size_t size) { maxTableSize = size; }
+    const HpackTable& getTable() const { return table; }
+
+private:
+    HpackTable table;
+    size_t maxTableSize;
+};
+
+/**
+ * HpackEncoder - header blocks for the peer
+ * Repeated fields go in the dynamic table; fields whose values change from
+ * response to response (dates, lengths, validators) are sent as literals so
+ * they do not push reusable entries out, and cookies are never indexed.
+ */
+class HpackEncoder {
+public:
+    explicit HpackEncoder(size_t maxTableSize = Hpack::kDefaultTableSize);
+
+    // The peer's SETTINGS_HEADER_TABLE_SIZE; announced at the next block
+    void setMaxTableSize(size_t size);
+
+    // Starts a header block: pending table size updates come first
+    void beginBlock(std::string& output);
+    void encode(const std::string& name, const std::string& value, std::string& output);
+
+    const HpackTable& getTable() const { return table; }
+
+private:
+    HpackTable table;
+    size_t limit;            // never grows past our default, whatever the peer allows
+    size_t pendingSize;      // size to announce at the next block
+    size_t smallestPending;  // smallest size since the last block; SIZE_MAX when none
+};
@@ -0,0 +1,128 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstddef>
+
+enum class ParseResult {
+    Incomplete,
+    Complete,
+    Invalid
+};
+
+/**
+ * Parsed HTTP/1.x message head (request line or status line + headers)
+ * Header names keep their original case; lookups are case-insensitive.
+ */
+struct HttpHead {
+    std::string method;       // requests only
+    std::string path;         // requests only
+    std::string version;
+    int statusCode = 0;       // responses only
+    std::string reason;       // responses only
+    std::vector<std::pair<std::string, std::string>> headers;
+    size_t headLength = 0;    // bytes up to and including the blank line
+
+    const std::string* findHeader(const std::string& name) const;
+    bool hasToken(const std::string& name, const std::string& token) const;
+
+    // Body framing, checked while parsing (conflicting lengths, whitespace
+    // before a colon and requests not ending in chunked are invalid):
+    // -1 when no Content-Length header is present
+    long long contentLength() const;
+    // Transfer-Encoding ends with chunked
+    bool isChunked() const;
+
+    // Whether the client wants the connection kept open after this exchange
+    bool wantsKeepAlive() const;
+
+    // HTTP/1.1 protocol switch request (Connection: Upgrade plus an Upgrade header)
+    bool isUpgrade() const;
+};
+
+/**
+ * Incremental decoder for one message body, fed as bytes arrive
+ * Content-Length and EOF-delimited bodies pass through; chunked framing is
+ * stripped (extensions and trailers are dropped). The payload can come out
+ * re-encoded as chunks, so any framing can be relayed as chunked.
+ */
+class BodyDecoder {
+public:
+    enum class Framing {
+        None,
+        Length,
+        Chunked,
+        UntilClose
+    };
+
+    BodyDecoder() { reset(Framing::None); }
+
+    void reset(Framing framing, long long length = 0);
+
+    // Appends the payload found in data to output (as chunks when chunked is
+    // set) and returns the bytes consumed. Stops at the end of the body, so
+    // whatever follows (a pipelined request) is left unconsumed.
+    size_t decode(const char* data, size_t length, std::string& output, bool chunked);
+
+    Framing getFraming() const { return framing; }
+    bool isComplete() const { return state == State::Done; }
+    bool isInvalid() const { return state == State::Invalid; }
+
+private:
+    enum class State {
+        Size,          // chunk size digits
+        Extension,     // rest of the chunk size line
+        SizeLF,
+        Data,
+        DataCR,
+        DataLF,
+        TrailerStart,  // start of a trailer line, or the final CRLF
+        Trailer,
+        FinalLF,
+        Body,          // Length and UntilClose payload
+        Done,
+        Invalid
+    };
+
+    Framing framing;
+    State state;
+    unsigned long long remaining;   // Length body or current chunk
+    int sizeDigits;
+};
+
+namespace Http {
+
+// Largest message head accepted from either side
+constexpr size_t kMaxHeadSize = 16 * 1024;
+
+ParseResult parseRequestHead(const char* data, size_t length, HttpHead& head);
+ParseResult parseResponseHead(const char* data, size_t length, HttpHead& head);
+
+bool equalsIgnoreCase(const std::string& a, const std::string& b);
+
+// Methods a client may safely have sent twice (RFC 9110 9.2.2)
+bool isIdempotentMethod(const std::string& method);
+
+// Methods without side effects, safe to send to two backends at once
+bool isSafeMethod(const std::string& method);
+
+// Hop-by-hop headers are consumed by the proxy and never forwarded
+bool isHopByHop(const std::string& name);
+
+// Request head as forwarded: hop-by-hop headers and Expect dropped, the
+// client address added, and the backend asked to close after answering.
+// Chunked bodies are re-encoded, so they keep Transfer-Encoding: chunked only.
+// An upgrade request keeps its Upgrade header and asks for the switch instead.
+void appendUpstreamRequestHead(const HttpHead& request, const std::string& clientIP, std::string& output);
+
+// Response head as relayed to the client, with the proxy's own status line
+// version (HTTP/1.1) and Connection header; chunked replaces the backend's
+// framing with Transfer-Encoding: chunked.
+// A 101 keeps its Upgrade header and confirms the switch.
+void appendClientResponseHead(const HttpHead& response, bool keepAlive, bool chunked, std::string& output);
+
+// Chunked transfer coding: one chunk per call, then the last chunk
+void appendChunk(const char* data, size_t length, std::string& output);
+void appendLastChunk(std::string& output);
+
+} // namespace Http
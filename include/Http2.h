@@ -0,0 +1,291 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <cstdint>
+#include "EventLoop.h"
+#include "TimerWheel.h"
+#include "Http.h"
+#include "Hpack.h"
+#include "Platform.h"
+
+class Worker;
+class Server;
+class Logger;
+class TlsStream;
+class Http2Session;
+struct BackendServer;
+struct Route;
+struct Http2Config;
+struct StaticFile;
+
+namespace Http2 {
+
+// Client connection preface (RFC 9113 3.4), sent ahead of its SETTINGS
+constexpr char kPreface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+constexpr size_t kPrefaceLength = sizeof(kPreface) - 1;
+
+// Protocol id offered in ALPN on the TLS listener
+constexpr char kAlpnId[] = "h2";
+
+} // namespace Http2
+
+/**
+ * Http2Stream - one request on an HTTP/2 connection, forwarded as an
+ * HTTP/1.1 exchange on its own backend connection. The request body goes
+ * out as DATA frames arrive (re-chunked when the client gave no length);
+ * the response body is decoded from its HTTP/1.1 framing and sent back in
+ * DATA frames as the flow-control windows allow. A static route's stream
+ * has no backend; its file is read into the body a chunk at a time.
+ *
+ * Streams are recycled through the worker's Http2StreamPool, so their
+ * buffers and timers are not reallocated for every request.
+ */
+struct Http2Stream {
+    enum class Stage {
+        Idle,          // no backend connection
+        Connecting,
+        Sending,       // request head or body still going out
+        Awaiting,      // request sent, no response byte yet
+        Relaying
+    };
+
+    class Endpoint : public IoHandler {
+    public:
+        explicit Endpoint(Http2Stream& s) : stream(s) {}
+        void onEvent(uint32_t events) override;
+    private:
+        Http2Stream& stream;
+    };
+
+    Http2Stream();
+
+    Http2Stream(const Http2Stream&) = delete;
+    Http2Stream& operator=(const Http2Stream&) = delete;
+
+    // Back to the pooled state; small buffers keep their capacity
+    void reset();
+
+    Http2Session* session;   // null while pooled
+    uint32_t id;
+    Http2Stream* nextFree;
+
+    // Request
+    HttpHead request;
+    const Route* route;
+    bool requestEnded;        // END_STREAM received
+    bool chunkedUpload;       // no content-length: forwarded with chunked coding
+    long long declaredLength; // content-length, or -1
+    long long bodyReceived;
+    int64_t bufferedBody;     // body bytes queued for the backend, not yet credited back
+    int64_t receiveWindow;    // bytes the client may still send
+    int64_t unacknowledged;   // consumed bytes not yet returned in a WINDOW_UPDATE
+
+    // Backend exchange
+    Stage stage;
+    SOCKET socket;
+    Endpoint endpoint;
+    uint32_t events;
+    BackendServer* backend;
+    std::string url;
+    std::string output;       // request bytes for the backend
+    size_t outputOffset;
+    bool writeClosed;         // backend answered and stopped taking the body
+    std::string input;        // response head, until parsed
+    bool headersSent;
+    BodyDecoder responseDecoder;
+    bool responseComplete;
+    int status;
+    uint64_t startUs;
+    TimerWheel::Timer timer;  // connect, first byte, then the request deadline
+
+    // Response payload waiting for window
+    std::string body;
+    size_t bodyOffset;
+    std::shared_ptr<const StaticFile> file;   // static route: the rest of the body, read as body drains
+    uint64_t fileOffset;
+    uint64_t fileRemaining;
+    int64_t sendWindow;
+    bool endSent;             // END_STREAM queued
+    bool scheduled;           // in the session's list of streams to pump
+
+    size_t pendingOutput() const { return output.size() - outputOffset; }
+    size_t pendingBody() const { return body.size() - bodyOffset; }
+    uint64_t pendingResponse() const { return pendingBody() + fileRemaining; }
+};
+
+/**
+ * Http2StreamPool - per-worker free list of streams, carved from slabs
+ * Acquire and release are a pointer swap on the worker thread; the pool
+ * only grows to the peak number of streams live at once.
+ */
+class Http2StreamPool {
+public:
+    struct Stats {
+        uint64_t acquisitions = 0;
+        size_t created = 0;
+        size_t live = 0;
+        size_t peakLive = 0;
+    };
+
+    Http2StreamPool() = default;
+    Http2StreamPool(const Http2StreamPool&) = delete;
+    Http2StreamPool& operator=(const Http2StreamPool&) = delete;
+
+    Http2Stream* acquire();
+    void release(Http2Stream* stream);
+
+    const Stats& getStats() const { return stats; }
+
+private:
+    static constexpr size_t kSlabStreams = 16;
+
+    std::vector<std::unique_ptr<Http2Stream[]>> slabs;
+    Http2Stream* freeList = nullptr;
+    Stats stats;
+};
+
+/**
+ * Http2Session - one client connection speaking HTTP/2, taken over from a
+ * Connection once it has seen the h2c preface or negotiated "h2" in ALPN.
+ * Frames are parsed from the client input, header blocks go through HPACK,
+ * and every stream becomes its own backend request picked by the
+ * LoadBalancer, so many requests share one client socket and handshake.
+ *
+ * Both directions are flow controlled: a stream's receive window is only
+ * returned as its body is written to the backend, and response DATA is
+ * sent round-robin across streams within the client's windows while the
+ * output backlog stays under the connection buffer. A backend is not read
+ * while its stream has a buffer's worth of response waiting.
+ *
+ * Streams are not queued by admission control, retried or hedged.
+ */
+class Http2Session {
+public:
+    // Takes over the client socket (and its TLS session); input holds the
+    // bytes already read from it, starting with the preface if any
+    Http2Session(Worker& worker, SOCKET clientSocket, std::unique_ptr<TlsStream> clientTls, std::string input);
+    ~Http2Session();
+
+    Http2Session(const Http2Session&) = delete;
+    Http2Session& operator=(const Http2Session&) = delete;
+
+    bool start();
+    // Hot restart: GOAWAY, then close once the open streams are answered
+    void drain();
+
+private:
+    friend struct Http2Stream;
+
+    class ClientEndpoint : public IoHandler {
+    public:
+        explicit ClientEndpoint(Http2Session& s) : session(s) {}
+        void onEvent(uint32_t events) override;
+    private:
+        Http2Session& session;
+    };
+
+    Worker& worker;
+    Server& server;
+    Logger& logger;
+    const Http2Config& settings;
+    size_t highWatermark;           // client output backlog, and per-stream response buffering
+
+    SOCKET clientSocket;
+    ClientEndpoint clientEndpoint;
+    uint32_t clientEvents;
+    std::string clientIP;
+    std::unique_ptr<TlsStream> tls;
+    bool tlsReadScheduled;
+    bool clientQuickAck;            // the listener's quick_ack policy
+    bool closed;
+    bool prefaceReceived;
+    bool goingAway;                 // GOAWAY received: no new streams, close when idle
+
+    std::string input;
+    size_t inputOffset;
+    std::string output;
+    size_t outputOffset;
+
+    HpackDecoder decoder;
+    HpackEncoder encoder;
+    std::string headerBlock;        // HEADERS plus CONTINUATION fragments
+    uint32_t headerStreamId;        // nonzero while a header block is incomplete
+    bool headerEndStream;
+
+    // Peer settings and connection-level windows
+    uint32_t peerMaxFrameSize;
+    int64_t peerInitialWindow;
+    int64_t sendWindow;
+    int64_t receiveWindow;
+    int64_t connectionWindow;       // what receiveWindow is topped back up to
+    int64_t unacknowledged;
+
+    std::unordered_map<uint32_t, Http2Stream*> streams;
+    std::vector<Http2Stream*> scheduled;   // streams with frames to send, in round-robin order
+    std::vector<Http2Stream*> visiting;    // scheduled list being retired by pumpStreams
+    uint32_t lastStreamId;
+    uint64_t streamsServed;
+
+    TimerWheel::Timer idleTimer;
+    uint64_t lastActivityMs;
+
+    void onClientEvent(uint32_t events);
+    void readClient();
+    void processInput();
+    bool handleFrame(uint8_t type, uint8_t flags, uint32_t streamId, const uint8_t* payload, size_t length);
+    bool handleData(uint8_t flags, uint32_t streamId, const uint8_t* payload, size_t length);
+    bool handleHeaders(uint8_t flags, uint32_t streamId, const uint8_t* payload, size_t length);
+    bool handleContinuation(uint8_t flags, uint32_t streamId, const uint8_t* payload, size_t length);
+    bool handleSettings(uint8_t flags, uint32_t streamId, const uint8_t* payload, size_t length);
+    bool handleWindowUpdate(uint32_t streamId, const uint8_t* payload, size_t length);
+    bool handleRstStream(uint32_t streamId, const uint8_t* payload, size_t length);
+    bool finishHeaderBlock();
+
+    void openStream(uint32_t id, HeaderList& fields, bool endStream, bool oversized);
+    bool buildRequest(Http2Stream& stream, HeaderList& fields);
+    bool checkRateLimit(Http2Stream& stream);
+    void endRequestBody(Http2Stream& stream);
+    void acknowledge(Http2Stream& stream, int64_t bytes);
+
+    void serveStatic(Http2Stream& stream);
+    bool readStaticChunk(Http2Stream& stream);
+    void startUpstream(Http2Stream& stream);
+    void onUpstreamEvent(Http2Stream& stream, uint32_t events);
+    void onUpstreamConnected(Http2Stream& stream);
+    void writeUpstream(Http2Stream& stream);
+    void readUpstream(Http2Stream& stream);
+    bool processResponseHead(Http2Stream& stream);
+    bool appendResponseBody(Http2Stream& stream, const char* data, size_t length);
+    void onStreamTimeout(Http2Stream& stream);
+    void upstreamFailed(Http2Stream& stream, int statusCode, const std::string& body);
+    void releaseUpstream(Http2Stream& stream);
+    void updateUpstreamEvents(Http2Stream& stream);
+
+    void sendHeaders(Http2Stream& stream, int statusCode, const HeaderList& fields, bool endStream);
+    void sendLocalResponse(Http2Stream& stream, int statusCode, const std::string& body,
+                           const std::string& retryAfter = "");
+    bool sendDataFrame(Http2Stream& stream);
+    void schedule(Http2Stream& stream);
+    void pumpStreams();
+    void resetStream(Http2Stream& stream, uint32_t errorCode);
+    void resetStream(uint32_t streamId, uint32_t errorCode);
+    void closeStream(Http2Stream& stream, int statusCode);
+    size_t routeSlot(const Http2Stream& stream) const;
+
+    void appendFrame(uint8_t type, uint8_t flags, uint32_t streamId, const char* payload, size_t length);
+    void sendSettings();
+    void sendWindowUpdate(uint32_t streamId, int64_t increment);
+    void connectionError(uint32_t errorCode, const std::string& reason);
+    void flushClient();
+    void updateClientEvents();
+    long clientRecv(char* buffer, size_t length);
+    long clientSend(const char* data, size_t length);
+    size_t pendingClientOutput() const { return output.size() - outputOffset; }
+    // A scheduled stream could send more of its file right now
+    bool hasSendableFile() const;
+
+    void onIdleTimer();
+    void close();
+};
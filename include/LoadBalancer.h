@@ -3,6 +3,8 @@
 #include <string>
 #include <atomic>
 #include <map>
+#include <memory>
+#include <mutex>
 #include "Config.h"
 
 /**
@@ -41,6 +43,12 @@ struct BackendServer {
  * LoadBalancer class - manages backend servers and routing
  * Supports multiple load balancing algorithms
  * Thread-safe for concurrent requests
+ *
+ * With per-worker shards, each worker thread picks from its own copy of the
+ * selection state (round-robin cursor, weighted round-robin weights and the
+ * connections it opened), so picks write no cache line another core reads
+ * on every request. Least connections then balances each worker's share;
+ * the per-backend totals are merged only when reported.
  */
 class LoadBalancer {
 private:
@@ -49,9 +57,34 @@ private:
     std::atomic<size_t> weightedIndex; // For weighted round-robin
     LoadBalancingAlgorithm algorithm;
     
-    // Weighted round-robin state
+    // Weighted round-robin state (guarded: each pick updates every weight)
     std::vector<int> currentWeights;
+    std::mutex weightsMutex;
     std::atomic<int> totalWeight;
+    
+    // Written only by the worker it belongs to; others read connections
+    struct alignas(64) Shard {
+        // Counts come in whole cache lines of their own, so one worker's
+        // writes never invalidate a line another worker is writing
+        static constexpr size_t kCountsPerLine = 64 / sizeof(std::atomic<int>);
+        struct alignas(64) CountLine {
+            std::atomic<int> counts[kCountsPerLine];
+        };
+
+        size_t roundRobin;
+        std::vector<int> currentWeights;
+        std::unique_ptr<CountLine[]> countLines;
+
+        std::atomic<int>& connections(size_t backend) {
+            return countLines[backend / kCountsPerLine].counts[backend % kCountsPerLine];
+        }
+    };
+    std::vector<std::unique_ptr<Shard>> shards;   // sized by configure, filled by createShard
+    static thread_local int threadShard;
+    
+    Shard* currentShard() const;
+    int pickWeighted(std::vector<int>& weights) const;
+    int findBackend(const std::string& host, int port) const;
 
 public:
     LoadBalancer(LoadBalancingAlgorithm algo = LoadBalancingAlgorithm::ROUND_ROBIN);
@@ -71,9 +104,19 @@ public:
     BackendServer* getLeastConnectionsBackend();
     BackendServer* getIPHashBackend(const std::string& clientIP);
     
+    // Per-worker selection state: createShard before the worker starts (its
+    // memory is allocated by the calling thread), then setThreadShard on the
+    // worker thread. Threads without a shard use the shared state.
+    bool isSharded() const { return !shards.empty(); }
+    void setShardCount(size_t count);
+    void createShard(size_t index);
+    static void setThreadShard(int index) { threadShard = index; }
+    
     // Connection tracking
     void incrementConnections(const std::string& host, int port);
     void decrementConnections(const std::string& host, int port);
+    // Merged over the shared count and every shard
+    int getActiveConnections(size_t index) const;
     
     // Health check methods
     void markUnhealthy(const std::string& host, int port);
@@ -81,6 +124,9 @@ public:
     
     // Utility methods
     size_t getBackendCount() const;
+    BackendServer* getBackend(size_t index) { return &backends[index]; }
+    const BackendServer* getBackend(size_t index) const { return &backends[index]; }
+    size_t indexOf(const BackendServer* backend) const { return static_cast<size_t>(backend - backends.data()); }
     size_t getHealthyBackendCount() const;
     void printStatus() const;
     
@@ -1,6 +1,7 @@
 #pragma once
 #include <string>
 #include <fstream>
+#include <mutex>
 
 enum class LogLevel {
     DEBUG,
@@ -16,6 +17,7 @@ private:
     std::ofstream logFile;
     bool consoleOutput;
     LogLevel currentLogLevel;
+    std::mutex writeMutex;  // workers log concurrently
 
 public:
     Logger(const std::string& filename = "", bool console = true, LogLevel level = LogLevel::INFO);
@@ -0,0 +1,219 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// Adds to a cell that only its owning thread writes: a plain load and store,
+// no locked instruction. Readers on other threads see a recent value.
+inline void bumpCell(std::atomic<uint64_t>& cell, uint64_t amount = 1) {
+    cell.store(cell.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+/**
+ * LatencyHistogram - HDR-style log-linear histogram of microsecond values
+ * Each power of two is split into 16 linear sub-buckets, so any recorded
+ * value is off by less than 1/16 at every magnitude from 1us to hours, in
+ * one fixed array. Single writer; recording is two relaxed increments.
+ */
+class LatencyHistogram {
+public:
+    static constexpr int kSubBucketBits = 4;
+    static constexpr int kSubBuckets = 1 << kSubBucketBits;
+    static constexpr int kBucketCount = kSubBuckets + 32 * kSubBuckets;   // up to 2^36 us
+
+    void record(uint64_t valueUs) {
+        bumpCell(counts[bucketFor(valueUs)]);
+        bumpCell(sum, valueUs);
+    }
+
+    // Samples recorded elsewhere (stats carried over a hot restart)
+    void addBucket(int bucket, uint64_t count) { bumpCell(counts[bucket], count); }
+    void addSum(uint64_t valueUs) { bumpCell(sum, valueUs); }
+
+    static int bucketFor(uint64_t valueUs) {
+        if (valueUs < static_cast<uint64_t>(kSubBuckets)) {
+            return static_cast<int>(valueUs);
+        }
+        int msb = highestBit(valueUs);
+        int shift = msb - kSubBucketBits;
+        int bucket = kSubBuckets + shift * kSubBuckets +
+                     static_cast<int>((valueUs >> shift) & (kSubBuckets - 1));
+        return bucket < kBucketCount ? bucket : kBucketCount - 1;
+    }
+
+    // Largest value that lands in bucket
+    static uint64_t bucketUpperBound(int bucket);
+
+    uint64_t getCount(int bucket) const { return counts[bucket].load(std::memory_order_relaxed); }
+    uint64_t getSum() const { return sum.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> counts[kBucketCount]{};
+    std::atomic<uint64_t> sum{0};
+
+    static int highestBit(uint64_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+        return 63 - __builtin_clzll(value);
+#else
+        int bit = 63;
+        while ((value >> bit) == 0) bit--;
+        return bit;
+#endif
+    }
+};
+
+/**
+ * Sum of several threads' LatencyHistograms, taken at scrape time
+ */
+class HistogramSnapshot {
+public:
+    HistogramSnapshot();
+
+    void add(const LatencyHistogram& histogram);
+
+    uint64_t getCount() const { return count; }
+    uint64_t getSum() const { return sum; }
+    uint64_t getBucketCount(int bucket) const { return counts[bucket]; }
+    // Samples at or below limitUs (bucket resolution)
+    uint64_t countAtOrBelow(uint64_t limitUs) const;
+    uint64_t getQuantile(double quantile) const;
+
+private:
+    std::vector<uint64_t> counts;
+    uint64_t count;
+    uint64_t sum;
+};
+
+enum class Counter {
+    ConnectionsAccepted,
+    ConnectionsRejected,
+    Requests,
+    RequestBytes,
+    ResponseBytes,
+    Count
+};
+
+enum class Gauge {
+    ActiveRequests,
+    QueuedRequests,
+    Http2Sessions,
+    Http2Streams,
+    Count
+};
+
+/**
+ * MetricsShard - every metric cell written by one thread
+ * Each worker records into its own shard, so recording never contends or
+ * bounces cache lines; shards are cache-line aligned and summed on scrape.
+ * Routes are indexed as in the Router, with one extra slot for requests
+ * that matched no route; backends as in the LoadBalancer; priority classes
+ * as in the PriorityClassifier.
+ */
+class alignas(64) MetricsShard {
+public:
+    static constexpr int kStatusClasses = 5;   // 1xx .. 5xx
+
+    MetricsShard(size_t routeSlots, size_t backendCount, size_t classCount);
+
+    void add(Counter counter, uint64_t amount = 1) { bumpCell(counters[static_cast<int>(counter)], amount); }
+    void addGauge(Gauge gauge, int64_t delta) {
+        std::atomic<int64_t>& cell = gauges[static_cast<int>(gauge)];
+        cell.store(cell.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+    }
+    void setGauge(Gauge gauge, int64_t value) { gauges[static_cast<int>(gauge)].store(value, std::memory_order_relaxed); }
+
+    void recordRequest(size_t route, int statusCode, uint64_t durationUs);
+    void recordQueueWait(size_t route, uint64_t waitUs) { queueWait[route].record(waitUs); }
+    void recordClassWait(size_t priorityClass, uint64_t waitUs) { classQueueWait[priorityClass].record(waitUs); }
+    void setClassQueued(size_t priorityClass, int64_t depth) {
+        classQueued[priorityClass].store(depth, std::memory_order_relaxed);
+    }
+    void recordUpstreamLatency(size_t backend, uint64_t firstByteUs) { upstreamLatency[backend].record(firstByteUs); }
+    void recordUpstreamFailure(size_t backend) { bumpCell(upstreamFailures[backend]); }
+
+    // Tunnels (TCP mode and upgraded connections): bytes are counted as they
+    // move, the tunnel when it closes
+    void addTunnelBytes(size_t backend, bool toBackend, uint64_t bytes) {
+        bumpCell(tunnelBytes[backend * 2 + (toBackend ? 0 : 1)], bytes);
+    }
+    void recordTunnel(size_t backend, uint64_t durationUs) {
+        bumpCell(tunnels[backend]);
+        tunnelDuration[backend].record(durationUs);
+    }
+
+private:
+    friend class MetricsRegistry;
+
+    std::atomic<uint64_t> counters[static_cast<int>(Counter::Count)]{};
+    std::atomic<int64_t> gauges[static_cast<int>(Gauge::Count)]{};
+    std::unique_ptr<std::atomic<uint64_t>[]> responses;         // route x status class
+    std::unique_ptr<std::atomic<uint64_t>[]> upstreamFailures;  // per backend
+    std::unique_ptr<LatencyHistogram[]> requestDuration;        // per route
+    std::unique_ptr<LatencyHistogram[]> queueWait;              // per route
+    std::unique_ptr<LatencyHistogram[]> classQueueWait;         // per priority class
+    std::unique_ptr<std::atomic<int64_t>[]> classQueued;        // per priority class, this worker's queue
+    std::unique_ptr<LatencyHistogram[]> upstreamLatency;        // per backend
+    std::unique_ptr<std::atomic<uint64_t>[]> tunnels;           // per backend, closed tunnels
+    std::unique_ptr<std::atomic<uint64_t>[]> tunnelBytes;       // backend x direction
+    std::unique_ptr<LatencyHistogram[]> tunnelDuration;         // per backend
+};
+
+/**
+ * Builds a Prometheus text exposition (format 0.0.4)
+ */
+class PrometheusWriter {
+public:
+    explicit PrometheusWriter(std::string& output) : out(output) {}
+
+    void family(const char* name, const char* help, const char* type);
+    // labels is preformatted, e.g. route="/api/",code="2xx"; may be empty
+    void sample(const char* name, const std::string& labels, double value);
+    void sample(const char* name, const std::string& labels, uint64_t value);
+    void histogram(const char* name, const std::string& labels, const HistogramSnapshot& snapshot);
+
+    static std::string label(const char* key, const std::string& value);
+
+private:
+    std::string& out;
+
+    void appendName(const char* name, const char* suffix, const std::string& labels);
+};
+
+/**
+ * MetricsRegistry - owns the per-thread shards and renders their sum
+ */
+class MetricsRegistry {
+public:
+    MetricsRegistry();
+
+    // Fixes the label sets; drops previously created shards
+    void configure(const std::vector<std::string>& routeLabels, const std::vector<std::string>& backendLabels,
+                   const std::vector<std::string>& classLabels);
+
+    // Shard for recording thread index (a worker id); created on first use
+    MetricsShard& getShard(size_t index);
+
+    size_t getRouteSlots() const { return routeLabels.size() + 1; }
+
+    void render(PrometheusWriter& writer) const;
+    void printStatus() const;
+
+    // Hot restart: every counter and histogram summed over the shards, one
+    // per line, routes and backends named by label rather than index
+    std::string exportTotals() const;
+    // Adds exported totals in a shard of their own; lines for routes or
+    // backends this configuration does not have are dropped
+    void importTotals(const std::string& totals);
+
+private:
+    std::vector<std::string> routeLabels;
+    std::vector<std::string> backendLabels;
+    std::vector<std::string> classLabels;
+    mutable std::mutex shardsMutex;   // shard creation and scrapes only
+    std::vector<std::unique_ptr<MetricsShard>> shards;
+
+    std::string routeLabel(size_t route) const;
+};
@@ -0,0 +1,79 @@
+#pragma once
+
+#ifdef _WIN32
+    #include <winsock2.h>
+    #include <ws2tcpip.h>
+    typedef int socklen_t;
+    #define MSG_NOSIGNAL 0
+#else
+    #include <sys/socket.h>
+    #include <sys/uio.h>
+    #include <arpa/inet.h>
+    #include <netinet/in.h>
+    #include <netinet/tcp.h>
+    #include <unistd.h>
+    #include <fcntl.h>
+    #include <netdb.h>
+    #include <cerrno>
+    typedef int SOCKET;
+    #define INVALID_SOCKET -1
+    #define SOCKET_ERROR -1
+#endif
+
+#ifndef _WIN32
+inline int closesocket(SOCKET socket) {
+    return ::close(socket);
+}
+#endif
+
+inline bool setNonBlocking(SOCKET socket) {
+#ifdef _WIN32
+    u_long mode = 1;
+    return ioctlsocket(socket, FIONBIO, &mode) == 0;
+#else
+    int flags = fcntl(socket, F_GETFL, 0);
+    return flags >= 0 && fcntl(socket, F_SETFL, flags | O_NONBLOCK) == 0;
+#endif
+}
+
+inline int lastSocketError() {
+#ifdef _WIN32
+    return WSAGetLastError();
+#else
+    return errno;
+#endif
+}
+
+inline bool isWouldBlock(int error) {
+#ifdef _WIN32
+    return error == WSAEWOULDBLOCK;
+#else
+    return error == EAGAIN || error == EWOULDBLOCK;
+#endif
+}
+
+inline bool isConnectInProgress(int error) {
+#ifdef _WIN32
+    return error == WSAEWOULDBLOCK || error == WSAEINPROGRESS;
+#else
+    return error == EINPROGRESS;
+#endif
+}
+
+inline bool isInterrupted(int error) {
+#ifdef _WIN32
+    return error == WSAEINTR;
+#else
+    return error == EINTR;
+#endif
+}
+
+// An IPv4 or IPv6 endpoint in binary form, ready for socket() and connect()
+struct SocketAddress {
+    sockaddr_storage storage;
+    socklen_t length;
+
+    SocketAddress() : storage(), length(0) {}
+    int family() const { return storage.ss_family; }
+    const sockaddr* get() const { return reinterpret_cast<const sockaddr*>(&storage); }
+};
@@ -0,0 +1,23 @@
+#pragma once
+
+// Static USDT probe points (provider "reverse_proxy"). With systemtap's
+// <sys/sdt.h> available each probe compiles to a single nop plus an ELF note,
+// so perf and bpftrace can attach without recompiling:
+//   bpftrace -e 'usdt:./reverse_proxy:reverse_proxy:request_done { @[arg1] = hist(arg2); }'
+// Without the header (or with REVERSE_PROXY_NO_USDT) the probes compile away.
+#if defined(__has_include) && !defined(REVERSE_PROXY_NO_USDT)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define REVERSE_PROXY_HAVE_USDT 1
+#endif
+#endif
+
+#ifdef REVERSE_PROXY_HAVE_USDT
+#define PROXY_PROBE1(name, a) DTRACE_PROBE1(reverse_proxy, name, a)
+#define PROXY_PROBE2(name, a, b) DTRACE_PROBE2(reverse_proxy, name, a, b)
+#define PROXY_PROBE3(name, a, b, c) DTRACE_PROBE3(reverse_proxy, name, a, b, c)
+#else
+#define PROXY_PROBE1(name, a) ((void)(a))
+#define PROXY_PROBE2(name, a, b) ((void)(a), (void)(b))
+#define PROXY_PROBE3(name, a, b, c) ((void)(a), (void)(b), (void)(c))
+#endif
@@ -0,0 +1,85 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * RateLimiter - per-key token buckets in a fixed-size hash table
+ * The table is split into shards, each an open-addressing array of
+ * 16-byte slots: a 64-bit key hash plus one 64-bit word packing the
+ * bucket's token count (1/1024 token units) and its last-access time.
+ * Buckets are updated with a single CAS, so checks never take a lock.
+ *
+ * Memory is bounded by the configured capacity. When a key's probe
+ * window is full, the slot touched least recently is taken over
+ * (approximate LRU). A racing update can leak at most one token between
+ * an evicted key and its replacement, which is acceptable for limiting.
+ */
+class RateLimiter {
+public:
+    // Bucket parameters for one route, precomputed into fixed point
+    class Policy {
+    public:
+        Policy() : Policy(0.0, 0) {}
+        Policy(double requestsPerSecond, uint32_t burst);
+
+        bool isEnabled() const { return refillPerMsQ16 > 0 && capacity > 0; }
+        double getRate() const { return rate; }
+        uint32_t getBurst() const { return capacity / kTokenUnit; }
+
+    private:
+        friend class RateLimiter;
+        double rate;
+        uint64_t capacity;        // burst in token units
+        uint64_t refillPerMsQ16;  // token units per millisecond, 16.16 fixed point
+        uint32_t fillTimeMs;      // time to refill an empty bucket
+    };
+
+    static constexpr uint64_t kTokenUnit = 1024;
+
+    explicit RateLimiter(size_t capacity = 1u << 20, size_t shardCount = 64);
+
+    RateLimiter(const RateLimiter&) = delete;
+    RateLimiter& operator=(const RateLimiter&) = delete;
+
+    // Take one token for keyHash. On refusal retryAfterMs is set to the
+    // time until the next token is available.
+    bool tryAcquire(uint64_t keyHash, const Policy& policy, uint64_t nowMs, uint32_t& retryAfterMs);
+
+    // Hash a key string; seed separates buckets of different routes
+    static uint64_t hashKey(uint64_t seed, const char* data, size_t length);
+
+    size_t getCapacity() const { return shardCount * shardSize; }
+    size_t getKeyCount() const;
+    uint64_t getEvictions() const;
+    uint64_t getLimited() const;
+
+private:
+    static constexpr size_t kProbeLimit = 8;
+
+    struct Slot {
+        std::atomic<uint64_t> key{0};    // 0 = empty
+        std::atomic<uint64_t> state{0};  // tokens << 32 | last access (ms, mod 2^32)
+    };
+
+    // All shards' slots come from one slab so the table can sit on huge pages
+    struct SlabDeleter {
+        void operator()(Slot* slab) const;
+    };
+
+    struct alignas(64) Shard {
+        Slot* slots = nullptr;
+        std::atomic<uint64_t> keys{0};
+        std::atomic<uint64_t> evictions{0};
+        std::atomic<uint64_t> limited{0};
+    };
+
+    std::unique_ptr<Slot, SlabDeleter> slab;
+    std::unique_ptr<Shard[]> shards;
+    size_t shardCount;
+    size_t shardSize;      // slots per shard, a power of two
+
+    Slot& findSlot(Shard& shard, uint64_t keyHash, uint32_t now, bool& fresh);
+    static bool refill(uint64_t& state, const Policy& policy, uint32_t now, uint32_t& retryAfterMs);
+};
@@ -0,0 +1,22 @@
+#pragma once
+#include "Coroutine.h"
+#include "Platform.h"
+
+#ifdef PROXY_HAS_COROUTINES
+class Worker;
+
+/**
+ * RequestPipeline - the request path written as one coroutine per client
+ * parse -> route -> select -> proxy -> log, as straight-line co_await code
+ * over AsyncSocket. The request handling itself (parsing, routing, body
+ * framing, retries, keep-alive and accounting) is the Exchange shared with
+ * the callback Connection. Selected with server.pipeline = "coroutine".
+ * Not supported, and ignored with a warning at startup: the admission wait
+ * queue (a saturated limiter answers 503 at once), priority classes and
+ * hedging. TLS clients are always served by the callback Connection.
+ */
+namespace RequestPipeline {
+    // Serves one accepted client until it closes; runs on the worker's loop
+    Task<void> serve(Worker& worker, SOCKET clientSocket);
+}
+#endif
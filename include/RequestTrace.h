@@ -0,0 +1,136 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/**
+ * Tsc - cheap monotonic timestamps for request phase boundaries
+ * Reads the time stamp counter directly (no syscall, no vDSO) when the CPU
+ * advertises an invariant TSC, which ticks at a constant rate and is
+ * synchronised across cores; otherwise falls back to steady_clock.
+ * calibrate() runs once at startup, before any worker thread.
+ */
+class Tsc {
+public:
+    static void calibrate();
+
+    static uint64_t now() {
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64)
+        if (invariant) return __rdtsc();
+#endif
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    static uint64_t toUs(uint64_t ticks) { return static_cast<uint64_t>(static_cast<double>(ticks) * usPerTick); }
+    static bool isInvariant() { return invariant; }
+
+private:
+    static bool invariant;
+    static double usPerTick;
+};
+
+// Phase boundaries of one request, in the order a proxied request crosses them
+enum class TraceMark {
+    Accepted,            // connection accepted (first request on it only)
+    FirstByte,           // first request byte read
+    HeadParsed,          // request head complete
+    RequestRead,         // body complete, dispatching
+    Admitted,            // past rate limit and admission queue
+    UpstreamStart,       // backend chosen and resolved, connecting
+    UpstreamConnected,
+    RequestSent,         // request fully written to the backend
+    FirstResponseByte,
+    Complete,            // last response byte handed to the kernel
+    Count
+};
+
+/**
+ * RequestTrace - timestamps taken at each phase boundary of the current
+ * request. A phase lasts from its mark to the next mark that was reached,
+ * so a request that ends early (a 429, a 503 from the queue) charges the
+ * remainder to the phase it was in.
+ */
+struct RequestTrace {
+    static constexpr int kMarks = static_cast<int>(TraceMark::Count);
+    static constexpr int kPhases = kMarks - 1;
+
+    uint64_t marks[kMarks] = {};
+
+    void mark(TraceMark point) { marks[static_cast<int>(point)] = Tsc::now(); }
+    void set(TraceMark point, uint64_t tsc) { marks[static_cast<int>(point)] = tsc; }
+    uint64_t get(TraceMark point) const { return marks[static_cast<int>(point)]; }
+    void reset() { *this = RequestTrace(); }
+
+    // Microseconds spent in each phase; phases never reached are zero
+    void phaseDurations(uint32_t (&phaseUs)[kPhases]) const;
+
+    static const char* phaseName(int phase);
+};
+
+/**
+ * One slow request as kept in the SlowRequestLog. Plain data with fixed-size
+ * strings (truncated) so it can be copied through the ring word by word.
+ */
+struct SlowRequest {
+    uint64_t sequence;           // order in which requests were recorded
+    uint64_t finishedAtMs;       // wall clock
+    uint32_t totalUs;            // first request byte to completion
+    uint32_t phaseUs[RequestTrace::kPhases];
+    uint16_t status;             // 0 = client went away before the response
+    uint16_t worker;
+    uint8_t retries;
+    uint8_t hedged;
+    uint8_t reserved[2];
+    char method[8];
+    char path[96];
+    char backend[48];
+    char client[48];
+
+    static void copyString(char* target, size_t size, const std::string& value);
+};
+
+/**
+ * SlowRequestLog - the last N slow requests in a lock-free ring
+ * Workers claim slots with one fetch_add and publish them under a per-slot
+ * sequence lock; readers (admin thread, signal dump) copy slots without
+ * blocking writers and skip any slot caught mid-write. Only requests over
+ * the threshold pay for the atomics; everything else is one comparison.
+ */
+class SlowRequestLog {
+public:
+    SlowRequestLog(size_t capacity, uint64_t thresholdUs);
+
+    uint64_t getThresholdUs() const { return thresholdUs; }
+    bool isSlow(uint64_t totalUs) const { return totalUs >= thresholdUs; }
+
+    void record(SlowRequest& entry);
+    // Consistent copies of the retained entries, oldest first
+    std::vector<SlowRequest> snapshot() const;
+    std::string render() const;
+
+    uint64_t getRecorded() const { return head.load(std::memory_order_relaxed); }
+    uint64_t getDropped() const { return dropped.load(std::memory_order_relaxed); }
+
+private:
+    static constexpr size_t kWords = sizeof(SlowRequest) / sizeof(uint64_t);
+
+    struct Slot {
+        std::atomic<uint64_t> version{0};   // odd while a writer owns the slot
+        std::atomic<uint64_t> words[kWords]{};
+    };
+
+    std::unique_ptr<Slot[]> slots;
+    size_t mask;
+    uint64_t thresholdUs;
+    alignas(64) std::atomic<uint64_t> head{0};
+    std::atomic<uint64_t> dropped{0};
+};
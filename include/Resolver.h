@@ -0,0 +1,79 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include "Config.h"
+#include "Platform.h"
+
+class Logger;
+class LoadBalancer;
+
+/**
+ * Resolver - backend addresses for connect(), resolved off the event loops
+ *
+ * Every backend's host is resolved once when the server starts (numeric
+ * addresses are just parsed) and hostnames again every refresh_s on a
+ * background thread, with blocking getaddrinfo, so /etc/hosts and the
+ * system's DNS servers both apply. All A/AAAA records are kept as binary
+ * sockaddrs; connects rotate over them, so a name with several records
+ * spreads its backend's connections across all of them. A failed refresh
+ * keeps the previous records and is retried after retry_s.
+ *
+ * Workers only copy an address out under the backend's own mutex, which
+ * the refresh thread holds just long enough to swap in a new list.
+ */
+class Resolver {
+public:
+    explicit Resolver(Logger& logger);
+    ~Resolver();
+
+    Resolver(const Resolver&) = delete;
+    Resolver& operator=(const Resolver&) = delete;
+
+    // One entry per LoadBalancer backend, by index
+    void configure(const Config& config, const LoadBalancer& loadBalancer);
+    // Resolves every hostname (blocking), then refreshes them in the background
+    void start();
+    void stop();
+
+    // Next address of a backend; false while it has none
+    bool lookup(size_t backend, SocketAddress& address) const;
+    size_t getAddressCount(size_t backend) const;
+    uint64_t getFailures() const { return failures.load(std::memory_order_relaxed); }
+    void printStatus() const;
+
+    // Numeric host ("10.0.0.1", "::1") in binary form, without any lookup
+    static bool parseNumeric(const std::string& host, int port, SocketAddress& address);
+    static std::string format(const SocketAddress& address);
+
+private:
+    struct Entry {
+        std::string host;
+        int port;
+        bool numeric;
+        mutable std::mutex mutex;
+        std::vector<SocketAddress> addresses;   // guarded by mutex
+        mutable std::atomic<size_t> nextAddress{0};   // rotation over this backend's addresses
+        uint64_t nextRefreshMs;                 // refresh thread only
+        bool failing;                           // refresh thread only
+    };
+
+    Logger& logger;
+    ResolverConfig config;
+    std::vector<std::unique_ptr<Entry>> entries;
+    std::atomic<uint64_t> failures{0};
+
+    std::thread thread;
+    std::mutex wakeMutex;
+    std::condition_variable wake;
+    bool stopping;
+
+    void run();
+    // Blocking; false (entry untouched) when the name does not resolve
+    bool resolve(Entry& entry);
+};
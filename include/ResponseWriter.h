@@ -0,0 +1,53 @@
+#pragma once
+#include <string>
+#include <cstddef>
+#include "Platform.h"
+
+/**
+ * ResponseWriter - assembles HTTP responses without concatenation
+ * Status lines and constant headers are pre-rendered in static storage,
+ * only Content-Length and Date are formatted per response (into a small
+ * stack buffer), and the pieces go out with a single writev()
+ */
+class ResponseWriter {
+public:
+    static constexpr size_t kMaxSlices = 5;
+    static constexpr size_t kScratchSize = 112;
+
+    struct Slice {
+        const char* data;
+        size_t length;
+    };
+
+    // Scatter list for one response; the dynamic header bytes live in scratch
+    struct Frame {
+        Slice slices[kMaxSlices];
+        size_t count = 0;
+        size_t totalLength = 0;
+        char scratch[kScratchSize];
+    };
+
+    // Fill frame with status line, headers and body (body and extraHeaders
+    // are referenced, not copied; extraHeaders is complete "Name: value\r\n" lines)
+    static void build(Frame& frame, int statusCode, const char* body, size_t bodyLength,
+                      const char* extraHeaders = nullptr, size_t extraHeadersLength = 0);
+
+    // Write a complete response to a blocking socket with one gather write
+    static bool send(SOCKET socket, int statusCode, const std::string& body);
+
+    // One gather write on a non-blocking socket; the frame is advanced past
+    // whatever was written. Returns false on a hard socket error.
+    static bool writeSome(SOCKET socket, Frame& frame);
+
+    // Flatten a response into a string (debugging and benchmarks)
+    static std::string render(int statusCode, const std::string& body);
+
+    static const char* statusText(int statusCode);
+
+private:
+    static Slice statusLine(int statusCode);
+    static size_t formatDynamicHeaders(char* buffer, size_t contentLength);
+    static bool writeFrame(SOCKET socket, Frame& frame);
+    static long gatherWrite(SOCKET socket, const Frame& frame);
+    static void advance(Frame& frame, size_t sent);
+};
@@ -0,0 +1,111 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <cstdint>
+
+class Config;
+class LoadBalancer;
+struct BackendServer;
+
+/**
+ * Global allowance for extra upstream attempts (retries and hedges)
+ * Every request deposits a fraction of a token and every extra attempt
+ * withdraws a whole one, so extra attempts stay under that fraction of
+ * traffic. A small per-second floor keeps retries possible at low load.
+ * An outage drains the budget instead of multiplying the load on it.
+ */
+class RetryBudget {
+public:
+    RetryBudget(double ratio = 0.1, int minPerSecond = 5);
+
+    void onRequest();
+    bool tryWithdraw(uint64_t nowMs);
+
+private:
+    static constexpr int64_t kToken = 1000;
+
+    int64_t depositPerRequest;    // token thousandths
+    int64_t floorPerSecond;       // token thousandths
+    int64_t maxBalance;
+    std::atomic<int64_t> balance;
+    std::atomic<uint64_t> lastRefillMs;
+};
+
+/**
+ * Recent latency distribution of one backend (log-linear buckets)
+ * Counts are halved every kDecaySamples samples so the estimate follows
+ * the backend's current behaviour. The configured quantile is recomputed
+ * every few samples and read without scanning.
+ */
+class LatencyTracker {
+public:
+    explicit LatencyTracker(double quantile);
+
+    void record(uint64_t latencyUs);
+
+    // 0 until enough samples have been seen
+    uint64_t getQuantileUs() const { return cachedQuantileUs.load(std::memory_order_relaxed); }
+
+private:
+    static constexpr int kSubBuckets = 8;
+    static constexpr int kBucketCount = 8 + 29 * kSubBuckets;   // covers up to ~2^32 us
+    static constexpr uint32_t kMinSamples = 20;
+    static constexpr uint32_t kRecomputeEvery = 16;
+    static constexpr uint32_t kDecaySamples = 2000;
+
+    double quantile;
+    std::atomic<uint32_t> counts[kBucketCount];
+    std::atomic<uint32_t> samples;
+    std::atomic<uint64_t> cachedQuantileUs;
+
+    static int bucketFor(uint64_t latencyUs);
+    static uint64_t bucketUpperBound(int bucket);
+    void recompute(bool decay);
+};
+
+struct RetryStats {
+    std::atomic<uint64_t> retries{0};
+    std::atomic<uint64_t> hedges{0};
+    std::atomic<uint64_t> hedgeWins{0};
+    std::atomic<uint64_t> budgetExhausted{0};
+};
+
+/**
+ * RetryController - retry/hedging policy shared by all workers
+ * Owns the retry budget and one latency tracker per backend (indexed
+ * like the load balancer's backends).
+ */
+class RetryController {
+public:
+    RetryController();
+
+    void configure(const Config& config, LoadBalancer& loadBalancer);
+
+    bool isEnabled() const { return enabled; }
+    bool isHedgingEnabled() const { return enabled && hedgeEnabled; }
+    int getMaxRetries() const { return maxRetries; }
+
+    void onRequest() { budget->onRequest(); }
+    // Withdraws from the budget; counts the refusal when it is empty
+    bool tryExtraAttempt(uint64_t nowMs);
+
+    void recordLatency(const BackendServer* backend, uint64_t latencyUs);
+    // Delay after which a request to backend is hedged; 0 = don't hedge yet
+    uint64_t getHedgeDelayMs(const BackendServer* backend) const;
+
+    RetryStats& getStats() { return stats; }
+    void printStatus() const;
+
+private:
+    bool enabled;
+    bool hedgeEnabled;
+    int maxRetries;
+    uint64_t hedgeMinDelayMs;
+    LoadBalancer* loadBalancer;
+    std::unique_ptr<RetryBudget> budget;
+    std::vector<std::unique_ptr<LatencyTracker>> trackers;
+    RetryStats stats;
+
+    LatencyTracker* getTracker(const BackendServer* backend) const;
+};
@@ -0,0 +1,36 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "Config.h"
+#include "RateLimiter.h"
+
+/**
+ * One configured route plus the runtime state derived from its config
+ */
+struct Route {
+    RouteConfig config;
+    RateLimiter::Policy rateLimit;
+    uint64_t keySeed;    // keeps rate limit buckets of different routes apart
+    size_t index;        // position in the Router, used as the metrics slot
+};
+
+/**
+ * Router - longest-prefix match of request paths to configured routes
+ * Routes are fixed after configure(); match() is read-only and safe to
+ * call from every worker.
+ */
+class Router {
+public:
+    void configure(const Config& config);
+
+    // Route with the longest prefix matching path, or nullptr
+    const Route* match(const std::string& path) const;
+
+    size_t getRouteCount() const { return routes.size(); }
+    const std::vector<Route>& getRoutes() const { return routes; }
+    bool hasRateLimits() const;
+
+private:
+    std::vector<Route> routes;   // longest prefix first
+};
@@ -1,50 +1,120 @@
 #pragma once
 #include <string>
+#include <vector>
+#include <memory>
 #include <thread>
 #include <atomic>
+#include <cstdint>
 #include "Logger.h"
 #include "LoadBalancer.h"
 #include "Config.h"
+#include "Platform.h"
+#include "AdmissionControl.h"
+#include "Router.h"
+#include "RateLimiter.h"
+#include "RetryControl.h"
+#include "Metrics.h"
+#include "AdminServer.h"
+#include "RequestTrace.h"
+#include "Tls.h"
+#include "HotRestart.h"
+#include "Resolver.h"
+#include "StaticFiles.h"
 
-#ifdef _WIN32
-    #include <winsock2.h>
-    #include <ws2tcpip.h>
-    typedef int socklen_t;
-#else
-    #include <sys/socket.h>
-    #include <arpa/inet.h>
-    #include <unistd.h>
-    #include <netdb.h>
-    typedef int SOCKET;
-    #define INVALID_SOCKET -1
-    #define SOCKET_ERROR -1
-    #define closesocket close
-#endif
+class Worker;
+
+/**
+ * Expiry counters, one per timeout kind, shared by all workers
+ */
+struct TimeoutCounters {
+    std::atomic<uint64_t> clientHeader{0};
+    std::atomic<uint64_t> idleKeepAlive{0};
+    std::atomic<uint64_t> upstreamConnect{0};
+    std::atomic<uint64_t> upstreamFirstByte{0};
+    std::atomic<uint64_t> requestTotal{0};
+    std::atomic<uint64_t> tunnelIdle{0};
+};
 
 class Server {
 private:
     Logger& logger;
     LoadBalancer& loadBalancer;
     Config config;
-    SOCKET serverSocket;
+    Resolver resolver;
+    StaticFiles staticFiles;
+    std::vector<SOCKET> listenSockets;
+    std::vector<SOCKET> tlsListenSockets;
+    std::unique_ptr<TlsContext> tls;    // null unless the TLS listener is up
+    std::vector<std::unique_ptr<Worker>> workers;
     std::atomic<bool> running{false};
-    
+    TimeoutCounters timeoutCounters;
+    AdmissionController admission;
+    Router router;
+    std::unique_ptr<RateLimiter> rateLimiter;
+    RetryController retries;
+    MetricsRegistry metrics;
+    std::unique_ptr<AdminServer> admin;
+    std::unique_ptr<SlowRequestLog> slowRequests;
+    std::atomic<bool> slowRequestDumpRequested{false};
+    std::atomic<int> activeConnections{0};
+    std::unique_ptr<HotRestart> hotRestart;   // null unless hot restart is enabled
+    std::atomic<bool> draining{false};
+
     bool initializeNetworking();
     void cleanupNetworking();
-    void handleClient(SOCKET clientSocket);
-    std::pair<std::string, std::string> parseHttpRequest(const std::string& request);
-    std::string getClientIP(SOCKET clientSocket);
-    std::string forwardToBackend(const std::string& method, const std::string& path, 
-                                const std::string& headers, const std::string& clientIP);
-    std::string createHttpResponse(int statusCode, const std::string& body);
+    SOCKET createListenSocket(bool reusePort, int port, const ListenerSocketConfig& options);
+    bool openListeners(std::vector<SOCKET>& sockets, int count, bool reusePort, int port,
+                       const ListenerSocketConfig& options);
+    void keepListenersOnPort(std::vector<SOCKET>& sockets, int port);
+    void assignListeners(Worker& worker, int workerCount);
+    std::vector<int> workerCpus(int workerCount);
+    void steerListeners(const std::vector<int>& cpus);
+    void closeListenSockets();
+    void startAdmin();
+    void startDraining();
+    std::string exportStats() const;
+    void importStats(const std::string& stats);
 
 public:
     Server(Logger& log, LoadBalancer& lb);
     ~Server();
-    
+
     bool configure(const std::string& configFile);
     bool start();
     void stop();
+    void requestStop() { running.store(false); }  // async-signal-safe
     bool isRunning() const { return running.load(); }
+    // Hot restart handed the listeners on: finish what is in flight, keep nothing alive
+    bool isDraining() const { return draining.load(std::memory_order_relaxed); }
+    const std::atomic<bool>& getRunningFlag() const { return running; }
     const Config& getConfig() const { return config; }
+
+    Logger& getLogger() { return logger; }
+    LoadBalancer& getLoadBalancer() { return loadBalancer; }
+    TimeoutCounters& getTimeoutCounters() { return timeoutCounters; }
+    void printTimeoutCounters() const;
+    AdmissionController& getAdmission() { return admission; }
+    const Router& getRouter() const { return router; }
+    RateLimiter& getRateLimiter() { return *rateLimiter; }
+    void printRateLimitStatus() const;
+    RetryController& getRetryControl() { return retries; }
+    MetricsRegistry& getMetrics() { return metrics; }
+    TlsContext* getTls() { return tls.get(); }
+    StaticFiles& getStaticFiles() { return staticFiles; }
+    // Prometheus text exposition of every counter the server keeps
+    std::string renderMetrics();
+    // nullptr when tracing is disabled
+    SlowRequestLog* getSlowRequests() { return slowRequests.get(); }
+    void requestSlowRequestDump() { slowRequestDumpRequested.store(true); }  // async-signal-safe
+    void printSlowRequests() const;
+
+    // Enforces max_connections across all workers
+    bool tryAcquireConnection();
+    void releaseConnection() { activeConnections.fetch_sub(1, std::memory_order_relaxed); }
+
+    static std::string getClientIP(SOCKET clientSocket);
+    // Current address of a backend from the resolver cache; never blocks
+    bool resolveBackend(const BackendServer* backend, SocketAddress& address) const {
+        return resolver.lookup(loadBalancer.indexOf(backend), address);
+    }
 };
@@ -0,0 +1,44 @@
+#pragma once
+#include "Config.h"
+#include "Platform.h"
+
+class Logger;
+
+/**
+ * SocketTuning - the TCP options of listeners and backend connections
+ *
+ * Listener options are set once on the listening socket and inherited by
+ * every connection accepted from it (Linux copies the socket, buffer sizes
+ * and TCP_NODELAY included), so they cost no system call per connection:
+ * TCP_DEFER_ACCEPT keeps a connection in the kernel until its first bytes
+ * arrive, TCP_FASTOPEN lets a returning client's request ride in its SYN,
+ * SO_BUSY_POLL spins on the device queue instead of waiting for an
+ * interrupt. TCP_QUICKACK is the exception: the kernel falls back to
+ * delayed ACKs by itself, so it is set again after every read.
+ *
+ * Options the platform lacks are skipped; options it refuses are logged
+ * once per listener and otherwise ignored.
+ */
+class SocketTuning {
+public:
+    // Before listen(), or on a socket inherited already listening
+    static void applyListener(SOCKET socket, const ListenerSocketConfig& config, Logger& logger);
+    // Before connect()
+    static void applyUpstream(SOCKET socket, const UpstreamSocketConfig& config);
+    // Acknowledge what arrives next right away instead of after up to 40 ms
+    static void quickAck(SOCKET socket) {
+#ifdef TCP_QUICKACK
+        int on = 1;
+        setsockopt(socket, IPPROTO_TCP, TCP_QUICKACK, reinterpret_cast<char*>(&on), sizeof(on));
+#else
+        (void)socket;
+#endif
+    }
+
+    // accept4() where available: the socket arrives non-blocking and
+    // close-on-exec without two more system calls
+    static SOCKET accept(SOCKET listener, sockaddr* address, socklen_t* length);
+
+    // Warns about system settings that would silently turn an option off
+    static void checkSystem(const SocketConfig& config, bool tlsListener, Logger& logger);
+};
@@ -0,0 +1,170 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include "Config.h"
+#include "Http.h"
+#include "Platform.h"
+
+class Logger;
+struct Route;
+
+/**
+ * Cache counters, shared by all workers
+ */
+struct StaticFileStats {
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+    std::atomic<uint64_t> evictions{0};
+    std::atomic<uint64_t> invalidations{0};   // entries dropped because the file changed
+};
+
+/**
+ * StaticFile - one open file and the stat results its responses are built
+ * from. Shared: a response still being sent keeps the descriptor (and the
+ * mapping) alive after the cache has dropped the entry.
+ */
+struct StaticFile {
+    StaticFile() : fd(-1), size(0), inode(0), modified(0), contentType(nullptr), data(nullptr) {}
+    ~StaticFile();
+
+    StaticFile(const StaticFile&) = delete;
+    StaticFile& operator=(const StaticFile&) = delete;
+
+    int fd;
+    uint64_t size;
+    uint64_t inode;
+    time_t modified;
+    std::string etag;              // quoted, from mtime and size
+    std::string lastModified;      // IMF-fixdate
+    const char* contentType;
+    const char* data;              // copy of a small file in its own mapping, otherwise nullptr
+};
+
+/**
+ * StaticResponse - how a static route answers one request: the status
+ * line and headers (Connection is added by the caller), then either a
+ * short text body or length bytes of file from offset.
+ */
+struct StaticResponse {
+    HttpHead head;
+    std::string body;
+    std::shared_ptr<const StaticFile> file;
+    uint64_t offset = 0;
+    uint64_t length = 0;
+};
+
+/**
+ * StaticFiles - serves static routes from disk. Files stay open in a
+ * bounded cache, split into shards with their own mutex and LRU order;
+ * a hit builds the response from the cached stat results without any
+ * open() or stat() call, and the body goes to the socket with sendfile(),
+ * so it is never copied through user space. Files up to mmap_max_kb are
+ * also read once into an anonymous mapping and sent from there: one
+ * send() with no page cache lookup, and the TLS and HTTP/2 paths, which
+ * need the bytes in memory, copy them without a pread(). Being a copy,
+ * the mapping cannot fault when the file is truncated underneath.
+ *
+ * Cached entries are dropped when inotify reports a change in their
+ * directory, from a background thread. Without inotify, a hit re-checks
+ * the file with stat() at most once a second.
+ *
+ * Each root is opened once, at configure, and files are opened beneath it
+ * (openat2 with RESOLVE_BENEATH, or one O_NOFOLLOW component at a time
+ * where that is missing), so a symlink cannot lead out of the root.
+ *
+ * GET and HEAD only, with single byte ranges and If-None-Match,
+ * If-Modified-Since and If-Range. Missing files are not cached.
+ */
+class StaticFiles {
+public:
+    enum class Range {
+        None,            // absent, malformed or several ranges: the whole file
+        Satisfiable,
+        Unsatisfiable
+    };
+
+    explicit StaticFiles(Logger& logger);
+    ~StaticFiles();
+
+    StaticFiles(const StaticFiles&) = delete;
+    StaticFiles& operator=(const StaticFiles&) = delete;
+
+    void configure(const Config& config);
+    // Starts watching for changes; nothing to do without static routes
+    void start();
+    void stop();
+
+    void respond(const Route& route, const HttpHead& request, StaticResponse& response);
+
+    // Up to length bytes of the file from offset, straight from the page
+    // cache into a non-blocking socket; behaves like send()
+    static long send(SOCKET socket, const StaticFile& file, uint64_t offset, size_t length);
+    // Copies file bytes, for encryption or framing; false on a read error
+    static bool read(const StaticFile& file, uint64_t offset, char* buffer, size_t length);
+
+    StaticFileStats& getStats() { return stats; }
+    size_t getCachedFiles() const;
+    void printStatus() const;
+
+    // Request path below the route prefix as a path relative to the root
+    // (query dropped, %XX decoded, index appended to directories); false
+    // when it would leave the root
+    static bool mapPath(const std::string& requestPath, size_t prefixLength, const std::string& index,
+                        std::string& relative);
+    // A Range header against a file of size bytes; first and last inclusive
+    static Range parseRange(const std::string& header, uint64_t size, uint64_t& first, uint64_t& last);
+
+private:
+    struct Entry {
+        std::shared_ptr<const StaticFile> file;
+        std::list<std::string>::iterator position;
+        bool watched;                   // its directory is watched; otherwise re-checked
+        uint64_t validatedMs;
+    };
+    struct Shard {
+        mutable std::mutex mutex;
+        std::list<std::string> order;   // least recently used first
+        std::unordered_map<std::string, Entry> files;
+        uint64_t generation = 0;        // bumped by every invalidation that may touch the shard
+    };
+
+    Logger& logger;
+    StaticFilesConfig config;
+    bool enabled;                       // some route is static
+    std::vector<std::unique_ptr<Shard>> shards;
+    size_t shardCapacity;
+    StaticFileStats stats;
+    std::unordered_map<std::string, int> roots;     // root -> directory descriptor, -1 when it cannot be opened
+
+    // inotify: one watch per directory holding a cached file
+    int notifyFd;
+    int wakeFds[2];                     // stop() writes to end the thread's poll
+    std::mutex watchMutex;
+    std::unordered_map<int, std::string> watches;   // descriptor -> directory
+    std::thread thread;
+
+    Shard& shardFor(const std::string& path);
+    // path is root/relative, the cache key; the file is opened as relative below root
+    std::shared_ptr<const StaticFile> lookup(const std::string& path, int root, const std::string& relative,
+                                             int& error);
+    std::shared_ptr<const StaticFile> open(const std::string& path, int root, const std::string& relative,
+                                           int& error);
+    void closeRoots();
+    // Watches the directory holding path; false when changes cannot be watched
+    bool watch(const std::string& path);
+    bool unchanged(const std::string& path, Entry& entry);
+    void run();
+    // Drops path, and everything below it when it is a directory
+    void invalidate(const std::string& path, bool directory);
+    void invalidateAll();
+
+    static void error(StaticResponse& response, int statusCode);
+};
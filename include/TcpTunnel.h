@@ -0,0 +1,139 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include "EventLoop.h"
+#include "TimerWheel.h"
+#include "Platform.h"
+
+class Worker;
+class Server;
+class Logger;
+class TlsStream;
+struct BackendServer;
+
+/**
+ * TcpTunnel - one client connection relayed byte for byte to a backend.
+ * In server.mode "tcp" nothing is parsed: the backend is picked by the
+ * LoadBalancer as soon as the client connects. An HTTP connection that a
+ * backend switched protocols on (101, e.g. WebSocket) is handed over with
+ * both sockets already open. Either way the two sockets are joined until
+ * both sides have finished sending.
+ *
+ * On Linux each direction moves through its own pipe with splice(), so
+ * payload never enters user space; elsewhere a bounded buffer is used.
+ * Either way a direction stops reading while its pipe or buffer is full,
+ * and an EOF is passed on as a write shutdown so half-closed protocols
+ * keep working.
+ *
+ * A client upgraded on the TLS listener keeps its TlsStream: what it sends
+ * is decrypted into a buffer, and what it receives is spliced straight
+ * into the socket when kernel TLS encrypts it, buffered otherwise.
+ */
+class TcpTunnel {
+public:
+    TcpTunnel(Worker& worker, SOCKET clientSocket);
+    // Takes over an upgraded connection: backend already counts it as active.
+    // The given bytes are sent ahead of anything relayed.
+    TcpTunnel(Worker& worker, SOCKET clientSocket, SOCKET upstreamSocket, BackendServer* backend,
+              std::string toClientData, std::string toBackendData, std::unique_ptr<TlsStream> clientTls = nullptr);
+    ~TcpTunnel();
+
+    TcpTunnel(const TcpTunnel&) = delete;
+    TcpTunnel& operator=(const TcpTunnel&) = delete;
+
+    // Starts relaying, after picking and connecting a backend if there is
+    // none yet; closes the tunnel on failure
+    void start();
+
+private:
+    class Endpoint : public IoHandler {
+    public:
+        Endpoint(TcpTunnel& t, bool upstreamSide) : tunnel(t), upstream(upstreamSide) {}
+        void onEvent(uint32_t events) override;
+    private:
+        TcpTunnel& tunnel;
+        bool upstream;
+    };
+
+    // One way of the relay: bytes read from one socket, queued, written to the other
+    struct Direction {
+        bool toBackend;
+        bool eof;            // reading side finished
+        bool shutDown;       // EOF passed on to the writing side
+        bool stalled;        // read would block with bytes queued; retried once some drain
+        size_t queued;       // bytes read but not yet written
+        uint64_t bytes;      // bytes written
+        std::string preamble;     // user-space bytes written before the queue
+        size_t preambleOffset;
+        bool spliced;        // queued in the pipe rather than the buffer
+#ifdef __linux__
+        int pipe[2];
+#endif
+        std::string buffer;
+        size_t offset;
+
+        explicit Direction(bool backendBound);
+        bool hasOutput() const { return queued > 0 || preambleOffset < preamble.size(); }
+    };
+
+    enum class Pump {
+        Idle,
+        Progress,
+        Failed
+    };
+
+    Worker& worker;
+    Server& server;
+    Logger& logger;
+    SOCKET clientSocket;
+    SOCKET upstreamSocket;
+    std::unique_ptr<TlsStream> tls;   // client side, when it came in over TLS
+    bool relayScheduled;              // TLS holds decrypted input; relay again
+    Endpoint clientEndpoint;
+    Endpoint upstreamEndpoint;
+    uint32_t clientEvents;
+    uint32_t upstreamEvents;
+    bool connecting;
+    bool relaying;
+    bool closed;
+
+    std::string clientIP;
+    BackendServer* backend;
+    size_t backendIndex;
+    std::string backendUrl;
+    std::vector<const BackendServer*> failed;   // backends that refused this client
+
+    Direction toBackend;
+    Direction toClient;
+    size_t capacity;         // per direction
+
+    TimerWheel::Timer timer;  // connect timeout, then idle timeout
+    uint64_t startUs;
+    uint64_t lastActivityMs;
+
+    BackendServer* pickBackend();
+    void connectBackend();
+    void connectFailed(const std::string& reason);
+    void onConnected();
+    void beginRelay();
+    void onEvent(bool upstream, uint32_t events);
+    void onTimer();
+
+    void relay();
+    Pump pump(Direction& direction, SOCKET from, SOCKET to);
+    // Reads up to the free space of direction's queue; bytes, 0 at EOF, or negative
+    long fill(Direction& direction, SOCKET from);
+    // Writes out direction's queue; bytes written or negative
+    long drain(Direction& direction, SOCKET to);
+    // recv()/send() through the client's TLS session where there is one
+    long receive(SOCKET from, char* buffer, size_t length);
+    long transmit(SOCKET to, const char* data, size_t length);
+    uint32_t wantedEvents(const Direction& reading, const Direction& writing) const;
+    bool setEvents(SOCKET socket, uint32_t& current, uint32_t wanted, Endpoint& endpoint);
+    void updateEvents();
+
+    void releaseBackend();
+    void close();
+};
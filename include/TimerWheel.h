@@ -0,0 +1,80 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+
+/**
+ * Hierarchical timing wheel (one per event loop, not thread-safe)
+ * Timers are intrusive list nodes embedded in their owner, so arming and
+ * cancelling are O(1) pointer updates with no allocation. Level 0 has 256
+ * one-tick slots; three 64-slot levels above it cover ~7.7 days at 10 ms
+ * ticks, and entries cascade down as the wheel turns.
+ */
+class TimerWheel {
+public:
+    class Timer {
+    public:
+        Timer() = default;
+        explicit Timer(std::function<void()> cb) : callback(std::move(cb)) {}
+        ~Timer() { cancel(); }
+
+        Timer(const Timer&) = delete;
+        Timer& operator=(const Timer&) = delete;
+
+        void setCallback(std::function<void()> cb) { callback = std::move(cb); }
+        bool isArmed() const { return next != nullptr; }
+        void cancel();
+
+    private:
+        friend class TimerWheel;
+        Timer* prev = nullptr;
+        Timer* next = nullptr;
+        TimerWheel* wheel = nullptr;
+        uint64_t expiry = 0;
+        std::function<void()> callback;
+    };
+
+    explicit TimerWheel(uint64_t startMs = 0, uint32_t tickMs = 10);
+    ~TimerWheel();
+
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+    // (Re)arm timer to fire delayMs from the wheel's current time
+    void schedule(Timer& timer, uint64_t delayMs);
+
+    // Turn the wheel up to nowMs, firing every timer that expired on the way
+    size_t advance(uint64_t nowMs);
+
+    // Milliseconds from nowMs until the next timer may fire, or -1 when nothing is armed
+    int nextTimeoutMs(uint64_t nowMs) const;
+
+    size_t size() const { return armedCount; }
+    uint32_t getTickMs() const { return tickMs; }
+
+private:
+    static constexpr int kLevel0Bits = 8;
+    static constexpr int kLevelBits = 6;
+    static constexpr int kLevels = 4;
+    static constexpr size_t kLevel0Size = size_t(1) << kLevel0Bits;
+    static constexpr size_t kLevelSize = size_t(1) << kLevelBits;
+
+    struct Slot {
+        Timer head;
+        Slot() { head.prev = head.next = &head; }
+        bool empty() const { return head.next == &head; }
+    };
+
+    Slot level0[kLevel0Size];
+    Slot levels[kLevels - 1][kLevelSize];
+
+    uint64_t currentTick;
+    uint64_t startMs;
+    uint32_t tickMs;
+    size_t armedCount;
+
+    void insert(Timer& timer);
+    void unlink(Timer& timer);
+    void cascade(int level, size_t index);
+    static void spliceInto(Slot& from, Slot& to);
+};
@@ -0,0 +1,161 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include "Config.h"
+#include "Platform.h"
+
+class Logger;
+
+// OpenSSL types, kept out of every file that includes this header
+struct ssl_st;
+struct ssl_ctx_st;
+struct ssl_session_st;
+
+/**
+ * Handshake and session counters, shared by all workers
+ */
+struct TlsStats {
+    std::atomic<uint64_t> fullHandshakes{0};
+    std::atomic<uint64_t> resumedHandshakes{0};
+    std::atomic<uint64_t> failedHandshakes{0};
+    std::atomic<uint64_t> kernelSend{0};      // connections whose records the kernel encrypts
+    std::atomic<uint64_t> kernelReceive{0};   // ... and decrypts
+    std::atomic<uint64_t> cacheHits{0};
+    std::atomic<uint64_t> cacheMisses{0};
+    std::atomic<uint64_t> cacheStores{0};
+    std::atomic<uint64_t> cacheEvictions{0};
+};
+
+/**
+ * TlsSessionCache - server-side sessions for resumption by session id (and
+ * TLS 1.3 stateful tickets), shared by every worker. Split into shards,
+ * each with its own mutex and LRU order, so handshakes on different
+ * workers rarely meet on a lock. Holds one reference per stored session.
+ */
+class TlsSessionCache {
+public:
+    TlsSessionCache(size_t capacity, size_t shardCount, TlsStats& stats);
+    ~TlsSessionCache();
+
+    TlsSessionCache(const TlsSessionCache&) = delete;
+    TlsSessionCache& operator=(const TlsSessionCache&) = delete;
+
+    // Takes over the caller's reference to the session
+    void store(ssl_session_st* session);
+    // Returns the session with a reference added for the caller, or nullptr
+    ssl_session_st* lookup(const unsigned char* id, size_t length);
+    void remove(const unsigned char* id, size_t length);
+    size_t size() const;
+
+private:
+    struct Entry {
+        ssl_session_st* session;
+        std::list<std::string>::iterator position;
+    };
+    struct Shard {
+        mutable std::mutex mutex;
+        std::list<std::string> order;   // least recently used first
+        std::unordered_map<std::string, Entry> sessions;
+    };
+
+    std::vector<std::unique_ptr<Shard>> shards;
+    size_t shardCapacity;
+    TlsStats& stats;
+
+    Shard& shardFor(const std::string& id);
+};
+
+/**
+ * TlsContext - certificate, key and settings for the TLS listener: one
+ * SSL_CTX shared by all workers, so session tickets issued on one worker
+ * resume on any other.
+ */
+class TlsContext {
+public:
+    // nullptr (after logging why) when the certificate or key cannot be
+    // loaded, or the build has no TLS support. offerHttp2 adds "h2" to the
+    // protocols selected in ALPN, ahead of "http/1.1".
+    static std::unique_ptr<TlsContext> create(const TlsConfig& config, Logger& logger, bool offerHttp2 = false);
+    ~TlsContext();
+
+    TlsContext(const TlsContext&) = delete;
+    TlsContext& operator=(const TlsContext&) = delete;
+
+    // New server-side session on an accepted socket; nullptr on failure
+    ssl_st* newSession(SOCKET socket);
+
+    TlsStats& getStats() { return stats; }
+    size_t getCachedSessions() const { return cache ? cache->size() : 0; }
+    bool isKernelTlsEnabled() const { return config.ktls; }
+    void printStatus() const;
+
+private:
+    TlsContext(const TlsConfig& config, Logger& logger, bool offerHttp2);
+
+    TlsConfig config;
+    Logger& logger;
+    bool offerHttp2;
+    ssl_ctx_st* context;
+    TlsStats stats;
+    std::unique_ptr<TlsSessionCache> cache;   // null when session_cache_size is 0
+
+    bool initialize();
+
+    static int onNewSession(ssl_st* ssl, ssl_session_st* session);
+    static ssl_session_st* onGetSession(ssl_st* ssl, const unsigned char* id, int length, int* copy);
+    static void onRemoveSession(ssl_ctx_st* ctx, ssl_session_st* session);
+    static int onSelectProtocol(ssl_st* ssl, const unsigned char** out, unsigned char* outLength,
+                                const unsigned char* in, unsigned int inLength, void* arg);
+};
+
+/**
+ * TlsStream - one TLS connection on a non-blocking socket. read() and
+ * write() behave like recv()/send(): a byte count, 0 at the end of the
+ * stream, or -1 with the socket error set (would-block while the record
+ * layer waits on the socket). Once the handshake is done the kernel may
+ * have taken over record encryption (kTLS), in which case bytes can be
+ * spliced straight into the socket.
+ */
+class TlsStream {
+public:
+    enum class Handshake {
+        Done,
+        WantRead,
+        WantWrite,
+        Failed
+    };
+
+    TlsStream(TlsContext& context, SOCKET socket);
+    ~TlsStream();
+
+    TlsStream(const TlsStream&) = delete;
+    TlsStream& operator=(const TlsStream&) = delete;
+
+    bool isValid() const { return ssl != nullptr; }
+    Handshake handshake();
+    long read(char* buffer, size_t length);
+    long write(const char* data, size_t length);
+    // Sends close_notify, best effort
+    void shutdown();
+
+    // Decrypted bytes held by the library, invisible to socket readiness
+    bool hasPending() const;
+    bool isResumed() const;
+    bool sendsInKernel() const;
+    bool receivesInKernel() const;
+    std::string describe() const;   // protocol and cipher, after the handshake
+    std::string selectedProtocol() const;   // ALPN result; empty when none was negotiated
+
+private:
+    TlsContext& context;
+    ssl_st* ssl;
+    bool established;
+
+    long failed(int result);
+};
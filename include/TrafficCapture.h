@@ -0,0 +1,102 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include "Config.h"
+
+class Logger;
+
+/**
+ * Capture file format (native byte order)
+ * A segment starts with a CaptureFileHeader, followed by records, each a
+ * CaptureRecord and the raw request head, padded to 8 bytes. Segments are
+ * preallocated and zero-filled, so a record size of 0 marks the end of a
+ * segment that was not closed cleanly.
+ */
+struct CaptureFileHeader {
+    char magic[8];              // "RPCAP01"
+    uint32_t version;
+    uint32_t headerSize;
+    uint64_t createdUnixUs;     // wall clock when the segment was opened
+    uint64_t createdMonotonicUs; // the same moment on the records' clock
+    uint32_t worker;
+    uint32_t segment;
+    uint8_t reserved[24];
+};
+
+struct CaptureRecord {
+    uint32_t size;              // whole record, head and padding included
+    uint32_t headLength;
+    uint64_t timestampUs;       // first request byte, monotonic (shared by all workers)
+    uint64_t connectionId;      // unique per client connection in this process
+    uint32_t requestIndex;      // position of the request on its connection
+    uint32_t flags;
+    uint64_t bodyLength;
+};
+
+enum CaptureFlags : uint32_t {
+    CaptureChunkedBody = 1
+};
+
+/**
+ * TrafficCapture - per-worker writer of sampled request heads
+ * Sampling is per connection, so a sampled connection keeps all of its
+ * requests and replay can reproduce connection reuse. Records are appended
+ * with a memcpy into an mmap'd segment; full segments are trimmed and the
+ * oldest ones deleted beyond the configured count. Single-threaded: each
+ * worker owns one. Linux/POSIX only; disabled on Windows.
+ */
+class TrafficCapture {
+public:
+    TrafficCapture(const CaptureConfig& config, int worker, Logger& logger);
+    ~TrafficCapture();
+
+    TrafficCapture(const TrafficCapture&) = delete;
+    TrafficCapture& operator=(const TrafficCapture&) = delete;
+
+    // Id for a new connection, or 0 when it is not sampled
+    uint64_t sampleConnection();
+    void record(uint64_t connectionId, uint32_t requestIndex, uint64_t timestampUs,
+                const char* head, size_t headLength, long long bodyLength);
+
+    uint64_t getRecorded() const { return recorded; }
+    uint64_t getDropped() const { return dropped; }
+
+private:
+    CaptureConfig config;
+    int worker;
+    Logger& logger;
+    uint64_t random;
+    uint64_t nextConnection;
+    uint64_t recorded;
+    uint64_t dropped;
+
+    int fd;
+    char* mapping;
+    size_t mappingSize;
+    size_t used;
+    uint32_t segment;
+    std::vector<std::string> segments;   // oldest first
+
+    bool openSegment();
+    void closeSegment();
+};
+
+/**
+ * A captured request, read back for replay
+ */
+struct CapturedRequest {
+    uint64_t timestampUs;
+    uint64_t connectionId;
+    uint32_t requestIndex;
+    uint32_t flags;
+    uint64_t bodyLength;
+    std::string head;
+};
+
+namespace CaptureReader {
+    // Appends every record of one segment file; false if it is not a capture
+    bool readSegment(const std::string& path, std::vector<CapturedRequest>& requests, std::string& error);
+}
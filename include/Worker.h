@@ -0,0 +1,151 @@
+#pragma once
+#include <thread>
+#include <list>
+#include <memory>
+#include <unordered_set>
+#include <vector>
+#include "EventLoop.h"
+#include "AdmissionControl.h"
+#include "Metrics.h"
+#include "TrafficCapture.h"
+#include "Coroutine.h"
+#include "Http2.h"
+#include "Platform.h"
+
+class Server;
+class Connection;
+class TcpTunnel;
+class Http2Session;
+
+/**
+ * Worker - one event loop thread with its own listening sockets (usually
+ * one, plus one for TLS when enabled; more after a hot restart that
+ * inherited extra sockets)
+ * Accepts clients and owns every Connection (or, in TCP mode, TcpTunnel)
+ * created on its loop. TLS clients are always served by Connection, until
+ * a connection switches to HTTP/2 and becomes an Http2Session.
+ */
+class Worker {
+public:
+    Worker(Server& server, int id);
+    ~Worker();
+
+    Worker(const Worker&) = delete;
+    Worker& operator=(const Worker&) = delete;
+
+    // Before start(); the socket stays owned by the Server
+    void addListener(SOCKET listenSocket, bool tls);
+    // Before start(): the thread runs on this CPU only
+    void pinTo(int cpuIndex) { cpu = cpuIndex; }
+    bool start();
+    void join();
+
+    // Hot restart, from any thread: stop accepting, let busy connections
+    // finish their current request and idle keep-alive ones send one more
+    // within kDrainIdleGraceMs
+    void startDraining();
+    static constexpr uint64_t kDrainIdleGraceMs = 1000;
+
+    // clientSocket must already be non-blocking
+    void handleClient(SOCKET clientSocket, bool tls = false);
+    void release(Connection* connection);
+    void release(TcpTunnel* tunnel);
+    // Takes ownership of a new tunnel (TCP mode or an upgraded connection) and starts it
+    void adoptTunnel(TcpTunnel* tunnel);
+    void release(Http2Session* session);
+    // Takes ownership of a connection that switched to HTTP/2 and starts it
+    void adoptSession(Http2Session* session);
+
+    // Admission wait queues: requests waiting for an in-flight slot, one
+    // queue per priority class
+    using QueuePosition = std::list<Connection*>::iterator;
+    bool hasQueuedRequests() const { return queuedRequests > 0; }
+    bool enqueue(Connection* connection, size_t priorityClass, QueuePosition& position);
+    void dequeue(size_t priorityClass, QueuePosition position);
+    void scheduleQueueDrain();
+
+    EventLoop& getLoop() { return loop; }
+    MetricsShard& getMetrics() { return metrics; }
+    TrafficCapture* getCapture() { return capture.get(); }
+    const FramePool& getFramePool() const { return framePool; }
+    Http2StreamPool& getStreamPool() { return streamPool; }
+    Server& getServer() { return server; }
+    int getId() const { return id; }
+    size_t getConnectionCount() const { return connections.size() + tunnels.size() + sessions.size(); }
+
+#ifdef PROXY_HAS_COROUTINES
+    // Coroutine clients waiting for their next keep-alive request
+    void watchIdle(AsyncSocket& client) { idleClients.insert(&client); }
+    void unwatchIdle(AsyncSocket& client) { idleClients.erase(&client); }
+#endif
+
+private:
+    class Acceptor : public IoHandler {
+    public:
+        Acceptor(Worker& w, SOCKET listener, bool tlsListener) : worker(w), socket(listener), tls(tlsListener) {}
+        void onEvent(uint32_t events) override;
+        SOCKET getSocket() const { return socket; }
+    private:
+        Worker& worker;
+        SOCKET socket;
+        bool tls;
+    };
+
+    Server& server;
+    int id;
+    int cpu;                  // -1: not pinned
+    EventLoop loop;
+    std::vector<std::unique_ptr<Acceptor>> acceptors;
+    bool accepting;           // listeners registered with the loop
+    MetricsShard& metrics;
+    std::unique_ptr<TrafficCapture> capture;   // null unless capture is enabled
+    std::thread thread;
+    std::unordered_set<Connection*> connections;
+    std::unordered_set<TcpTunnel*> tunnels;
+    std::unordered_set<Http2Session*> sessions;
+    Http2StreamPool streamPool;
+    bool tcpMode;
+
+    // Deficit round-robin over the classes: a class's turn lasts for weight
+    // dispatches, so with every class backlogged each gets slots in
+    // proportion to its weight, and a class with nothing queued gives its
+    // turn away
+    struct ClassQueue {
+        ClassQueue(const PriorityClassConfig& config, int intervalMs)
+            : codel(static_cast<uint64_t>(config.queueTargetMs), static_cast<uint64_t>(intervalMs)),
+              weight(config.weight), deadlineMs(static_cast<uint64_t>(config.deadlineMs)),
+              capacity(static_cast<size_t>(config.queueSize)), deficit(0) {}
+
+        std::list<Connection*> waiting;
+        CoDelState codel;
+        int weight;
+        uint64_t deadlineMs;
+        size_t capacity;
+        int deficit;             // dispatches left in this class's turn
+    };
+    std::vector<ClassQueue> queues;
+    size_t queuedRequests;
+    size_t currentClass;         // whose turn it is
+    TimerWheel::Timer queueTimer;
+    bool drainScheduled;
+
+    // Coroutine pipeline: one task per client, frames from this worker's pool
+    bool coroutinePipeline;
+    FramePool framePool;
+#ifdef PROXY_HAS_COROUTINES
+    TaskGroup tasks;
+    std::unordered_set<AsyncSocket*> idleClients;
+    TimerWheel::Timer idleDrainTimer;
+    void closeIdleClients();
+#endif
+
+    void run();
+    void stopAccepting();
+    void drainClients();
+    void acceptConnections(SOCKET listener, bool tls);
+    void rejectClient(SOCKET clientSocket, bool tls);
+    void drainQueue();
+    // Drops heads that waited past their deadline, or past the CoDel target while shedding
+    void expireQueued(size_t priorityClass, uint64_t now);
+    void updateQueueGauges(size_t priorityClass);
+};
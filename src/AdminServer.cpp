@@ -0,0 +1,204 @@
+#include "AdminServer.h"
+#include "Config.h"
+#include "Logger.h"
+#include "Http.h"
+
+AdminServer::AdminServer(Logger& log)
+    : logger(log), listenSocket(INVALID_SOCKET), acceptor(*this), runningFlag(nullptr) {
+}
+
+AdminServer::~AdminServer() {
+    join();
+}
+
+void AdminServer::addEndpoint(const std::string& path, const std::string& contentType, Handler handler) {
+    endpoints[path] = Endpoint{contentType, std::move(handler)};
+}
+
+bool AdminServer::start(const AdminConfig& config, const std::atomic<bool>& running) {
+    if (!loop.isValid()) {
+        logger.error("Admin: failed to create event loop");
+        return false;
+    }
+
+    listenSocket = socket(AF_INET, SOCK_STREAM, 0);
+    if (listenSocket == INVALID_SOCKET) {
+        logger.error("Admin: failed to create socket");
+        return false;
+    }
+
+    int opt = 1;
+    setsockopt(listenSocket, SOL_SOCKET, SO_REUSEADDR, (char*)&opt, sizeof(opt));
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<uint16_t>(config.port));
+    if (inet_pton(AF_INET, config.address.c_str(), &addr.sin_addr) != 1 ||
+        bind(listenSocket, (sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR ||
+        listen(listenSocket, 64) == SOCKET_ERROR || !setNonBlocking(listenSocket) ||
+        !loop.add(listenSocket, EventLoop::Readable, &acceptor)) {
+        logger.error("Admin: failed to listen on " + config.address + ":" + std::to_string(config.port));
+        closesocket(listenSocket);
+        listenSocket = INVALID_SOCKET;
+        return false;
+    }
+
+    runningFlag = &running;
+    thread = std::thread(&AdminServer::run, this);
+    logger.info("Admin endpoints listening on " + config.address + ":" + std::to_string(config.port));
+    return true;
+}
+
+void AdminServer::join() {
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+void AdminServer::run() {
+    loop.run(*runningFlag);
+
+    std::unordered_set<Session*> remaining;
+    remaining.swap(sessions);
+    for (Session* session : remaining) {
+        session->close();
+        delete session;
+    }
+    loop.remove(listenSocket);
+    closesocket(listenSocket);
+    listenSocket = INVALID_SOCKET;
+}
+
+void AdminServer::Acceptor::onEvent(uint32_t events) {
+    if (events & EventLoop::Readable) {
+        server.acceptSessions();
+    }
+}
+
+void AdminServer::acceptSessions() {
+    while (true) {
+        SOCKET clientSocket = accept(listenSocket, nullptr, nullptr);
+        if (clientSocket == INVALID_SOCKET) {
+            if (isInterrupted(lastSocketError())) continue;
+            return;
+        }
+
+        Session* session = new Session(*this, clientSocket);
+        if (!setNonBlocking(clientSocket) || !loop.add(clientSocket, EventLoop::Readable, session)) {
+            closesocket(clientSocket);
+            delete session;
+            continue;
+        }
+        sessions.insert(session);
+    }
+}
+
+void AdminServer::release(Session* session) {
+    if (sessions.erase(session) == 0) return;
+    session->close();
+    loop.defer([session] { delete session; });
+}
+
+AdminServer::Session::Session(AdminServer& s, SOCKET fd)
+    : server(s), socket(fd), outputOffset(0), responding(false) {
+    timer.setCallback([this] { server.release(this); });
+    server.loop.timers().schedule(timer, kSessionTimeoutMs);
+}
+
+void AdminServer::Session::close() {
+    timer.cancel();
+    if (socket != INVALID_SOCKET) {
+        server.loop.remove(socket);
+        closesocket(socket);
+        socket = INVALID_SOCKET;
+    }
+}
+
+void AdminServer::Session::onEvent(uint32_t events) {
+    if (socket == INVALID_SOCKET) return;
+    if (events & EventLoop::Closed) {
+        server.release(this);
+        return;
+    }
+    if (responding) {
+        flush();
+        return;
+    }
+
+    char buffer[4096];
+    bool finished = false;
+    while (input.size() < kMaxRequest) {
+        int received = recv(socket, buffer, sizeof(buffer), 0);
+        if (received > 0) {
+            input.append(buffer, received);
+            continue;
+        }
+        if (received < 0 && isInterrupted(lastSocketError())) continue;
+        if (received < 0 && isWouldBlock(lastSocketError())) break;
+        if (received < 0 || input.empty()) {
+            server.release(this);
+            return;
+        }
+        finished = true;   // peer shut down its side after sending
+        break;
+    }
+
+    HttpHead request;
+    ParseResult result = Http::parseRequestHead(input.data(), input.size(), request);
+    if (result == ParseResult::Incomplete && !finished && input.size() < kMaxRequest) return;
+    respond();
+}
+
+void AdminServer::Session::respond() {
+    HttpHead request;
+    ParseResult result = Http::parseRequestHead(input.data(), input.size(), request);
+
+    std::string status = "200 OK";
+    std::string contentType = "text/plain; charset=utf-8";
+    std::string body;
+    if (result != ParseResult::Complete) {
+        status = "400 Bad Request";
+        body = "Bad Request\n";
+    } else {
+        std::string path = request.path.substr(0, request.path.find('?'));
+        auto endpoint = server.endpoints.find(path);
+        if (endpoint == server.endpoints.end()) {
+            status = "404 Not Found";
+            body = "Endpoints:";
+            for (const auto& entry : server.endpoints) {
+                body += " " + entry.first;
+            }
+            body += "\n";
+        } else if (request.method != "GET" && request.method != "HEAD") {
+            status = "405 Method Not Allowed";
+            body = "Method Not Allowed\n";
+        } else {
+            contentType = endpoint->second.contentType;
+            body = endpoint->second.handler();
+            if (request.method == "HEAD") body.clear();
+        }
+    }
+
+    output = "HTTP/1.1 " + status + "\r\nContent-Type: " + contentType +
+             "\r\nContent-Length: " + std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+    responding = true;
+    flush();
+}
+
+void AdminServer::Session::flush() {
+    while (outputOffset < output.size()) {
+        int sent = send(socket, output.data() + outputOffset, static_cast<int>(output.size() - outputOffset), MSG_NOSIGNAL);
+        if (sent > 0) {
+            outputOffset += static_cast<size_t>(sent);
+            continue;
+        }
+        int error = lastSocketError();
+        if (sent < 0 && isInterrupted(error)) continue;
+        if (sent < 0 && isWouldBlock(error)) {
+            server.loop.modify(socket, EventLoop::Writable, this);
+            return;
+        }
+        break;
+    }
+    server.release(this);
+}
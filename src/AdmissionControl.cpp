@@ -0,0 +1,321 @@
+#include "AdmissionControl.h"
+#include "Config.h"
+#include "LoadBalancer.h"
+#include "Http.h"
+#include "Platform.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+namespace {
+
+// Long-term latency baseline is an EMA over roughly this many samples
+constexpr double kLongWindow = 600.0;
+// Latency may exceed the baseline by this factor before the limit shrinks
+constexpr double kRttTolerance = 1.5;
+// Fraction of each new estimate blended into the limit
+constexpr double kSmoothing = 0.2;
+// Multiplicative decrease once per window with failures or timeouts
+constexpr double kBackoffRatio = 0.9;
+// Samples folded into the limit at a time
+constexpr uint32_t kWindowSamples = 16;
+
+std::string trim(const std::string& value) {
+    size_t first = value.find_first_not_of(" \t");
+    if (first == std::string::npos) return std::string();
+    return value.substr(first, value.find_last_not_of(" \t") - first + 1);
+}
+
+// Comma-separated list with blanks trimmed and empty entries dropped
+std::vector<std::string> splitList(const std::string& list) {
+    std::vector<std::string> items;
+    std::istringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        item = trim(item);
+        if (!item.empty()) items.push_back(item);
+    }
+    return items;
+}
+
+} // namespace
+
+ConcurrencyLimiter::ConcurrencyLimiter(const Settings& s)
+    : settings(s), inFlight(0), windowSamples(0), windowDrops(0), windowLatencyUs(0), windowPeakInFlight(0),
+      updating(false), longRttUs(0.0) {
+    int initial = std::max(settings.minLimit, std::min(settings.initialLimit, settings.maxLimit));
+    if (!settings.adaptive) {
+        initial = settings.maxLimit;
+    }
+    limit.store(initial);
+    estimatedLimit = initial;
+}
+
+bool ConcurrencyLimiter::tryAcquire() {
+    int current = inFlight.load(std::memory_order_relaxed);
+    while (current < limit.load(std::memory_order_relaxed)) {
+        if (inFlight.compare_exchange_weak(current, current + 1, std::memory_order_acq_rel)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void ConcurrencyLimiter::release(uint64_t latencyUs, bool dropped) {
+    int inFlightAtRelease = inFlight.fetch_sub(1, std::memory_order_acq_rel);
+    if (settings.adaptive) {
+        addSample(latencyUs, dropped, inFlightAtRelease);
+    }
+}
+
+void ConcurrencyLimiter::releaseWithoutSample() {
+    inFlight.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+void ConcurrencyLimiter::addSample(uint64_t latencyUs, bool dropped, int inFlightAtRelease) {
+    if (dropped) {
+        windowDrops.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        windowLatencyUs.fetch_add(latencyUs > 0 ? latencyUs : 1, std::memory_order_relaxed);
+    }
+    int peak = windowPeakInFlight.load(std::memory_order_relaxed);
+    while (inFlightAtRelease > peak &&
+           !windowPeakInFlight.compare_exchange_weak(peak, inFlightAtRelease, std::memory_order_relaxed)) {
+    }
+
+    if (windowSamples.fetch_add(1, std::memory_order_relaxed) + 1 < kWindowSamples) return;
+    // Whoever closes the window folds it; a release racing it just adds to the next one
+    if (updating.exchange(true, std::memory_order_acquire)) return;
+    updateLimit();
+    updating.store(false, std::memory_order_release);
+}
+
+void ConcurrencyLimiter::updateLimit() {
+    uint32_t samples = windowSamples.exchange(0, std::memory_order_relaxed);
+    if (samples < kWindowSamples) return;   // folded by the previous holder already
+    uint32_t drops = std::min(windowDrops.exchange(0, std::memory_order_relaxed), samples);
+    uint64_t latencyUs = windowLatencyUs.exchange(0, std::memory_order_relaxed);
+    int peakInFlight = windowPeakInFlight.exchange(0, std::memory_order_relaxed);
+
+    uint32_t successes = samples - drops;
+    double sample = successes > 0 ? static_cast<double>(latencyUs) / successes : 0.0;
+    if (successes > 0) {
+        if (longRttUs == 0.0) {
+            longRttUs = sample;
+        } else {
+            longRttUs += (sample - longRttUs) * std::min(1.0, successes / kLongWindow);
+        }
+        // Let the baseline catch up quickly after a latency drop
+        if (longRttUs / sample > 2.0) {
+            longRttUs *= 0.95;
+        }
+    }
+
+    if (drops > 0) {
+        estimatedLimit = std::max<double>(settings.minLimit, estimatedLimit * kBackoffRatio);
+        limit.store(static_cast<int>(estimatedLimit), std::memory_order_relaxed);
+        return;
+    }
+
+    // Don't grow a limit the traffic isn't using
+    if (peakInFlight < estimatedLimit / 2) {
+        return;
+    }
+
+    double gradient = std::max(0.5, std::min(1.0, kRttTolerance * longRttUs / sample));
+    double queueAllowance = std::sqrt(estimatedLimit);
+    double target = estimatedLimit * gradient + queueAllowance;
+
+    estimatedLimit = estimatedLimit * (1.0 - kSmoothing) + target * kSmoothing;
+    estimatedLimit = std::max<double>(settings.minLimit, std::min<double>(settings.maxLimit, estimatedLimit));
+    limit.store(static_cast<int>(estimatedLimit), std::memory_order_relaxed);
+}
+
+CoDelState::CoDelState(uint64_t target, uint64_t interval)
+    : targetMs(target), intervalMs(interval), firstAboveMs(0), shedding(false) {
+}
+
+void CoDelState::update(uint64_t sojournMs, uint64_t nowMs) {
+    if (sojournMs < targetMs) {
+        firstAboveMs = 0;
+        shedding = false;
+        return;
+    }
+
+    if (firstAboveMs == 0) {
+        firstAboveMs = nowMs + intervalMs;
+    } else if (nowMs >= firstAboveMs) {
+        shedding = true;
+    }
+}
+
+AdmissionController::AdmissionController()
+    : enabled(false), loadBalancer(nullptr) {
+    globalLimiter.reset(new ConcurrencyLimiter(ConcurrencyLimiter::Settings()));
+    classifier.configure(AdmissionConfig());
+    classStats.reset(new PriorityClassStats[1]);
+}
+
+void AdmissionController::configure(const Config& config, LoadBalancer& lb) {
+    const AdmissionConfig& admission = config.getAdmission();
+    enabled = admission.enabled;
+    loadBalancer = &lb;
+
+    ConcurrencyLimiter::Settings globalSettings;
+    globalSettings.adaptive = admission.adaptive;
+    globalSettings.initialLimit = admission.initialLimit;
+    globalSettings.minLimit = admission.minLimit;
+    globalSettings.maxLimit = admission.maxInFlight;
+    globalLimiter.reset(new ConcurrencyLimiter(globalSettings));
+
+    ConcurrencyLimiter::Settings backendSettings = globalSettings;
+    backendSettings.maxLimit = admission.backendMaxInFlight;
+
+    backendLimiters.clear();
+    for (size_t i = 0; i < lb.getBackendCount(); i++) {
+        backendLimiters.emplace_back(new ConcurrencyLimiter(backendSettings));
+    }
+
+    classifier.configure(admission);
+    classStats.reset(new PriorityClassStats[classifier.getClassCount()]);
+}
+
+void PriorityClassifier::configure(const AdmissionConfig& config) {
+    classes.clear();
+    matchesAddresses = false;
+    defaultClass = 0;
+
+    std::vector<PriorityClassConfig> configured = config.classes;
+    if (configured.empty()) {
+        // One class for everything: a single FIFO queue, as without classes
+        PriorityClassConfig everything;
+        everything.name = "default";
+        everything.deadlineMs = config.queueTimeoutMs;
+        everything.queueSize = config.queueSize;
+        everything.queueTargetMs = config.queueTargetMs;
+        configured.push_back(everything);
+    }
+
+    for (const PriorityClassConfig& priorityClass : configured) {
+        Class entry;
+        entry.config = priorityClass;
+        entry.paths = splitList(priorityClass.paths);
+        size_t colon = priorityClass.header.find(':');
+        entry.headerName = trim(priorityClass.header.substr(0, colon));
+        if (colon != std::string::npos) entry.headerValue = trim(priorityClass.header.substr(colon + 1));
+        parseNetworks(priorityClass.cidrs, entry.networks);
+        matchesAddresses = matchesAddresses || !entry.networks.empty();
+        if (priorityClass.name == config.defaultClass) defaultClass = classes.size();
+        classes.push_back(entry);
+    }
+    if (config.defaultClass.empty()) defaultClass = classes.size() - 1;
+}
+
+size_t PriorityClassifier::classify(const HttpHead& request, const std::string& clientIP) const {
+    if (classes.size() == 1) return 0;
+
+    // The address is parsed once, and only when some class needs it
+    int family = 0;
+    unsigned char address[16] = {};
+    if (matchesAddresses) {
+        if (inet_pton(AF_INET, clientIP.c_str(), address) == 1) {
+            family = AF_INET;
+        } else if (inet_pton(AF_INET6, clientIP.c_str(), address) == 1) {
+            family = AF_INET6;
+            static const unsigned char kMappedPrefix[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+            if (std::memcmp(address, kMappedPrefix, sizeof(kMappedPrefix)) == 0) {
+                std::memmove(address, address + 12, 4);
+                family = AF_INET;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < classes.size(); i++) {
+        const Class& candidate = classes[i];
+        for (const std::string& prefix : candidate.paths) {
+            if (request.path.compare(0, prefix.length(), prefix) == 0) return i;
+        }
+        if (!candidate.headerName.empty()) {
+            const std::string* value = request.findHeader(candidate.headerName);
+            if (value != nullptr && (candidate.headerValue.empty() || *value == candidate.headerValue)) return i;
+        }
+        for (const Network& network : candidate.networks) {
+            if (contains(network, family, address)) return i;
+        }
+    }
+    return defaultClass;
+}
+
+bool PriorityClassifier::parseNetworks(const std::string& list, std::vector<Network>& networks) {
+    networks.clear();
+    for (const std::string& item : splitList(list)) {
+        Network network;
+        std::memset(network.address, 0, sizeof(network.address));
+        size_t slash = item.find('/');
+        std::string host = item.substr(0, slash);
+        if (inet_pton(AF_INET, host.c_str(), network.address) == 1) {
+            network.family = AF_INET;
+            network.prefixBits = 32;
+        } else if (inet_pton(AF_INET6, host.c_str(), network.address) == 1) {
+            network.family = AF_INET6;
+            network.prefixBits = 128;
+        } else {
+            return false;
+        }
+        if (slash != std::string::npos) {
+            std::string bits = item.substr(slash + 1);
+            char* end = nullptr;
+            long prefix = std::strtol(bits.c_str(), &end, 10);
+            if (bits.empty() || *end != '\0' || prefix < 0 || prefix > network.prefixBits) return false;
+            network.prefixBits = static_cast<int>(prefix);
+        }
+        networks.push_back(network);
+    }
+    return true;
+}
+
+bool PriorityClassifier::contains(const Network& network, int family, const unsigned char* address) {
+    if (family != network.family) return false;
+    int fullBytes = network.prefixBits / 8;
+    if (std::memcmp(network.address, address, static_cast<size_t>(fullBytes)) != 0) return false;
+    int remainingBits = network.prefixBits % 8;
+    if (remainingBits == 0) return true;
+    unsigned char mask = static_cast<unsigned char>(0xff << (8 - remainingBits));
+    return (network.address[fullBytes] & mask) == (address[fullBytes] & mask);
+}
+
+ConcurrencyLimiter* AdmissionController::getBackendLimiter(const BackendServer* backend) {
+    if (loadBalancer == nullptr || backend == nullptr) return nullptr;
+
+    size_t index = loadBalancer->indexOf(backend);
+    return index < backendLimiters.size() ? backendLimiters[index].get() : nullptr;
+}
+
+void AdmissionController::printStatus() const {
+    std::cout << "\n=== Admission Control ===" << std::endl;
+    std::cout << "Global limit: " << globalLimiter->getLimit()
+              << " (in flight: " << globalLimiter->getInFlight() << ")" << std::endl;
+    for (size_t i = 0; i < backendLimiters.size(); i++) {
+        const BackendServer* backend = loadBalancer->getBackend(i);
+        std::cout << "  " << backend->host << ":" << backend->port
+                  << " limit: " << backendLimiters[i]->getLimit()
+                  << " (in flight: " << backendLimiters[i]->getInFlight() << ")" << std::endl;
+    }
+    std::cout << "Admitted: " << stats.admitted.load() << std::endl;
+    std::cout << "Queued: " << stats.queued.load() << std::endl;
+    std::cout << "Rejected connections (max_connections): " << stats.rejectedConnections.load() << std::endl;
+    std::cout << "Rejected (queue full): " << stats.rejectedQueueFull.load() << std::endl;
+    std::cout << "Shed (queue over target): " << stats.shed.load() << std::endl;
+    std::cout << "Queue timeouts: " << stats.queueTimeouts.load() << std::endl;
+    for (size_t i = 0; i < classifier.getClassCount() && classifier.getClassCount() > 1; i++) {
+        const PriorityClassStats& counts = classStats[i];
+        std::cout << "  Class " << classifier.getClass(i).name << ": " << counts.admitted.load() << " admitted, "
+                  << counts.queued.load() << " queued, " << counts.rejectedQueueFull.load() << " queue full, "
+                  << counts.shed.load() << " shed, " << counts.queueTimeouts.load() << " past deadline"
+                  << std::endl;
+    }
+    std::cout << "=========================\n" << std::endl;
+}
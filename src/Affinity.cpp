@@ -0,0 +1,149 @@
+#include "Affinity.h"
+#include <algorithm>
+#include <cstdint>
+#include <sstream>
+#ifdef __linux__
+#include <sched.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <sys/syscall.h>
+#include <linux/filter.h>
+#endif
+
+namespace {
+
+#ifdef __linux__
+// From <numaif.h>, so the build needs no libnuma
+constexpr int kMpolDefault = 0;
+constexpr int kMpolPreferred = 1;
+constexpr size_t kMaskBits = 8 * sizeof(unsigned long);
+#endif
+
+bool parseCpu(const std::string& text, int& cpu) {
+    size_t begin = text.find_first_not_of(" \t");
+    size_t end = text.find_last_not_of(" \t");
+    if (begin == std::string::npos) return false;
+    cpu = 0;
+    for (size_t i = begin; i <= end; i++) {
+        if (text[i] < '0' || text[i] > '9') return false;
+        cpu = cpu * 10 + (text[i] - '0');
+        if (cpu >= CpuAffinity::kMaxCpus) return false;
+    }
+    return true;
+}
+
+} // namespace
+
+bool CpuAffinity::parseCpuList(const std::string& list, std::vector<int>& cpus) {
+    cpus.clear();
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        size_t dash = item.find('-');
+        int first = 0;
+        int last = 0;
+        if (!parseCpu(item.substr(0, dash), first)) return false;
+        if (dash == std::string::npos) {
+            last = first;
+        } else if (!parseCpu(item.substr(dash + 1), last) || last < first) {
+            return false;
+        }
+        for (int cpu = first; cpu <= last; cpu++) {
+            if (std::find(cpus.begin(), cpus.end(), cpu) == cpus.end()) {
+                cpus.push_back(cpu);
+            }
+        }
+    }
+    return !cpus.empty();
+}
+
+std::vector<int> CpuAffinity::allowedCpus() {
+    std::vector<int> cpus;
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE && cpu < kMaxCpus; cpu++) {
+            if (CPU_ISSET(cpu, &set)) cpus.push_back(cpu);
+        }
+    }
+#endif
+    return cpus;
+}
+
+int CpuAffinity::nodeOfCpu(int cpu) {
+    int node = -1;
+#ifdef __linux__
+    // sysfs links each CPU to its node as cpuN/nodeM
+    std::string path = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+    DIR* directory = opendir(path.c_str());
+    if (directory == nullptr) return -1;
+    while (dirent* entry = readdir(directory)) {
+        std::string name = entry->d_name;
+        if (name.size() > 4 && name.compare(0, 4, "node") == 0 &&
+            name.find_first_not_of("0123456789", 4) == std::string::npos) {
+            node = std::stoi(name.substr(4));
+            break;
+        }
+    }
+    closedir(directory);
+#else
+    (void)cpu;
+#endif
+    return node;
+}
+
+bool CpuAffinity::pinCurrentThread(int cpu) {
+#ifdef __linux__
+    if (cpu < 0 || cpu >= CPU_SETSIZE) return false;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void)cpu;
+    return false;
+#endif
+}
+
+bool CpuAffinity::setMemoryNode(int node) {
+#if defined(__linux__) && defined(SYS_set_mempolicy)
+    if (node < 0) {
+        return syscall(SYS_set_mempolicy, kMpolDefault, nullptr, 0) == 0;
+    }
+    if (node >= kMaxCpus) return false;
+    unsigned long mask[kMaxCpus / kMaskBits] = {};
+    mask[node / kMaskBits] |= 1UL << (node % kMaskBits);
+    // The kernel reads one bit fewer than maxnode
+    return syscall(SYS_set_mempolicy, kMpolPreferred, mask, kMaxCpus + 1) == 0;
+#else
+    (void)node;
+    return false;
+#endif
+}
+
+bool CpuAffinity::steerByCpu(const std::vector<SOCKET>& listeners, const std::vector<int>& cpus) {
+#if defined(__linux__) && defined(SO_ATTACH_REUSEPORT_CBPF)
+    size_t count = std::min(listeners.size(), cpus.size());
+    if (count < 2) return false;
+
+    // A = receiving CPU; one compare-and-return per listener
+    std::vector<sock_filter> program;
+    program.push_back(BPF_STMT(BPF_LD | BPF_W | BPF_ABS, static_cast<uint32_t>(SKF_AD_OFF + SKF_AD_CPU)));
+    for (size_t i = 0; i < count; i++) {
+        program.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, static_cast<uint32_t>(cpus[i]), 0, 1));
+        program.push_back(BPF_STMT(BPF_RET | BPF_K, static_cast<uint32_t>(i)));
+    }
+    // An index past the group makes the kernel pick by hash
+    program.push_back(BPF_STMT(BPF_RET | BPF_K, 0xffffffffu));
+
+    sock_fprog filter{};
+    filter.len = static_cast<unsigned short>(program.size());
+    filter.filter = program.data();
+    return setsockopt(listeners.front(), SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &filter, sizeof(filter)) == 0;
+#else
+    (void)listeners;
+    (void)cpus;
+    return false;
+#endif
+}
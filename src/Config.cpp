@@ -1,10 +1,32 @@
 #include "Config.h"
 #include "Logger.h"
+#include "Affinity.h"
+#include "AdmissionControl.h"
 #include <fstream>
 #include <sstream>
 #include <iostream>
 #include <algorithm>
 
+namespace {
+
+std::string describeBuffers(int sendKb, int receiveKb) {
+    if (sendKb == 0 && receiveKb == 0) return "autotuned";
+    return std::string("send ") + (sendKb > 0 ? std::to_string(sendKb) + "KB" : "auto") + ", receive " +
+           (receiveKb > 0 ? std::to_string(receiveKb) + "KB" : "auto");
+}
+
+std::string describeListener(const ListenerSocketConfig& listener) {
+    std::string text = std::string("nodelay ") + (listener.noDelay ? "on" : "off") + ", quickack " +
+                       (listener.quickAck ? "on" : "off") + ", defer accept " +
+                       (listener.deferAcceptS > 0 ? std::to_string(listener.deferAcceptS) + "s" : "off") +
+                       ", fast open " +
+                       (listener.fastOpenQueue > 0 ? "queue " + std::to_string(listener.fastOpenQueue) : "off");
+    if (listener.busyPollUs > 0) text += ", busy poll " + std::to_string(listener.busyPollUs) + "us";
+    return text + ", buffers " + describeBuffers(listener.sendBufferKb, listener.receiveBufferKb);
+}
+
+} // namespace
+
 Config::Config() {
     loadDefaults();
 }
@@ -45,6 +67,34 @@ void Config::loadDefaults() {
     maxConnections = 100;
     connectionTimeout = 30;
     keepAlive = true;
+    workerCount = 1;
+    mode = "http";
+    pipeline = "callback";
+    connectionBufferKb = 64;
+    
+    clientHeaderTimeout = connectionTimeout * 1000;
+    idleKeepAliveTimeout = connectionTimeout * 1000;
+    upstreamConnectTimeout = 5000;
+    upstreamFirstByteTimeout = 30000;
+    requestTimeout = 60000;
+    tunnelIdleTimeout = 300000;
+    
+    admission = AdmissionConfig();
+    retry = RetryConfig();
+    admin = AdminConfig();
+    tracing = TracingConfig();
+    capture = CaptureConfig();
+    tls = TlsConfig();
+    http2 = Http2Config();
+    hotRestart = HotRestartConfig();
+    affinity = AffinityConfig();
+    resolver = ResolverConfig();
+    staticFiles = StaticFilesConfig();
+    sockets = SocketConfig();
+    
+    routes.clear();
+    rateLimitMaxKeys = 1 << 20;
+    rateLimitShards = 64;
     
     logFile = "reverse_proxy.log";
     logLevel = LogLevel::INFO;
@@ -89,6 +139,139 @@ bool Config::parseJson(const std::string& jsonContent) {
             }
         }
         
+        std::string serverJson = extractObject(jsonContent, "server");
+        readInt(serverJson, "connection_timeout", connectionTimeout);
+        readBool(serverJson, "keep_alive", keepAlive);
+        readInt(serverJson, "workers", workerCount);
+        readString(serverJson, "mode", mode);
+        readString(serverJson, "pipeline", pipeline);
+        readInt(serverJson, "connection_buffer_kb", connectionBufferKb);
+        
+        // Client-side timeouts default to the legacy connection_timeout
+        clientHeaderTimeout = connectionTimeout * 1000;
+        idleKeepAliveTimeout = connectionTimeout * 1000;
+        
+        std::string timeoutsJson = extractObject(jsonContent, "timeouts");
+        readInt(timeoutsJson, "client_header_ms", clientHeaderTimeout);
+        readInt(timeoutsJson, "idle_keep_alive_ms", idleKeepAliveTimeout);
+        readInt(timeoutsJson, "upstream_connect_ms", upstreamConnectTimeout);
+        readInt(timeoutsJson, "upstream_first_byte_ms", upstreamFirstByteTimeout);
+        readInt(timeoutsJson, "request_total_ms", requestTimeout);
+        readInt(timeoutsJson, "tunnel_idle_ms", tunnelIdleTimeout);
+        
+        std::string admissionJson = extractObject(jsonContent, "admission");
+        // Cut the classes out first so their keys cannot shadow the ones below
+        std::string classesJson = extractObject(admissionJson, "classes");
+        if (!classesJson.empty()) {
+            admissionJson.erase(admissionJson.find(classesJson), classesJson.length());
+        }
+        readBool(admissionJson, "enabled", admission.enabled);
+        readBool(admissionJson, "adaptive", admission.adaptive);
+        readInt(admissionJson, "max_in_flight", admission.maxInFlight);
+        readInt(admissionJson, "backend_max_in_flight", admission.backendMaxInFlight);
+        readInt(admissionJson, "initial_limit", admission.initialLimit);
+        readInt(admissionJson, "min_limit", admission.minLimit);
+        readInt(admissionJson, "queue_size", admission.queueSize);
+        readInt(admissionJson, "queue_target_ms", admission.queueTargetMs);
+        readInt(admissionJson, "queue_interval_ms", admission.queueIntervalMs);
+        readInt(admissionJson, "queue_timeout_ms", admission.queueTimeoutMs);
+        readString(admissionJson, "default_class", admission.defaultClass);
+        if (!classesJson.empty()) {
+            admission.classes.clear();
+            for (const std::string& classJson : splitObjects(classesJson)) {
+                admission.classes.push_back(parsePriorityClass(classJson, admission));
+            }
+        }
+        
+        std::string retriesJson = extractObject(jsonContent, "retries");
+        readBool(retriesJson, "enabled", retry.enabled);
+        readInt(retriesJson, "max_retries", retry.maxRetries);
+        readDouble(retriesJson, "budget_percent", retry.budgetPercent);
+        readInt(retriesJson, "min_retries_per_second", retry.minRetriesPerSecond);
+        readBool(retriesJson, "hedge_enabled", retry.hedgeEnabled);
+        readDouble(retriesJson, "hedge_percentile", retry.hedgePercentile);
+        readInt(retriesJson, "hedge_min_delay_ms", retry.hedgeMinDelayMs);
+        
+        std::string adminJson = extractObject(jsonContent, "admin");
+        readBool(adminJson, "enabled", admin.enabled);
+        readString(adminJson, "address", admin.address);
+        readInt(adminJson, "port", admin.port);
+        
+        std::string tracingJson = extractObject(jsonContent, "tracing");
+        readBool(tracingJson, "enabled", tracing.enabled);
+        readInt(tracingJson, "slow_request_ms", tracing.slowRequestMs);
+        readInt(tracingJson, "slow_request_log_size", tracing.slowRequestLogSize);
+        
+        std::string captureJson = extractObject(jsonContent, "capture");
+        readBool(captureJson, "enabled", capture.enabled);
+        readString(captureJson, "directory", capture.directory);
+        readDouble(captureJson, "sample_rate", capture.sampleRate);
+        readInt(captureJson, "segment_size_mb", capture.segmentSizeMb);
+        readInt(captureJson, "max_segments", capture.maxSegments);
+        
+        std::string tlsJson = extractObject(jsonContent, "tls");
+        readBool(tlsJson, "enabled", tls.enabled);
+        readInt(tlsJson, "port", tls.port);
+        readString(tlsJson, "certificate", tls.certificate);
+        readString(tlsJson, "private_key", tls.privateKey);
+        readInt(tlsJson, "session_cache_size", tls.sessionCacheSize);
+        readInt(tlsJson, "session_cache_shards", tls.sessionCacheShards);
+        readInt(tlsJson, "session_timeout_s", tls.sessionTimeoutS);
+        readBool(tlsJson, "session_tickets", tls.sessionTickets);
+        readBool(tlsJson, "ktls", tls.ktls);
+        
+        std::string http2Json = extractObject(jsonContent, "http2");
+        readBool(http2Json, "enabled", http2.enabled);
+        readInt(http2Json, "max_concurrent_streams", http2.maxConcurrentStreams);
+        readInt(http2Json, "initial_window_kb", http2.initialWindowKb);
+        readInt(http2Json, "max_header_list_kb", http2.maxHeaderListKb);
+        
+        std::string hotRestartJson = extractObject(jsonContent, "hot_restart");
+        readBool(hotRestartJson, "enabled", hotRestart.enabled);
+        readString(hotRestartJson, "socket_path", hotRestart.socketPath);
+        readInt(hotRestartJson, "drain_timeout_ms", hotRestart.drainTimeoutMs);
+        readBool(hotRestartJson, "transfer_stats", hotRestart.transferStats);
+        
+        std::string affinityJson = extractObject(jsonContent, "affinity");
+        readBool(affinityJson, "enabled", affinity.enabled);
+        readString(affinityJson, "cpus", affinity.cpus);
+        readBool(affinityJson, "numa_local", affinity.numaLocal);
+        readBool(affinityJson, "steer_connections", affinity.steerConnections);
+        readBool(affinityJson, "per_worker_balancer", affinity.perWorkerBalancer);
+        
+        std::string resolverJson = extractObject(jsonContent, "resolver");
+        readInt(resolverJson, "refresh_s", resolver.refreshS);
+        readInt(resolverJson, "retry_s", resolver.retryS);
+        readString(resolverJson, "family", resolver.family);
+        
+        std::string staticFilesJson = extractObject(jsonContent, "static_files");
+        readInt(staticFilesJson, "max_open_files", staticFiles.maxOpenFiles);
+        readInt(staticFilesJson, "cache_shards", staticFiles.cacheShards);
+        readInt(staticFilesJson, "mmap_max_kb", staticFiles.mmapMaxKb);
+        
+        std::string socketsJson = extractObject(jsonContent, "sockets");
+        parseListenerSockets(extractObject(socketsJson, "listener"), sockets.listener);
+        sockets.tlsListener = sockets.listener;
+        parseListenerSockets(extractObject(socketsJson, "tls_listener"), sockets.tlsListener);
+        std::string upstreamJson = extractObject(socketsJson, "upstream");
+        readBool(upstreamJson, "fast_open", sockets.upstream.fastOpen);
+        readBool(upstreamJson, "no_delay", sockets.upstream.noDelay);
+        readBool(upstreamJson, "quick_ack", sockets.upstream.quickAck);
+        readInt(upstreamJson, "send_buffer_kb", sockets.upstream.sendBufferKb);
+        readInt(upstreamJson, "receive_buffer_kb", sockets.upstream.receiveBufferKb);
+        
+        std::string routesJson = extractObject(jsonContent, "routes");
+        if (!routesJson.empty()) {
+            routes.clear();
+            for (const std::string& routeJson : splitObjects(routesJson)) {
+                routes.push_back(parseRoute(routeJson));
+            }
+        }
+        
+        std::string rateLimiterJson = extractObject(jsonContent, "rate_limiter");
+        readInt(rateLimiterJson, "max_keys", rateLimitMaxKeys);
+        readInt(rateLimiterJson, "shards", rateLimitShards);
+        
         size_t loggingPos = jsonContent.find("\"logging\"");
         if (loggingPos != std::string::npos) {
             size_t levelPos = jsonContent.find("\"level\"", loggingPos);
@@ -193,6 +376,214 @@ bool Config::parseJson(const std::string& jsonContent) {
     }
 }
 
+std::string Config::extractObject(const std::string& json, const std::string& key) {
+    size_t keyPos = json.find("\"" + key + "\"");
+    if (keyPos == std::string::npos) return "";
+    
+    size_t start = json.find_first_of("{[", keyPos);
+    if (start == std::string::npos) return "";
+    
+    char open = json[start];
+    char close = (open == '{') ? '}' : ']';
+    int depth = 0;
+    bool inString = false;
+    for (size_t i = start; i < json.length(); i++) {
+        char c = json[i];
+        if (inString) {
+            if (c == '\\') i++;
+            else if (c == '"') inString = false;
+            continue;
+        }
+        if (c == '"') inString = true;
+        else if (c == open) depth++;
+        else if (c == close && --depth == 0) {
+            return json.substr(start, i - start + 1);
+        }
+    }
+    return "";
+}
+
+bool Config::readInt(const std::string& json, const std::string& key, int& value) {
+    size_t keyPos = json.find("\"" + key + "\"");
+    if (keyPos == std::string::npos) return false;
+    
+    size_t colonPos = json.find(":", keyPos);
+    size_t endPos = json.find_first_of(",}\n", colonPos);
+    if (colonPos == std::string::npos || endPos == std::string::npos) return false;
+    
+    std::string numberStr = json.substr(colonPos + 1, endPos - colonPos - 1);
+    numberStr.erase(std::remove_if(numberStr.begin(), numberStr.end(), ::isspace), numberStr.end());
+    value = std::stoi(numberStr);
+    return true;
+}
+
+bool Config::readBool(const std::string& json, const std::string& key, bool& value) {
+    size_t keyPos = json.find("\"" + key + "\"");
+    if (keyPos == std::string::npos) return false;
+    
+    size_t colonPos = json.find(":", keyPos);
+    size_t endPos = json.find_first_of(",}\n", colonPos);
+    if (colonPos == std::string::npos || endPos == std::string::npos) return false;
+    
+    std::string boolStr = json.substr(colonPos + 1, endPos - colonPos - 1);
+    boolStr.erase(std::remove_if(boolStr.begin(), boolStr.end(), ::isspace), boolStr.end());
+    value = (boolStr == "true");
+    return true;
+}
+
+bool Config::readString(const std::string& json, const std::string& key, std::string& value) {
+    size_t keyPos = json.find("\"" + key + "\"");
+    if (keyPos == std::string::npos) return false;
+    
+    size_t colonPos = json.find(":", keyPos);
+    size_t quoteStart = json.find("\"", colonPos);
+    size_t quoteEnd = json.find("\"", quoteStart + 1);
+    if (colonPos == std::string::npos || quoteStart == std::string::npos || quoteEnd == std::string::npos) {
+        return false;
+    }
+    
+    value = json.substr(quoteStart + 1, quoteEnd - quoteStart - 1);
+    return true;
+}
+
+bool Config::readDouble(const std::string& json, const std::string& key, double& value) {
+    size_t keyPos = json.find("\"" + key + "\"");
+    if (keyPos == std::string::npos) return false;
+    
+    size_t colonPos = json.find(":", keyPos);
+    size_t endPos = json.find_first_of(",}\n", colonPos);
+    if (colonPos == std::string::npos || endPos == std::string::npos) return false;
+    
+    std::string numberStr = json.substr(colonPos + 1, endPos - colonPos - 1);
+    numberStr.erase(std::remove_if(numberStr.begin(), numberStr.end(), ::isspace), numberStr.end());
+    value = std::stod(numberStr);
+    return true;
+}
+
+std::vector<std::string> Config::splitObjects(const std::string& array) {
+    std::vector<std::string> objects;
+    size_t pos = 0;
+    while (true) {
+        size_t start = array.find("{", pos);
+        if (start == std::string::npos) break;
+        
+        // extractObject-style depth scan, starting at this object's brace
+        int depth = 0;
+        bool inString = false;
+        size_t end = std::string::npos;
+        for (size_t i = start; i < array.length(); i++) {
+            char c = array[i];
+            if (inString) {
+                if (c == '\\') i++;
+                else if (c == '"') inString = false;
+                continue;
+            }
+            if (c == '"') inString = true;
+            else if (c == '{') depth++;
+            else if (c == '}' && --depth == 0) {
+                end = i;
+                break;
+            }
+        }
+        if (end == std::string::npos) break;
+        
+        objects.push_back(array.substr(start, end - start + 1));
+        pos = end + 1;
+    }
+    return objects;
+}
+
+RouteConfig Config::parseRoute(const std::string& json) {
+    RouteConfig route;
+    readString(json, "prefix", route.prefix);
+    
+    std::string rateLimitJson = extractObject(json, "rate_limit");
+    if (!rateLimitJson.empty()) {
+        RateLimitConfig& rateLimit = route.rateLimit;
+        rateLimit.enabled = true;
+        readBool(rateLimitJson, "enabled", rateLimit.enabled);
+        readDouble(rateLimitJson, "requests_per_second", rateLimit.requestsPerSecond);
+        rateLimit.burst = static_cast<int>(rateLimit.requestsPerSecond + 0.999);
+        readInt(rateLimitJson, "burst", rateLimit.burst);
+        
+        // "ip" (default) or "header:<Name>"
+        std::string key;
+        if (readString(rateLimitJson, "key", key) && key.compare(0, 7, "header:") == 0) {
+            rateLimit.keyHeader = key.substr(7);
+        }
+    }
+    
+    std::string staticJson = extractObject(json, "static");
+    if (!staticJson.empty()) {
+        readString(staticJson, "root", route.staticFiles.root);
+        readString(staticJson, "index", route.staticFiles.index);
+    }
+    return route;
+}
+
+PriorityClassConfig Config::parsePriorityClass(const std::string& json, const AdmissionConfig& admission) {
+    PriorityClassConfig priorityClass;
+    priorityClass.deadlineMs = admission.queueTimeoutMs;
+    priorityClass.queueSize = admission.queueSize;
+    priorityClass.queueTargetMs = admission.queueTargetMs;
+    readString(json, "name", priorityClass.name);
+    readInt(json, "weight", priorityClass.weight);
+    readInt(json, "deadline_ms", priorityClass.deadlineMs);
+    readInt(json, "queue_size", priorityClass.queueSize);
+    readInt(json, "queue_target_ms", priorityClass.queueTargetMs);
+    readString(json, "paths", priorityClass.paths);
+    readString(json, "header", priorityClass.header);
+    readString(json, "cidrs", priorityClass.cidrs);
+    return priorityClass;
+}
+
+bool Config::validPriorityClasses(const AdmissionConfig& admission) {
+    std::vector<std::string> names;
+    for (const PriorityClassConfig& priorityClass : admission.classes) {
+        if (priorityClass.name.empty() ||
+            std::find(names.begin(), names.end(), priorityClass.name) != names.end()) {
+            std::cerr << "Admission classes need unique, non-empty names: \"" << priorityClass.name << "\""
+                      << std::endl;
+            return false;
+        }
+        names.push_back(priorityClass.name);
+        if (priorityClass.weight <= 0 || priorityClass.deadlineMs <= 0 || priorityClass.queueSize < 0 ||
+            priorityClass.queueTargetMs <= 0) {
+            std::cerr << "Admission class " << priorityClass.name
+                      << " needs a positive weight, deadline and queue target, and a queue size of at least 0"
+                      << std::endl;
+            return false;
+        }
+        std::vector<PriorityClassifier::Network> networks;
+        if (!PriorityClassifier::parseNetworks(priorityClass.cidrs, networks)) {
+            std::cerr << "Admission class " << priorityClass.name << " cidrs must be a list like "
+                      << "\"10.0.0.0/8,fd00::/8\": " << priorityClass.cidrs << std::endl;
+            return false;
+        }
+    }
+    if (!admission.defaultClass.empty() &&
+        std::find(names.begin(), names.end(), admission.defaultClass) == names.end()) {
+        std::cerr << "Admission default_class names no class: " << admission.defaultClass << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void Config::parseListenerSockets(const std::string& json, ListenerSocketConfig& listener) {
+    readInt(json, "defer_accept_s", listener.deferAcceptS);
+    readInt(json, "fast_open_queue", listener.fastOpenQueue);
+    readBool(json, "no_delay", listener.noDelay);
+    readBool(json, "quick_ack", listener.quickAck);
+    readInt(json, "send_buffer_kb", listener.sendBufferKb);
+    readInt(json, "receive_buffer_kb", listener.receiveBufferKb);
+    readInt(json, "busy_poll_us", listener.busyPollUs);
+}
+
+bool Config::validListenerSockets(const ListenerSocketConfig& listener) {
+    return listener.deferAcceptS >= 0 && listener.fastOpenQueue >= 0 && listener.sendBufferKb >= 0 &&
+           listener.receiveBufferKb >= 0 && listener.busyPollUs >= 0;
+}
+
 LoadBalancingAlgorithm Config::parseAlgorithm(const std::string& algo) {
     if (algo == "ROUND_ROBIN") return LoadBalancingAlgorithm::ROUND_ROBIN;
     if (algo == "WEIGHTED_ROUND_ROBIN") return LoadBalancingAlgorithm::WEIGHTED_ROUND_ROBIN;
@@ -235,6 +626,177 @@ bool Config::validate() const {
         return false;
     }
     
+    if (workerCount <= 0 || workerCount > 256) {
+        std::cerr << "Worker count must be between 1 and 256: " << workerCount << std::endl;
+        return false;
+    }
+    
+    if (mode != "http" && mode != "tcp") {
+        std::cerr << "Mode must be \"http\" or \"tcp\": " << mode << std::endl;
+        return false;
+    }
+    
+    if (pipeline != "callback" && pipeline != "coroutine") {
+        std::cerr << "Pipeline must be \"callback\" or \"coroutine\": " << pipeline << std::endl;
+        return false;
+    }
+    
+    if (connectionBufferKb < 16 || connectionBufferKb > 65536) {
+        std::cerr << "Connection buffer must be between 16 and 65536 KB: " << connectionBufferKb << std::endl;
+        return false;
+    }
+    
+    if (clientHeaderTimeout <= 0 || idleKeepAliveTimeout <= 0 || upstreamConnectTimeout <= 0 ||
+        upstreamFirstByteTimeout <= 0 || requestTimeout <= 0 || tunnelIdleTimeout <= 0) {
+        std::cerr << "Timeouts must be positive" << std::endl;
+        return false;
+    }
+    
+    if (maxConnections <= 0) {
+        std::cerr << "Max connections must be positive: " << maxConnections << std::endl;
+        return false;
+    }
+    
+    if (admission.enabled) {
+        if (admission.minLimit <= 0 || admission.initialLimit < admission.minLimit ||
+            admission.maxInFlight < admission.minLimit || admission.backendMaxInFlight < admission.minLimit) {
+            std::cerr << "Admission limits must satisfy 0 < min_limit <= initial_limit and min_limit <= max_in_flight" << std::endl;
+            return false;
+        }
+        if (admission.queueSize < 0 || admission.queueTargetMs <= 0 || admission.queueIntervalMs <= 0 ||
+            admission.queueTimeoutMs <= 0) {
+            std::cerr << "Admission queue settings must be positive" << std::endl;
+            return false;
+        }
+        if (!validPriorityClasses(admission)) {
+            return false;
+        }
+    }
+    
+    if (retry.enabled) {
+        if (retry.maxRetries < 0 || retry.budgetPercent < 0.0 || retry.minRetriesPerSecond < 0) {
+            std::cerr << "Retry settings must not be negative" << std::endl;
+            return false;
+        }
+        if (retry.hedgeEnabled &&
+            (retry.hedgePercentile <= 0.0 || retry.hedgePercentile >= 100.0 || retry.hedgeMinDelayMs < 0)) {
+            std::cerr << "Hedge percentile must be between 0 and 100 (exclusive)" << std::endl;
+            return false;
+        }
+    }
+    
+    if (admin.enabled) {
+        if (admin.port <= 0 || admin.port > 65535 || admin.port == proxyPort) {
+            std::cerr << "Admin port must be valid and differ from the proxy port: " << admin.port << std::endl;
+            return false;
+        }
+    }
+    
+    if (tracing.enabled && (tracing.slowRequestMs < 0 || tracing.slowRequestLogSize <= 0)) {
+        std::cerr << "Tracing threshold must not be negative and the log size must be positive" << std::endl;
+        return false;
+    }
+    
+    if (capture.enabled) {
+        if (capture.directory.empty() || capture.sampleRate <= 0.0 || capture.sampleRate > 1.0) {
+            std::cerr << "Capture needs a directory and a sample rate in (0, 1]" << std::endl;
+            return false;
+        }
+        if (capture.segmentSizeMb <= 0 || capture.segmentSizeMb > 4096 || capture.maxSegments <= 0) {
+            std::cerr << "Capture segment size must be 1-4096 MB and at least one segment kept" << std::endl;
+            return false;
+        }
+    }
+    
+    if (tls.enabled) {
+        if (tls.port <= 0 || tls.port > 65535 || tls.port == proxyPort) {
+            std::cerr << "TLS port must be 1-65535 and differ from the proxy port" << std::endl;
+            return false;
+        }
+        if (tls.certificate.empty() || tls.privateKey.empty()) {
+            std::cerr << "TLS needs a certificate and a private_key file" << std::endl;
+            return false;
+        }
+        if (tls.sessionCacheSize < 0 || tls.sessionCacheShards <= 0 || tls.sessionTimeoutS <= 0) {
+            std::cerr << "TLS session cache size must not be negative, shards and timeout must be positive" << std::endl;
+            return false;
+        }
+    }
+    
+    if (http2.enabled) {
+        // Below 64 KB a client could overrun the window before our SETTINGS reach it
+        if (http2.maxConcurrentStreams <= 0 || http2.initialWindowKb < 64 || http2.initialWindowKb > 1048575 ||
+            http2.maxHeaderListKb <= 0) {
+            std::cerr << "HTTP/2 needs at least one stream, a 64 KB - 1 GB window and a positive header list limit"
+                      << std::endl;
+            return false;
+        }
+    }
+    
+    if (hotRestart.enabled) {
+        // sun_path holds 108 bytes on Linux, 104 on the BSDs
+        if (hotRestart.socketPath.empty() || hotRestart.socketPath.size() >= 104 || hotRestart.drainTimeoutMs <= 0) {
+            std::cerr << "Hot restart needs a socket path under 104 characters and a positive drain timeout"
+                      << std::endl;
+            return false;
+        }
+    }
+    
+    if (resolver.refreshS <= 0 || resolver.retryS <= 0 ||
+        (resolver.family != "any" && resolver.family != "ipv4" && resolver.family != "ipv6")) {
+        std::cerr << "Resolver needs positive refresh_s and retry_s and a family of any, ipv4 or ipv6" << std::endl;
+        return false;
+    }
+    
+    std::vector<int> cpus;
+    if (affinity.enabled && !affinity.cpus.empty() && !CpuAffinity::parseCpuList(affinity.cpus, cpus)) {
+        std::cerr << "Affinity cpus must be a list like \"0-7,16-23\" of CPUs below " << CpuAffinity::kMaxCpus
+                  << ": " << affinity.cpus << std::endl;
+        return false;
+    }
+    
+    for (const auto& route : routes) {
+        if (route.prefix.empty() || route.prefix[0] != '/') {
+            std::cerr << "Route prefix must start with '/': " << route.prefix << std::endl;
+            return false;
+        }
+        if (route.rateLimit.enabled &&
+            (route.rateLimit.requestsPerSecond <= 0.0 || route.rateLimit.burst <= 0)) {
+            std::cerr << "Rate limit for route " << route.prefix
+                      << " needs positive requests_per_second and burst" << std::endl;
+            return false;
+        }
+        if (route.isStatic() && (route.staticFiles.index.empty() ||
+                                 route.staticFiles.index.find('/') != std::string::npos)) {
+            std::cerr << "Static route " << route.prefix << " needs an index file name without '/'" << std::endl;
+            return false;
+        }
+    }
+    
+    if (staticFiles.maxOpenFiles <= 0 || staticFiles.cacheShards <= 0 || staticFiles.mmapMaxKb < 0) {
+        std::cerr << "Static files need positive max_open_files and cache_shards and a mmap_max_kb of 0 or more"
+                  << std::endl;
+        return false;
+    }
+    
+    if (!validListenerSockets(sockets.listener) || !validListenerSockets(sockets.tlsListener) ||
+        sockets.upstream.sendBufferKb < 0 || sockets.upstream.receiveBufferKb < 0) {
+        std::cerr << "Socket option values (sockets.*) must not be negative" << std::endl;
+        return false;
+    }
+    
+    // The backend may speak first (SMTP, MySQL): its greeting would wait for the client
+    if (mode == "tcp" && sockets.listener.deferAcceptS > 0) {
+        std::cerr << "sockets.listener.defer_accept_s needs a protocol where the client speaks first; "
+                  << "it is not allowed in tcp mode" << std::endl;
+        return false;
+    }
+    
+    if (rateLimitMaxKeys <= 0 || rateLimitShards <= 0) {
+        std::cerr << "Rate limiter max_keys and shards must be positive" << std::endl;
+        return false;
+    }
+    
     if (backends.empty()) {
         std::cerr << "No backend servers configured" << std::endl;
         return false;
@@ -276,6 +838,160 @@ void Config::printConfiguration() const {
     std::cout << "  Max Connections: " << maxConnections << std::endl;
     std::cout << "  Connection Timeout: " << connectionTimeout << "s" << std::endl;
     std::cout << "  Keep-Alive: " << (keepAlive ? "Enabled" : "Disabled") << std::endl;
+    std::cout << "  Workers: " << workerCount << std::endl;
+    std::cout << "  Mode: " << mode << std::endl;
+    std::cout << "  Pipeline: " << pipeline << std::endl;
+    std::cout << "  Connection Buffer: " << connectionBufferKb << " KB" << std::endl;
+    
+    std::cout << "\nTimeouts:" << std::endl;
+    std::cout << "  Client Header: " << clientHeaderTimeout << "ms" << std::endl;
+    std::cout << "  Idle Keep-Alive: " << idleKeepAliveTimeout << "ms" << std::endl;
+    std::cout << "  Upstream Connect: " << upstreamConnectTimeout << "ms" << std::endl;
+    std::cout << "  Upstream First Byte: " << upstreamFirstByteTimeout << "ms" << std::endl;
+    std::cout << "  Request Total: " << requestTimeout << "ms" << std::endl;
+    std::cout << "  Tunnel Idle: " << tunnelIdleTimeout << "ms" << std::endl;
+    
+    std::cout << "\nAdmission Control:" << std::endl;
+    std::cout << "  Enabled: " << (admission.enabled ? "Yes" : "No") << std::endl;
+    if (admission.enabled) {
+        std::cout << "  Limits: " << (admission.adaptive ? "adaptive" : "fixed")
+                  << " (initial " << admission.initialLimit << ", min " << admission.minLimit
+                  << ", global max " << admission.maxInFlight
+                  << ", backend max " << admission.backendMaxInFlight << ")" << std::endl;
+        std::cout << "  Queue: " << admission.queueSize << " entries, target " << admission.queueTargetMs
+                  << "ms, interval " << admission.queueIntervalMs << "ms, timeout "
+                  << admission.queueTimeoutMs << "ms" << std::endl;
+        for (const PriorityClassConfig& priorityClass : admission.classes) {
+            std::cout << "  Class " << priorityClass.name << ": weight " << priorityClass.weight << ", deadline "
+                      << priorityClass.deadlineMs << "ms, queue " << priorityClass.queueSize << ", target "
+                      << priorityClass.queueTargetMs << "ms";
+            if (!priorityClass.paths.empty()) std::cout << ", paths " << priorityClass.paths;
+            if (!priorityClass.header.empty()) std::cout << ", header " << priorityClass.header;
+            if (!priorityClass.cidrs.empty()) std::cout << ", clients " << priorityClass.cidrs;
+            std::cout << std::endl;
+        }
+        if (!admission.classes.empty()) {
+            std::cout << "  Unmatched requests: "
+                      << (admission.defaultClass.empty() ? admission.classes.back().name : admission.defaultClass)
+                      << std::endl;
+        }
+    }
+    
+    std::cout << "\nRetries:" << std::endl;
+    std::cout << "  Enabled: " << (retry.enabled ? "Yes" : "No") << std::endl;
+    if (retry.enabled) {
+        std::cout << "  Max Retries: " << retry.maxRetries << " (budget " << retry.budgetPercent
+                  << "% of requests, floor " << retry.minRetriesPerSecond << "/s)" << std::endl;
+        std::cout << "  Hedging: ";
+        if (retry.hedgeEnabled) {
+            std::cout << "p" << retry.hedgePercentile << " (min " << retry.hedgeMinDelayMs << "ms)" << std::endl;
+        } else {
+            std::cout << "Disabled" << std::endl;
+        }
+    }
+    
+    std::cout << "\nAdmin:" << std::endl;
+    if (admin.enabled) {
+        std::cout << "  Metrics: http://" << admin.address << ":" << admin.port << "/metrics" << std::endl;
+        if (tracing.enabled) {
+            std::cout << "  Slow requests: http://" << admin.address << ":" << admin.port << "/slow_requests" << std::endl;
+        }
+    } else {
+        std::cout << "  Disabled" << std::endl;
+    }
+    
+    std::cout << "\nTracing:" << std::endl;
+    if (tracing.enabled) {
+        std::cout << "  Slow requests: >= " << tracing.slowRequestMs << "ms, last "
+                  << tracing.slowRequestLogSize << " kept" << std::endl;
+    } else {
+        std::cout << "  Disabled" << std::endl;
+    }
+    
+    std::cout << "\nCapture:" << std::endl;
+    if (capture.enabled) {
+        std::cout << "  Directory: " << capture.directory << ", " << capture.sampleRate * 100.0
+                  << "% of connections, " << capture.maxSegments << " x " << capture.segmentSizeMb
+                  << "MB segments per worker" << std::endl;
+    } else {
+        std::cout << "  Disabled" << std::endl;
+    }
+    
+    std::cout << "\nTLS:" << std::endl;
+    if (tls.enabled) {
+        std::cout << "  Port: " << tls.port << " (" << tls.certificate << ")" << std::endl;
+        std::cout << "  Sessions: " << tls.sessionCacheSize << " cached in " << tls.sessionCacheShards
+                  << " shards for " << tls.sessionTimeoutS << "s, tickets "
+                  << (tls.sessionTickets ? "on" : "off") << std::endl;
+        std::cout << "  Kernel TLS: " << (tls.ktls ? "when available" : "off") << std::endl;
+    } else {
+        std::cout << "  Disabled" << std::endl;
+    }
+    
+    std::cout << "\nHTTP/2:" << std::endl;
+    if (http2.enabled) {
+        std::cout << "  Streams: " << http2.maxConcurrentStreams << " per connection, " << http2.initialWindowKb
+                  << "KB window, " << http2.maxHeaderListKb << "KB header lists" << std::endl;
+    } else {
+        std::cout << "  Disabled" << std::endl;
+    }
+    
+    std::cout << "\nHot Restart:" << std::endl;
+    if (hotRestart.enabled) {
+        std::cout << "  Socket: " << hotRestart.socketPath << ", drain " << hotRestart.drainTimeoutMs
+                  << "ms, stats " << (hotRestart.transferStats ? "transferred" : "not transferred") << std::endl;
+    } else {
+        std::cout << "  Disabled" << std::endl;
+    }
+    
+    std::cout << "\nCPU Affinity:" << std::endl;
+    if (affinity.enabled) {
+        std::cout << "  CPUs: " << (affinity.cpus.empty() ? "all allowed" : affinity.cpus) << ", memory "
+                  << (affinity.numaLocal ? "NUMA-local" : "default policy") << ", steering "
+                  << (affinity.steerConnections ? "on" : "off") << std::endl;
+    } else {
+        std::cout << "  Workers not pinned" << std::endl;
+    }
+    std::cout << "  Balancer state: " << (affinity.perWorkerBalancer ? "per worker" : "shared") << std::endl;
+    
+    std::cout << "\nResolver:" << std::endl;
+    std::cout << "  Hostnames refreshed every " << resolver.refreshS << "s (" << resolver.retryS
+              << "s after a failure), family " << resolver.family << std::endl;
+    
+    std::cout << "\nSockets:" << std::endl;
+    std::cout << "  Listener: " << describeListener(sockets.listener) << std::endl;
+    if (tls.enabled) {
+        std::cout << "  TLS listener: " << describeListener(sockets.tlsListener) << std::endl;
+    }
+    const UpstreamSocketConfig& upstream = sockets.upstream;
+    std::cout << "  Upstream: nodelay " << (upstream.noDelay ? "on" : "off") << ", quickack "
+              << (upstream.quickAck ? "on" : "off") << ", fast open " << (upstream.fastOpen ? "on" : "off")
+              << ", buffers " << describeBuffers(upstream.sendBufferKb, upstream.receiveBufferKb) << std::endl;
+    
+    bool staticRoutes = std::any_of(routes.begin(), routes.end(),
+                                    [](const RouteConfig& route) { return route.isStatic(); });
+    if (staticRoutes) {
+        std::cout << "\nStatic Files:" << std::endl;
+        std::cout << "  Open files cached: " << staticFiles.maxOpenFiles << " in " << staticFiles.cacheShards
+                  << " shards, mapped up to " << staticFiles.mmapMaxKb << " KB" << std::endl;
+    }
+    
+    if (!routes.empty()) {
+        std::cout << "\nRoutes:" << std::endl;
+        for (const auto& route : routes) {
+            std::cout << "  " << route.prefix;
+            if (route.rateLimit.enabled) {
+                std::cout << " (rate limit " << route.rateLimit.requestsPerSecond << "/s, burst "
+                          << route.rateLimit.burst << ", key "
+                          << (route.rateLimit.keyHeader.empty() ? "client IP" : route.rateLimit.keyHeader) << ")";
+            }
+            if (route.isStatic()) {
+                std::cout << " -> files in " << route.staticFiles.root;
+            }
+            std::cout << std::endl;
+        }
+        std::cout << "  Rate limiter capacity: " << rateLimitMaxKeys << " keys" << std::endl;
+    }
     
     std::cout << "\nLogging:" << std::endl;
     std::cout << "  File: " << logFile << std::endl;
@@ -0,0 +1,1169 @@
+#include "Connection.h"
+#include "Worker.h"
+#include "Server.h"
+#include "ResponseWriter.h"
+#include "AdmissionControl.h"
+#include "RetryControl.h"
+#include "Probes.h"
+#include "TcpTunnel.h"
+#include "Http2.h"
+#include "Tls.h"
+#include "StaticFiles.h"
+#include "SocketTuning.h"
+#include <algorithm>
+#include <cstring>
+
+void Connection::Endpoint::onEvent(uint32_t events) {
+    if (connection.closed) return;
+
+    if (upstream != nullptr) {
+        connection.onUpstreamEvent(*upstream, events);
+    } else {
+        connection.onClientEvent(events);
+    }
+}
+
+Connection::Connection(Worker& w, SOCKET socket, TlsContext* tlsContext)
+    : Exchange(w, socket, this),
+      highWatermark(w.getServer().getConfig().getConnectionBufferSize()), lowWatermark(highWatermark / 4),
+      clientSocket(socket), clientEndpoint(*this, nullptr), clientEvents(0), handshaking(false),
+      tlsReadScheduled(false), state(State::ReadingRequest), phase(Phase::None), closed(false),
+      requestHeadParsed(false), upgraded(false),
+      primary(*this), secondary(*this), active(nullptr),
+      responseHeadParsed(false), responseChunked(false), responseComplete(false), responseLatencyUs(0),
+      responseStatus(0),
+      globalAdmitted(false), queued(false), priorityClass(0), queuedAtMs(0), queuedAtUs(0),
+      clientOutputOffset(0), responseStarted(false), staticOffset(0), staticRemaining(0) {
+    if (tlsContext != nullptr) {
+        tls.reset(new TlsStream(*tlsContext, clientSocket));
+        handshaking = true;
+    }
+    const SocketConfig& sockets = server.getConfig().getSockets();
+    clientQuickAck = (tls ? sockets.tlsListener : sockets.listener).quickAck;
+    phaseTimer.setCallback([this] { onPhaseTimeout(); });
+    deadlineTimer.setCallback([this] { onDeadline(); });
+    hedgeTimer.setCallback([this] { launchHedge(); });
+    primary.timer.setCallback([this] { onUpstreamTimeout(primary); });
+    secondary.timer.setCallback([this] { onUpstreamTimeout(secondary); });
+}
+
+Connection::~Connection() {
+    close();
+    if (!upgraded) {
+        server.releaseConnection();
+    }
+}
+
+bool Connection::start() {
+    if (tls && !tls->isValid()) {
+        return false;
+    }
+    if (!worker.getLoop().add(clientSocket, EventLoop::Readable, &clientEndpoint)) {
+        return false;
+    }
+    clientEvents = EventLoop::Readable;
+    armPhase(Phase::ClientHeader);
+    return true;
+}
+
+void Connection::onClientEvent(uint32_t events) {
+    if (events & EventLoop::Closed) {
+        logger.debug("Client " + clientIP + " connection error or hang-up");
+        close();
+        return;
+    }
+
+    if (handshaking) {
+        continueHandshake();
+        return;
+    }
+    if ((events & EventLoop::Writable) && !closed) {
+        flushClient();
+    }
+    if ((events & EventLoop::Readable) && !closed && wantsClientInput()) {
+        readRequest();
+    }
+}
+
+// The client header timeout, armed at accept, also bounds the handshake
+void Connection::continueHandshake() {
+    switch (tls->handshake()) {
+        case TlsStream::Handshake::Done:
+            handshaking = false;
+            logger.debug("TLS handshake with " + clientIP + " done: " + tls->describe());
+            if (http2Candidate && tls->selectedProtocol() == Http2::kAlpnId) {
+                upgradeToHttp2();
+                break;
+            }
+            setClientEvents(EventLoop::Readable);
+            // The first request may have arrived with the handshake's last flight
+            if (tls->hasPending()) readRequest();
+            break;
+        case TlsStream::Handshake::WantRead:
+            setClientEvents(EventLoop::Readable);
+            break;
+        case TlsStream::Handshake::WantWrite:
+            setClientEvents(EventLoop::Writable);
+            break;
+        case TlsStream::Handshake::Failed:
+            logger.debug("TLS handshake with " + clientIP + " failed");
+            close();
+            break;
+    }
+}
+
+long Connection::clientRecv(char* buffer, size_t length) {
+    long received = tls ? tls->read(buffer, length) : recv(clientSocket, buffer, static_cast<int>(length), 0);
+    if (received > 0 && clientQuickAck) SocketTuning::quickAck(clientSocket);
+    return received;
+}
+
+long Connection::clientSend(const char* data, size_t length) {
+    if (tls) return tls->write(data, length);
+    return send(clientSocket, data, static_cast<int>(length), MSG_NOSIGNAL);
+}
+
+void Connection::onUpstreamEvent(Upstream& upstream, uint32_t events) {
+    switch (upstream.stage) {
+        case Upstream::Stage::Connecting:
+            if (events & (EventLoop::Writable | EventLoop::Closed)) {
+                onUpstreamConnected(upstream);
+            }
+            break;
+        case Upstream::Stage::Sending:
+        case Upstream::Stage::Awaiting:
+        case Upstream::Stage::Relaying:
+            // While a body streams, request and response bytes can flow at once
+            if ((events & EventLoop::Writable) && upstream.pendingOutput() > 0) {
+                writeUpstream(upstream);
+                if (closed || upstream.stage == Upstream::Stage::Idle ||
+                    upstream.stage == Upstream::Stage::Connecting) {
+                    break;
+                }
+            }
+            if (upstream.stage == Upstream::Stage::Sending && !requestStreaming) {
+                if (events & EventLoop::Closed) writeUpstream(upstream);
+            } else if (events & (EventLoop::Readable | EventLoop::Closed)) {
+                readUpstream(upstream);
+            }
+            break;
+        case Upstream::Stage::Idle:
+            // Stale readiness for an attempt dropped earlier in this round
+            break;
+    }
+}
+
+void Connection::readRequest() {
+    char buffer[kReadChunk];
+
+    while (requestBuffer.size() < clientInputLimit()) {
+        long received = clientRecv(buffer, sizeof(buffer));
+        if (received > 0) {
+            if (requestBuffer.empty() && !requestHeadParsed) {
+                beginRequest();
+                armPhase(Phase::ClientHeader);
+                worker.getLoop().timers().schedule(deadlineTimer, server.getConfig().getRequestTimeout());
+            } else if (requestStreaming) {
+                // A streamed body only has to keep moving
+                armPhase(Phase::ClientHeader);
+            }
+            requestBuffer.append(buffer, static_cast<size_t>(received));
+            if (static_cast<size_t>(received) < sizeof(buffer) && !(tls && tls->hasPending())) break;
+            continue;
+        }
+        if (received == 0) {
+            if (!requestBuffer.empty() || requestHeadParsed) {
+                logger.warning("Client " + clientIP + " closed connection mid-request");
+            }
+            close();
+            return;
+        }
+
+        int error = lastSocketError();
+        if (isInterrupted(error)) continue;
+        if (isWouldBlock(error)) break;
+
+        logger.warning("Failed to receive data from client " + clientIP);
+        close();
+        return;
+    }
+
+    processRequestBuffer();
+}
+
+void Connection::processRequestBuffer() {
+    if (!requestHeadParsed) {
+        if (requestBuffer.empty()) return;
+        switch (parseRequestHead()) {
+            case HeadStatus::Incomplete:
+                return;
+            case HeadStatus::Http2Preface:
+                upgradeToHttp2();
+                return;
+            case HeadStatus::Invalid:
+                sendErrorResponse(400, "Bad Request");
+                return;
+            case HeadStatus::Parsed:
+                break;
+        }
+
+        requestHeadParsed = true;
+        if (!checkRateLimit()) return;
+
+        startRequestBody();
+        if (!decodeRequestBody()) return;
+        if (wantsContinue()) {
+            clientOutput.append(kContinue, sizeof(kContinue) - 1);
+            flushClient();
+            if (closed) return;
+        }
+    }
+
+    if (state != State::ReadingRequest) {
+        // More of a streamed body, for the attempt already under way
+        Upstream* upstream = sendingUpstream();
+        if (upstream != nullptr && upstream->stage != Upstream::Stage::Connecting) {
+            writeUpstream(*upstream);
+        } else if (!decodeRequestBody()) {
+            return;
+        }
+        updateClientEvents();
+        return;
+    }
+
+    if (!decodeRequestBody() || queued || !requestBodyReady()) return;
+
+    onRequestRead();
+    dispatchRequest();
+}
+
+// Exchange::decodeRequestBody, answering invalid framing; false once the
+// client has been answered
+bool Connection::decodeRequestBody() {
+    if (!Exchange::decodeRequestBody()) {
+        sendErrorResponse(400, "Bad Request");
+        return false;
+    }
+    if (requestDecoder.isComplete()) {
+        armPhase(Phase::None);
+    }
+    return true;
+}
+
+// Streaming: decodes more of the body and hands it to the attempt once the
+// bytes before it are mostly out
+void Connection::pumpRequestBody(Upstream& upstream) {
+    if (!decodeRequestBody()) return;
+    if (requestBody.empty() || upstream.pendingOutput() >= lowWatermark) return;
+
+    if (upstream.writeClosed) {
+        requestBody.clear();
+        return;
+    }
+    requestBodySent = true;
+    if (upstream.pendingOutput() == 0) {
+        upstream.output.swap(requestBody);
+        upstream.outputOffset = 0;
+    } else {
+        upstream.output.append(requestBody);
+    }
+    requestBody.clear();
+}
+
+bool Connection::requestFullySent() const {
+    return !requestStreaming || (requestDecoder.isComplete() && requestBody.empty());
+}
+
+bool Connection::checkRateLimit() {
+    uint32_t retryAfterSeconds = 0;
+    if (Exchange::checkRateLimit(retryAfterSeconds)) return true;
+    sendErrorResponse(429, "Too Many Requests", "Retry-After: " + std::to_string(retryAfterSeconds) + "\r\n");
+    return false;
+}
+
+void Connection::dispatchRequest() {
+    if (requestDecoder.isComplete()) {
+        armPhase(Phase::None);
+    }
+    // Files need no backend, so no admission either
+    if (route != nullptr && route->config.isStatic()) {
+        serveStatic();
+        return;
+    }
+    AdmissionController& admission = server.getAdmission();
+    if (!admission.isEnabled()) {
+        forwardToBackend();
+        return;
+    }
+    priorityClass = admission.getClassifier().classify(request, clientIP);
+
+    // Queued requests go first; only bypass the queue when it is empty
+    if (!worker.hasQueuedRequests()) {
+        Admission result = tryAdmit();
+        if (result != Admission::Saturated) {
+            admitQueued(result);
+            return;
+        }
+    }
+
+    updateClientEvents();
+    queuedAtMs = EventLoop::monotonicMs();
+    queuedAtUs = EventLoop::monotonicUs();
+    if (!worker.enqueue(this, priorityClass, queuePosition)) {
+        logger.warning("Overloaded, rejecting " + request.method + " " + request.path + " from " + clientIP +
+                       " (class " + admission.getClassifier().getClass(priorityClass).name + ")");
+        sendErrorResponse(503, "Service Unavailable - overloaded");
+        return;
+    }
+    queued = true;
+    logger.debug("Queued " + request.method + " " + request.path + " from " + clientIP + " for admission");
+}
+
+Connection::Admission Connection::tryAdmit() {
+    AdmissionController& admission = server.getAdmission();
+
+    ConcurrencyLimiter& global = admission.getGlobalLimiter();
+    if (!global.tryAcquire()) {
+        return Admission::Saturated;
+    }
+
+    Selection selection = selectBackend(primary.backend, primary.limiter);
+    if (selection != Selection::Selected) {
+        global.releaseWithoutSample();
+        return selection == Selection::NoBackend ? Admission::NoBackend : Admission::Saturated;
+    }
+    globalAdmitted = true;
+    admission.getStats().admitted.fetch_add(1, std::memory_order_relaxed);
+    admission.getClassStats(priorityClass).admitted.fetch_add(1, std::memory_order_relaxed);
+    return Admission::Admitted;
+}
+
+void Connection::admitQueued(Admission result) {
+    if (queued) {
+        uint64_t waitUs = EventLoop::monotonicUs() - queuedAtUs;
+        worker.getMetrics().recordQueueWait(routeSlot(), waitUs);
+        worker.getMetrics().recordClassWait(priorityClass, waitUs);
+    }
+    queued = false;
+    if (result == Admission::NoBackend) {
+        logger.error("No healthy backend servers available");
+        sendErrorResponse(503, "Service Unavailable - No backend servers");
+        return;
+    }
+    forwardToBackend();
+}
+
+void Connection::rejectQueued(const std::string& reason) {
+    uint64_t waitUs = EventLoop::monotonicUs() - queuedAtUs;
+    worker.getMetrics().recordQueueWait(routeSlot(), waitUs);
+    worker.getMetrics().recordClassWait(priorityClass, waitUs);
+    queued = false;
+    logger.warning("Admission queue rejected " + request.method + " " + request.path + " from " + clientIP);
+    sendErrorResponse(503, reason);
+}
+
+void Connection::forwardToBackend() {
+    trace.mark(TraceMark::Admitted);
+    PROXY_PROBE1(request_admitted, this);
+    // Admission control picked the backend already when it is enabled
+    if (primary.backend == nullptr && selectBackend(primary.backend, primary.limiter) != Selection::Selected) {
+        logger.error("No healthy backend servers available");
+        sendErrorResponse(503, "Service Unavailable - No backend servers");
+        return;
+    }
+
+    server.getRetryControl().onRequest();
+    state = State::Forwarding;
+    updateClientEvents();
+
+    startUpstream(primary);
+    if (!closed && state == State::Forwarding) {
+        scheduleHedge();
+    }
+}
+
+void Connection::serveStatic() {
+    trace.mark(TraceMark::Admitted);
+    StaticResponse response;
+    server.getStaticFiles().respond(*route, request, response);
+    responseStatus = response.head.statusCode;
+    logger.debug("Static " + std::to_string(responseStatus) + " for " + request.path + " to " + clientIP);
+
+    Http::appendClientResponseHead(response.head, keepAlive, false, clientOutput);
+    clientOutput += response.body;
+    staticFile = std::move(response.file);
+    staticOffset = response.offset;
+    staticRemaining = response.length;
+    responseStarted = true;
+    responseComplete = true;
+    state = State::RelayingResponse;
+    trace.mark(TraceMark::FirstResponseByte);
+    flushClient();
+}
+
+// User-space TLS encrypts from memory: the next piece of the file goes
+// through clientOutput. False when the file could not be read (and the
+// connection is closed, the length having been promised already).
+bool Connection::readStaticChunk() {
+    size_t length = static_cast<size_t>(std::min<uint64_t>(staticRemaining, kReadChunk));
+    clientOutput.resize(length);
+    clientOutputOffset = 0;
+    if (!StaticFiles::read(*staticFile, staticOffset, &clientOutput[0], length)) {
+        logger.error("Failed to read static file for " + request.path);
+        close();
+        return false;
+    }
+    staticOffset += length;
+    staticRemaining -= length;
+    return true;
+}
+
+void Connection::startUpstream(Upstream& upstream) {
+    BackendServer* backend = upstream.backend;
+    upstream.url = beginAttempt(backend, upstream.hedge);
+    upstream.startUs = EventLoop::monotonicUs();
+    upstream.stage = Upstream::Stage::Connecting;
+
+    SocketAddress backendAddr;
+    if (!server.resolveBackend(backend, backendAddr)) {
+        logger.error("Failed to resolve backend " + upstream.url);
+        upstreamFailed(upstream, 502, "Bad Gateway - backend unresolvable", true);
+        return;
+    }
+    upstream.startTsc = Tsc::now();
+    PROXY_PROBE3(upstream_start, this, upstream.url.c_str(), upstream.hedge);
+
+    upstream.socket = socket(backendAddr.family(), SOCK_STREAM, 0);
+    if (upstream.socket == INVALID_SOCKET || !setNonBlocking(upstream.socket)) {
+        logger.error("Failed to create upstream socket");
+        upstreamFailed(upstream, 502, "Bad Gateway", false);
+        return;
+    }
+    SocketTuning::applyUpstream(upstream.socket, server.getConfig().getSockets().upstream);
+
+    buildUpstreamRequest(upstream);
+
+    int connected = connect(upstream.socket, backendAddr.get(), backendAddr.length);
+    if (connected == SOCKET_ERROR && !isConnectInProgress(lastSocketError())) {
+        logger.error("Failed to connect to backend " + upstream.url);
+        upstreamFailed(upstream, 502, "Bad Gateway - backend unreachable", true);
+        return;
+    }
+    // Only TCP_FASTOPEN_CONNECT returns at once; the socket is writable but has no peer yet
+    upstream.deferredConnect = connected == 0;
+
+    if (!worker.getLoop().add(upstream.socket, EventLoop::Writable, &upstream.endpoint)) {
+        upstreamFailed(upstream, 502, "Bad Gateway", false);
+        return;
+    }
+    upstream.events = EventLoop::Writable;
+    worker.getLoop().timers().schedule(upstream.timer,
+                                       static_cast<uint64_t>(server.getConfig().getUpstreamConnectTimeout()));
+}
+
+void Connection::buildUpstreamRequest(Upstream& upstream) {
+    upstream.output.clear();
+    upstream.outputOffset = 0;
+    appendUpstreamRequest(upstream.output);
+}
+
+void Connection::onUpstreamConnected(Upstream& upstream) {
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if (getsockopt(upstream.socket, SOL_SOCKET, SO_ERROR, reinterpret_cast<char*>(&error), &length) != 0 || error != 0) {
+        logger.error("Failed to connect to backend " + upstream.url);
+        upstreamFailed(upstream, 502, "Bad Gateway - backend unreachable", true);
+        return;
+    }
+
+    // A retry can reuse this slot within one event batch; ignore readiness
+    // that belonged to the previous attempt's socket
+    sockaddr_storage peer;
+    socklen_t peerLength = sizeof(peer);
+    if (getpeername(upstream.socket, reinterpret_cast<sockaddr*>(&peer), &peerLength) != 0 &&
+        !upstream.deferredConnect) {
+        return;
+    }
+
+    upstream.stage = Upstream::Stage::Sending;
+    upstream.connectedTsc = Tsc::now();
+    PROXY_PROBE2(upstream_connected, this, upstream.url.c_str());
+    upstream.timer.cancel();
+    writeUpstream(upstream);
+}
+
+void Connection::writeUpstream(Upstream& upstream) {
+    while (true) {
+        if (requestStreaming) {
+            pumpRequestBody(upstream);
+            if (closed || !upstream.isActive()) return;   // invalid body framing was answered
+        }
+        if (upstream.pendingOutput() == 0) break;
+
+        int sent = send(upstream.socket, upstream.output.data() + upstream.outputOffset,
+                        static_cast<int>(upstream.pendingOutput()), MSG_NOSIGNAL);
+        if (sent > 0) {
+            upstream.outputOffset += static_cast<size_t>(sent);
+            worker.getMetrics().add(Counter::RequestBytes, static_cast<uint64_t>(sent));
+            continue;
+        }
+
+        int error = lastSocketError();
+        if (sent < 0 && isInterrupted(error)) continue;
+        if (sent < 0 && isWouldBlock(error)) {
+            updateUpstreamEvents(upstream);
+            if (requestStreaming) updateClientEvents();
+            return;
+        }
+
+        if (upstream.stage == Upstream::Stage::Relaying) {
+            // Answered early and stopped reading: drop the rest of the body,
+            // then the client connection, which still has body bytes coming
+            logger.debug("Backend " + upstream.url + " stopped reading the request body");
+            upstream.writeClosed = true;
+            upstream.output.clear();
+            upstream.outputOffset = 0;
+            requestBody.clear();
+            keepAlive = false;
+            updateUpstreamEvents(upstream);
+            updateClientEvents();
+            return;
+        }
+
+        // Part of the request may have reached the backend
+        logger.error("Failed to send request to backend " + upstream.url);
+        upstreamFailed(upstream, 502, "Bad Gateway - backend write failed", Http::isIdempotentMethod(request.method));
+        return;
+    }
+
+    upstream.output.clear();
+    upstream.outputOffset = 0;
+    if (upstream.stage == Upstream::Stage::Sending && requestFullySent()) {
+        upstream.stage = Upstream::Stage::Awaiting;
+        upstream.sentTsc = Tsc::now();
+        PROXY_PROBE2(request_sent, this, upstream.url.c_str());
+        worker.getLoop().timers().schedule(upstream.timer,
+                                           static_cast<uint64_t>(server.getConfig().getUpstreamFirstByteTimeout()));
+    }
+    updateUpstreamEvents(upstream);
+    if (requestStreaming) updateClientEvents();
+}
+
+void Connection::readUpstream(Upstream& upstream) {
+    char buffer[kReadChunk];
+    bool quickAck = server.getConfig().getSockets().upstream.quickAck;
+
+    while (pendingClientOutput() < highWatermark) {
+        int received = recv(upstream.socket, buffer, sizeof(buffer), 0);
+        if (received > 0) {
+            if (quickAck) SocketTuning::quickAck(upstream.socket);
+            if (upstream.stage == Upstream::Stage::Awaiting || upstream.stage == Upstream::Stage::Sending) {
+                promote(upstream);
+            }
+
+            if (!responseHeadParsed) {
+                upstreamInput.append(buffer, received);
+                if (!processResponseHead()) return;
+            } else if (!appendResponseBody(buffer, static_cast<size_t>(received))) {
+                return;
+            }
+
+            if (responseComplete) break;
+            continue;
+        }
+
+        bool awaiting = upstream.stage == Upstream::Stage::Awaiting || upstream.stage == Upstream::Stage::Sending;
+        if (received == 0) {
+            if (awaiting) {
+                logger.error("Backend " + upstream.url + " closed connection without a response");
+                upstreamFailed(upstream, 502, "Bad Gateway - empty backend response",
+                               Http::isIdempotentMethod(request.method));
+                return;
+            }
+            if (!responseHeadParsed) {
+                logger.error("Backend " + upstream.url + " closed connection mid response head");
+                sendErrorResponse(502, "Bad Gateway - truncated backend response");
+                return;
+            }
+            endResponseAtEof(responseDecoder, responseChunked, clientOutput);
+            responseComplete = true;
+            break;
+        }
+
+        int error = lastSocketError();
+        if (isInterrupted(error)) continue;
+        if (isWouldBlock(error)) break;
+
+        logger.error("Failed to read response from backend " + upstream.url);
+        if (awaiting) {
+            // Reset before any response byte: safe to replay idempotent requests
+            upstreamFailed(upstream, 502, "Bad Gateway - backend read failed", Http::isIdempotentMethod(request.method));
+        } else if (responseStarted) {
+            close();
+        } else {
+            sendErrorResponse(502, "Bad Gateway - backend read failed");
+        }
+        return;
+    }
+
+    if (closed) return;
+
+    if (responseComplete) {
+        releaseUpstream(upstream, true, false);
+    } else if (pendingClientOutput() >= highWatermark) {
+        // Slow client: stop reading upstream until the backlog drains
+        upstream.readPaused = true;
+        updateUpstreamEvents(upstream);
+    }
+
+    flushClient();
+}
+
+void Connection::promote(Upstream& upstream) {
+    RetryController& retries = server.getRetryControl();
+
+    // First response byte decides the race; the other attempt is dropped
+    hedgeTimer.cancel();
+    Upstream& other = otherThan(upstream);
+    if (other.isActive()) {
+        logger.debug("Dropping slower attempt on backend " + other.url);
+        releaseUpstream(other, false, false);
+    }
+    if (upstream.hedge) {
+        retries.getStats().hedgeWins.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    responseLatencyUs = EventLoop::monotonicUs() - upstream.startUs;
+    adoptAttemptTrace(upstream);
+    recordFirstByte(upstream.backend, upstream.url, responseLatencyUs);
+
+    upstream.stage = Upstream::Stage::Relaying;
+    upstream.timer.cancel();
+    active = &upstream;
+    backendUrl = upstream.url;
+    state = State::RelayingResponse;
+}
+
+bool Connection::processResponseHead() {
+    HttpHead response;
+    ParseResult result = Http::parseResponseHead(upstreamInput.data(), upstreamInput.size(), response);
+    if (result == ParseResult::Incomplete) return true;
+    if (result == ParseResult::Invalid) {
+        logger.error("Invalid response from backend " + backendUrl);
+        sendErrorResponse(502, "Bad Gateway - invalid backend response");
+        return false;
+    }
+
+    responseHeadParsed = true;
+    responseStatus = response.statusCode;
+
+    if (response.statusCode == 101) {
+        // A re-chunked body cannot continue as raw bytes
+        if (!request.isUpgrade() || (request.isChunked() && !requestDecoder.isComplete())) {
+            logger.error("Unexpected protocol switch from backend " + backendUrl);
+            sendErrorResponse(502, "Bad Gateway - invalid backend response");
+            return false;
+        }
+        upgradeToTunnel(*active, response);
+        return false;
+    }
+
+    responseChunked = startResponse(response, responseDecoder, clientOutput);
+    responseStarted = true;
+
+    if (!appendResponseBody(upstreamInput.data() + response.headLength, upstreamInput.size() - response.headLength)) {
+        return false;
+    }
+    upstreamInput.clear();
+    upstreamInput.shrink_to_fit();
+    return true;
+}
+
+// Hands both sockets to a tunnel; whatever either side sent past the
+// handshake goes ahead of the relayed bytes
+void Connection::upgradeToTunnel(Upstream& upstream, const HttpHead& response) {
+    std::string toClient = clientOutput.substr(clientOutputOffset);
+    Http::appendClientResponseHead(response, false, false, toClient);
+    toClient.append(upstreamInput, response.headLength, std::string::npos);
+
+    std::string toBackend = upstream.output.substr(upstream.outputOffset);
+    if (requestStreaming) {
+        toBackend += requestBody;
+    }
+    toBackend += requestBuffer;
+
+    logger.info("Upgraded connection from " + clientIP + " to backend " + upstream.url + " (" +
+                *request.findHeader("Upgrade") + ")");
+
+    // The tunnel keeps the backend counted as active
+    BackendServer* backend = upstream.backend;
+    SOCKET backendSocket = upstream.socket;
+    worker.getLoop().remove(backendSocket);
+    upstream.socket = INVALID_SOCKET;
+    upstream.events = 0;
+    upstream.backend = nullptr;
+
+    recordRequestEnd(101);
+    releaseUpstreams(true, false);
+    releaseAdmission(true, false);
+
+    SOCKET socket = clientSocket;
+    worker.getLoop().remove(clientSocket);
+    clientSocket = INVALID_SOCKET;
+    clientEvents = 0;
+    upgraded = true;
+    close();
+
+    worker.adoptTunnel(new TcpTunnel(worker, socket, backendSocket, backend, std::move(toClient), std::move(toBackend),
+                                     std::move(tls)));
+}
+
+// Hands the client socket (and TLS session) to an Http2Session, along with
+// whatever has been read of the preface and the frames after it
+void Connection::upgradeToHttp2() {
+    std::string received;
+    received.swap(requestBuffer);
+
+    phaseTimer.cancel();
+    SOCKET socket = clientSocket;
+    worker.getLoop().remove(clientSocket);
+    clientSocket = INVALID_SOCKET;
+    clientEvents = 0;
+    requestStartUs = 0;
+    upgraded = true;
+    close();
+
+    worker.adoptSession(new Http2Session(worker, socket, std::move(tls), std::move(received)));
+}
+
+// Decodes response body bytes into the client output; false when the
+// backend's chunked framing was invalid and the client has been dropped
+bool Connection::appendResponseBody(const char* data, size_t length) {
+    if (!decodeResponseBody(responseDecoder, responseChunked, data, length, clientOutput)) {
+        sendErrorResponse(502, "Bad Gateway - invalid backend response");
+        return false;
+    }
+    if (responseDecoder.isComplete()) {
+        responseComplete = true;
+    }
+    return true;
+}
+
+void Connection::flushClient() {
+    while (hasClientBacklog()) {
+        long sent = 0;
+        if (pendingClientOutput() > 0) {
+            sent = clientSend(clientOutput.data() + clientOutputOffset, pendingClientOutput());
+            if (sent > 0) clientOutputOffset += static_cast<size_t>(sent);
+        } else if (!tls || tls->sendsInKernel()) {
+            // With kTLS the kernel encrypts what sendfile() hands it
+            size_t length = static_cast<size_t>(std::min<uint64_t>(staticRemaining, SIZE_MAX));
+            sent = StaticFiles::send(clientSocket, *staticFile, staticOffset, length);
+            if (sent > 0) {
+                staticOffset += static_cast<uint64_t>(sent);
+                staticRemaining -= static_cast<uint64_t>(sent);
+            }
+        } else {
+            if (!readStaticChunk()) return;
+            continue;
+        }
+        if (sent > 0) {
+            worker.getMetrics().add(Counter::ResponseBytes, static_cast<uint64_t>(sent));
+            continue;
+        }
+
+        int error = lastSocketError();
+        if (sent < 0 && isInterrupted(error)) continue;
+        if (sent < 0 && isWouldBlock(error)) break;
+
+        logger.warning("Failed to send response to client " + clientIP);
+        close();
+        return;
+    }
+
+    if (pendingClientOutput() == 0) {
+        clientOutput.clear();
+        clientOutputOffset = 0;
+    } else if (clientOutputOffset > highWatermark) {
+        clientOutput.erase(0, clientOutputOffset);
+        clientOutputOffset = 0;
+    }
+
+    if (staticRemaining == 0) {
+        staticFile.reset();
+    }
+
+    bool flushed = !hasClientBacklog();
+    if (flushed && state == State::Closing) {
+        close();
+        return;
+    }
+
+    if (state == State::RelayingResponse) {
+        if (flushed && responseComplete) {
+            finishExchange();
+            return;
+        }
+        if (active != nullptr && active->readPaused && pendingClientOutput() < lowWatermark) {
+            active->readPaused = false;
+            updateUpstreamEvents(*active);
+        }
+    }
+
+    updateClientEvents();
+}
+
+void Connection::finishExchange() {
+    deadlineTimer.cancel();
+    recordRequestEnd(responseStatus);
+    releaseUpstreams(true, false);
+    releaseAdmission(true, false);
+    if (!backendUrl.empty()) {
+        logger.info("Backend " + backendUrl + " processed request successfully");
+    }
+
+    // Answered before the whole body arrived: the rest cannot be told apart
+    // from the next request
+    if (!keepAlive || !requestDecoder.isComplete()) {
+        close();
+        return;
+    }
+
+    resetRequest();
+    requestHeadParsed = false;
+    responseHeadParsed = false;
+    responseDecoder.reset(BodyDecoder::Framing::None);
+    responseChunked = false;
+    responseComplete = false;
+    responseStarted = false;
+    responseLatencyUs = 0;
+    responseStatus = 0;
+
+    state = State::ReadingRequest;
+    updateClientEvents();
+
+    if (requestBuffer.empty()) {
+        armPhase(Phase::IdleKeepAlive);
+        if (server.isDraining()) drain();
+    } else {
+        // Pipelined request already buffered: its clock starts now
+        beginRequest();
+        armPhase(Phase::ClientHeader);
+        worker.getLoop().timers().schedule(deadlineTimer, server.getConfig().getRequestTimeout());
+        processRequestBuffer();
+    }
+}
+
+void Connection::upstreamFailed(Upstream& upstream, int statusCode, const std::string& body, bool retryable) {
+    const BackendServer* failedBackend = upstream.backend;
+    worker.getMetrics().recordUpstreamFailure(server.getLoadBalancer().indexOf(failedBackend));
+    adoptAttemptTrace(upstream);
+    releaseUpstream(upstream, true, true);
+
+    // The other attempt may still answer
+    if (otherThan(upstream).isActive()) {
+        logger.warning("Attempt on backend " + upstream.url + " failed; waiting for the other attempt");
+        return;
+    }
+
+    if (retryAfterFailure(retryable, failedBackend, otherThan(upstream).backend, upstream.url, upstream.backend,
+                          upstream.limiter)) {
+        upstream.hedge = false;
+        startUpstream(upstream);
+        return;
+    }
+    sendErrorResponse(statusCode, body);
+}
+
+void Connection::scheduleHedge() {
+    RetryController& retries = server.getRetryControl();
+    if (!retries.isHedgingEnabled() || hedged || requestStreaming || request.isUpgrade() ||
+        !Http::isSafeMethod(request.method) || server.getLoadBalancer().getBackendCount() < 2) {
+        return;
+    }
+
+    uint64_t delayMs = retries.getHedgeDelayMs(primary.backend);
+    if (delayMs == 0) return;   // no latency history for this backend yet
+    worker.getLoop().timers().schedule(hedgeTimer, delayMs);
+}
+
+void Connection::launchHedge() {
+    if (state != State::Forwarding || hedged) return;
+
+    Upstream& hedge = primary.isActive() ? secondary : primary;
+    if (hedge.isActive()) return;
+
+    const BackendServer* slow = otherThan(hedge).backend;
+    if (!selectAlternateBackend(slow, slow, hedge.backend, hedge.limiter)) return;
+
+    RetryController& retries = server.getRetryControl();
+    if (!retries.tryExtraAttempt(worker.getLoop().now())) {
+        releaseUpstream(hedge, false, false);
+        return;
+    }
+
+    hedged = true;
+    hedge.hedge = true;
+    retries.getStats().hedges.fetch_add(1, std::memory_order_relaxed);
+    startUpstream(hedge);
+}
+
+void Connection::onUpstreamTimeout(Upstream& upstream) {
+    TimeoutCounters& counters = server.getTimeoutCounters();
+
+    if (upstream.stage == Upstream::Stage::Connecting) {
+        counters.upstreamConnect.fetch_add(1, std::memory_order_relaxed);
+        logger.warning("Upstream connect timeout for backend " + upstream.url);
+        upstreamFailed(upstream, 504, "Gateway Timeout - backend connect timed out", true);
+    } else if (upstream.stage == Upstream::Stage::Awaiting) {
+        counters.upstreamFirstByte.fetch_add(1, std::memory_order_relaxed);
+        logger.warning("Upstream first-byte timeout for backend " + upstream.url);
+        upstreamFailed(upstream, 504, "Gateway Timeout - backend did not respond", false);
+    }
+}
+
+void Connection::armPhase(Phase next) {
+    phase = next;
+    const Config& config = server.getConfig();
+    int timeoutMs = 0;
+
+    switch (next) {
+        case Phase::ClientHeader: timeoutMs = config.getClientHeaderTimeout(); break;
+        case Phase::IdleKeepAlive: timeoutMs = config.getIdleKeepAliveTimeout(); break;
+        case Phase::None:
+            phaseTimer.cancel();
+            return;
+    }
+
+    worker.getLoop().timers().schedule(phaseTimer, static_cast<uint64_t>(timeoutMs));
+}
+
+void Connection::onPhaseTimeout() {
+    TimeoutCounters& counters = server.getTimeoutCounters();
+    Phase expired = phase;
+    phase = Phase::None;
+
+    switch (expired) {
+        case Phase::ClientHeader:
+            counters.clientHeader.fetch_add(1, std::memory_order_relaxed);
+            if (handshaking) {
+                // No session to answer in yet
+                logger.warning("TLS handshake timeout for " + clientIP);
+                close();
+                break;
+            }
+            logger.warning("Client header timeout for " + clientIP);
+            sendErrorResponse(408, "Request Timeout");
+            break;
+        case Phase::IdleKeepAlive:
+            counters.idleKeepAlive.fetch_add(1, std::memory_order_relaxed);
+            logger.debug("Idle keep-alive timeout for " + clientIP);
+            close();
+            break;
+        case Phase::None:
+            break;
+    }
+}
+
+void Connection::onDeadline() {
+    countDeadline();
+    if (state == State::ReadingRequest) {
+        sendErrorResponse(408, "Request Timeout");
+    } else {
+        sendErrorResponse(504, "Gateway Timeout - request deadline exceeded");
+    }
+}
+
+void Connection::sendErrorResponse(int statusCode, const std::string& body, const std::string& extraHeaders) {
+    if (state == State::Forwarding && (primary.isActive() || secondary.isActive())) {
+        // Keep how far the in-flight attempt got (e.g. a deadline while awaiting)
+        adoptAttemptTrace(primary.isActive() ? primary : secondary);
+    }
+    // Gateway errors count against the backend's concurrency limit
+    releaseUpstreams(statusCode >= 502, statusCode >= 502);
+    releaseAdmission(statusCode >= 502, statusCode >= 502);
+    armPhase(Phase::None);
+    deadlineTimer.cancel();
+    hedgeTimer.cancel();
+
+    if (responseStarted) {
+        recordRequestEnd(0);
+        // Part of a response is already out; closing is the only signal left
+        close();
+        return;
+    }
+
+    keepAlive = false;
+    responseStarted = true;
+    state = State::Closing;
+    recordRequestEnd(statusCode);
+
+    ResponseWriter::Frame frame;
+    ResponseWriter::build(frame, statusCode, body.data(), body.length(), extraHeaders.data(), extraHeaders.length());
+    if (!tls && pendingClientOutput() == 0 && !ResponseWriter::writeSome(clientSocket, frame)) {
+        close();
+        return;
+    }
+    for (size_t i = 0; i < frame.count; i++) {
+        clientOutput.append(frame.slices[i].data, frame.slices[i].length);
+    }
+
+    flushClient();
+}
+
+void Connection::adoptAttemptTrace(const Upstream& upstream) {
+    trace.set(TraceMark::UpstreamStart, upstream.startTsc);
+    trace.set(TraceMark::UpstreamConnected, upstream.connectedTsc);
+    trace.set(TraceMark::RequestSent, upstream.sentTsc);
+}
+
+void Connection::releaseUpstream(Upstream& upstream, bool sample, bool dropped) {
+    upstream.timer.cancel();
+
+    if (upstream.socket != INVALID_SOCKET) {
+        worker.getLoop().remove(upstream.socket);
+        closesocket(upstream.socket);
+        upstream.socket = INVALID_SOCKET;
+        upstream.events = 0;
+    }
+
+    // Connections are only counted once the attempt has started
+    if (upstream.backend != nullptr && upstream.isActive()) {
+        server.getLoadBalancer().decrementConnections(upstream.backend->host, upstream.backend->port);
+    }
+
+    if (upstream.limiter != nullptr) {
+        bool hasSample = dropped || (&upstream == active && responseLatencyUs > 0);
+        if (sample && hasSample) {
+            upstream.limiter->release(responseLatencyUs, dropped);
+        } else {
+            upstream.limiter->releaseWithoutSample();
+        }
+        worker.scheduleQueueDrain();
+    }
+
+    if (active == &upstream) {
+        active = nullptr;
+    }
+    upstream.stage = Upstream::Stage::Idle;
+    upstream.backend = nullptr;
+    upstream.limiter = nullptr;
+    upstream.output.clear();
+    upstream.outputOffset = 0;
+    upstream.startUs = 0;
+    upstream.startTsc = 0;
+    upstream.connectedTsc = 0;
+    upstream.sentTsc = 0;
+    upstream.hedge = false;
+    upstream.readPaused = false;
+    upstream.writeClosed = false;
+}
+
+void Connection::releaseUpstreams(bool sample, bool dropped) {
+    hedgeTimer.cancel();
+    releaseUpstream(primary, sample, dropped);
+    releaseUpstream(secondary, sample, dropped);
+}
+
+void Connection::releaseAdmission(bool sample, bool dropped) {
+    if (queued) {
+        worker.dequeue(priorityClass, queuePosition);
+        queued = false;
+    }
+    if (!globalAdmitted) return;
+
+    ConcurrencyLimiter& global = server.getAdmission().getGlobalLimiter();
+    if (sample && (responseLatencyUs > 0 || dropped)) {
+        global.release(responseLatencyUs, dropped);
+    } else {
+        global.releaseWithoutSample();
+    }
+
+    globalAdmitted = false;
+    worker.scheduleQueueDrain();
+}
+
+// Client bytes are read while a head or body is expected and there is room
+bool Connection::wantsClientInput() const {
+    if (closed || state == State::Closing) return false;
+    if (!requestHeadParsed) return state == State::ReadingRequest;
+    return !requestDecoder.isComplete() && requestBuffer.size() < clientInputLimit();
+}
+
+size_t Connection::clientInputLimit() const {
+    // An unparsed head may take up to the head limit; parsing rejects more
+    return requestHeadParsed ? highWatermark : std::max(highWatermark, Http::kMaxHeadSize + 1);
+}
+
+void Connection::updateClientEvents() {
+    uint32_t events = 0;
+    if (hasClientBacklog()) events |= EventLoop::Writable;
+    if (wantsClientInput()) events |= EventLoop::Readable;
+    setClientEvents(events);
+
+    // Readiness says nothing about input the TLS layer already decrypted
+    if ((events & EventLoop::Readable) && tls && tls->hasPending() && !tlsReadScheduled) {
+        tlsReadScheduled = true;
+        worker.getLoop().defer([this] {
+            tlsReadScheduled = false;
+            if (!closed && wantsClientInput()) readRequest();
+        });
+    }
+}
+
+void Connection::updateUpstreamEvents(Upstream& upstream) {
+    uint32_t events = 0;
+    switch (upstream.stage) {
+        case Upstream::Stage::Idle:
+            return;
+        case Upstream::Stage::Connecting:
+            events = EventLoop::Writable;
+            break;
+        default: {
+            if (upstream.pendingOutput() > 0) events |= EventLoop::Writable;
+            // A streaming upload also watches for an early answer
+            bool reading = upstream.stage != Upstream::Stage::Sending || requestStreaming;
+            if (reading && !upstream.readPaused) events |= EventLoop::Readable;
+            break;
+        }
+    }
+    setUpstreamEvents(upstream, events);
+}
+
+void Connection::setClientEvents(uint32_t events) {
+    if (events == clientEvents || clientSocket == INVALID_SOCKET) return;
+    worker.getLoop().modify(clientSocket, events, &clientEndpoint);
+    clientEvents = events;
+}
+
+void Connection::setUpstreamEvents(Upstream& upstream, uint32_t events) {
+    if (events == upstream.events || upstream.socket == INVALID_SOCKET) return;
+    worker.getLoop().modify(upstream.socket, events, &upstream.endpoint);
+    upstream.events = events;
+}
+
+void Connection::drain() {
+    if (phase == Phase::IdleKeepAlive) {
+        worker.getLoop().timers().schedule(phaseTimer, Worker::kDrainIdleGraceMs);
+    }
+}
+
+void Connection::close() {
+    if (closed) return;
+    closed = true;
+
+    phaseTimer.cancel();
+    deadlineTimer.cancel();
+    recordRequestEnd(0);
+    releaseUpstreams(false, false);
+    releaseAdmission(false, false);
+
+    if (clientSocket != INVALID_SOCKET) {
+        worker.getLoop().remove(clientSocket);
+        if (tls && !handshaking) tls->shutdown();
+        closesocket(clientSocket);
+        clientSocket = INVALID_SOCKET;
+    }
+
+    worker.release(this);
+}
@@ -0,0 +1,358 @@
+#include "Coroutine.h"
+#include "StaticFiles.h"
+#include "SocketTuning.h"
+#include <algorithm>
+#include <new>
+
+namespace {
+
+thread_local FramePool* currentPool = nullptr;
+
+} // namespace
+
+FramePool::FramePool() : slabCursor(nullptr), slabRemaining(0) {
+    for (size_t i = 0; i < kClasses; i++) {
+        freeLists[i] = nullptr;
+    }
+}
+
+FramePool::~FramePool() {
+    for (char* slab : slabs) {
+        ::operator delete(slab);
+    }
+}
+
+void* FramePool::allocate(size_t size) {
+    size_t sizeClass = classFor(size);
+    stats.allocations++;
+    stats.live++;
+    if (stats.live > stats.peakLive) stats.peakLive = stats.live;
+
+    if (FreeBlock* block = freeLists[sizeClass]) {
+        freeLists[sizeClass] = block->next;
+        stats.reused++;
+        return block;
+    }
+
+    // Carve a fresh block; the tail of a slab too small for it is abandoned
+    size_t blockSize = (sizeClass + 1) * kGranularity;
+    if (slabRemaining < blockSize) {
+        slabCursor = static_cast<char*>(::operator new(kSlabSize));
+        slabs.push_back(slabCursor);
+        slabRemaining = kSlabSize;
+        stats.slabBytes += kSlabSize;
+    }
+    void* block = slabCursor;
+    slabCursor += blockSize;
+    slabRemaining -= blockSize;
+    return block;
+}
+
+void FramePool::deallocate(void* block, size_t size) {
+    size_t sizeClass = classFor(size);
+    FreeBlock* freed = static_cast<FreeBlock*>(block);
+    freed->next = freeLists[sizeClass];
+    freeLists[sizeClass] = freed;
+    stats.live--;
+}
+
+void FramePool::setCurrent(FramePool* pool) {
+    currentPool = pool;
+}
+
+FramePool* FramePool::current() {
+    return currentPool;
+}
+
+void* FramePool::allocateFrame(size_t size) {
+    size_t total = size + kHeaderSize;
+    FramePool* pool = currentPool;
+    char* block;
+    if (pool != nullptr && total <= kClasses * kGranularity) {
+        block = static_cast<char*>(pool->allocate(total));
+    } else {
+        block = static_cast<char*>(::operator new(total));
+        if (pool != nullptr) pool->stats.heapFallbacks++;
+        pool = nullptr;
+    }
+    *reinterpret_cast<FramePool**>(block) = pool;
+    return block + kHeaderSize;
+}
+
+void FramePool::releaseFrame(void* frame, size_t size) {
+    char* block = static_cast<char*>(frame) - kHeaderSize;
+    FramePool* pool = *reinterpret_cast<FramePool**>(block);
+    if (pool != nullptr) {
+        pool->deallocate(block, size + kHeaderSize);
+    } else {
+        ::operator delete(block);
+    }
+}
+
+#ifdef PROXY_HAS_COROUTINES
+
+TaskGroup::Root::promise_type::~promise_type() {
+    if (group == nullptr) return;
+    if (prev != nullptr) prev->next = next; else group->head = next;
+    if (next != nullptr) next->prev = prev;
+    group->count--;
+}
+
+TaskGroup::Root TaskGroup::run(Task<void> task) {
+    // Task stores an escaping exception; there is nobody left to report it to
+    try {
+        co_await task;
+    } catch (...) {
+    }
+}
+
+void TaskGroup::spawn(Task<void> task) {
+    Root root = run(std::move(task));
+    Root::promise_type& promise = root.handle.promise();
+    promise.group = this;
+    promise.next = head;
+    if (head != nullptr) head->prev = &promise;
+    head = &promise;
+    count++;
+    root.handle.resume();
+}
+
+void TaskGroup::destroyAll() {
+    while (head != nullptr) {
+        Root::promise_type* promise = head;
+        head = promise->next;
+        if (head != nullptr) head->prev = nullptr;
+        promise->group = nullptr;
+        count--;
+        std::coroutine_handle<Root::promise_type>::from_promise(*promise).destroy();
+    }
+}
+
+SocketOperation::~SocketOperation() {
+    // The awaiting frame is being destroyed mid-wait (worker shutdown)
+    if (socket.reader == this) socket.reader = nullptr;
+    if (socket.writer == this) socket.writer = nullptr;
+}
+
+bool SocketOperation::await_ready() {
+    if (!socket.isOpen()) {
+        result.error = EBADF;
+        return true;
+    }
+    if (isWrite() || socket.readMayHaveData || socket.hungUp) {
+        if (attempt()) return true;
+        if (socket.hungUp) {
+            result.error = ECONNRESET;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool SocketOperation::await_suspend(std::coroutine_handle<> awaiter) {
+    waiter = awaiter;
+    if (isWrite()) socket.writer = this; else socket.reader = this;
+
+    // A stale Writable interest goes while the registration is being touched anyway
+    uint32_t wanted = (socket.reader != nullptr ? uint32_t(EventLoop::Readable) : 0u) |
+                      (socket.writer != nullptr ? uint32_t(EventLoop::Writable) : 0u);
+    socket.updateInterest(wanted | (socket.interest & EventLoop::Readable));
+    return true;
+}
+
+void SocketOperation::complete() {
+    if (socket.reader == this) socket.reader = nullptr;
+    if (socket.writer == this) socket.writer = nullptr;
+    std::coroutine_handle<> awaiter = waiter;
+    waiter = nullptr;
+    socket.loop.defer([awaiter] { awaiter.resume(); });
+}
+
+void SocketOperation::cancel() {
+    if (socket.reader != this && socket.writer != this) return;
+    result.timedOut = true;
+    complete();
+}
+
+AsyncSocket::AsyncSocket(EventLoop& l, SOCKET socket)
+    : loop(l), fd(socket), registered(false), hungUp(false), readMayHaveData(socket != INVALID_SOCKET),
+      quickAck(false), interest(0), reader(nullptr), writer(nullptr) {
+}
+
+AsyncSocket::~AsyncSocket() {
+    close();
+}
+
+bool AsyncSocket::open(int family) {
+    close();
+    fd = socket(family, SOCK_STREAM, 0);
+    if (fd == INVALID_SOCKET) return false;
+    if (!setNonBlocking(fd)) {
+        close();
+        return false;
+    }
+    hungUp = false;
+    readMayHaveData = false;
+    return true;
+}
+
+void AsyncSocket::close() {
+    if (fd == INVALID_SOCKET) return;
+    if (registered) {
+        loop.remove(fd);
+        registered = false;
+    }
+    closesocket(fd);
+    fd = INVALID_SOCKET;
+    interest = 0;
+}
+
+SOCKET AsyncSocket::release() {
+    if (registered) {
+        loop.remove(fd);
+        registered = false;
+    }
+    SOCKET released = fd;
+    fd = INVALID_SOCKET;
+    interest = 0;
+    return released;
+}
+
+void AsyncSocket::updateInterest(uint32_t events) {
+    if (fd == INVALID_SOCKET || (registered && events == interest) || hungUp) return;
+    if (!registered) {
+        registered = loop.add(fd, events, this);
+    } else {
+        loop.modify(fd, events, this);
+    }
+    interest = events;
+}
+
+void AsyncSocket::onEvent(uint32_t events) {
+    if (events & EventLoop::Closed) hungUp = true;
+
+    uint32_t idle = 0;
+    if (events & (EventLoop::Readable | EventLoop::Closed)) {
+        if (reader == nullptr) {
+            idle |= EventLoop::Readable;
+        } else if (reader->attempt()) {
+            reader->complete();
+        } else if (hungUp) {
+            reader->result.error = ECONNRESET;
+            reader->complete();
+        }
+    }
+    if (events & (EventLoop::Writable | EventLoop::Closed)) {
+        if (writer == nullptr) {
+            idle |= EventLoop::Writable;
+        } else if (writer->attempt()) {
+            writer->complete();
+        } else if (hungUp) {
+            writer->result.error = ECONNRESET;
+            writer->complete();
+        }
+    }
+
+    if (hungUp) {
+        // Errors are reported whatever the interest; stop watching the socket
+        if (registered) {
+            loop.remove(fd);
+            registered = false;
+            interest = 0;
+        }
+        return;
+    }
+    // Lazy interest drop: only once readiness arrives that nobody waits for
+    if (idle != 0 && (interest & idle) != 0) {
+        updateInterest(interest & ~idle);
+    }
+}
+
+bool AsyncSocket::ReadOperation::attempt() {
+    while (true) {
+        int received = recv(socket.fd, buffer, static_cast<int>(length), 0);
+        if (received >= 0) {
+            if (received > 0 && socket.quickAck) SocketTuning::quickAck(socket.fd);
+            result.bytes = received;
+            socket.readMayHaveData = received > 0 && static_cast<size_t>(received) == length;
+            return true;
+        }
+
+        int error = lastSocketError();
+        if (isInterrupted(error)) continue;
+        if (isWouldBlock(error)) {
+            socket.readMayHaveData = false;
+            return false;
+        }
+        result.error = error != 0 ? error : EIO;
+        return true;
+    }
+}
+
+bool AsyncSocket::WriteOperation::attempt() {
+    while (static_cast<size_t>(result.bytes) < length) {
+        int sent = send(socket.fd, data + result.bytes, static_cast<int>(length - static_cast<size_t>(result.bytes)),
+                        MSG_NOSIGNAL);
+        if (sent > 0) {
+            result.bytes += sent;
+            continue;
+        }
+
+        int error = lastSocketError();
+        if (sent < 0 && isInterrupted(error)) continue;
+        if (sent < 0 && isWouldBlock(error)) return false;
+        result.error = error != 0 ? error : EIO;
+        return true;
+    }
+    return true;
+}
+
+bool AsyncSocket::SendFileOperation::attempt() {
+    while (static_cast<uint64_t>(result.bytes) < length) {
+        uint64_t remaining = length - static_cast<uint64_t>(result.bytes);
+        long sent = StaticFiles::send(socket.fd, file, offset + static_cast<uint64_t>(result.bytes),
+                                      static_cast<size_t>(std::min<uint64_t>(remaining, 1u << 30)));
+        if (sent > 0) {
+            result.bytes += sent;
+            continue;
+        }
+
+        int error = lastSocketError();
+        if (sent < 0 && isInterrupted(error)) continue;
+        if (sent < 0 && isWouldBlock(error)) return false;
+        // 0: the file shrank since it was cached
+        result.error = sent < 0 && error != 0 ? error : EIO;
+        return true;
+    }
+    return true;
+}
+
+bool AsyncSocket::ConnectOperation::attempt() {
+    if (!started) {
+        started = true;
+        if (::connect(socket.fd, address.get(), address.length) == 0) {
+            return true;
+        }
+        int error = lastSocketError();
+        if (isConnectInProgress(error)) return false;
+        result.error = error != 0 ? error : ECONNREFUSED;
+        return true;
+    }
+
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if (getsockopt(socket.fd, SOL_SOCKET, SO_ERROR, reinterpret_cast<char*>(&error), &length) != 0) {
+        error = lastSocketError();
+    }
+    result.error = error;
+    return true;
+}
+
+void Sleep::await_suspend(std::coroutine_handle<> awaiter) {
+    // Resume after the timer pass, not from inside the wheel
+    EventLoop* owner = &loop;
+    timer.setCallback([owner, awaiter] { owner->defer([awaiter] { awaiter.resume(); }); });
+    loop.timers().schedule(timer, delayMs);
+}
+
+#endif // PROXY_HAS_COROUTINES
@@ -0,0 +1,198 @@
+#include "EventLoop.h"
+#include <chrono>
+#include <cerrno>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#elif !defined(_WIN32)
+#include <poll.h>
+#endif
+
+uint64_t EventLoop::monotonicMs() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+uint64_t EventLoop::monotonicUs() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+EventLoop::EventLoop()
+    : timerWheel(monotonicMs()), cachedNowMs(monotonicMs()) {
+#ifdef __linux__
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+#endif
+}
+
+EventLoop::~EventLoop() {
+#ifdef __linux__
+    if (epollFd >= 0) {
+        close(epollFd);
+    }
+#endif
+}
+
+bool EventLoop::isValid() const {
+#ifdef __linux__
+    return epollFd >= 0;
+#else
+    return true;
+#endif
+}
+
+#ifdef __linux__
+namespace {
+
+uint32_t toEpoll(uint32_t events) {
+    uint32_t mask = 0;
+    if (events & EventLoop::Readable) mask |= EPOLLIN | EPOLLRDHUP;
+    if (events & EventLoop::Writable) mask |= EPOLLOUT;
+    return mask;
+}
+
+} // namespace
+#endif
+
+bool EventLoop::add(SOCKET fd, uint32_t events, IoHandler* handler) {
+#ifdef __linux__
+    epoll_event ev{};
+    ev.events = toEpoll(events);
+    ev.data.ptr = handler;
+    return epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) == 0;
+#else
+    registrations[fd] = {events, handler};
+    return true;
+#endif
+}
+
+bool EventLoop::modify(SOCKET fd, uint32_t events, IoHandler* handler) {
+#ifdef __linux__
+    epoll_event ev{};
+    ev.events = toEpoll(events);
+    ev.data.ptr = handler;
+    return epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &ev) == 0;
+#else
+    registrations[fd] = {events, handler};
+    return true;
+#endif
+}
+
+void EventLoop::remove(SOCKET fd) {
+#ifdef __linux__
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+#else
+    registrations.erase(fd);
+#endif
+}
+
+void EventLoop::defer(std::function<void()> task) {
+    deferred.push_back(std::move(task));
+}
+
+void EventLoop::post(std::function<void()> task) {
+    std::lock_guard<std::mutex> lock(postedMutex);
+    posted.push_back(std::move(task));
+    hasPosted.store(true, std::memory_order_release);
+}
+
+void EventLoop::takePosted() {
+    std::lock_guard<std::mutex> lock(postedMutex);
+    for (auto& task : posted) {
+        deferred.push_back(std::move(task));
+    }
+    posted.clear();
+    hasPosted.store(false, std::memory_order_relaxed);
+}
+
+void EventLoop::runDeferred() {
+    while (!deferred.empty()) {
+        std::vector<std::function<void()>> tasks;
+        tasks.swap(deferred);
+        for (auto& task : tasks) {
+            task();
+        }
+    }
+}
+
+int EventLoop::pollOnce(int timeoutMs) {
+#ifdef __linux__
+    epoll_event events[kMaxEvents];
+    int count = epoll_wait(epollFd, events, kMaxEvents, timeoutMs);
+    if (count < 0) {
+        return errno == EINTR ? 0 : -1;
+    }
+
+    cachedNowMs = monotonicMs();
+    for (int i = 0; i < count; i++) {
+        uint32_t mask = 0;
+        if (events[i].events & (EPOLLIN | EPOLLRDHUP)) mask |= Readable;
+        if (events[i].events & EPOLLOUT) mask |= Writable;
+        if (events[i].events & (EPOLLERR | EPOLLHUP)) mask |= Closed;
+        static_cast<IoHandler*>(events[i].data.ptr)->onEvent(mask);
+    }
+    return count;
+#else
+    std::vector<pollfd> fds;
+    std::vector<IoHandler*> handlers;
+    fds.reserve(registrations.size());
+    handlers.reserve(registrations.size());
+    for (const auto& entry : registrations) {
+        pollfd pfd{};
+        pfd.fd = entry.first;
+        if (entry.second.events & Readable) pfd.events |= POLLIN;
+        if (entry.second.events & Writable) pfd.events |= POLLOUT;
+        fds.push_back(pfd);
+        handlers.push_back(entry.second.handler);
+    }
+
+#ifdef _WIN32
+    int count = fds.empty() ? (Sleep(timeoutMs), 0) : WSAPoll(fds.data(), static_cast<ULONG>(fds.size()), timeoutMs);
+#else
+    int count = poll(fds.data(), fds.size(), timeoutMs);
+#endif
+    if (count < 0) {
+        return errno == EINTR ? 0 : -1;
+    }
+
+    cachedNowMs = monotonicMs();
+    for (size_t i = 0; i < fds.size(); i++) {
+        if (fds[i].revents == 0) continue;
+        // Handlers may unregister sockets polled in this round
+        auto it = registrations.find(fds[i].fd);
+        if (it == registrations.end() || it->second.handler != handlers[i]) continue;
+
+        uint32_t mask = 0;
+        if (fds[i].revents & POLLIN) mask |= Readable;
+        if (fds[i].revents & POLLOUT) mask |= Writable;
+        if (fds[i].revents & (POLLERR | POLLHUP)) mask |= Closed;
+        handlers[i]->onEvent(mask);
+    }
+    return count;
+#endif
+}
+
+void EventLoop::run(const std::atomic<bool>& running) {
+    stopRequested.store(false);
+
+    while (running.load() && !stopRequested.load()) {
+        cachedNowMs = monotonicMs();
+        timerWheel.advance(cachedNowMs);
+        if (hasPosted.load(std::memory_order_acquire)) {
+            takePosted();
+        }
+        runDeferred();
+
+        int timeoutMs = timerWheel.nextTimeoutMs(cachedNowMs);
+        if (timeoutMs < 0 || timeoutMs > kMaxWaitMs) {
+            timeoutMs = kMaxWaitMs;
+        }
+
+        if (pollOnce(timeoutMs) < 0) {
+            break;
+        }
+        runDeferred();
+    }
+
+    runDeferred();
+}
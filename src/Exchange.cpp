@@ -0,0 +1,362 @@
+#include "Exchange.h"
+#include "Worker.h"
+#include "Server.h"
+#include "AdmissionControl.h"
+#include "RetryControl.h"
+#include "Probes.h"
+#include "Http2.h"
+#include <algorithm>
+#include <chrono>
+
+Exchange::Exchange(Worker& w, SOCKET clientSocket, const void* id)
+    : worker(w), server(w.getServer()), logger(w.getServer().getLogger()), probeId(id),
+      bufferSize(w.getServer().getConfig().getConnectionBufferSize()),
+      requestStreaming(false), requestBodySent(false), keepAlive(false),
+      http2Candidate(w.getServer().getConfig().getHttp2().enabled), route(nullptr), requestStartUs(0),
+      requestActive(false), captureId(0), capturedRequests(0), retriesUsed(0), hedged(false) {
+    clientIP = Server::getClientIP(clientSocket);
+    trace.mark(TraceMark::Accepted);
+    if (TrafficCapture* capture = worker.getCapture()) {
+        captureId = capture->sampleConnection();
+    }
+}
+
+// First byte of a new request: idle wait ends, the request clock starts
+void Exchange::beginRequest() {
+    requestStartUs = EventLoop::monotonicUs();
+    trace.mark(TraceMark::FirstByte);
+    PROXY_PROBE1(request_start, probeId);
+}
+
+// Looks for the next request head in requestBuffer; once parsed, the
+// request is counted, captured and routed
+Exchange::HeadStatus Exchange::parseRequestHead() {
+    if (http2Candidate) {
+        // Prior-knowledge h2c: the preface instead of a first request
+        size_t compared = std::min(requestBuffer.size(), Http2::kPrefaceLength);
+        if (requestBuffer.compare(0, compared, Http2::kPreface, compared) == 0) {
+            return compared == Http2::kPrefaceLength ? HeadStatus::Http2Preface : HeadStatus::Incomplete;
+        }
+        http2Candidate = false;
+    }
+    ParseResult result = Http::parseRequestHead(requestBuffer.data(), requestBuffer.size(), request);
+    if (result == ParseResult::Incomplete) return HeadStatus::Incomplete;
+    if (result == ParseResult::Invalid) {
+        logger.warning("Invalid HTTP request format from " + clientIP);
+        return HeadStatus::Invalid;
+    }
+
+    http2Candidate = false;
+    requestActive = true;
+    trace.mark(TraceMark::HeadParsed);
+    PROXY_PROBE3(request_head, probeId, request.method.c_str(), request.path.c_str());
+    worker.getMetrics().add(Counter::Requests);
+    worker.getMetrics().addGauge(Gauge::ActiveRequests, 1);
+    logger.debug("Received HTTP request from " + clientIP + " (" + std::to_string(request.headLength) + " header bytes)");
+    if (captureId != 0) {
+        worker.getCapture()->record(captureId, capturedRequests++, requestStartUs, requestBuffer.data(),
+                                    request.headLength, request.isChunked() ? -1 : request.contentLength());
+    }
+
+    route = server.getRouter().match(request.path);
+    return HeadStatus::Parsed;
+}
+
+// False when the route's rate limit turned the request away
+bool Exchange::checkRateLimit(uint32_t& retryAfterSeconds) {
+    if (route == nullptr || !route->rateLimit.isEnabled()) return true;
+
+    // Fall back to the client address when the key header is missing
+    const std::string* key = &clientIP;
+    if (!route->config.rateLimit.keyHeader.empty()) {
+        const std::string* header = request.findHeader(route->config.rateLimit.keyHeader);
+        if (header != nullptr) key = header;
+    }
+
+    uint64_t keyHash = RateLimiter::hashKey(route->keySeed, key->data(), key->length());
+    uint32_t retryAfterMs = 0;
+    if (server.getRateLimiter().tryAcquire(keyHash, route->rateLimit, worker.getLoop().now(), retryAfterMs)) {
+        return true;
+    }
+    retryAfterSeconds = std::max<uint32_t>((retryAfterMs + 999) / 1000, 1);
+    logger.debug("Rate limited " + request.method + " " + request.path + " from " + clientIP);
+    return false;
+}
+
+// The head is rebuilt from the parsed fields; only the body stays buffered.
+// A body that fits in the buffer is held whole, a larger one is streamed.
+void Exchange::startRequestBody() {
+    requestBuffer.erase(0, request.headLength);
+    long long bodyLength = request.contentLength();
+    if (request.isChunked()) {
+        requestDecoder.reset(BodyDecoder::Framing::Chunked);
+    } else if (bodyLength > 0) {
+        requestDecoder.reset(BodyDecoder::Framing::Length, bodyLength);
+        requestStreaming = static_cast<size_t>(bodyLength) > bufferSize;
+    } else {
+        requestDecoder.reset(BodyDecoder::Framing::None);
+    }
+}
+
+// Moves body bytes from requestBuffer into requestBody, re-encoded for the
+// backend, up to the buffer size; false on invalid chunked framing
+bool Exchange::decodeRequestBody() {
+    if (requestDecoder.isComplete() || requestBuffer.empty() || requestBody.size() >= bufferSize) return true;
+
+    bool chunked = requestDecoder.getFraming() == BodyDecoder::Framing::Chunked;
+    size_t length = std::min(requestBuffer.size(), bufferSize - requestBody.size());
+    requestBuffer.erase(0, requestDecoder.decode(requestBuffer.data(), length, requestBody, chunked));
+    if (requestDecoder.isInvalid()) {
+        logger.warning("Invalid chunked request body from " + clientIP);
+        return false;
+    }
+    if (requestDecoder.isComplete() && chunked) {
+        Http::appendLastChunk(requestBody);
+    }
+    return true;
+}
+
+// True once the body is whole or has to be streamed: chunked bodies are
+// held until they end or outgrow the buffer
+bool Exchange::requestBodyReady() {
+    if (requestDecoder.isComplete()) return true;
+    if (!requestStreaming && requestBody.size() < bufferSize) return false;
+    requestStreaming = true;
+    return true;
+}
+
+bool Exchange::wantsContinue() const {
+    return !requestDecoder.isComplete() && request.hasToken("Expect", "100-continue");
+}
+
+void Exchange::onRequestRead() {
+    logger.info("Request: " + request.method + " " + request.path + " from " + clientIP);
+    keepAlive = server.getConfig().isKeepAliveEnabled() && request.wantsKeepAlive() && !server.isDraining();
+    trace.mark(TraceMark::RequestRead);
+    PROXY_PROBE1(request_read, probeId);
+}
+
+// First pick: a saturated backend is skipped in favour of the next one
+Exchange::Selection Exchange::selectBackend(BackendServer*& backend, ConcurrencyLimiter*& limiter) {
+    LoadBalancer& loadBalancer = server.getLoadBalancer();
+    AdmissionController& admission = server.getAdmission();
+
+    bool saturated = false;
+    size_t count = loadBalancer.getBackendCount();
+    for (size_t i = 0; i < count; i++) {
+        BackendServer* candidate = loadBalancer.getNextBackend(clientIP);
+        if (candidate == nullptr) return Selection::NoBackend;
+        if (!candidate->isHealthy) continue;
+
+        ConcurrencyLimiter* candidateLimiter = admission.isEnabled() ? admission.getBackendLimiter(candidate) : nullptr;
+        if (candidateLimiter != nullptr && !candidateLimiter->tryAcquire()) {
+            saturated = true;
+            continue;
+        }
+        backend = candidate;
+        limiter = candidateLimiter;
+        return Selection::Selected;
+    }
+    return saturated ? Selection::Saturated : Selection::NoBackend;
+}
+
+// Retries and hedges avoid the backends already tried. The balancer is
+// asked first; sticky algorithms (IP hash) fall through to a scan.
+bool Exchange::selectAlternateBackend(const BackendServer* avoid, const BackendServer* busy, BackendServer*& backend,
+                                      ConcurrencyLimiter*& limiter) {
+    LoadBalancer& loadBalancer = server.getLoadBalancer();
+    AdmissionController& admission = server.getAdmission();
+
+    size_t count = loadBalancer.getBackendCount();
+    for (size_t i = 0; i < 2 * count; i++) {
+        BackendServer* candidate = i < count ? loadBalancer.getNextBackend(clientIP) : loadBalancer.getBackend(i - count);
+        if (candidate == nullptr || candidate == avoid || candidate == busy || !candidate->isHealthy) continue;
+
+        ConcurrencyLimiter* candidateLimiter = admission.isEnabled() ? admission.getBackendLimiter(candidate) : nullptr;
+        if (candidateLimiter != nullptr && !candidateLimiter->tryAcquire()) continue;
+
+        backend = candidate;
+        limiter = candidateLimiter;
+        return true;
+    }
+    return false;
+}
+
+// After a failed attempt: true when the request goes to backend (holding
+// limiter) next, with the retry counted against the budget
+bool Exchange::retryAfterFailure(bool retryable, const BackendServer* failed, const BackendServer* busy,
+                                 const std::string& failedUrl, BackendServer*& backend, ConcurrencyLimiter*& limiter) {
+    // A streamed body cannot be replayed once part of it is gone
+    RetryController& retries = server.getRetryControl();
+    if (!retryable || requestBodySent || !retries.isEnabled() || retriesUsed >= retries.getMaxRetries() ||
+        !selectAlternateBackend(failed, busy, backend, limiter)) {
+        return false;
+    }
+
+    if (!retries.tryExtraAttempt(worker.getLoop().now())) {
+        logger.warning("Retry budget exhausted, not retrying " + request.method + " " + request.path);
+        if (limiter != nullptr) {
+            limiter->releaseWithoutSample();
+            worker.scheduleQueueDrain();
+        }
+        backend = nullptr;
+        limiter = nullptr;
+        return false;
+    }
+    retriesUsed++;
+    retries.getStats().retries.fetch_add(1, std::memory_order_relaxed);
+    logger.warning("Retrying " + request.method + " " + request.path + " after failure on " + failedUrl);
+    return true;
+}
+
+// Counts the backend as busy for the attempt; returns its URL
+std::string Exchange::beginAttempt(BackendServer* backend, bool hedge) {
+    std::string url = backend->host + ":" + std::to_string(backend->port);
+    if (backendUrl.empty() || !hedge) {
+        backendUrl = url;
+    }
+    logger.info(std::string(hedge ? "Hedging " : "Forwarding ") + request.method + " " + request.path +
+                " to backend: " + url + " (algorithm: " + server.getConfig().algorithmToString() + ")");
+    server.getLoadBalancer().incrementConnections(backend->host, backend->port);
+    return url;
+}
+
+// A body held whole goes with the head, so a retry or hedge can send it
+// again; a streamed one follows once the attempt is connected
+void Exchange::appendUpstreamRequest(std::string& output) const {
+    output.reserve(output.size() + request.headLength + 128 + (requestStreaming ? 0 : requestBody.size()));
+    Http::appendUpstreamRequestHead(request, clientIP, output);
+    if (!requestStreaming) {
+        output += requestBody;
+    }
+}
+
+void Exchange::recordFirstByte(const BackendServer* backend, const std::string& url, uint64_t latencyUs) {
+    server.getRetryControl().recordLatency(backend, latencyUs);
+    worker.getMetrics().recordUpstreamLatency(server.getLoadBalancer().indexOf(backend), latencyUs);
+    trace.mark(TraceMark::FirstResponseByte);
+    PROXY_PROBE3(upstream_first_byte, probeId, url.c_str(), latencyUs);
+}
+
+void Exchange::countDeadline() {
+    server.getTimeoutCounters().requestTotal.fetch_add(1, std::memory_order_relaxed);
+    logger.warning("Request deadline exceeded for " + clientIP +
+                   (backendUrl.empty() ? std::string() : " (backend " + backendUrl + ")"));
+}
+
+// Frames the response body for the client, settles keep-alive and appends
+// the response head to output; true when the body is relayed as chunks
+bool Exchange::startResponse(const HttpHead& response, BodyDecoder& decoder, std::string& output) {
+    bool noBody = request.method == "HEAD" || response.statusCode == 204 || response.statusCode == 304 ||
+                  (response.statusCode >= 100 && response.statusCode < 200);
+    long long contentLength = response.contentLength();
+    // HTTP/1.0 clients cannot take chunks; their bodies end when we close
+    bool chunkedClient = request.version != "HTTP/1.0";
+    bool chunked = false;
+    if (server.isDraining()) {
+        keepAlive = false;   // hot restart: announce the close in this response
+    }
+    if (noBody) {
+        decoder.reset(BodyDecoder::Framing::None);
+    } else if (response.isChunked()) {
+        decoder.reset(BodyDecoder::Framing::Chunked);
+        chunked = chunkedClient;
+    } else if (contentLength >= 0) {
+        decoder.reset(BodyDecoder::Framing::Length, contentLength);
+    } else {
+        // Ends at upstream EOF; re-chunked so the client connection can stay open
+        decoder.reset(BodyDecoder::Framing::UntilClose);
+        chunked = chunkedClient && keepAlive;
+    }
+    if (!chunked && (decoder.getFraming() == BodyDecoder::Framing::Chunked ||
+                     decoder.getFraming() == BodyDecoder::Framing::UntilClose)) {
+        keepAlive = false;
+    }
+
+    Http::appendClientResponseHead(response, keepAlive, chunked, output);
+    return chunked;
+}
+
+// Appends response body bytes for the client; false when the backend's
+// chunked framing was invalid
+bool Exchange::decodeResponseBody(BodyDecoder& decoder, bool chunked, const char* data, size_t length,
+                                  std::string& output) {
+    decoder.decode(data, length, output, chunked);
+    if (decoder.isInvalid()) {
+        logger.error("Invalid chunked response body from backend " + backendUrl);
+        return false;
+    }
+    if (decoder.isComplete() && chunked) {
+        Http::appendLastChunk(output);
+    }
+    return true;
+}
+
+// Upstream EOF after the response head
+void Exchange::endResponseAtEof(const BodyDecoder& decoder, bool chunked, std::string& output) {
+    if (decoder.getFraming() != BodyDecoder::Framing::UntilClose) {
+        // Truncated body: the client can only detect it if we close
+        logger.warning("Backend " + backendUrl + " response truncated");
+        keepAlive = false;
+    } else if (chunked) {
+        Http::appendLastChunk(output);
+    }
+}
+
+void Exchange::recordRequestEnd(int statusCode) {
+    MetricsShard& metrics = worker.getMetrics();
+    if (requestActive) {
+        requestActive = false;
+        metrics.addGauge(Gauge::ActiveRequests, -1);
+    }
+    // Abandoned exchanges (statusCode 0) only leave the gauge
+    if (requestStartUs != 0 && statusCode > 0) {
+        metrics.recordRequest(routeSlot(), statusCode, EventLoop::monotonicUs() - requestStartUs);
+    }
+
+    if (requestStartUs != 0) {
+        trace.mark(TraceMark::Complete);
+        uint64_t totalUs = Tsc::toUs(trace.get(TraceMark::Complete) - trace.get(TraceMark::FirstByte));
+        PROXY_PROBE3(request_done, probeId, statusCode, totalUs);
+        SlowRequestLog* slowRequests = server.getSlowRequests();
+        if (slowRequests != nullptr && slowRequests->isSlow(totalUs)) {
+            recordSlowRequest(*slowRequests, statusCode, totalUs);
+        }
+    }
+    trace.reset();
+    requestStartUs = 0;
+}
+
+void Exchange::recordSlowRequest(SlowRequestLog& log, int statusCode, uint64_t totalUs) {
+    SlowRequest entry{};
+    entry.finishedAtMs = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count());
+    entry.totalUs = static_cast<uint32_t>(std::min<uint64_t>(totalUs, UINT32_MAX));
+    trace.phaseDurations(entry.phaseUs);
+    entry.status = static_cast<uint16_t>(statusCode);
+    entry.worker = static_cast<uint16_t>(worker.getId());
+    entry.retries = static_cast<uint8_t>(retriesUsed);
+    entry.hedged = hedged ? 1 : 0;
+    SlowRequest::copyString(entry.method, sizeof(entry.method), request.method);
+    SlowRequest::copyString(entry.path, sizeof(entry.path), request.path);
+    SlowRequest::copyString(entry.backend, sizeof(entry.backend), backendUrl);
+    SlowRequest::copyString(entry.client, sizeof(entry.client), clientIP);
+    log.record(entry);
+}
+
+// Keep-alive: drop the finished request; the next one may already be buffered
+void Exchange::resetRequest() {
+    request = HttpHead();
+    requestDecoder.reset(BodyDecoder::Framing::None);
+    requestBody.clear();
+    requestStreaming = false;
+    requestBodySent = false;
+    route = nullptr;
+    backendUrl.clear();
+    retriesUsed = 0;
+    hedged = false;
+}
+
+size_t Exchange::routeSlot() const {
+    return route != nullptr ? route->index : server.getRouter().getRouteCount();
+}
@@ -0,0 +1,336 @@
+#include "HotRestart.h"
+#include "Config.h"
+#include "Logger.h"
+#include <cstring>
+
+#ifndef _WIN32
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <poll.h>
+#endif
+
+HotRestart::HotRestart(const HotRestartConfig& settings, Logger& log)
+    : config(settings), logger(log), listenSocket(INVALID_SOCKET), predecessor(INVALID_SOCKET),
+      successor(INVALID_SOCKET) {
+}
+
+HotRestart::~HotRestart() {
+#ifndef _WIN32
+    // Still ours unless a successor took over
+    if (listenSocket != INVALID_SOCKET) {
+        unlink(config.socketPath.c_str());
+    }
+#endif
+    closeSocket(listenSocket);
+    closeSocket(predecessor);
+    closeSocket(successor);
+}
+
+void HotRestart::closeSocket(SOCKET& socket) {
+    if (socket != INVALID_SOCKET) {
+        closesocket(socket);
+        socket = INVALID_SOCKET;
+    }
+}
+
+#ifndef _WIN32
+
+namespace {
+
+constexpr size_t kHeaderSize = 5;   // type, then the payload length (big endian)
+constexpr size_t kMaxFds = 250;     // under the kernel's SCM_MAX_FD
+
+bool unixAddress(const std::string& path, sockaddr_un& address) {
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) return false;
+    memcpy(address.sun_path, path.data(), path.size());
+    return true;
+}
+
+bool setTimeouts(SOCKET socket, int timeoutMs) {
+    timeval timeout{};
+    timeout.tv_sec = timeoutMs / 1000;
+    timeout.tv_usec = (timeoutMs % 1000) * 1000;
+    return setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == 0 &&
+           setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) == 0;
+}
+
+bool readFully(SOCKET socket, char* data, size_t length) {
+    while (length > 0) {
+        ssize_t received = recv(socket, data, length, 0);
+        if (received < 0 && errno == EINTR) continue;
+        if (received <= 0) return false;
+        data += received;
+        length -= static_cast<size_t>(received);
+    }
+    return true;
+}
+
+void appendUint32(std::string& out, uint32_t value) {
+    out += static_cast<char>((value >> 24) & 0xff);
+    out += static_cast<char>((value >> 16) & 0xff);
+    out += static_cast<char>((value >> 8) & 0xff);
+    out += static_cast<char>(value & 0xff);
+}
+
+uint32_t readUint32(const char* data) {
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+    return (static_cast<uint32_t>(bytes[0]) << 24) | (static_cast<uint32_t>(bytes[1]) << 16) |
+           (static_cast<uint32_t>(bytes[2]) << 8) | bytes[3];
+}
+
+} // namespace
+
+bool HotRestart::send(SOCKET socket, Message type, const std::string& payload, const std::vector<SOCKET>& fds) {
+    std::string message;
+    message += static_cast<char>(type);
+    appendUint32(message, static_cast<uint32_t>(payload.size()));
+    message += payload;
+
+    // Descriptors ride along with the first byte
+    iovec iov{};
+    iov.iov_base = &message[0];
+    iov.iov_len = message.size();
+    msghdr header{};
+    header.msg_iov = &iov;
+    header.msg_iovlen = 1;
+    std::vector<char> control;
+    if (!fds.empty()) {
+        control.assign(CMSG_SPACE(fds.size() * sizeof(int)), 0);
+        header.msg_control = control.data();
+        header.msg_controllen = control.size();
+        cmsghdr* cmsg = CMSG_FIRSTHDR(&header);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(fds.size() * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), fds.data(), fds.size() * sizeof(int));
+    }
+
+    size_t offset = 0;
+    while (offset < message.size()) {
+        ssize_t sent = sendmsg(socket, &header, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent <= 0) return false;
+        offset += static_cast<size_t>(sent);
+        iov.iov_base = &message[offset];
+        iov.iov_len = message.size() - offset;
+        header.msg_control = nullptr;
+        header.msg_controllen = 0;
+    }
+    return true;
+}
+
+bool HotRestart::receive(SOCKET socket, Message& type, std::string& payload, std::vector<SOCKET>* fds) {
+    char head[kHeaderSize];
+    iovec iov{};
+    iov.iov_base = head;
+    iov.iov_len = sizeof(head);
+    msghdr header{};
+    header.msg_iov = &iov;
+    header.msg_iovlen = 1;
+    std::vector<char> control(CMSG_SPACE(kMaxFds * sizeof(int)), 0);
+    header.msg_control = control.data();
+    header.msg_controllen = control.size();
+
+    ssize_t received;
+    do {
+        received = recvmsg(socket, &header, MSG_CMSG_CLOEXEC);
+    } while (received < 0 && errno == EINTR);
+    if (received <= 0) return false;
+
+    for (cmsghdr* cmsg = CMSG_FIRSTHDR(&header); cmsg != nullptr; cmsg = CMSG_NXTHDR(&header, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+        size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (size_t i = 0; i < count; i++) {
+            int fd;
+            memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+            if (fds != nullptr) {
+                fds->push_back(fd);
+            } else {
+                closesocket(fd);
+            }
+        }
+    }
+    if (header.msg_flags & MSG_CTRUNC) {
+        logger.error("Hot restart: descriptors truncated in transfer");
+        return false;
+    }
+
+    if (static_cast<size_t>(received) < kHeaderSize &&
+        !readFully(socket, head + received, kHeaderSize - static_cast<size_t>(received))) {
+        return false;
+    }
+    type = static_cast<Message>(head[0]);
+    uint32_t length = readUint32(head + 1);
+    if (length > kMaxMessage) return false;
+    payload.assign(length, '\0');
+    return length == 0 || readFully(socket, &payload[0], length);
+}
+
+bool HotRestart::inherit(std::vector<SOCKET>& listeners, std::vector<SOCKET>& tlsListeners) {
+    sockaddr_un address;
+    if (!unixAddress(config.socketPath, address)) return false;
+
+    predecessor = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (predecessor == INVALID_SOCKET) return false;
+    if (connect(predecessor, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        // Nothing running (or a stale socket file): a cold start
+        closeSocket(predecessor);
+        return false;
+    }
+    setTimeouts(predecessor, kHandoffTimeoutMs);
+
+    Message type;
+    std::string payload;
+    std::vector<SOCKET> fds;
+    if (!send(predecessor, Message::Hello, std::string()) || !receive(predecessor, type, payload, &fds) ||
+        type != Message::Listeners || payload.size() != 8 ||
+        fds.size() != static_cast<size_t>(readUint32(payload.data())) + readUint32(payload.data() + 4)) {
+        logger.error("Hot restart: no listening sockets from the process on " + config.socketPath);
+        for (SOCKET fd : fds) {
+            closesocket(fd);
+        }
+        closeSocket(predecessor);
+        return false;
+    }
+
+    size_t proxyCount = readUint32(payload.data());
+    listeners.assign(fds.begin(), fds.begin() + static_cast<long>(proxyCount));
+    tlsListeners.assign(fds.begin() + static_cast<long>(proxyCount), fds.end());
+    logger.info("Hot restart: inherited " + std::to_string(listeners.size()) + " listening socket(s) and " +
+                std::to_string(tlsListeners.size()) + " TLS listening socket(s)");
+    return true;
+}
+
+bool HotRestart::confirmInherited() {
+    if (predecessor == INVALID_SOCKET) return false;
+
+    Message type;
+    std::string payload;
+    if (!send(predecessor, Message::Ready, std::string()) || !receive(predecessor, type, payload) ||
+        type != Message::Draining) {
+        logger.warning("Hot restart: previous process did not confirm draining");
+        closeSocket(predecessor);
+        return false;
+    }
+    logger.info("Hot restart: previous process is draining");
+    return true;
+}
+
+bool HotRestart::pollStats(std::string& stats) {
+    if (predecessor == INVALID_SOCKET) return false;
+
+    pollfd pfd{};
+    pfd.fd = predecessor;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, 0) <= 0) return false;
+
+    Message type;
+    bool received = receive(predecessor, type, stats) && type == Message::Stats;
+    closeSocket(predecessor);
+    if (!received) {
+        logger.warning("Hot restart: previous process exited without handing over stats");
+        stats.clear();
+    }
+    return received;
+}
+
+bool HotRestart::listen() {
+    sockaddr_un address;
+    if (!unixAddress(config.socketPath, address)) return false;
+
+    listenSocket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listenSocket == INVALID_SOCKET) return false;
+
+    // The previous process keeps its (now unnamed) socket until it exits
+    unlink(config.socketPath.c_str());
+    if (bind(listenSocket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+        chmod(config.socketPath.c_str(), 0600) != 0 || ::listen(listenSocket, 1) != 0 ||
+        !setNonBlocking(listenSocket)) {
+        logger.error("Hot restart: failed to listen on " + config.socketPath);
+        closeSocket(listenSocket);
+        return false;
+    }
+    logger.info("Hot restart: accepting a successor on " + config.socketPath);
+    return true;
+}
+
+bool HotRestart::pollSuccessor(const std::vector<SOCKET>& listeners, const std::vector<SOCKET>& tlsListeners) {
+    if (listenSocket == INVALID_SOCKET || successor != INVALID_SOCKET) return false;
+
+    SOCKET candidate = accept(listenSocket, nullptr, nullptr);
+    if (candidate == INVALID_SOCKET) return false;
+#ifdef SO_PEERCRED
+    // The listening sockets only go to processes of our own user
+    ucred peer{};
+    socklen_t peerLength = sizeof(peer);
+    if (getsockopt(candidate, SOL_SOCKET, SO_PEERCRED, &peer, &peerLength) != 0 || peer.uid != geteuid()) {
+        logger.warning("Hot restart: refusing a successor running as another user");
+        closesocket(candidate);
+        return false;
+    }
+#endif
+    int flags = fcntl(candidate, F_GETFL, 0);
+    fcntl(candidate, F_SETFL, flags & ~O_NONBLOCK);
+    setTimeouts(candidate, kHandoffTimeoutMs);
+
+    std::vector<SOCKET> fds(listeners);
+    fds.insert(fds.end(), tlsListeners.begin(), tlsListeners.end());
+    std::string counts;
+    appendUint32(counts, static_cast<uint32_t>(listeners.size()));
+    appendUint32(counts, static_cast<uint32_t>(tlsListeners.size()));
+
+    Message type;
+    std::string payload;
+    if (fds.size() > kMaxFds || !receive(candidate, type, payload) || type != Message::Hello ||
+        !send(candidate, Message::Listeners, counts, fds) || !receive(candidate, type, payload) ||
+        type != Message::Ready) {
+        // The new process failed to start: keep serving
+        logger.warning("Hot restart: handoff to the new process failed; still accepting");
+        closesocket(candidate);
+        return false;
+    }
+
+    successor = candidate;
+    closeSocket(listenSocket);
+    logger.info("Hot restart: new process is accepting on our listening sockets");
+    return true;
+}
+
+void HotRestart::notifyDraining() {
+    if (successor != INVALID_SOCKET && !send(successor, Message::Draining, std::string())) {
+        logger.warning("Hot restart: lost the connection to the new process");
+        closeSocket(successor);
+    }
+}
+
+void HotRestart::sendStats(const std::string& stats) {
+    if (successor == INVALID_SOCKET) return;
+    if (!send(successor, Message::Stats, stats)) {
+        logger.warning("Hot restart: failed to hand over stats");
+    }
+    closeSocket(successor);
+}
+
+#else
+
+// No descriptor passing: every start is a cold start
+
+bool HotRestart::send(SOCKET, Message, const std::string&, const std::vector<SOCKET>&) { return false; }
+bool HotRestart::receive(SOCKET, Message&, std::string&, std::vector<SOCKET>*) { return false; }
+
+bool HotRestart::inherit(std::vector<SOCKET>&, std::vector<SOCKET>&) { return false; }
+bool HotRestart::confirmInherited() { return false; }
+bool HotRestart::pollStats(std::string&) { return false; }
+
+bool HotRestart::listen() {
+    logger.warning("Hot restart needs Unix domain sockets; disabled on this platform");
+    return false;
+}
+
+bool HotRestart::pollSuccessor(const std::vector<SOCKET>&, const std::vector<SOCKET>&) { return false; }
+void HotRestart::notifyDraining() {}
+void HotRestart::sendStats(const std::string&) {}
+
+#endif
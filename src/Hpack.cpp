@@ -0,0 +1,485 @@
+#include "Hpack.h"
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <cstring>
+
+namespace {
+
+// RFC 7541 Appendix A
+const std::pair<std::string, std::string> kStaticTable[HpackTable::kStaticEntries] = {
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""},
+};
+
+// RFC 7541 Appendix B: code for each octet, left-aligned in length bits
+constexpr uint32_t kHuffmanCodes[256] = {
+    0x1ff8, 0x7fffd8, 0xfffffe2, 0xfffffe3, 0xfffffe4, 0xfffffe5, 0xfffffe6, 0xfffffe7,
+    0xfffffe8, 0xffffea, 0x3ffffffc, 0xfffffe9, 0xfffffea, 0x3ffffffd, 0xfffffeb, 0xfffffec,
+    0xfffffed, 0xfffffee, 0xfffffef, 0xffffff0, 0xffffff1, 0xffffff2, 0x3ffffffe, 0xffffff3,
+    0xffffff4, 0xffffff5, 0xffffff6, 0xffffff7, 0xffffff8, 0xffffff9, 0xffffffa, 0xffffffb,
+    0x14, 0x3f8, 0x3f9, 0xffa, 0x1ff9, 0x15, 0xf8, 0x7fa,
+    0x3fa, 0x3fb, 0xf9, 0x7fb, 0xfa, 0x16, 0x17, 0x18,
+    0x0, 0x1, 0x2, 0x19, 0x1a, 0x1b, 0x1c, 0x1d,
+    0x1e, 0x1f, 0x5c, 0xfb, 0x7ffc, 0x20, 0xffb, 0x3fc,
+    0x1ffa, 0x21, 0x5d, 0x5e, 0x5f, 0x60, 0x61, 0x62,
+    0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a,
+    0x6b, 0x6c, 0x6d, 0x6e, 0x6f, 0x70, 0x71, 0x72,
+    0xfc, 0x73, 0xfd, 0x1ffb, 0x7fff0, 0x1ffc, 0x3ffc, 0x22,
+    0x7ffd, 0x3, 0x23, 0x4, 0x24, 0x5, 0x25, 0x26,
+    0x27, 0x6, 0x74, 0x75, 0x28, 0x29, 0x2a, 0x7,
+    0x2b, 0x76, 0x2c, 0x8, 0x9, 0x2d, 0x77, 0x78,
+    0x79, 0x7a, 0x7b, 0x7ffe, 0x7fc, 0x3ffd, 0x1ffd, 0xffffffc,
+    0xfffe6, 0x3fffd2, 0xfffe7, 0xfffe8, 0x3fffd3, 0x3fffd4, 0x3fffd5, 0x7fffd9,
+    0x3fffd6, 0x7fffda, 0x7fffdb, 0x7fffdc, 0x7fffdd, 0x7fffde, 0xffffeb, 0x7fffdf,
+    0xffffec, 0xffffed, 0x3fffd7, 0x7fffe0, 0xffffee, 0x7fffe1, 0x7fffe2, 0x7fffe3,
+    0x7fffe4, 0x1fffdc, 0x3fffd8, 0x7fffe5, 0x3fffd9, 0x7fffe6, 0x7fffe7, 0xffffef,
+    0x3fffda, 0x1fffdd, 0xfffe9, 0x3fffdb, 0x3fffdc, 0x7fffe8, 0x7fffe9, 0x1fffde,
+    0x7fffea, 0x3fffdd, 0x3fffde, 0xfffff0, 0x1fffdf, 0x3fffdf, 0x7fffeb, 0x7fffec,
+    0x1fffe0, 0x1fffe1, 0x3fffe0, 0x1fffe2, 0x7fffed, 0x3fffe1, 0x7fffee, 0x7fffef,
+    0xfffea, 0x3fffe2, 0x3fffe3, 0x3fffe4, 0x7ffff0, 0x3fffe5, 0x3fffe6, 0x7ffff1,
+    0x3ffffe0, 0x3ffffe1, 0xfffeb, 0x7fff1, 0x3fffe7, 0x7ffff2, 0x3fffe8, 0x1ffffec,
+    0x3ffffe2, 0x3ffffe3, 0x3ffffe4, 0x7ffffde, 0x7ffffdf, 0x3ffffe5, 0xfffff1, 0x1ffffed,
+    0x7fff2, 0x1fffe3, 0x3ffffe6, 0x7ffffe0, 0x7ffffe1, 0x3ffffe7, 0x7ffffe2, 0xfffff2,
+    0x1fffe4, 0x1fffe5, 0x3ffffe8, 0x3ffffe9, 0xffffffd, 0x7ffffe3, 0x7ffffe4, 0x7ffffe5,
+    0xfffec, 0xfffff3, 0xfffed, 0x1fffe6, 0x3fffe9, 0x1fffe7, 0x1fffe8, 0x7ffff3,
+    0x3fffea, 0x3fffeb, 0x1ffffee, 0x1ffffef, 0xfffff4, 0xfffff5, 0x3ffffea, 0x7ffff4,
+    0x3ffffeb, 0x7ffffe6, 0x3ffffec, 0x3ffffed, 0x7ffffe7, 0x7ffffe8, 0x7ffffe9, 0x7ffffea,
+    0x7ffffeb, 0xffffffe, 0x7ffffec, 0x7ffffed, 0x7ffffee, 0x7ffffef, 0x7fffff0, 0x3ffffee,
+};
+constexpr uint8_t kHuffmanLengths[256] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+    5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+    13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+    6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+};
+
+constexpr uint32_t kEosCode = 0x3fffffff;
+constexpr int kEosLength = 30;
+
+/**
+ * Huffman decoding four bits at a time. States are the internal nodes of
+ * the code tree (256 of them for 257 codes); from each, a nibble leads to
+ * another internal node, emitting at most one octet on the way since no
+ * code is shorter than five bits.
+ */
+class HuffmanDecoder {
+public:
+    enum : uint8_t {
+        kEmit = 1,
+        kFail = 2   // the nibble runs into EOS
+    };
+
+    struct Transition {
+        uint8_t next;
+        uint8_t symbol;
+        uint8_t flags;
+    };
+
+    HuffmanDecoder() {
+        // A child >= 0 is an internal node (0, the root, is nobody's child,
+        // so it also marks a missing child); < 0 is the leaf for -child - 1
+        int16_t children[256][2] = {};
+        uint8_t depth[256] = {};
+        bool allOnes[256] = {};
+        allOnes[0] = true;
+        int nodes = 1;
+        for (int symbol = 0; symbol <= 256; symbol++) {
+            uint32_t code = symbol < 256 ? kHuffmanCodes[symbol] : kEosCode;
+            int length = symbol < 256 ? kHuffmanLengths[symbol] : kEosLength;
+            int node = 0;
+            for (int bit = length - 1; bit > 0; bit--) {
+                int branch = (code >> bit) & 1;
+                if (children[node][branch] == 0) {
+                    depth[nodes] = static_cast<uint8_t>(depth[node] + 1);
+                    allOnes[nodes] = allOnes[node] && branch == 1;
+                    children[node][branch] = static_cast<int16_t>(nodes++);
+                }
+                node = children[node][branch];
+            }
+            children[node][code & 1] = static_cast<int16_t>(-(symbol + 1));
+        }
+
+        for (int state = 0; state < nodes; state++) {
+            // Padding is up to seven 1 bits: the start of EOS
+            accepting[state] = allOnes[state] && depth[state] <= 7;
+            for (int nibble = 0; nibble < 16; nibble++) {
+                Transition transition{0, 0, 0};
+                int node = state;
+                for (int bit = 3; bit >= 0; bit--) {
+                    int child = children[node][(nibble >> bit) & 1];
+                    if (child >= 0) {
+                        node = child;
+                    } else if (child == -257) {
+                        transition.flags = kFail;
+                        break;
+                    } else {
+                        transition.symbol = static_cast<uint8_t>(-child - 1);
+                        transition.flags |= kEmit;
+                        node = 0;
+                    }
+                }
+                transition.next = static_cast<uint8_t>(node);
+                transitions[state][nibble] = transition;
+            }
+        }
+    }
+
+    bool decode(const uint8_t* data, size_t length, std::string& output) const {
+        uint8_t state = 0;
+        for (size_t i = 0; i < length; i++) {
+            for (int nibble : {data[i] >> 4, data[i] & 0x0f}) {
+                const Transition& transition = transitions[state][nibble];
+                if (transition.flags & kFail) return false;
+                if (transition.flags & kEmit) output.push_back(static_cast<char>(transition.symbol));
+                state = transition.next;
+            }
+        }
+        return accepting[state];
+    }
+
+private:
+    Transition transitions[256][16];
+    bool accepting[256];
+};
+
+const HuffmanDecoder& huffmanDecoder() {
+    static const HuffmanDecoder decoder;
+    return decoder;
+}
+
+// Prefix-coded integers (RFC 7541 5.1); flags fill the bits above the prefix
+void writeInteger(std::string& output, uint8_t flags, int prefixBits, uint64_t value) {
+    uint64_t limit = (1u << prefixBits) - 1;
+    if (value < limit) {
+        output.push_back(static_cast<char>(flags | value));
+        return;
+    }
+    output.push_back(static_cast<char>(flags | limit));
+    value -= limit;
+    while (value >= 0x80) {
+        output.push_back(static_cast<char>(0x80 | (value & 0x7f)));
+        value >>= 7;
+    }
+    output.push_back(static_cast<char>(value));
+}
+
+// At most five continuation octets: far beyond any size we accept
+bool readInteger(const uint8_t*& position, const uint8_t* end, int prefixBits, uint64_t& value) {
+    if (position == end) return false;
+    uint64_t limit = (1u << prefixBits) - 1;
+    value = *position++ & limit;
+    if (value < limit) return true;
+    for (int shift = 0; shift <= 28; shift += 7) {
+        if (position == end) return false;
+        uint8_t octet = *position++;
+        value += static_cast<uint64_t>(octet & 0x7f) << shift;
+        if ((octet & 0x80) == 0) return true;
+    }
+    return false;
+}
+
+// String literals (RFC 7541 5.2), Huffman coded when that is shorter
+void writeString(std::string& output, const std::string& value) {
+    size_t encoded = Hpack::huffmanLength(value);
+    if (encoded < value.size()) {
+        writeInteger(output, 0x80, 7, encoded);
+        Hpack::huffmanEncode(value, output);
+    } else {
+        writeInteger(output, 0, 7, value.size());
+        output += value;
+    }
+}
+
+bool readString(const uint8_t*& position, const uint8_t* end, std::string& value) {
+    if (position == end) return false;
+    bool huffman = (*position & 0x80) != 0;
+    uint64_t length = 0;
+    if (!readInteger(position, end, 7, length) || length > static_cast<uint64_t>(end - position)) {
+        return false;
+    }
+    value.clear();
+    if (huffman) {
+        if (!huffmanDecoder().decode(position, static_cast<size_t>(length), value)) return false;
+    } else {
+        value.assign(reinterpret_cast<const char*>(position), static_cast<size_t>(length));
+    }
+    position += length;
+    return true;
+}
+
+const char* const kSensitiveHeaders[] = {"authorization", "proxy-authorization", "cookie", "set-cookie"};
+
+// Values that differ on nearly every response would only churn the table
+bool isVolatile(const std::string& name) {
+    return name == "content-length" || name == "content-range" || name == "date" || name == "etag" ||
+           name == "last-modified" || name == "expires" || name == "age";
+}
+
+}
+
+namespace Hpack {
+
+bool isSensitive(const char* name, size_t length) {
+    for (const char* sensitive : kSensitiveHeaders) {
+        if (strlen(sensitive) != length) continue;
+        size_t i = 0;
+        while (i < length && tolower(static_cast<unsigned char>(name[i])) == sensitive[i]) {
+            i++;
+        }
+        if (i == length) return true;
+    }
+    return false;
+}
+
+size_t huffmanLength(const std::string& value) {
+    size_t bits = 0;
+    for (unsigned char octet : value) {
+        bits += kHuffmanLengths[octet];
+    }
+    return (bits + 7) / 8;
+}
+
+void huffmanEncode(const std::string& value, std::string& output) {
+    // Only the low count bits matter; older bits may shift out the top
+    uint64_t bits = 0;
+    int count = 0;
+    for (unsigned char octet : value) {
+        bits = (bits << kHuffmanLengths[octet]) | kHuffmanCodes[octet];
+        count += kHuffmanLengths[octet];
+        while (count >= 8) {
+            count -= 8;
+            output.push_back(static_cast<char>(bits >> count));
+        }
+    }
+    if (count > 0) {
+        // Padded with the most significant bits of EOS
+        output.push_back(static_cast<char>((bits << (8 - count)) | (0xffu >> count)));
+    }
+}
+
+bool huffmanDecode(const uint8_t* data, size_t length, std::string& output) {
+    return huffmanDecoder().decode(data, length, output);
+}
+
+} // namespace Hpack
+
+HpackTable::HpackTable(size_t limit) : size(0), maxSize(limit) {}
+
+const std::pair<std::string, std::string>* HpackTable::get(size_t index) const {
+    if (index == 0) return nullptr;
+    if (index <= kStaticEntries) return &kStaticTable[index - 1];
+    index -= kStaticEntries + 1;
+    return index < entries.size() ? &entries[index] : nullptr;
+}
+
+void HpackTable::add(const std::string& name, const std::string& value) {
+    size_t needed = entrySize(name, value);
+    if (needed > maxSize) {
+        // Not an error: the table just ends up empty (RFC 7541 4.4)
+        entries.clear();
+        size = 0;
+        return;
+    }
+    evict(maxSize - needed);
+    entries.emplace_front(name, value);
+    size += needed;
+}
+
+void HpackTable::setMaxSize(size_t limit) {
+    maxSize = limit;
+    evict(limit);
+}
+
+size_t HpackTable::find(const std::string& name, const std::string& value, size_t& nameIndex) const {
+    nameIndex = 0;
+    for (size_t i = 0; i < kStaticEntries; i++) {
+        if (kStaticTable[i].first != name) continue;
+        if (kStaticTable[i].second == value) return i + 1;
+        if (nameIndex == 0) nameIndex = i + 1;
+    }
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (entries[i].first != name) continue;
+        if (entries[i].second == value) return kStaticEntries + 1 + i;
+        if (nameIndex == 0) nameIndex = kStaticEntries + 1 + i;
+    }
+    return 0;
+}
+
+void HpackTable::evict(size_t limit) {
+    while (size > limit && !entries.empty()) {
+        size -= entrySize(entries.back().first, entries.back().second);
+        entries.pop_back();
+    }
+}
+
+HpackDecoder::HpackDecoder(size_t limit) : table(limit), maxTableSize(limit) {}
+
+HpackDecoder::Result HpackDecoder::decode(const uint8_t* data, size_t length, HeaderList& headers,
+                                          size_t maxListSize) {
+    const uint8_t* position = data;
+    const uint8_t* end = data + length;
+    size_t listSize = 0;
+    bool fieldSeen = false;
+    bool oversized = false;
+    std::string name;
+    std::string value;
+
+    while (position < end) {
+        uint8_t first = *position;
+        if (first & 0x80) {
+            // Indexed field
+            uint64_t index = 0;
+            if (!readInteger(position, end, 7, index)) return Result::Invalid;
+            const std::pair<std::string, std::string>* entry = table.get(static_cast<size_t>(index));
+            if (entry == nullptr) return Result::Invalid;
+            name = entry->first;
+            value = entry->second;
+        } else if ((first & 0xe0) == 0x20) {
+            // Dynamic table size update, only ahead of the first field
+            uint64_t limit = 0;
+            if (fieldSeen || !readInteger(position, end, 5, limit) || limit > maxTableSize) return Result::Invalid;
+            table.setMaxSize(static_cast<size_t>(limit));
+            continue;
+        } else {
+            // Literal with incremental indexing (01), without (0000) or never indexed (0001)
+            bool indexing = (first & 0xc0) == 0x40;
+            uint64_t index = 0;
+            if (!readInteger(position, end, indexing ? 6 : 4, index)) return Result::Invalid;
+            if (index == 0) {
+                if (!readString(position, end, name)) return Result::Invalid;
+            } else {
+                const std::pair<std::string, std::string>* entry = table.get(static_cast<size_t>(index));
+                if (entry == nullptr) return Result::Invalid;
+                name = entry->first;
+            }
+            if (!readString(position, end, value)) return Result::Invalid;
+            if (indexing) table.add(name, value);
+        }
+
+        fieldSeen = true;
+        listSize += HpackTable::entrySize(name, value);
+        if (listSize > maxListSize) {
+            // Keep decoding so the table stays in step
+            oversized = true;
+            continue;
+        }
+        headers.emplace_back(std::move(name), std::move(value));
+    }
+    return oversized ? Result::Oversized : Result::Ok;
+}
+
+HpackEncoder::HpackEncoder(size_t maxTableSize)
+    : table(maxTableSize), limit(maxTableSize), pendingSize(maxTableSize), smallestPending(SIZE_MAX) {}
+
+void HpackEncoder::setMaxTableSize(size_t size) {
+    size = std::min(size, limit);
+    pendingSize = size;
+    smallestPending = std::min(smallestPending, size);
+}
+
+void HpackEncoder::beginBlock(std::string& output) {
+    if (smallestPending == SIZE_MAX) return;
+    // A shrink in between must be signalled even if the size grew back
+    if (smallestPending < table.getMaxSize()) {
+        table.setMaxSize(smallestPending);
+        writeInteger(output, 0x20, 5, smallestPending);
+    }
+    if (pendingSize != table.getMaxSize()) {
+        table.setMaxSize(pendingSize);
+        writeInteger(output, 0x20, 5, pendingSize);
+    }
+    smallestPending = SIZE_MAX;
+}
+
+void HpackEncoder::encode(const std::string& name, const std::string& value, std::string& output) {
+    size_t nameIndex = 0;
+    size_t index = table.find(name, value, nameIndex);
+    // Credentials stay out of both tables (and intermediaries' caches of them)
+    bool sensitive = Hpack::isSensitive(name.data(), name.size());
+    if (index != 0 && !sensitive) {
+        writeInteger(output, 0x80, 7, index);
+        return;
+    }
+
+    bool indexing = !sensitive && !isVolatile(name) && HpackTable::entrySize(name, value) <= table.getMaxSize() / 2;
+    if (indexing) {
+        writeInteger(output, 0x40, 6, nameIndex);
+    } else {
+        writeInteger(output, sensitive ? 0x10 : 0x00, 4, nameIndex);
+    }
+    if (nameIndex == 0) writeString(output, name);
+    writeString(output, value);
+    if (indexing) table.add(name, value);
+}
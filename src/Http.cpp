@@ -0,0 +1,409 @@
+#include "Http.h"
+#include <cstring>
+#include <cctype>
+#include <cstdlib>
+#include <cstdio>
+
+namespace {
+
+const char* findHeadEnd(const char* data, size_t length) {
+    if (length < 4) return nullptr;
+    for (size_t i = 0; i + 3 < length; i++) {
+        if (data[i] == '\r' && data[i + 1] == '\n' && data[i + 2] == '\r' && data[i + 3] == '\n') {
+            return data + i + 4;
+        }
+    }
+    return nullptr;
+}
+
+std::string trim(const char* begin, const char* end) {
+    while (begin < end && (*begin == ' ' || *begin == '\t')) begin++;
+    while (end > begin && (end[-1] == ' ' || end[-1] == '\t')) end--;
+    return std::string(begin, end);
+}
+
+// Split "a b c" on single spaces into at most three parts (the last keeps spaces)
+size_t splitStartLine(const char* begin, const char* end, std::string parts[3]) {
+    size_t count = 0;
+    const char* cursor = begin;
+    while (cursor < end && count < 3) {
+        const char* space = (count < 2) ? static_cast<const char*>(memchr(cursor, ' ', end - cursor)) : nullptr;
+        const char* partEnd = space ? space : end;
+        parts[count++] = std::string(cursor, partEnd);
+        cursor = space ? space + 1 : end;
+    }
+    return count;
+}
+
+int hexValue(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+bool parseHeaders(const char* cursor, const char* headEnd, HttpHead& head) {
+    while (cursor < headEnd - 2) {
+        const char* lineEnd = static_cast<const char*>(memchr(cursor, '\r', headEnd - cursor));
+        if (lineEnd == nullptr) return false;
+
+        const char* colon = static_cast<const char*>(memchr(cursor, ':', lineEnd - cursor));
+        if (colon == nullptr || colon == cursor) return false;
+        // No whitespace in a field name: "Content-Length : 5" and obs-fold
+        // continuation lines would be read differently by the next hop
+        for (const char* c = cursor; c < colon; c++) {
+            if (*c == ' ' || *c == '\t') return false;
+        }
+
+        head.headers.emplace_back(std::string(cursor, colon), trim(colon + 1, lineEnd));
+        cursor = lineEnd + 2;
+    }
+    return true;
+}
+
+// One Content-Length value: digits only, no sign, small enough for a long long
+bool parseLength(const std::string& text, long long& length) {
+    if (text.empty() || text.size() > 18) return false;
+    length = 0;
+    for (char c : text) {
+        if (c < '0' || c > '9') return false;
+        length = length * 10 + (c - '0');
+    }
+    return true;
+}
+
+// Body framing as RFC 9112 6.3 settles it. Content-Length must be one
+// number; repeats of the same value ("5, 5" or two headers) collapse into
+// one header, and anything else is refused rather than guessed at, since
+// the next hop could split the stream differently. Transfer-Encoding
+// wins over Content-Length, which is dropped. A request must end its
+// codings with chunked, and HTTP/1.0 requests cannot use them at all.
+bool checkFraming(HttpHead& head, bool isRequest) {
+    bool transferEncoding = false;
+    bool lengthSeen = false;
+    long long length = 0;
+    for (const auto& header : head.headers) {
+        if (Http::equalsIgnoreCase(header.first, "Transfer-Encoding")) {
+            transferEncoding = true;
+            continue;
+        }
+        if (!Http::equalsIgnoreCase(header.first, "Content-Length")) continue;
+
+        const std::string& value = header.second;
+        size_t start = 0;
+        while (start <= value.size()) {
+            size_t comma = value.find(',', start);
+            if (comma == std::string::npos) comma = value.size();
+            long long item = 0;
+            if (!parseLength(trim(value.data() + start, value.data() + comma), item)) return false;
+            if (lengthSeen && item != length) return false;
+            lengthSeen = true;
+            length = item;
+            start = comma + 1;
+        }
+    }
+
+    if (transferEncoding && isRequest && (head.version == "HTTP/1.0" || !head.isChunked())) return false;
+    if (!lengthSeen) return true;
+
+    auto& headers = head.headers;
+    bool kept = transferEncoding;
+    for (auto header = headers.begin(); header != headers.end();) {
+        if (!Http::equalsIgnoreCase(header->first, "Content-Length")) {
+            ++header;
+        } else if (!kept) {
+            header->second = std::to_string(length);
+            kept = true;
+            ++header;
+        } else {
+            header = headers.erase(header);
+        }
+    }
+    return true;
+}
+
+ParseResult parseHead(const char* data, size_t length, HttpHead& head, bool isRequest) {
+    const char* headEnd = findHeadEnd(data, length);
+    if (headEnd == nullptr) {
+        return length > Http::kMaxHeadSize ? ParseResult::Invalid : ParseResult::Incomplete;
+    }
+
+    const char* lineEnd = static_cast<const char*>(memchr(data, '\r', headEnd - data));
+    std::string parts[3];
+    size_t partCount = splitStartLine(data, lineEnd, parts);
+
+    head = HttpHead();
+    if (isRequest) {
+        if (partCount != 3 || parts[0].empty() || parts[1].empty()) return ParseResult::Invalid;
+        if (parts[2].compare(0, 5, "HTTP/") != 0) return ParseResult::Invalid;
+        head.method = parts[0];
+        head.path = parts[1];
+        head.version = parts[2];
+    } else {
+        if (partCount < 2 || parts[0].compare(0, 5, "HTTP/") != 0) return ParseResult::Invalid;
+        head.version = parts[0];
+        head.statusCode = atoi(parts[1].c_str());
+        if (head.statusCode < 100 || head.statusCode > 999) return ParseResult::Invalid;
+        head.reason = partCount == 3 ? parts[2] : "";
+    }
+
+    if (!parseHeaders(lineEnd + 2, headEnd, head) || !checkFraming(head, isRequest)) return ParseResult::Invalid;
+
+    head.headLength = static_cast<size_t>(headEnd - data);
+    return ParseResult::Complete;
+}
+
+} // namespace
+
+namespace Http {
+
+bool equalsIgnoreCase(const std::string& a, const std::string& b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); i++) {
+        if (tolower(static_cast<unsigned char>(a[i])) != tolower(static_cast<unsigned char>(b[i]))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool isHopByHop(const std::string& name) {
+    static const char* const hopHeaders[] = {
+        "Connection", "Keep-Alive", "Proxy-Connection", "Proxy-Authenticate",
+        "Proxy-Authorization", "TE", "Trailer", "Upgrade"
+    };
+    for (const char* hop : hopHeaders) {
+        if (equalsIgnoreCase(name, hop)) return true;
+    }
+    return false;
+}
+
+bool isIdempotentMethod(const std::string& method) {
+    return isSafeMethod(method) || method == "PUT" || method == "DELETE";
+}
+
+bool isSafeMethod(const std::string& method) {
+    return method == "GET" || method == "HEAD" || method == "OPTIONS" || method == "TRACE";
+}
+
+ParseResult parseRequestHead(const char* data, size_t length, HttpHead& head) {
+    return parseHead(data, length, head, true);
+}
+
+ParseResult parseResponseHead(const char* data, size_t length, HttpHead& head) {
+    return parseHead(data, length, head, false);
+}
+
+void appendUpstreamRequestHead(const HttpHead& request, const std::string& clientIP, std::string& output) {
+    bool chunked = request.isChunked();
+    output += request.method + " " + request.path + " " + request.version + "\r\n";
+    for (const auto& header : request.headers) {
+        if (isHopByHop(header.first) || equalsIgnoreCase(header.first, "Expect")) {
+            continue;
+        }
+        // Chunked wins over Content-Length; never pass both on
+        if (chunked && (equalsIgnoreCase(header.first, "Transfer-Encoding") ||
+                        equalsIgnoreCase(header.first, "Content-Length"))) {
+            continue;
+        }
+        output += header.first + ": " + header.second + "\r\n";
+    }
+    if (chunked) output += "Transfer-Encoding: chunked\r\n";
+    output += "X-Forwarded-For: " + clientIP + "\r\n";
+    if (request.isUpgrade()) {
+        output += "Upgrade: " + *request.findHeader("Upgrade") + "\r\n";
+        output += "Connection: Upgrade\r\n\r\n";
+        return;
+    }
+    output += "Connection: close\r\n\r\n";
+}
+
+void appendClientResponseHead(const HttpHead& response, bool keepAlive, bool chunked, std::string& output) {
+    // The proxy frames the body, so the version is its own, not the backend's:
+    // an HTTP/1.0 status line with Transfer-Encoding is faulty framing
+    output += "HTTP/1.1 " + std::to_string(response.statusCode) + " " + response.reason + "\r\n";
+    for (const auto& header : response.headers) {
+        if (isHopByHop(header.first) || equalsIgnoreCase(header.first, "Transfer-Encoding")) continue;
+        if (chunked && equalsIgnoreCase(header.first, "Content-Length")) continue;
+        output += header.first + ": " + header.second + "\r\n";
+    }
+    if (chunked) output += "Transfer-Encoding: chunked\r\n";
+    const std::string* upgrade = response.statusCode == 101 ? response.findHeader("Upgrade") : nullptr;
+    if (upgrade != nullptr) {
+        output += "Upgrade: " + *upgrade + "\r\n";
+        output += "Connection: Upgrade\r\n\r\n";
+        return;
+    }
+    output += keepAlive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+}
+
+void appendChunk(const char* data, size_t length, std::string& output) {
+    if (length == 0) return;   // a zero-size chunk would end the body
+    char size[24];
+    int sizeLength = snprintf(size, sizeof(size), "%zx\r\n", length);
+    output.append(size, static_cast<size_t>(sizeLength));
+    output.append(data, length);
+    output.append("\r\n", 2);
+}
+
+void appendLastChunk(std::string& output) {
+    output.append("0\r\n\r\n", 5);
+}
+
+} // namespace Http
+
+const std::string* HttpHead::findHeader(const std::string& name) const {
+    for (const auto& header : headers) {
+        if (Http::equalsIgnoreCase(header.first, name)) {
+            return &header.second;
+        }
+    }
+    return nullptr;
+}
+
+bool HttpHead::hasToken(const std::string& name, const std::string& token) const {
+    for (const auto& header : headers) {
+        if (!Http::equalsIgnoreCase(header.first, name)) continue;
+
+        size_t start = 0;
+        const std::string& value = header.second;
+        while (start <= value.size()) {
+            size_t comma = value.find(',', start);
+            if (comma == std::string::npos) comma = value.size();
+            if (Http::equalsIgnoreCase(trim(value.data() + start, value.data() + comma), token)) {
+                return true;
+            }
+            start = comma + 1;
+        }
+    }
+    return false;
+}
+
+long long HttpHead::contentLength() const {
+    const std::string* value = findHeader("Content-Length");
+    if (value == nullptr || value->empty()) return -1;
+
+    char* end = nullptr;
+    long long length = strtoll(value->c_str(), &end, 10);
+    if (end == value->c_str() || *end != '\0' || length < 0) return -1;
+    return length;
+}
+
+// Chunked only as the final coding: after "chunked, gzip" the body is not
+// chunk-framed (a response then ends at EOF; such a request is refused)
+bool HttpHead::isChunked() const {
+    std::string last;
+    for (const auto& header : headers) {
+        if (!Http::equalsIgnoreCase(header.first, "Transfer-Encoding")) continue;
+
+        size_t start = 0;
+        const std::string& value = header.second;
+        while (start <= value.size()) {
+            size_t comma = value.find(',', start);
+            if (comma == std::string::npos) comma = value.size();
+            std::string coding = trim(value.data() + start, value.data() + comma);
+            if (!coding.empty()) last = std::move(coding);
+            start = comma + 1;
+        }
+    }
+    return Http::equalsIgnoreCase(last, "chunked");
+}
+
+void BodyDecoder::reset(Framing f, long long length) {
+    framing = f;
+    remaining = length > 0 ? static_cast<unsigned long long>(length) : 0;
+    sizeDigits = 0;
+    switch (f) {
+        case Framing::None: state = State::Done; break;
+        case Framing::Length: state = remaining > 0 ? State::Body : State::Done; break;
+        case Framing::Chunked: state = State::Size; break;
+        case Framing::UntilClose: state = State::Body; break;
+    }
+}
+
+size_t BodyDecoder::decode(const char* data, size_t length, std::string& output, bool chunked) {
+    size_t offset = 0;
+
+    while (offset < length && state != State::Done && state != State::Invalid) {
+        if (state == State::Body || state == State::Data) {
+            size_t run = length - offset;
+            if (framing != Framing::UntilClose && run > remaining) {
+                run = static_cast<size_t>(remaining);
+            }
+            if (chunked) {
+                Http::appendChunk(data + offset, run, output);
+            } else {
+                output.append(data + offset, run);
+            }
+            offset += run;
+            if (framing == Framing::UntilClose) continue;
+
+            remaining -= run;
+            if (remaining == 0) {
+                state = state == State::Body ? State::Done : State::DataCR;
+            }
+            continue;
+        }
+
+        char c = data[offset++];
+        switch (state) {
+            case State::Size: {
+                int digit = hexValue(c);
+                if (digit >= 0) {
+                    // 15 hex digits is already far beyond any sane chunk
+                    if (++sizeDigits > 15) {
+                        state = State::Invalid;
+                        break;
+                    }
+                    remaining = remaining * 16 + static_cast<unsigned long long>(digit);
+                } else if (sizeDigits > 0 && (c == ';' || c == ' ' || c == '\t')) {
+                    state = State::Extension;
+                } else if (sizeDigits > 0 && c == '\r') {
+                    state = State::SizeLF;
+                } else {
+                    state = State::Invalid;
+                }
+                break;
+            }
+            case State::Extension:
+                if (c == '\r') state = State::SizeLF;
+                break;
+            case State::SizeLF:
+                if (c != '\n') {
+                    state = State::Invalid;
+                } else {
+                    sizeDigits = 0;
+                    state = remaining > 0 ? State::Data : State::TrailerStart;
+                }
+                break;
+            case State::DataCR:
+                state = c == '\r' ? State::DataLF : State::Invalid;
+                break;
+            case State::DataLF:
+                state = c == '\n' ? State::Size : State::Invalid;
+                break;
+            case State::TrailerStart:
+                state = c == '\r' ? State::FinalLF : State::Trailer;
+                break;
+            case State::Trailer:
+                if (c == '\n') state = State::TrailerStart;
+                break;
+            case State::FinalLF:
+                state = c == '\n' ? State::Done : State::Invalid;
+                break;
+            default:
+                break;
+        }
+    }
+    return offset;
+}
+
+bool HttpHead::wantsKeepAlive() const {
+    if (hasToken("Connection", "close")) return false;
+    if (version == "HTTP/1.0") return hasToken("Connection", "keep-alive");
+    return true;
+}
+
+bool HttpHead::isUpgrade() const {
+    return version != "HTTP/1.0" && hasToken("Connection", "upgrade") && findHeader("Upgrade") != nullptr;
+}
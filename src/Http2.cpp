@@ -0,0 +1,1535 @@
+#include "Http2.h"
+#include "Worker.h"
+#include "Server.h"
+#include "Tls.h"
+#include "StaticFiles.h"
+#include "SocketTuning.h"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+namespace {
+
+enum FrameType : uint8_t {
+    kData = 0x0,
+    kHeaders = 0x1,
+    kPriority = 0x2,
+    kRstStream = 0x3,
+    kSettings = 0x4,
+    kPushPromise = 0x5,
+    kPing = 0x6,
+    kGoAway = 0x7,
+    kWindowUpdate = 0x8,
+    kContinuation = 0x9
+};
+
+enum FrameFlag : uint8_t {
+    kEndStream = 0x1,
+    kAck = 0x1,
+    kEndHeaders = 0x4,
+    kPadded = 0x8,
+    kPriorityFlag = 0x20
+};
+
+enum ErrorCode : uint32_t {
+    kNoError = 0x0,
+    kProtocolError = 0x1,
+    kInternalError = 0x2,
+    kFlowControlError = 0x3,
+    kStreamClosed = 0x5,
+    kFrameSizeError = 0x6,
+    kRefusedStream = 0x7,
+    kCancel = 0x8,
+    kCompressionError = 0x9,
+    kEnhanceYourCalm = 0xb
+};
+
+enum SettingId : uint16_t {
+    kHeaderTableSize = 0x1,
+    kEnablePush = 0x2,
+    kMaxConcurrentStreams = 0x3,
+    kInitialWindowSize = 0x4,
+    kMaxFrameSize = 0x5,
+    kMaxHeaderListSize = 0x6
+};
+
+constexpr size_t kFrameHeaderLength = 9;
+// Largest frame accepted: the protocol default, which we never raise
+constexpr size_t kMaxFramePayload = 16384;
+constexpr int64_t kMaxWindow = 0x7fffffff;
+constexpr int64_t kDefaultWindow = 65535;
+constexpr size_t kReadChunk = 16 * 1024;
+// Client reads per event before yielding to other sockets on the loop
+constexpr int kMaxRounds = 16;
+// Pooled streams keep buffers up to this size between requests
+constexpr size_t kRetainedBuffer = 16 * 1024;
+
+uint32_t readUint32(const uint8_t* data) {
+    return (static_cast<uint32_t>(data[0]) << 24) | (static_cast<uint32_t>(data[1]) << 16) |
+           (static_cast<uint32_t>(data[2]) << 8) | static_cast<uint32_t>(data[3]);
+}
+
+void appendUint32(std::string& output, uint32_t value) {
+    char bytes[4] = {static_cast<char>(value >> 24), static_cast<char>(value >> 16), static_cast<char>(value >> 8),
+                     static_cast<char>(value)};
+    output.append(bytes, sizeof(bytes));
+}
+
+void appendSetting(std::string& output, uint16_t id, uint32_t value) {
+    output.push_back(static_cast<char>(id >> 8));
+    output.push_back(static_cast<char>(id));
+    appendUint32(output, value);
+}
+
+void releaseBuffer(std::string& buffer) {
+    if (buffer.capacity() > kRetainedBuffer) {
+        std::string().swap(buffer);
+    } else {
+        buffer.clear();
+    }
+}
+
+// Field names must arrive in lower case (RFC 9113 8.2.1)
+bool hasUpperCase(const std::string& name) {
+    return std::any_of(name.begin(), name.end(), [](unsigned char c) { return c >= 'A' && c <= 'Z'; });
+}
+
+// Connection-specific fields make an HTTP/2 request malformed (RFC 9113 8.2.2)
+bool isConnectionSpecific(const std::string& name) {
+    return name == "connection" || name == "keep-alive" || name == "proxy-connection" ||
+           name == "transfer-encoding" || name == "upgrade";
+}
+
+std::string toLower(const std::string& name) {
+    std::string lower(name);
+    std::transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char c) { return std::tolower(c); });
+    return lower;
+}
+
+}
+
+void Http2Stream::Endpoint::onEvent(uint32_t events) {
+    // Stale readiness for a stream already closed in this round
+    if (stream.session == nullptr) return;
+    stream.session->onUpstreamEvent(stream, events);
+}
+
+Http2Stream::Http2Stream() : nextFree(nullptr), socket(INVALID_SOCKET), endpoint(*this) {
+    timer.setCallback([this] {
+        if (session != nullptr) session->onStreamTimeout(*this);
+    });
+    reset();
+}
+
+void Http2Stream::reset() {
+    session = nullptr;
+    id = 0;
+    request.method.clear();
+    request.path.clear();
+    request.version.clear();
+    request.headers.clear();
+    request.headLength = 0;
+    route = nullptr;
+    requestEnded = false;
+    chunkedUpload = false;
+    declaredLength = -1;
+    bodyReceived = 0;
+    bufferedBody = 0;
+    receiveWindow = 0;
+    unacknowledged = 0;
+
+    stage = Stage::Idle;
+    socket = INVALID_SOCKET;
+    events = 0;
+    backend = nullptr;
+    url.clear();
+    releaseBuffer(output);
+    outputOffset = 0;
+    writeClosed = false;
+    releaseBuffer(input);
+    headersSent = false;
+    responseDecoder.reset(BodyDecoder::Framing::None);
+    responseComplete = false;
+    status = 0;
+    startUs = 0;
+    timer.cancel();
+
+    releaseBuffer(body);
+    bodyOffset = 0;
+    file.reset();
+    fileOffset = 0;
+    fileRemaining = 0;
+    sendWindow = 0;
+    endSent = false;
+    scheduled = false;
+}
+
+Http2Stream* Http2StreamPool::acquire() {
+    if (freeList == nullptr) {
+        std::unique_ptr<Http2Stream[]> slab(new Http2Stream[kSlabStreams]);
+        for (size_t i = kSlabStreams; i-- > 0;) {
+            slab[i].nextFree = freeList;
+            freeList = &slab[i];
+        }
+        slabs.push_back(std::move(slab));
+        stats.created += kSlabStreams;
+    }
+
+    Http2Stream* stream = freeList;
+    freeList = stream->nextFree;
+    stream->nextFree = nullptr;
+    stats.acquisitions++;
+    stats.live++;
+    stats.peakLive = std::max(stats.peakLive, stats.live);
+    return stream;
+}
+
+void Http2StreamPool::release(Http2Stream* stream) {
+    stream->reset();
+    stream->nextFree = freeList;
+    freeList = stream;
+    stats.live--;
+}
+
+void Http2Session::ClientEndpoint::onEvent(uint32_t events) {
+    if (session.closed) return;
+    session.onClientEvent(events);
+}
+
+Http2Session::Http2Session(Worker& w, SOCKET socket, std::unique_ptr<TlsStream> clientTls, std::string received)
+    : worker(w), server(w.getServer()), logger(w.getServer().getLogger()),
+      settings(w.getServer().getConfig().getHttp2()),
+      highWatermark(w.getServer().getConfig().getConnectionBufferSize()),
+      clientSocket(socket), clientEndpoint(*this), clientEvents(0), tls(std::move(clientTls)), tlsReadScheduled(false),
+      closed(false), prefaceReceived(false), goingAway(false), input(std::move(received)), inputOffset(0),
+      outputOffset(0), headerStreamId(0), headerEndStream(false),
+      peerMaxFrameSize(kMaxFramePayload), peerInitialWindow(kDefaultWindow), sendWindow(kDefaultWindow),
+      receiveWindow(kDefaultWindow), unacknowledged(0), lastStreamId(0), streamsServed(0), lastActivityMs(0) {
+    clientIP = Server::getClientIP(clientSocket);
+    const SocketConfig& sockets = server.getConfig().getSockets();
+    clientQuickAck = (tls ? sockets.tlsListener : sockets.listener).quickAck;
+    // Only new streams are held to the window; the connection's is topped up as DATA arrives
+    connectionWindow = std::min<int64_t>(kMaxWindow, static_cast<int64_t>(settings.initialWindowKb) * 1024 *
+                                                         std::max(settings.maxConcurrentStreams, 1));
+    connectionWindow = std::max(connectionWindow, kDefaultWindow);
+    idleTimer.setCallback([this] { onIdleTimer(); });
+    worker.getMetrics().addGauge(Gauge::Http2Sessions, 1);
+}
+
+Http2Session::~Http2Session() {
+    close();
+    worker.getMetrics().addGauge(Gauge::Http2Sessions, -1);
+    server.releaseConnection();
+}
+
+bool Http2Session::start() {
+    if (!worker.getLoop().add(clientSocket, EventLoop::Readable, &clientEndpoint)) {
+        return false;
+    }
+    clientEvents = EventLoop::Readable;
+    // Window updates and the tail of a window's worth of DATA must not wait on Nagle
+    int noDelay = 1;
+    setsockopt(clientSocket, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<char*>(&noDelay), sizeof(noDelay));
+    logger.debug("HTTP/2 session with " + clientIP + (tls ? " (ALPN h2)" : " (h2c)"));
+
+    sendSettings();
+    lastActivityMs = EventLoop::monotonicMs();
+    worker.getLoop().timers().schedule(idleTimer, static_cast<uint64_t>(server.getConfig().getIdleKeepAliveTimeout()));
+
+    // Frames that arrived with the preface
+    processInput();
+    pumpStreams();
+    return true;
+}
+
+void Http2Session::onClientEvent(uint32_t events) {
+    if (events & EventLoop::Closed) {
+        logger.debug("HTTP/2 client " + clientIP + " connection error or hang-up");
+        close();
+        return;
+    }
+    if (events & EventLoop::Writable) {
+        flushClient();
+        // Room in the backlog again for streams that were held back
+        pumpStreams();
+    }
+    if ((events & EventLoop::Readable) && !closed) {
+        readClient();
+    }
+}
+
+long Http2Session::clientRecv(char* buffer, size_t length) {
+    long received = tls ? tls->read(buffer, length) : recv(clientSocket, buffer, static_cast<int>(length), 0);
+    if (received > 0 && clientQuickAck) SocketTuning::quickAck(clientSocket);
+    return received;
+}
+
+long Http2Session::clientSend(const char* data, size_t length) {
+    if (tls) return tls->write(data, length);
+    return send(clientSocket, data, static_cast<int>(length), MSG_NOSIGNAL);
+}
+
+void Http2Session::readClient() {
+    char buffer[kReadChunk];
+
+    for (int round = 0; round < kMaxRounds && !closed; round++) {
+        long received = clientRecv(buffer, sizeof(buffer));
+        if (received > 0) {
+            input.append(buffer, static_cast<size_t>(received));
+            lastActivityMs = EventLoop::monotonicMs();
+            processInput();
+            // A client that does not read its responses is not read either
+            if (pendingClientOutput() >= highWatermark) break;
+            continue;
+        }
+        if (received == 0) {
+            logger.debug("HTTP/2 client " + clientIP + " closed the connection");
+            close();
+            return;
+        }
+
+        int error = lastSocketError();
+        if (isInterrupted(error)) continue;
+        if (isWouldBlock(error)) break;
+
+        logger.warning("Failed to receive data from HTTP/2 client " + clientIP);
+        close();
+        return;
+    }
+
+    pumpStreams();
+}
+
+void Http2Session::processInput() {
+    while (!closed) {
+        size_t available = input.size() - inputOffset;
+        const uint8_t* data = reinterpret_cast<const uint8_t*>(input.data()) + inputOffset;
+
+        if (!prefaceReceived) {
+            size_t compared = std::min(available, Http2::kPrefaceLength);
+            if (std::memcmp(data, Http2::kPreface, compared) != 0) {
+                connectionError(kProtocolError, "invalid connection preface");
+                return;
+            }
+            if (compared < Http2::kPrefaceLength) break;
+            inputOffset += Http2::kPrefaceLength;
+            prefaceReceived = true;
+            continue;
+        }
+
+        if (available < kFrameHeaderLength) break;
+        size_t length = (static_cast<size_t>(data[0]) << 16) | (static_cast<size_t>(data[1]) << 8) | data[2];
+        if (length > kMaxFramePayload) {
+            connectionError(kFrameSizeError, "frame of " + std::to_string(length) + " bytes");
+            return;
+        }
+        if (available < kFrameHeaderLength + length) break;
+
+        inputOffset += kFrameHeaderLength + length;
+        uint32_t streamId = readUint32(data + 5) & 0x7fffffff;
+        if (!handleFrame(data[3], data[4], streamId, data + kFrameHeaderLength, length)) return;
+    }
+
+    if (inputOffset == input.size()) {
+        input.clear();
+    } else {
+        input.erase(0, inputOffset);
+    }
+    inputOffset = 0;
+}
+
+// False once the session has been closed
+bool Http2Session::handleFrame(uint8_t type, uint8_t flags, uint32_t streamId, const uint8_t* payload, size_t length) {
+    if (headerStreamId != 0 && type != kContinuation) {
+        connectionError(kProtocolError, "header block interrupted");
+        return false;
+    }
+
+    switch (type) {
+        case kData:
+            return handleData(flags, streamId, payload, length);
+        case kHeaders:
+            return handleHeaders(flags, streamId, payload, length);
+        case kContinuation:
+            return handleContinuation(flags, streamId, payload, length);
+        case kSettings:
+            return handleSettings(flags, streamId, payload, length);
+        case kWindowUpdate:
+            return handleWindowUpdate(streamId, payload, length);
+        case kRstStream:
+            return handleRstStream(streamId, payload, length);
+        case kPriority:
+            // Streams are served round-robin; priorities are not used
+            if (streamId == 0) {
+                connectionError(kProtocolError, "PRIORITY on stream 0");
+                return false;
+            }
+            if (length != 5) resetStream(streamId, kFrameSizeError);
+            return true;
+        case kPing:
+            if (streamId != 0 || length != 8) {
+                connectionError(streamId != 0 ? kProtocolError : kFrameSizeError, "invalid PING");
+                return false;
+            }
+            if (!(flags & kAck)) {
+                appendFrame(kPing, kAck, 0, reinterpret_cast<const char*>(payload), length);
+            }
+            return true;
+        case kGoAway:
+            if (streamId != 0 || length < 8) {
+                connectionError(streamId != 0 ? kProtocolError : kFrameSizeError, "invalid GOAWAY");
+                return false;
+            }
+            logger.debug("HTTP/2 client " + clientIP + " going away (error " +
+                         std::to_string(readUint32(payload + 4)) + ")");
+            goingAway = true;
+            return true;
+        case kPushPromise:
+            connectionError(kProtocolError, "PUSH_PROMISE from a client");
+            return false;
+        default:
+            // Unknown frame types are ignored (RFC 9113 5.5)
+            return true;
+    }
+}
+
+bool Http2Session::handleData(uint8_t flags, uint32_t streamId, const uint8_t* payload, size_t length) {
+    if (streamId == 0) {
+        connectionError(kProtocolError, "DATA on stream 0");
+        return false;
+    }
+    int64_t frameLength = static_cast<int64_t>(length);
+    if (frameLength > receiveWindow) {
+        connectionError(kFlowControlError, "connection window exceeded");
+        return false;
+    }
+    // The connection window is returned at once: stream windows bound what is buffered
+    receiveWindow -= frameLength;
+    unacknowledged += frameLength;
+    if (unacknowledged >= connectionWindow / 2) {
+        sendWindowUpdate(0, unacknowledged);
+        receiveWindow += unacknowledged;
+        unacknowledged = 0;
+    }
+
+    size_t padding = 0;
+    if (flags & kPadded) {
+        if (length == 0 || payload[0] >= length) {
+            connectionError(kProtocolError, "invalid DATA padding");
+            return false;
+        }
+        padding = payload[0];
+        payload++;
+        length -= padding + 1;
+    }
+
+    auto found = streams.find(streamId);
+    if (found == streams.end()) {
+        if (streamId > lastStreamId) {
+            connectionError(kProtocolError, "DATA on idle stream " + std::to_string(streamId));
+            return false;
+        }
+        // Already reset or answered; the client may not have seen it yet
+        return true;
+    }
+    Http2Stream& stream = *found->second;
+    if (stream.requestEnded) {
+        resetStream(stream, kStreamClosed);
+        return true;
+    }
+    if (frameLength > stream.receiveWindow) {
+        resetStream(stream, kFlowControlError);
+        return true;
+    }
+    stream.receiveWindow -= frameLength;
+    stream.bodyReceived += static_cast<long long>(length);
+    if (stream.declaredLength >= 0 && stream.bodyReceived > stream.declaredLength) {
+        resetStream(stream, kProtocolError);
+        return true;
+    }
+
+    if (stream.writeClosed) {
+        acknowledge(stream, frameLength);
+    } else {
+        if (length > 0) {
+            if (stream.chunkedUpload) {
+                Http::appendChunk(reinterpret_cast<const char*>(payload), length, stream.output);
+            } else {
+                stream.output.append(reinterpret_cast<const char*>(payload), length);
+            }
+            stream.bufferedBody += static_cast<int64_t>(length);
+        }
+        // Padding has nothing to wait for
+        acknowledge(stream, frameLength - static_cast<int64_t>(length));
+    }
+
+    if (flags & kEndStream) {
+        endRequestBody(stream);
+    } else if (stream.stage != Http2Stream::Stage::Idle && stream.stage != Http2Stream::Stage::Connecting) {
+        writeUpstream(stream);
+    }
+    return !closed;
+}
+
+bool Http2Session::handleHeaders(uint8_t flags, uint32_t streamId, const uint8_t* payload, size_t length) {
+    if (streamId == 0 || streamId % 2 == 0) {
+        connectionError(kProtocolError, "HEADERS on stream " + std::to_string(streamId));
+        return false;
+    }
+
+    size_t offset = 0;
+    size_t padding = 0;
+    if (flags & kPadded) {
+        if (length == 0) {
+            connectionError(kFrameSizeError, "HEADERS too short");
+            return false;
+        }
+        padding = payload[0];
+        offset = 1;
+    }
+    if (flags & kPriorityFlag) {
+        offset += 5;
+    }
+    if (offset + padding > length) {
+        connectionError(kProtocolError, "invalid HEADERS padding");
+        return false;
+    }
+
+    headerBlock.assign(reinterpret_cast<const char*>(payload) + offset, length - offset - padding);
+    headerStreamId = streamId;
+    headerEndStream = (flags & kEndStream) != 0;
+    if (flags & kEndHeaders) {
+        return finishHeaderBlock();
+    }
+    return true;
+}
+
+bool Http2Session::handleContinuation(uint8_t flags, uint32_t streamId, const uint8_t* payload, size_t length) {
+    if (headerStreamId == 0 || streamId != headerStreamId) {
+        connectionError(kProtocolError, "unexpected CONTINUATION");
+        return false;
+    }
+    // Compressed blocks are no larger than what they decode to, give or take Huffman
+    if (headerBlock.size() + length > static_cast<size_t>(settings.maxHeaderListKb) * 2048) {
+        connectionError(kEnhanceYourCalm, "header block too large");
+        return false;
+    }
+    headerBlock.append(reinterpret_cast<const char*>(payload), length);
+    if (flags & kEndHeaders) {
+        return finishHeaderBlock();
+    }
+    return true;
+}
+
+bool Http2Session::finishHeaderBlock() {
+    uint32_t id = headerStreamId;
+    headerStreamId = 0;
+
+    // Decoded even for streams about to be refused, to keep the table in step
+    HeaderList fields;
+    HpackDecoder::Result result =
+        decoder.decode(reinterpret_cast<const uint8_t*>(headerBlock.data()), headerBlock.size(), fields,
+                       static_cast<size_t>(settings.maxHeaderListKb) * 1024);
+    headerBlock.clear();
+    if (result == HpackDecoder::Result::Invalid) {
+        connectionError(kCompressionError, "invalid header block");
+        return false;
+    }
+
+    auto found = streams.find(id);
+    if (found != streams.end()) {
+        // Trailers: they end the request body; their fields are not forwarded
+        Http2Stream& stream = *found->second;
+        if (stream.requestEnded || !headerEndStream) {
+            resetStream(stream, kProtocolError);
+        } else {
+            endRequestBody(stream);
+        }
+        return !closed;
+    }
+    if (id <= lastStreamId) {
+        // Trailers for a stream already reset or answered
+        return true;
+    }
+    lastStreamId = id;
+
+    if (goingAway || streams.size() >= static_cast<size_t>(settings.maxConcurrentStreams)) {
+        resetStream(id, kRefusedStream);
+        return true;
+    }
+    openStream(id, fields, headerEndStream, result == HpackDecoder::Result::Oversized);
+    return !closed;
+}
+
+bool Http2Session::handleSettings(uint8_t flags, uint32_t streamId, const uint8_t* payload, size_t length) {
+    if (streamId != 0) {
+        connectionError(kProtocolError, "SETTINGS on stream " + std::to_string(streamId));
+        return false;
+    }
+    if (flags & kAck) {
+        if (length != 0) {
+            connectionError(kFrameSizeError, "SETTINGS acknowledgement with a payload");
+            return false;
+        }
+        return true;
+    }
+    if (length % 6 != 0) {
+        connectionError(kFrameSizeError, "SETTINGS length " + std::to_string(length));
+        return false;
+    }
+
+    for (size_t offset = 0; offset < length; offset += 6) {
+        uint16_t id = static_cast<uint16_t>((payload[offset] << 8) | payload[offset + 1]);
+        uint32_t value = readUint32(payload + offset + 2);
+        switch (id) {
+            case kHeaderTableSize:
+                encoder.setMaxTableSize(value);
+                break;
+            case kEnablePush:
+                // Nothing is pushed either way
+                if (value > 1) {
+                    connectionError(kProtocolError, "invalid ENABLE_PUSH");
+                    return false;
+                }
+                break;
+            case kInitialWindowSize: {
+                if (value > kMaxWindow) {
+                    connectionError(kFlowControlError, "INITIAL_WINDOW_SIZE too large");
+                    return false;
+                }
+                // Applies to the windows of open streams too, possibly making them negative
+                int64_t delta = static_cast<int64_t>(value) - peerInitialWindow;
+                peerInitialWindow = value;
+                for (auto& entry : streams) {
+                    entry.second->sendWindow += delta;
+                    if (entry.second->sendWindow > kMaxWindow) {
+                        connectionError(kFlowControlError, "stream window overflow");
+                        return false;
+                    }
+                    if (delta > 0) schedule(*entry.second);
+                }
+                break;
+            }
+            case kMaxFrameSize:
+                if (value < 16384 || value > 16777215) {
+                    connectionError(kProtocolError, "invalid MAX_FRAME_SIZE");
+                    return false;
+                }
+                peerMaxFrameSize = value;
+                break;
+            default:
+                // MAX_CONCURRENT_STREAMS only limits pushes; the rest are advisory
+                break;
+        }
+    }
+    appendFrame(kSettings, kAck, 0, nullptr, 0);
+    return true;
+}
+
+bool Http2Session::handleWindowUpdate(uint32_t streamId, const uint8_t* payload, size_t length) {
+    if (length != 4) {
+        connectionError(kFrameSizeError, "WINDOW_UPDATE length " + std::to_string(length));
+        return false;
+    }
+    int64_t increment = readUint32(payload) & 0x7fffffff;
+
+    if (streamId == 0) {
+        sendWindow += increment;
+        if (increment == 0 || sendWindow > kMaxWindow) {
+            connectionError(increment == 0 ? kProtocolError : kFlowControlError, "invalid connection WINDOW_UPDATE");
+            return false;
+        }
+        return true;
+    }
+
+    auto found = streams.find(streamId);
+    if (found == streams.end()) {
+        if (streamId > lastStreamId) {
+            connectionError(kProtocolError, "WINDOW_UPDATE on idle stream " + std::to_string(streamId));
+            return false;
+        }
+        return true;
+    }
+    Http2Stream& stream = *found->second;
+    stream.sendWindow += increment;
+    if (increment == 0 || stream.sendWindow > kMaxWindow) {
+        resetStream(stream, increment == 0 ? kProtocolError : kFlowControlError);
+        return true;
+    }
+    schedule(stream);
+    return true;
+}
+
+bool Http2Session::handleRstStream(uint32_t streamId, const uint8_t* payload, size_t length) {
+    if (length != 4 || streamId == 0) {
+        connectionError(length != 4 ? kFrameSizeError : kProtocolError, "invalid RST_STREAM");
+        return false;
+    }
+    auto found = streams.find(streamId);
+    if (found == streams.end()) {
+        if (streamId > lastStreamId) {
+            connectionError(kProtocolError, "RST_STREAM on idle stream " + std::to_string(streamId));
+            return false;
+        }
+        return true;
+    }
+    logger.debug("HTTP/2 client " + clientIP + " reset stream " + std::to_string(streamId) + " (error " +
+                 std::to_string(readUint32(payload)) + ")");
+    closeStream(*found->second, 0);
+    return true;
+}
+
+void Http2Session::openStream(uint32_t id, HeaderList& fields, bool endStream, bool oversized) {
+    Http2Stream* stream = worker.getStreamPool().acquire();
+    stream->session = this;
+    stream->id = id;
+    stream->requestEnded = endStream;
+    stream->receiveWindow = static_cast<int64_t>(settings.initialWindowKb) * 1024;
+    stream->sendWindow = peerInitialWindow;
+    stream->startUs = EventLoop::monotonicUs();
+    streams[id] = stream;
+
+    MetricsShard& metrics = worker.getMetrics();
+    metrics.add(Counter::Requests);
+    metrics.addGauge(Gauge::ActiveRequests, 1);
+    metrics.addGauge(Gauge::Http2Streams, 1);
+
+    if (oversized) {
+        logger.warning("Oversized HTTP/2 header block from " + clientIP);
+        sendLocalResponse(*stream, 431, "Request Header Fields Too Large");
+        return;
+    }
+    if (!buildRequest(*stream, fields)) {
+        logger.warning("Malformed HTTP/2 request from " + clientIP);
+        resetStream(*stream, kProtocolError);
+        return;
+    }
+    if (stream->request.method == "CONNECT") {
+        sendLocalResponse(*stream, 501, "Not Implemented");
+        return;
+    }
+
+    stream->route = server.getRouter().match(stream->request.path);
+    if (!checkRateLimit(*stream)) return;
+
+    logger.info("Request: " + stream->request.method + " " + stream->request.path + " from " + clientIP +
+                " (HTTP/2 stream " + std::to_string(id) + ")");
+    if (stream->route != nullptr && stream->route->config.isStatic()) {
+        serveStatic(*stream);
+        return;
+    }
+    startUpstream(*stream);
+}
+
+void Http2Session::serveStatic(Http2Stream& stream) {
+    // Any request body has nowhere to go
+    stream.writeClosed = true;
+
+    StaticResponse response;
+    server.getStaticFiles().respond(*stream.route, stream.request, response);
+    HeaderList fields;
+    fields.reserve(response.head.headers.size());
+    for (const auto& header : response.head.headers) {
+        fields.emplace_back(toLower(header.first), header.second);
+    }
+    stream.status = response.head.statusCode;
+    stream.body = std::move(response.body);
+    stream.bodyOffset = 0;
+    stream.file = std::move(response.file);
+    stream.fileOffset = response.offset;
+    stream.fileRemaining = response.length;
+    stream.responseComplete = stream.fileRemaining == 0;
+    sendHeaders(stream, stream.status, fields, stream.pendingResponse() == 0);
+}
+
+// The next piece of a static file into the drained body; false on a read error
+bool Http2Session::readStaticChunk(Http2Stream& stream) {
+    size_t length = static_cast<size_t>(std::min<uint64_t>(stream.fileRemaining, highWatermark));
+    stream.body.resize(length);
+    stream.bodyOffset = 0;
+    if (!StaticFiles::read(*stream.file, stream.fileOffset, &stream.body[0], length)) {
+        logger.error("Failed to read static file for " + stream.request.path);
+        return false;
+    }
+    stream.fileOffset += length;
+    stream.fileRemaining -= length;
+    if (stream.fileRemaining == 0) {
+        stream.file.reset();
+        stream.responseComplete = true;
+    }
+    return true;
+}
+
+// Pseudo-header fields become the request line, :authority the Host header;
+// false when the request is malformed (RFC 9113 8.3.1)
+bool Http2Session::buildRequest(Http2Stream& stream, HeaderList& fields) {
+    HttpHead& request = stream.request;
+    request.version = "HTTP/1.1";
+    std::string authority;
+    std::string cookie;
+    bool regularSeen = false;
+    bool hasHost = false;
+
+    for (auto& field : fields) {
+        const std::string& name = field.first;
+        if (name.empty() || hasUpperCase(name)) return false;
+        if (name[0] == ':') {
+            if (regularSeen) return false;
+            if (name == ":method") {
+                request.method = std::move(field.second);
+            } else if (name == ":path") {
+                request.path = std::move(field.second);
+            } else if (name == ":authority") {
+                authority = std::move(field.second);
+            } else if (name != ":scheme") {
+                return false;
+            }
+            continue;
+        }
+        regularSeen = true;
+        if (isConnectionSpecific(name)) return false;
+        if (name == "te") {
+            if (field.second != "trailers") return false;
+            continue;
+        }
+        if (name == "cookie") {
+            // Split cookies are joined again for HTTP/1.1 (RFC 9113 8.2.3)
+            if (!cookie.empty()) cookie += "; ";
+            cookie += field.second;
+            continue;
+        }
+        if (name == "host") hasHost = true;
+        request.headers.emplace_back(std::move(field.first), std::move(field.second));
+    }
+
+    if (request.method.empty()) return false;
+    if (request.method == "CONNECT") return true;
+    if (request.path.empty()) return false;
+
+    if (!hasHost && !authority.empty()) {
+        request.headers.emplace(request.headers.begin(), "host", std::move(authority));
+    }
+    if (!cookie.empty()) {
+        request.headers.emplace_back("cookie", std::move(cookie));
+    }
+    stream.declaredLength = request.contentLength();
+    if (!stream.requestEnded && stream.declaredLength < 0) {
+        request.headers.emplace_back("transfer-encoding", "chunked");
+        stream.chunkedUpload = true;
+    }
+    return true;
+}
+
+bool Http2Session::checkRateLimit(Http2Stream& stream) {
+    const Route* route = stream.route;
+    if (route == nullptr || !route->rateLimit.isEnabled()) return true;
+
+    // Fall back to the client address when the key header is missing
+    const std::string* key = &clientIP;
+    if (!route->config.rateLimit.keyHeader.empty()) {
+        const std::string* header = stream.request.findHeader(route->config.rateLimit.keyHeader);
+        if (header != nullptr) key = header;
+    }
+
+    uint64_t keyHash = RateLimiter::hashKey(route->keySeed, key->data(), key->length());
+    uint32_t retryAfterMs = 0;
+    if (server.getRateLimiter().tryAcquire(keyHash, route->rateLimit, worker.getLoop().now(), retryAfterMs)) {
+        return true;
+    }
+
+    uint32_t retryAfterSeconds = (retryAfterMs + 999) / 1000;
+    logger.debug("Rate limited " + stream.request.method + " " + stream.request.path + " from " + clientIP);
+    sendLocalResponse(stream, 429, "Too Many Requests", std::to_string(retryAfterSeconds > 0 ? retryAfterSeconds : 1));
+    return false;
+}
+
+void Http2Session::endRequestBody(Http2Stream& stream) {
+    stream.requestEnded = true;
+    if (stream.declaredLength >= 0 && stream.bodyReceived != stream.declaredLength) {
+        resetStream(stream, kProtocolError);
+        return;
+    }
+    if (stream.chunkedUpload && !stream.writeClosed) {
+        Http::appendLastChunk(stream.output);
+    }
+    if (stream.stage != Http2Stream::Stage::Idle && stream.stage != Http2Stream::Stage::Connecting) {
+        writeUpstream(stream);
+    }
+}
+
+// Returns window for body bytes that have left for the backend, in batches
+void Http2Session::acknowledge(Http2Stream& stream, int64_t bytes) {
+    stream.unacknowledged += bytes;
+    if (stream.requestEnded) return;
+    if (stream.unacknowledged >= static_cast<int64_t>(settings.initialWindowKb) * 512) {
+        sendWindowUpdate(stream.id, stream.unacknowledged);
+        stream.receiveWindow += stream.unacknowledged;
+        stream.unacknowledged = 0;
+    }
+}
+
+void Http2Session::startUpstream(Http2Stream& stream) {
+    LoadBalancer& loadBalancer = server.getLoadBalancer();
+    BackendServer* backend = loadBalancer.getNextBackend(clientIP);
+    if (backend == nullptr) {
+        logger.error("No healthy backend servers available");
+        sendLocalResponse(stream, 503, "Service Unavailable - No backend servers");
+        return;
+    }
+
+    stream.backend = backend;
+    stream.url = backend->host + ":" + std::to_string(backend->port);
+    logger.info("Forwarding " + stream.request.method + " " + stream.request.path + " to backend: " + stream.url +
+                " (algorithm: " + server.getConfig().algorithmToString() + ")");
+    loadBalancer.incrementConnections(backend->host, backend->port);
+    stream.stage = Http2Stream::Stage::Connecting;
+
+    SocketAddress backendAddr;
+    if (!server.resolveBackend(backend, backendAddr)) {
+        logger.error("Failed to resolve backend " + stream.url);
+        upstreamFailed(stream, 502, "Bad Gateway - backend unresolvable");
+        return;
+    }
+    stream.socket = socket(backendAddr.family(), SOCK_STREAM, 0);
+    if (stream.socket == INVALID_SOCKET || !setNonBlocking(stream.socket)) {
+        logger.error("Failed to create upstream socket");
+        upstreamFailed(stream, 502, "Bad Gateway");
+        return;
+    }
+    SocketTuning::applyUpstream(stream.socket, server.getConfig().getSockets().upstream);
+
+    // No DATA has been read for this stream yet, so the head goes first
+    Http::appendUpstreamRequestHead(stream.request, clientIP, stream.output);
+
+    if (connect(stream.socket, backendAddr.get(), backendAddr.length) == SOCKET_ERROR &&
+        !isConnectInProgress(lastSocketError())) {
+        logger.error("Failed to connect to backend " + stream.url);
+        upstreamFailed(stream, 502, "Bad Gateway - backend unreachable");
+        return;
+    }
+    if (!worker.getLoop().add(stream.socket, EventLoop::Writable, &stream.endpoint)) {
+        upstreamFailed(stream, 502, "Bad Gateway");
+        return;
+    }
+    stream.events = EventLoop::Writable;
+    worker.getLoop().timers().schedule(stream.timer,
+                                       static_cast<uint64_t>(server.getConfig().getUpstreamConnectTimeout()));
+}
+
+void Http2Session::onUpstreamEvent(Http2Stream& stream, uint32_t events) {
+    if (closed) return;
+
+    switch (stream.stage) {
+        case Http2Stream::Stage::Idle:
+            break;
+        case Http2Stream::Stage::Connecting:
+            if (events & (EventLoop::Writable | EventLoop::Closed)) {
+                onUpstreamConnected(stream);
+            }
+            break;
+        default:
+            if ((events & EventLoop::Writable) && stream.pendingOutput() > 0) {
+                writeUpstream(stream);
+                if (stream.session == nullptr || stream.stage == Http2Stream::Stage::Idle) break;
+            }
+            if (events & (EventLoop::Readable | EventLoop::Closed)) {
+                readUpstream(stream);
+            }
+            break;
+    }
+    pumpStreams();
+}
+
+void Http2Session::onUpstreamConnected(Http2Stream& stream) {
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if (getsockopt(stream.socket, SOL_SOCKET, SO_ERROR, reinterpret_cast<char*>(&error), &length) != 0 || error != 0) {
+        logger.error("Failed to connect to backend " + stream.url);
+        upstreamFailed(stream, 502, "Bad Gateway - backend unreachable");
+        return;
+    }
+
+    stream.stage = Http2Stream::Stage::Sending;
+    stream.timer.cancel();
+    writeUpstream(stream);
+}
+
+void Http2Session::writeUpstream(Http2Stream& stream) {
+    while (stream.pendingOutput() > 0) {
+        int sent = send(stream.socket, stream.output.data() + stream.outputOffset,
+                        static_cast<int>(stream.pendingOutput()), MSG_NOSIGNAL);
+        if (sent > 0) {
+            stream.outputOffset += static_cast<size_t>(sent);
+            worker.getMetrics().add(Counter::RequestBytes, static_cast<uint64_t>(sent));
+            // Head and chunk framing count too: a slight over-credit, bounded by their size
+            int64_t credit = std::min<int64_t>(sent, stream.bufferedBody);
+            stream.bufferedBody -= credit;
+            acknowledge(stream, credit);
+            continue;
+        }
+
+        int error = lastSocketError();
+        if (sent < 0 && isInterrupted(error)) continue;
+        if (sent < 0 && isWouldBlock(error)) break;
+
+        if (stream.stage == Http2Stream::Stage::Relaying) {
+            // Answered early and stopped reading: the rest of the body is dropped
+            logger.debug("Backend " + stream.url + " stopped reading the request body");
+            stream.writeClosed = true;
+            stream.output.clear();
+            stream.outputOffset = 0;
+            acknowledge(stream, stream.bufferedBody);
+            stream.bufferedBody = 0;
+            updateUpstreamEvents(stream);
+            return;
+        }
+        logger.error("Failed to send request to backend " + stream.url);
+        upstreamFailed(stream, 502, "Bad Gateway - backend write failed");
+        return;
+    }
+
+    if (stream.pendingOutput() == 0) {
+        stream.output.clear();
+        stream.outputOffset = 0;
+        if (stream.stage == Http2Stream::Stage::Sending && stream.requestEnded) {
+            stream.stage = Http2Stream::Stage::Awaiting;
+            worker.getLoop().timers().schedule(
+                stream.timer, static_cast<uint64_t>(server.getConfig().getUpstreamFirstByteTimeout()));
+        }
+    } else if (stream.outputOffset >= kRetainedBuffer) {
+        stream.output.erase(0, stream.outputOffset);
+        stream.outputOffset = 0;
+    }
+    updateUpstreamEvents(stream);
+}
+
+void Http2Session::readUpstream(Http2Stream& stream) {
+    char buffer[kReadChunk];
+    bool quickAck = server.getConfig().getSockets().upstream.quickAck;
+
+    while (!stream.responseComplete && stream.pendingBody() < highWatermark) {
+        int received = recv(stream.socket, buffer, sizeof(buffer), 0);
+        if (received > 0) {
+            if (quickAck) SocketTuning::quickAck(stream.socket);
+            if (stream.stage != Http2Stream::Stage::Relaying) {
+                // First response byte: the rest of the request deadline applies from here
+                uint64_t latencyUs = EventLoop::monotonicUs() - stream.startUs;
+                worker.getMetrics().recordUpstreamLatency(server.getLoadBalancer().indexOf(stream.backend), latencyUs);
+                stream.stage = Http2Stream::Stage::Relaying;
+                uint64_t elapsedMs = latencyUs / 1000;
+                uint64_t limitMs = static_cast<uint64_t>(server.getConfig().getRequestTimeout());
+                worker.getLoop().timers().schedule(stream.timer, elapsedMs < limitMs ? limitMs - elapsedMs : 1);
+            }
+            if (!stream.headersSent) {
+                stream.input.append(buffer, static_cast<size_t>(received));
+                if (!processResponseHead(stream)) return;
+            } else if (!appendResponseBody(stream, buffer, static_cast<size_t>(received))) {
+                return;
+            }
+            continue;
+        }
+
+        if (received == 0) {
+            if (!stream.headersSent) {
+                logger.error("Backend " + stream.url + " closed connection without a response");
+                upstreamFailed(stream, 502, "Bad Gateway - empty backend response");
+                return;
+            }
+            if (stream.responseDecoder.getFraming() != BodyDecoder::Framing::UntilClose) {
+                // Truncated: only a reset tells the client
+                logger.warning("Backend " + stream.url + " response truncated");
+                resetStream(stream, kInternalError);
+                return;
+            }
+            stream.responseComplete = true;
+            break;
+        }
+
+        int error = lastSocketError();
+        if (isInterrupted(error)) continue;
+        if (isWouldBlock(error)) break;
+
+        logger.error("Failed to read response from backend " + stream.url);
+        if (!stream.headersSent) {
+            upstreamFailed(stream, 502, "Bad Gateway - backend read failed");
+        } else {
+            resetStream(stream, kInternalError);
+        }
+        return;
+    }
+
+    if (stream.headersSent) schedule(stream);
+    if (stream.responseComplete) {
+        releaseUpstream(stream);
+    } else {
+        updateUpstreamEvents(stream);
+    }
+}
+
+bool Http2Session::processResponseHead(Http2Stream& stream) {
+    HttpHead response;
+    while (true) {
+        ParseResult result = Http::parseResponseHead(stream.input.data(), stream.input.size(), response);
+        if (result == ParseResult::Incomplete) return true;
+        if (result == ParseResult::Invalid || response.statusCode == 101) {
+            logger.error("Invalid response from backend " + stream.url);
+            upstreamFailed(stream, 502, "Bad Gateway - invalid backend response");
+            return false;
+        }
+        if (response.statusCode >= 200) break;
+        // Interim responses (100 Continue) are not relayed
+        stream.input.erase(0, response.headLength);
+        response = HttpHead();
+    }
+
+    bool noBody = stream.request.method == "HEAD" || response.statusCode == 204 || response.statusCode == 304;
+    long long contentLength = response.contentLength();
+    if (noBody) {
+        stream.responseDecoder.reset(BodyDecoder::Framing::None);
+    } else if (response.isChunked()) {
+        stream.responseDecoder.reset(BodyDecoder::Framing::Chunked);
+    } else if (contentLength >= 0) {
+        stream.responseDecoder.reset(BodyDecoder::Framing::Length, contentLength);
+    } else {
+        stream.responseDecoder.reset(BodyDecoder::Framing::UntilClose);
+    }
+
+    HeaderList fields;
+    fields.reserve(response.headers.size());
+    for (const auto& header : response.headers) {
+        if (Http::isHopByHop(header.first) || Http::equalsIgnoreCase(header.first, "Transfer-Encoding")) continue;
+        // DATA frames carry the length of a chunked body
+        if (response.isChunked() && Http::equalsIgnoreCase(header.first, "Content-Length")) continue;
+        fields.emplace_back(toLower(header.first), header.second);
+    }
+    stream.status = response.statusCode;
+    sendHeaders(stream, response.statusCode, fields, noBody);
+    if (noBody) {
+        stream.responseComplete = true;
+        return true;
+    }
+
+    if (!appendResponseBody(stream, stream.input.data() + response.headLength,
+                            stream.input.size() - response.headLength)) {
+        return false;
+    }
+    releaseBuffer(stream.input);
+    return true;
+}
+
+// False when the backend's chunked framing was invalid and the stream was reset
+bool Http2Session::appendResponseBody(Http2Stream& stream, const char* data, size_t length) {
+    stream.responseDecoder.decode(data, length, stream.body, false);
+    if (stream.responseDecoder.isInvalid()) {
+        logger.error("Invalid chunked response body from backend " + stream.url);
+        resetStream(stream, kInternalError);
+        return false;
+    }
+    if (stream.responseDecoder.isComplete()) {
+        stream.responseComplete = true;
+    }
+    return true;
+}
+
+void Http2Session::onStreamTimeout(Http2Stream& stream) {
+    TimeoutCounters& counters = server.getTimeoutCounters();
+
+    switch (stream.stage) {
+        case Http2Stream::Stage::Connecting:
+            counters.upstreamConnect.fetch_add(1, std::memory_order_relaxed);
+            logger.warning("Upstream connect timeout for backend " + stream.url);
+            upstreamFailed(stream, 504, "Gateway Timeout - backend connect timed out");
+            break;
+        case Http2Stream::Stage::Awaiting:
+            counters.upstreamFirstByte.fetch_add(1, std::memory_order_relaxed);
+            logger.warning("Upstream first-byte timeout for backend " + stream.url);
+            upstreamFailed(stream, 504, "Gateway Timeout - backend did not respond");
+            break;
+        case Http2Stream::Stage::Relaying:
+            counters.requestTotal.fetch_add(1, std::memory_order_relaxed);
+            logger.warning("Request deadline exceeded for " + stream.request.method + " " + stream.request.path +
+                           " from " + clientIP);
+            resetStream(stream, kCancel);
+            break;
+        default:
+            break;
+    }
+    pumpStreams();
+}
+
+void Http2Session::upstreamFailed(Http2Stream& stream, int statusCode, const std::string& body) {
+    if (stream.backend != nullptr) {
+        worker.getMetrics().recordUpstreamFailure(server.getLoadBalancer().indexOf(stream.backend));
+    }
+    releaseUpstream(stream);
+    if (stream.headersSent) {
+        resetStream(stream, kInternalError);
+    } else {
+        sendLocalResponse(stream, statusCode, body);
+    }
+}
+
+void Http2Session::releaseUpstream(Http2Stream& stream) {
+    stream.timer.cancel();
+    if (stream.socket != INVALID_SOCKET) {
+        worker.getLoop().remove(stream.socket);
+        closesocket(stream.socket);
+        stream.socket = INVALID_SOCKET;
+        stream.events = 0;
+    }
+    // Counted once the attempt has started
+    if (stream.backend != nullptr && stream.stage != Http2Stream::Stage::Idle) {
+        server.getLoadBalancer().decrementConnections(stream.backend->host, stream.backend->port);
+    }
+    stream.stage = Http2Stream::Stage::Idle;
+    stream.backend = nullptr;
+    releaseBuffer(stream.output);
+    stream.outputOffset = 0;
+    releaseBuffer(stream.input);
+}
+
+void Http2Session::updateUpstreamEvents(Http2Stream& stream) {
+    if (stream.socket == INVALID_SOCKET) return;
+
+    uint32_t events = 0;
+    if (stream.stage == Http2Stream::Stage::Connecting) {
+        events = EventLoop::Writable;
+    } else {
+        if (stream.pendingOutput() > 0) events |= EventLoop::Writable;
+        // Held while a buffer's worth of response waits for the client's window
+        if (!stream.responseComplete && stream.pendingBody() < highWatermark) events |= EventLoop::Readable;
+    }
+    if (events == stream.events) return;
+    worker.getLoop().modify(stream.socket, events, &stream.endpoint);
+    stream.events = events;
+}
+
+void Http2Session::sendHeaders(Http2Stream& stream, int statusCode, const HeaderList& fields, bool endStream) {
+    std::string block;
+    encoder.beginBlock(block);
+    encoder.encode(":status", std::to_string(statusCode), block);
+    for (const auto& field : fields) {
+        encoder.encode(field.first, field.second, block);
+    }
+
+    // Blocks larger than a frame continue in CONTINUATION frames, back to back
+    size_t offset = 0;
+    bool first = true;
+    do {
+        size_t length = std::min<size_t>(block.size() - offset, peerMaxFrameSize);
+        bool last = offset + length == block.size();
+        uint8_t flags = static_cast<uint8_t>((last ? kEndHeaders : 0) | (first && endStream ? kEndStream : 0));
+        appendFrame(first ? kHeaders : kContinuation, flags, stream.id, block.data() + offset, length);
+        offset += length;
+        first = false;
+    } while (offset < block.size());
+
+    stream.headersSent = true;
+    if (endStream) stream.endSent = true;
+    schedule(stream);
+}
+
+void Http2Session::sendLocalResponse(Http2Stream& stream, int statusCode, const std::string& body,
+                                     const std::string& retryAfter) {
+    releaseUpstream(stream);
+    // Any request body still coming has nowhere to go
+    stream.writeClosed = true;
+    acknowledge(stream, stream.bufferedBody);
+    stream.bufferedBody = 0;
+
+    HeaderList fields = {{"content-type", "text/plain"}, {"content-length", std::to_string(body.size())}};
+    if (!retryAfter.empty()) fields.emplace_back("retry-after", retryAfter);
+    stream.status = statusCode;
+    stream.body = body;
+    stream.bodyOffset = 0;
+    stream.responseComplete = true;
+    sendHeaders(stream, statusCode, fields, body.empty());
+}
+
+// One DATA frame for the stream within both windows; false when it has
+// nothing it may send
+bool Http2Session::sendDataFrame(Http2Stream& stream) {
+    if (stream.endSent || !stream.headersSent) return false;
+
+    if (stream.pendingBody() == 0 && stream.fileRemaining > 0 && stream.sendWindow > 0 && sendWindow > 0 &&
+        !readStaticChunk(stream)) {
+        // Retired by pumpStreams like a finished stream, without a status
+        resetStream(stream.id, kInternalError);
+        stream.status = 0;
+        stream.requestEnded = true;
+        stream.endSent = true;
+        return true;
+    }
+    size_t available = stream.pendingBody();
+    if (available == 0) {
+        if (!stream.responseComplete) return false;
+        appendFrame(kData, kEndStream, stream.id, nullptr, 0);
+        stream.endSent = true;
+        return true;
+    }
+
+    int64_t allowed = std::min<int64_t>({sendWindow, stream.sendWindow, static_cast<int64_t>(peerMaxFrameSize)});
+    if (allowed <= 0) return false;
+    size_t length = std::min(available, static_cast<size_t>(allowed));
+    bool last = stream.responseComplete && length == available;
+    appendFrame(kData, last ? kEndStream : 0, stream.id, stream.body.data() + stream.bodyOffset, length);
+    sendWindow -= static_cast<int64_t>(length);
+    stream.sendWindow -= static_cast<int64_t>(length);
+    stream.bodyOffset += length;
+    worker.getMetrics().add(Counter::ResponseBytes, length);
+    if (last) stream.endSent = true;
+
+    if (stream.bodyOffset == stream.body.size()) {
+        stream.body.clear();
+        stream.bodyOffset = 0;
+    } else if (stream.bodyOffset >= highWatermark) {
+        stream.body.erase(0, stream.bodyOffset);
+        stream.bodyOffset = 0;
+    }
+    return true;
+}
+
+// Marks a stream as having response frames to send, or being done
+void Http2Session::schedule(Http2Stream& stream) {
+    if (stream.scheduled) return;
+    stream.scheduled = true;
+    scheduled.push_back(&stream);
+}
+
+// Sends DATA round-robin over the scheduled streams, a frame per stream per
+// pass, while the client backlog has room; then retires finished streams
+// and flushes. Streams out of their own window or waiting on the backend
+// leave the list until a WINDOW_UPDATE or more response brings them back.
+void Http2Session::pumpStreams() {
+    if (closed) return;
+
+    bool progress = true;
+    while (progress && pendingClientOutput() < highWatermark) {
+        progress = false;
+        for (Http2Stream* stream : scheduled) {
+            if (sendDataFrame(*stream)) progress = true;
+        }
+    }
+
+    visiting.swap(scheduled);
+    for (Http2Stream* stream : visiting) {
+        stream->scheduled = false;
+        if (stream->endSent) {
+            // Answered before the client finished sending: it can stop now
+            if (!stream->requestEnded) resetStream(stream->id, kNoError);
+            closeStream(*stream, stream->status);
+            continue;
+        }
+        // Reading resumes once the buffered response has drained
+        if (stream->stage != Http2Stream::Stage::Idle) updateUpstreamEvents(*stream);
+        bool sendable = stream->pendingResponse() > 0 ? stream->sendWindow > 0 : stream->responseComplete;
+        if (sendable) schedule(*stream);
+    }
+    visiting.clear();
+
+    flushClient();
+    if (!closed && goingAway && streams.empty() && pendingClientOutput() == 0) {
+        close();
+    }
+}
+
+void Http2Session::resetStream(Http2Stream& stream, uint32_t errorCode) {
+    logger.debug("Resetting HTTP/2 stream " + std::to_string(stream.id) + " from " + clientIP + " (error " +
+                 std::to_string(errorCode) + ")");
+    resetStream(stream.id, errorCode);
+    closeStream(stream, 0);
+}
+
+void Http2Session::resetStream(uint32_t streamId, uint32_t errorCode) {
+    std::string payload;
+    appendUint32(payload, errorCode);
+    appendFrame(kRstStream, 0, streamId, payload.data(), payload.size());
+}
+
+// Abandoned streams (statusCode 0) only leave the gauges
+void Http2Session::closeStream(Http2Stream& stream, int statusCode) {
+    if (stream.scheduled) {
+        scheduled.erase(std::find(scheduled.begin(), scheduled.end(), &stream));
+        stream.scheduled = false;
+    }
+    MetricsShard& metrics = worker.getMetrics();
+    metrics.addGauge(Gauge::ActiveRequests, -1);
+    metrics.addGauge(Gauge::Http2Streams, -1);
+    if (statusCode > 0) {
+        metrics.recordRequest(routeSlot(stream), statusCode, EventLoop::monotonicUs() - stream.startUs);
+    }
+
+    releaseUpstream(stream);
+    streams.erase(stream.id);
+    streamsServed++;
+    lastActivityMs = EventLoop::monotonicMs();
+
+    // Back to the pool after this round, once no stale readiness can reach it
+    stream.session = nullptr;
+    Http2StreamPool& pool = worker.getStreamPool();
+    Http2Stream* released = &stream;
+    worker.getLoop().defer([&pool, released] { pool.release(released); });
+}
+
+size_t Http2Session::routeSlot(const Http2Stream& stream) const {
+    return stream.route != nullptr ? stream.route->index : server.getRouter().getRouteCount();
+}
+
+void Http2Session::appendFrame(uint8_t type, uint8_t flags, uint32_t streamId, const char* payload, size_t length) {
+    char header[kFrameHeaderLength] = {
+        static_cast<char>(length >> 16), static_cast<char>(length >> 8), static_cast<char>(length),
+        static_cast<char>(type), static_cast<char>(flags),
+        static_cast<char>((streamId >> 24) & 0x7f), static_cast<char>(streamId >> 16),
+        static_cast<char>(streamId >> 8), static_cast<char>(streamId)
+    };
+    output.append(header, sizeof(header));
+    if (length > 0) output.append(payload, length);
+}
+
+void Http2Session::sendSettings() {
+    std::string payload;
+    appendSetting(payload, kMaxConcurrentStreams, static_cast<uint32_t>(settings.maxConcurrentStreams));
+    appendSetting(payload, kInitialWindowSize, static_cast<uint32_t>(settings.initialWindowKb) * 1024);
+    appendSetting(payload, kMaxHeaderListSize, static_cast<uint32_t>(settings.maxHeaderListKb) * 1024);
+    appendFrame(kSettings, 0, 0, payload.data(), payload.size());
+
+    if (connectionWindow > kDefaultWindow) {
+        sendWindowUpdate(0, connectionWindow - kDefaultWindow);
+        receiveWindow = connectionWindow;
+    }
+}
+
+void Http2Session::sendWindowUpdate(uint32_t streamId, int64_t increment) {
+    std::string payload;
+    appendUint32(payload, static_cast<uint32_t>(increment));
+    appendFrame(kWindowUpdate, 0, streamId, payload.data(), payload.size());
+}
+
+// Best effort: GOAWAY goes out with whatever fits in the socket buffer
+void Http2Session::connectionError(uint32_t errorCode, const std::string& reason) {
+    logger.warning("HTTP/2 protocol error from " + clientIP + ": " + reason);
+    std::string payload;
+    appendUint32(payload, lastStreamId);
+    appendUint32(payload, errorCode);
+    appendFrame(kGoAway, 0, 0, payload.data(), payload.size());
+    flushClient();
+    close();
+}
+
+void Http2Session::flushClient() {
+    if (closed) return;
+
+    while (pendingClientOutput() > 0) {
+        long sent = clientSend(output.data() + outputOffset, pendingClientOutput());
+        if (sent > 0) {
+            outputOffset += static_cast<size_t>(sent);
+            continue;
+        }
+        int error = lastSocketError();
+        if (sent < 0 && isInterrupted(error)) continue;
+        if (sent < 0 && isWouldBlock(error)) break;
+
+        logger.debug("Failed to send to HTTP/2 client " + clientIP);
+        close();
+        return;
+    }
+
+    if (outputOffset == output.size()) {
+        output.clear();
+        outputOffset = 0;
+    } else if (outputOffset >= highWatermark) {
+        output.erase(0, outputOffset);
+        outputOffset = 0;
+    }
+    updateClientEvents();
+}
+
+bool Http2Session::hasSendableFile() const {
+    if (sendWindow <= 0) return false;
+    return std::any_of(scheduled.begin(), scheduled.end(),
+                       [](const Http2Stream* stream) { return stream->fileRemaining > 0 && stream->sendWindow > 0; });
+}
+
+void Http2Session::updateClientEvents() {
+    if (closed) return;
+
+    uint32_t events = 0;
+    // Nothing else wakes a stream whose file was held back only by the
+    // backlog, so an idle socket is watched for writability until it is sent
+    if (pendingClientOutput() > 0 || hasSendableFile()) events |= EventLoop::Writable;
+    if (pendingClientOutput() < highWatermark) events |= EventLoop::Readable;
+    if (events != clientEvents) {
+        worker.getLoop().modify(clientSocket, events, &clientEndpoint);
+        clientEvents = events;
+    }
+
+    // Readiness says nothing about input the TLS layer already decrypted
+    if ((events & EventLoop::Readable) && tls && tls->hasPending() && !tlsReadScheduled) {
+        tlsReadScheduled = true;
+        worker.getLoop().defer([this] {
+            tlsReadScheduled = false;
+            if (!closed) readClient();
+        });
+    }
+}
+
+void Http2Session::onIdleTimer() {
+    // Activity only stamps a time; the timer is pushed back when it fires
+    uint64_t idleMs = static_cast<uint64_t>(server.getConfig().getIdleKeepAliveTimeout());
+    uint64_t quietMs = EventLoop::monotonicMs() - lastActivityMs;
+    if (!streams.empty() || quietMs < idleMs) {
+        worker.getLoop().timers().schedule(idleTimer, streams.empty() ? idleMs - quietMs : idleMs);
+        return;
+    }
+
+    server.getTimeoutCounters().idleKeepAlive.fetch_add(1, std::memory_order_relaxed);
+    logger.debug("Idle HTTP/2 timeout for " + clientIP);
+    std::string payload;
+    appendUint32(payload, lastStreamId);
+    appendUint32(payload, kNoError);
+    appendFrame(kGoAway, 0, 0, payload.data(), payload.size());
+    flushClient();
+    close();
+}
+
+// Streams up to lastStreamId are still answered; the client retries any
+// later ones on a new connection
+void Http2Session::drain() {
+    if (closed || goingAway) return;
+    goingAway = true;
+    logger.debug("Sending GOAWAY to HTTP/2 client " + clientIP + " to drain");
+    std::string payload;
+    appendUint32(payload, lastStreamId);
+    appendUint32(payload, kNoError);
+    appendFrame(kGoAway, 0, 0, payload.data(), payload.size());
+    flushClient();
+    if (!closed && streams.empty() && pendingClientOutput() == 0) {
+        close();
+    }
+}
+
+void Http2Session::close() {
+    if (closed) return;
+    closed = true;
+    idleTimer.cancel();
+
+    for (Http2Stream* stream : scheduled) {
+        stream->scheduled = false;
+    }
+    scheduled.clear();
+    std::unordered_map<uint32_t, Http2Stream*> remaining;
+    remaining.swap(streams);
+    for (auto& entry : remaining) {
+        closeStream(*entry.second, 0);
+    }
+
+    if (clientSocket != INVALID_SOCKET) {
+        worker.getLoop().remove(clientSocket);
+        if (tls) tls->shutdown();
+        closesocket(clientSocket);
+        clientSocket = INVALID_SOCKET;
+    }
+    logger.debug("HTTP/2 session with " + clientIP + " closed after " + std::to_string(streamsServed) + " streams");
+
+    worker.release(this);
+}
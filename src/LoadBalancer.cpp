@@ -4,6 +4,8 @@
 #include <functional>
 #include <climits>
 
+thread_local int LoadBalancer::threadShard = -1;
+
 LoadBalancer::LoadBalancer(LoadBalancingAlgorithm algo) 
     : currentIndex(0), weightedIndex(0), algorithm(algo), totalWeight(0) {
 }
@@ -12,6 +14,7 @@ void LoadBalancer::configure(const Config& config) {
     backends.clear();
     currentWeights.clear();
     totalWeight.store(0);
+    shards.clear();
     
     algorithm = config.getAlgorithm();
     
@@ -20,6 +23,35 @@ void LoadBalancer::configure(const Config& config) {
             addBackend(backendConfig.host, backendConfig.port, backendConfig.weight);
         }
     }
+    
+    if (config.getAffinity().perWorkerBalancer) {
+        setShardCount(static_cast<size_t>(config.getWorkerCount()));
+    }
+}
+
+void LoadBalancer::setShardCount(size_t count) {
+    shards.clear();
+    shards.resize(count);
+}
+
+void LoadBalancer::createShard(size_t index) {
+    if (index >= shards.size()) return;
+    
+    std::unique_ptr<Shard> shard(new Shard());
+    // Workers start at different backends rather than in step
+    shard->roundRobin = index;
+    shard->currentWeights.assign(backends.size(), 0);
+    size_t lines = (backends.size() + Shard::kCountsPerLine - 1) / Shard::kCountsPerLine;
+    shard->countLines.reset(new Shard::CountLine[lines]);
+    for (size_t i = 0; i < lines * Shard::kCountsPerLine; i++) {
+        shard->connections(i).store(0, std::memory_order_relaxed);
+    }
+    shards[index] = std::move(shard);
+}
+
+LoadBalancer::Shard* LoadBalancer::currentShard() const {
+    if (threadShard < 0 || static_cast<size_t>(threadShard) >= shards.size()) return nullptr;
+    return shards[static_cast<size_t>(threadShard)].get();
 }
 
 void LoadBalancer::addBackend(const std::string& host, int port, int weight) {
@@ -46,7 +78,8 @@ BackendServer* LoadBalancer::getNextBackend(const std::string& clientIP) {
 }
 
 BackendServer* LoadBalancer::getRoundRobinBackend() {
-    size_t startIndex = currentIndex.fetch_add(1) % backends.size();
+    Shard* shard = currentShard();
+    size_t startIndex = (shard ? shard->roundRobin++ : currentIndex.fetch_add(1)) % backends.size();
     
     if (backends[startIndex].isHealthy) {
         return &backends[startIndex];
@@ -65,38 +98,57 @@ BackendServer* LoadBalancer::getRoundRobinBackend() {
 BackendServer* LoadBalancer::getWeightedRoundRobinBackend() {
     if (backends.empty()) return nullptr;
     
+    int selectedIndex = -1;
+    if (Shard* shard = currentShard()) {
+        selectedIndex = pickWeighted(shard->currentWeights);
+    } else {
+        std::lock_guard<std::mutex> lock(weightsMutex);
+        selectedIndex = pickWeighted(currentWeights);
+    }
+    return selectedIndex < 0 ? nullptr : &backends[static_cast<size_t>(selectedIndex)];
+}
+
+// Smooth weighted round-robin over one copy of the current weights
+int LoadBalancer::pickWeighted(std::vector<int>& weights) const {
     int maxWeight = 0;
     int selectedIndex = -1;
+    int healthyWeight = 0;
     
     for (size_t i = 0; i < backends.size(); i++) {
         if (!backends[i].isHealthy) continue;
         
-        currentWeights[i] += backends[i].weight;
+        weights[i] += backends[i].weight;
+        healthyWeight += backends[i].weight;
         
-        if (selectedIndex == -1 || currentWeights[i] > maxWeight) {
-            maxWeight = currentWeights[i];
+        if (selectedIndex == -1 || weights[i] > maxWeight) {
+            maxWeight = weights[i];
             selectedIndex = static_cast<int>(i);
         }
     }
     
-    if (selectedIndex == -1) return nullptr;
+    if (selectedIndex == -1) return -1;
     
-    currentWeights[selectedIndex] -= totalWeight.load();
+    // Subtract only what this round added, or unhealthy weights make every
+    // current weight drift downwards without bound and skew the rotation
+    weights[selectedIndex] -= healthyWeight;
     
-    return &backends[selectedIndex];
+    return selectedIndex;
 }
 
 BackendServer* LoadBalancer::getLeastConnectionsBackend() {
     BackendServer* selected = nullptr;
     int minConnections = INT_MAX;
+    // A sharded worker compares only the connections it opened itself
+    Shard* shard = currentShard();
     
-    for (auto& backend : backends) {
-        if (!backend.isHealthy) continue;
+    for (size_t i = 0; i < backends.size(); i++) {
+        if (!backends[i].isHealthy) continue;
         
-        int connections = backend.activeConnections.load();
+        int connections = shard ? shard->connections(i).load(std::memory_order_relaxed)
+                                : backends[i].activeConnections.load();
         if (connections < minConnections) {
             minConnections = connections;
-            selected = &backend;
+            selected = &backends[i];
         }
     }
     
@@ -122,25 +174,54 @@ BackendServer* LoadBalancer::getIPHashBackend(const std::string& clientIP) {
     return &backends[selectedIndex];
 }
 
-void LoadBalancer::incrementConnections(const std::string& host, int port) {
-    for (auto& backend : backends) {
-        if (backend.host == host && backend.port == port) {
-            backend.activeConnections.fetch_add(1);
-            break;
+int LoadBalancer::findBackend(const std::string& host, int port) const {
+    for (size_t i = 0; i < backends.size(); i++) {
+        if (backends[i].host == host && backends[i].port == port) {
+            return static_cast<int>(i);
         }
     }
+    return -1;
+}
+
+void LoadBalancer::incrementConnections(const std::string& host, int port) {
+    int index = findBackend(host, port);
+    if (index < 0) return;
+    
+    if (Shard* shard = currentShard()) {
+        // Uncontended: the line is this worker's, so the add stays in its cache
+        shard->connections(index).fetch_add(1, std::memory_order_relaxed);
+    } else {
+        backends[index].activeConnections.fetch_add(1);
+    }
 }
 
 void LoadBalancer::decrementConnections(const std::string& host, int port) {
-    for (auto& backend : backends) {
-        if (backend.host == host && backend.port == port) {
-            int current = backend.activeConnections.load();
-            if (current > 0) {
-                backend.activeConnections.fetch_sub(1);
-            }
-            break;
+    int index = findBackend(host, port);
+    if (index < 0) return;
+    
+    if (Shard* shard = currentShard()) {
+        std::atomic<int>& count = shard->connections(index);
+        if (count.load(std::memory_order_relaxed) > 0) {
+            count.fetch_sub(1, std::memory_order_relaxed);
+        }
+        return;
+    }
+    
+    BackendServer& backend = backends[index];
+    int current = backend.activeConnections.load();
+    if (current > 0) {
+        backend.activeConnections.fetch_sub(1);
+    }
+}
+
+int LoadBalancer::getActiveConnections(size_t index) const {
+    int total = backends[index].activeConnections.load(std::memory_order_relaxed);
+    for (const auto& shard : shards) {
+        if (shard) {
+            total += shard->connections(index).load(std::memory_order_relaxed);
         }
     }
+    return total;
 }
 
 void LoadBalancer::markUnhealthy(const std::string& host, int port) {
@@ -204,7 +285,7 @@ void LoadBalancer::printStatus() const {
         const auto& backend = backends[i];
         std::cout << "  " << (i + 1) << ". " << backend.host << ":" << backend.port
                   << " (weight: " << backend.weight
-                  << ", connections: " << backend.activeConnections.load()
+                  << ", connections: " << getActiveConnections(i)
                   << ", " << (backend.isHealthy ? "healthy" : "unhealthy") << ")" << std::endl;
     }
     std::cout << "===========================\n" << std::endl;
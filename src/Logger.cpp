@@ -64,6 +64,7 @@ void Logger::writeLog(LogLevel level, const std::string& message) {
     std::string levelStr = logLevelToString(level);
     std::string logEntry = "[" + levelStr + "] [" + timestamp + "] " + message;
     
+    std::lock_guard<std::mutex> lock(writeMutex);
     if (consoleOutput) {
         switch (level) {
             case LogLevel::ERROR:
@@ -0,0 +1,581 @@
+#include "Metrics.h"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+
+namespace {
+
+// Prometheus histogram bucket bounds, in microseconds
+const uint64_t kBucketBoundsUs[] = {
+    100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000,
+    250000, 500000, 1000000, 2500000, 5000000, 10000000, 30000000, 60000000
+};
+
+void appendNumber(std::string& out, double value) {
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.9g", value);
+    out += buffer;
+}
+
+const char* const kCounterNames[] = {
+    "reverse_proxy_connections_accepted_total",
+    "reverse_proxy_connections_rejected_total",
+    "reverse_proxy_requests_received_total",
+    "reverse_proxy_request_bytes_total",
+    "reverse_proxy_response_bytes_total"
+};
+
+const char* const kStatusLabels[] = {"1xx", "2xx", "3xx", "4xx", "5xx"};
+const char* const kDirectionLabels[] = {"to_backend", "to_client"};
+
+// Route slot past the configured routes, in exported totals
+const char kUnmatchedRoute[] = "-";
+
+// Exported histograms: kind, sum, then bucket:count pairs for nonempty buckets
+void exportHistogram(std::string& out, const char* kind, const std::string& label, const HistogramSnapshot& snapshot) {
+    if (snapshot.getCount() == 0) return;
+    out += "h\t";
+    out += kind;
+    out += '\t';
+    out += label;
+    out += '\t';
+    out += std::to_string(snapshot.getSum());
+    out += '\t';
+    bool first = true;
+    for (int i = 0; i < LatencyHistogram::kBucketCount; i++) {
+        uint64_t count = snapshot.getBucketCount(i);
+        if (count == 0) continue;
+        if (!first) out += ',';
+        out += std::to_string(i) + ":" + std::to_string(count);
+        first = false;
+    }
+    out += '\n';
+}
+
+void importHistogram(LatencyHistogram& histogram, const std::string& sum, const std::string& buckets) {
+    histogram.addSum(std::strtoull(sum.c_str(), nullptr, 10));
+    std::istringstream list(buckets);
+    std::string entry;
+    while (std::getline(list, entry, ',')) {
+        size_t colon = entry.find(':');
+        if (colon == std::string::npos) continue;
+        int bucket = std::atoi(entry.c_str());
+        if (bucket < 0 || bucket >= LatencyHistogram::kBucketCount) continue;
+        histogram.addBucket(bucket, std::strtoull(entry.c_str() + colon + 1, nullptr, 10));
+    }
+}
+
+long indexOf(const std::vector<std::string>& labels, const std::string& label) {
+    for (size_t i = 0; i < labels.size(); i++) {
+        if (labels[i] == label) return static_cast<long>(i);
+    }
+    return -1;
+}
+
+} // namespace
+
+uint64_t LatencyHistogram::bucketUpperBound(int bucket) {
+    if (bucket < kSubBuckets) {
+        return static_cast<uint64_t>(bucket);
+    }
+    int shift = (bucket - kSubBuckets) / kSubBuckets;
+    uint64_t sub = static_cast<uint64_t>((bucket - kSubBuckets) % kSubBuckets);
+    return ((kSubBuckets + sub + 1) << shift) - 1;
+}
+
+HistogramSnapshot::HistogramSnapshot()
+    : counts(LatencyHistogram::kBucketCount, 0), count(0), sum(0) {
+}
+
+void HistogramSnapshot::add(const LatencyHistogram& histogram) {
+    for (int i = 0; i < LatencyHistogram::kBucketCount; i++) {
+        uint64_t bucketCount = histogram.getCount(i);
+        counts[i] += bucketCount;
+        count += bucketCount;
+    }
+    sum += histogram.getSum();
+}
+
+uint64_t HistogramSnapshot::countAtOrBelow(uint64_t limitUs) const {
+    uint64_t total = 0;
+    for (int i = 0; i < LatencyHistogram::kBucketCount; i++) {
+        if (LatencyHistogram::bucketUpperBound(i) > limitUs) break;
+        total += counts[i];
+    }
+    return total;
+}
+
+uint64_t HistogramSnapshot::getQuantile(double quantile) const {
+    if (count == 0) return 0;
+
+    uint64_t target = static_cast<uint64_t>(std::ceil(quantile * static_cast<double>(count)));
+    if (target == 0) target = 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < LatencyHistogram::kBucketCount; i++) {
+        seen += counts[i];
+        if (seen >= target) {
+            return LatencyHistogram::bucketUpperBound(i);
+        }
+    }
+    return LatencyHistogram::bucketUpperBound(LatencyHistogram::kBucketCount - 1);
+}
+
+MetricsShard::MetricsShard(size_t routes, size_t backends, size_t classes)
+    : responses(new std::atomic<uint64_t>[routes * kStatusClasses]()),
+      upstreamFailures(new std::atomic<uint64_t>[backends]()),
+      requestDuration(new LatencyHistogram[routes]),
+      queueWait(new LatencyHistogram[routes]),
+      classQueueWait(new LatencyHistogram[classes]),
+      classQueued(new std::atomic<int64_t>[classes]()),
+      upstreamLatency(new LatencyHistogram[backends]),
+      tunnels(new std::atomic<uint64_t>[backends]()),
+      tunnelBytes(new std::atomic<uint64_t>[backends * 2]()),
+      tunnelDuration(new LatencyHistogram[backends]) {
+}
+
+void MetricsShard::recordRequest(size_t route, int statusCode, uint64_t durationUs) {
+    int statusClass = statusCode / 100 - 1;
+    if (statusClass < 0 || statusClass >= kStatusClasses) {
+        statusClass = kStatusClasses - 1;
+    }
+    bumpCell(responses[route * kStatusClasses + static_cast<size_t>(statusClass)]);
+    requestDuration[route].record(durationUs);
+}
+
+void PrometheusWriter::family(const char* name, const char* help, const char* type) {
+    out += "# HELP ";
+    out += name;
+    out += ' ';
+    out += help;
+    out += "\n# TYPE ";
+    out += name;
+    out += ' ';
+    out += type;
+    out += '\n';
+}
+
+void PrometheusWriter::appendName(const char* name, const char* suffix, const std::string& labels) {
+    out += name;
+    out += suffix;
+    if (!labels.empty()) {
+        out += '{';
+        out += labels;
+        out += '}';
+    }
+    out += ' ';
+}
+
+void PrometheusWriter::sample(const char* name, const std::string& labels, double value) {
+    appendName(name, "", labels);
+    appendNumber(out, value);
+    out += '\n';
+}
+
+void PrometheusWriter::sample(const char* name, const std::string& labels, uint64_t value) {
+    appendName(name, "", labels);
+    out += std::to_string(value);
+    out += '\n';
+}
+
+void PrometheusWriter::histogram(const char* name, const std::string& labels, const HistogramSnapshot& snapshot) {
+    std::string prefix = labels.empty() ? std::string() : labels + ",";
+    for (uint64_t boundUs : kBucketBoundsUs) {
+        std::string le;
+        appendNumber(le, static_cast<double>(boundUs) / 1e6);
+        appendName(name, "_bucket", prefix + "le=\"" + le + "\"");
+        out += std::to_string(snapshot.countAtOrBelow(boundUs));
+        out += '\n';
+    }
+    appendName(name, "_bucket", prefix + "le=\"+Inf\"");
+    out += std::to_string(snapshot.getCount());
+    out += '\n';
+
+    appendName(name, "_sum", labels);
+    appendNumber(out, static_cast<double>(snapshot.getSum()) / 1e6);
+    out += '\n';
+    appendName(name, "_count", labels);
+    out += std::to_string(snapshot.getCount());
+    out += '\n';
+}
+
+std::string PrometheusWriter::label(const char* key, const std::string& value) {
+    std::string result = key;
+    result += "=\"";
+    for (char c : value) {
+        if (c == '\\' || c == '"') {
+            result += '\\';
+            result += c;
+        } else if (c == '\n') {
+            result += "\\n";
+        } else {
+            result += c;
+        }
+    }
+    result += '"';
+    return result;
+}
+
+MetricsRegistry::MetricsRegistry() {
+}
+
+void MetricsRegistry::configure(const std::vector<std::string>& routes, const std::vector<std::string>& backends,
+                                const std::vector<std::string>& classes) {
+    std::lock_guard<std::mutex> lock(shardsMutex);
+    routeLabels = routes;
+    backendLabels = backends;
+    classLabels = classes;
+    shards.clear();
+}
+
+MetricsShard& MetricsRegistry::getShard(size_t index) {
+    std::lock_guard<std::mutex> lock(shardsMutex);
+    while (shards.size() <= index) {
+        shards.emplace_back(new MetricsShard(routeLabels.size() + 1, backendLabels.size(), classLabels.size()));
+    }
+    return *shards[index];
+}
+
+std::string MetricsRegistry::routeLabel(size_t route) const {
+    return PrometheusWriter::label("route", route < routeLabels.size() ? routeLabels[route] : "unmatched");
+}
+
+void MetricsRegistry::render(PrometheusWriter& writer) const {
+    static const char* const kCounterHelp[] = {
+        "Client connections accepted",
+        "Client connections refused at max_connections",
+        "Request heads received",
+        "Request bytes forwarded to backends",
+        "Response bytes relayed to clients"
+    };
+    static const char* const kGaugeNames[] = {
+        "reverse_proxy_active_requests",
+        "reverse_proxy_queued_requests",
+        "reverse_proxy_http2_sessions",
+        "reverse_proxy_http2_active_streams"
+    };
+    static const char* const kGaugeHelp[] = {
+        "Requests between head received and response finished",
+        "Requests waiting in admission queues",
+        "Client connections speaking HTTP/2",
+        "HTTP/2 streams open on client connections"
+    };
+
+    std::lock_guard<std::mutex> lock(shardsMutex);
+    size_t routeSlots = routeLabels.size() + 1;
+
+    for (int c = 0; c < static_cast<int>(Counter::Count); c++) {
+        uint64_t total = 0;
+        for (const auto& shard : shards) {
+            total += shard->counters[c].load(std::memory_order_relaxed);
+        }
+        writer.family(kCounterNames[c], kCounterHelp[c], "counter");
+        writer.sample(kCounterNames[c], std::string(), total);
+    }
+
+    for (int g = 0; g < static_cast<int>(Gauge::Count); g++) {
+        int64_t total = 0;
+        for (const auto& shard : shards) {
+            total += shard->gauges[g].load(std::memory_order_relaxed);
+        }
+        writer.family(kGaugeNames[g], kGaugeHelp[g], "gauge");
+        writer.sample(kGaugeNames[g], std::string(), static_cast<double>(total));
+    }
+
+    writer.family("reverse_proxy_responses_total", "Responses sent to clients by route and status class", "counter");
+    for (size_t route = 0; route < routeSlots; route++) {
+        for (int s = 0; s < MetricsShard::kStatusClasses; s++) {
+            uint64_t total = 0;
+            for (const auto& shard : shards) {
+                total += shard->responses[route * MetricsShard::kStatusClasses + s].load(std::memory_order_relaxed);
+            }
+            if (total == 0) continue;
+            writer.sample("reverse_proxy_responses_total",
+                          routeLabel(route) + "," + PrometheusWriter::label("code", kStatusLabels[s]), total);
+        }
+    }
+
+    writer.family("reverse_proxy_request_duration_seconds",
+                  "Time from first request byte to last response byte", "histogram");
+    for (size_t route = 0; route < routeSlots; route++) {
+        HistogramSnapshot snapshot;
+        for (const auto& shard : shards) {
+            snapshot.add(shard->requestDuration[route]);
+        }
+        writer.histogram("reverse_proxy_request_duration_seconds", routeLabel(route), snapshot);
+    }
+
+    writer.family("reverse_proxy_queue_wait_seconds", "Time queued requests waited for admission", "histogram");
+    for (size_t route = 0; route < routeSlots; route++) {
+        HistogramSnapshot snapshot;
+        for (const auto& shard : shards) {
+            snapshot.add(shard->queueWait[route]);
+        }
+        writer.histogram("reverse_proxy_queue_wait_seconds", routeLabel(route), snapshot);
+    }
+
+    writer.family("reverse_proxy_class_queued_requests", "Requests waiting in admission queues by priority class",
+                  "gauge");
+    for (size_t priorityClass = 0; priorityClass < classLabels.size(); priorityClass++) {
+        int64_t total = 0;
+        for (const auto& shard : shards) {
+            total += shard->classQueued[priorityClass].load(std::memory_order_relaxed);
+        }
+        writer.sample("reverse_proxy_class_queued_requests",
+                      PrometheusWriter::label("class", classLabels[priorityClass]), static_cast<double>(total));
+    }
+
+    writer.family("reverse_proxy_class_queue_wait_seconds",
+                  "Time queued requests waited for admission by priority class", "histogram");
+    for (size_t priorityClass = 0; priorityClass < classLabels.size(); priorityClass++) {
+        HistogramSnapshot snapshot;
+        for (const auto& shard : shards) {
+            snapshot.add(shard->classQueueWait[priorityClass]);
+        }
+        writer.histogram("reverse_proxy_class_queue_wait_seconds",
+                         PrometheusWriter::label("class", classLabels[priorityClass]), snapshot);
+    }
+
+    writer.family("reverse_proxy_upstream_response_seconds",
+                  "Time from upstream attempt start to first response byte", "histogram");
+    for (size_t backend = 0; backend < backendLabels.size(); backend++) {
+        HistogramSnapshot snapshot;
+        for (const auto& shard : shards) {
+            snapshot.add(shard->upstreamLatency[backend]);
+        }
+        writer.histogram("reverse_proxy_upstream_response_seconds",
+                         PrometheusWriter::label("backend", backendLabels[backend]), snapshot);
+    }
+
+    writer.family("reverse_proxy_upstream_failures_total",
+                  "Upstream attempts that failed before a response", "counter");
+    for (size_t backend = 0; backend < backendLabels.size(); backend++) {
+        uint64_t total = 0;
+        for (const auto& shard : shards) {
+            total += shard->upstreamFailures[backend].load(std::memory_order_relaxed);
+        }
+        writer.sample("reverse_proxy_upstream_failures_total",
+                      PrometheusWriter::label("backend", backendLabels[backend]), total);
+    }
+
+    writer.family("reverse_proxy_tunnels_total", "Tunnels closed per backend", "counter");
+    for (size_t backend = 0; backend < backendLabels.size(); backend++) {
+        uint64_t total = 0;
+        for (const auto& shard : shards) {
+            total += shard->tunnels[backend].load(std::memory_order_relaxed);
+        }
+        writer.sample("reverse_proxy_tunnels_total", PrometheusWriter::label("backend", backendLabels[backend]), total);
+    }
+
+    writer.family("reverse_proxy_tunnel_bytes_total", "Bytes relayed through tunnels", "counter");
+    for (size_t backend = 0; backend < backendLabels.size(); backend++) {
+        for (int direction = 0; direction < 2; direction++) {
+            uint64_t total = 0;
+            for (const auto& shard : shards) {
+                total += shard->tunnelBytes[backend * 2 + direction].load(std::memory_order_relaxed);
+            }
+            writer.sample("reverse_proxy_tunnel_bytes_total",
+                          PrometheusWriter::label("backend", backendLabels[backend]) + "," +
+                              PrometheusWriter::label("direction", kDirectionLabels[direction]),
+                          total);
+        }
+    }
+
+    writer.family("reverse_proxy_tunnel_duration_seconds", "Lifetime of closed tunnels", "histogram");
+    for (size_t backend = 0; backend < backendLabels.size(); backend++) {
+        HistogramSnapshot snapshot;
+        for (const auto& shard : shards) {
+            snapshot.add(shard->tunnelDuration[backend]);
+        }
+        writer.histogram("reverse_proxy_tunnel_duration_seconds",
+                         PrometheusWriter::label("backend", backendLabels[backend]), snapshot);
+    }
+}
+
+void MetricsRegistry::printStatus() const {
+    std::lock_guard<std::mutex> lock(shardsMutex);
+
+    std::cout << "\n=== Request Latency ===" << std::endl;
+    for (size_t route = 0; route <= routeLabels.size(); route++) {
+        HistogramSnapshot snapshot;
+        for (const auto& shard : shards) {
+            snapshot.add(shard->requestDuration[route]);
+        }
+        if (snapshot.getCount() == 0) continue;
+
+        std::cout << (route < routeLabels.size() ? routeLabels[route] : std::string("(unmatched)"))
+                  << ": " << snapshot.getCount() << " requests, p50 " << snapshot.getQuantile(0.5)
+                  << "us, p99 " << snapshot.getQuantile(0.99) << "us, p999 " << snapshot.getQuantile(0.999)
+                  << "us" << std::endl;
+    }
+    std::cout << "=======================\n" << std::endl;
+
+    bool printedWaits = false;
+    for (size_t priorityClass = 0; priorityClass < classLabels.size(); priorityClass++) {
+        HistogramSnapshot snapshot;
+        for (const auto& shard : shards) {
+            snapshot.add(shard->classQueueWait[priorityClass]);
+        }
+        if (snapshot.getCount() == 0) continue;
+
+        if (!printedWaits) std::cout << "=== Admission Queue Wait ===" << std::endl;
+        printedWaits = true;
+        std::cout << classLabels[priorityClass] << ": " << snapshot.getCount() << " queued, p50 "
+                  << snapshot.getQuantile(0.5) << "us, p99 " << snapshot.getQuantile(0.99) << "us, max "
+                  << snapshot.getQuantile(1.0) << "us" << std::endl;
+    }
+    if (printedWaits) std::cout << "============================\n" << std::endl;
+
+    uint64_t tunnelCount = 0;
+    for (size_t backend = 0; backend < backendLabels.size(); backend++) {
+        for (const auto& shard : shards) {
+            tunnelCount += shard->tunnels[backend].load(std::memory_order_relaxed);
+        }
+    }
+    if (tunnelCount == 0) return;
+
+    std::cout << "=== Tunnels ===" << std::endl;
+    for (size_t backend = 0; backend < backendLabels.size(); backend++) {
+        HistogramSnapshot snapshot;
+        uint64_t toBackend = 0;
+        uint64_t toClient = 0;
+        for (const auto& shard : shards) {
+            snapshot.add(shard->tunnelDuration[backend]);
+            toBackend += shard->tunnelBytes[backend * 2].load(std::memory_order_relaxed);
+            toClient += shard->tunnelBytes[backend * 2 + 1].load(std::memory_order_relaxed);
+        }
+        std::cout << backendLabels[backend] << ": " << snapshot.getCount() << " tunnels, " << toBackend
+                  << " bytes in, " << toClient << " bytes out, duration p50 " << snapshot.getQuantile(0.5)
+                  << "us, p99 " << snapshot.getQuantile(0.99) << "us" << std::endl;
+    }
+    std::cout << "===============\n" << std::endl;
+}
+
+std::string MetricsRegistry::exportTotals() const {
+    std::lock_guard<std::mutex> lock(shardsMutex);
+    std::string out;
+    size_t routeSlots = routeLabels.size() + 1;
+    auto routeName = [this](size_t route) {
+        return route < routeLabels.size() ? routeLabels[route] : std::string(kUnmatchedRoute);
+    };
+    auto sum = [this](const std::unique_ptr<std::atomic<uint64_t>[]> MetricsShard::*cells, size_t index) {
+        uint64_t total = 0;
+        for (const auto& shard : shards) {
+            total += ((*shard).*cells)[index].load(std::memory_order_relaxed);
+        }
+        return total;
+    };
+
+    for (int c = 0; c < static_cast<int>(Counter::Count); c++) {
+        uint64_t total = 0;
+        for (const auto& shard : shards) {
+            total += shard->counters[c].load(std::memory_order_relaxed);
+        }
+        if (total > 0) out += std::string("c\t") + kCounterNames[c] + "\t" + std::to_string(total) + "\n";
+    }
+    for (size_t route = 0; route < routeSlots; route++) {
+        for (int s = 0; s < MetricsShard::kStatusClasses; s++) {
+            uint64_t total = sum(&MetricsShard::responses, route * MetricsShard::kStatusClasses + s);
+            if (total > 0) {
+                out += "r\t" + routeName(route) + "\t" + kStatusLabels[s] + "\t" + std::to_string(total) + "\n";
+            }
+        }
+        HistogramSnapshot duration;
+        HistogramSnapshot wait;
+        for (const auto& shard : shards) {
+            duration.add(shard->requestDuration[route]);
+            wait.add(shard->queueWait[route]);
+        }
+        exportHistogram(out, "duration", routeName(route), duration);
+        exportHistogram(out, "queue", routeName(route), wait);
+    }
+    for (size_t backend = 0; backend < backendLabels.size(); backend++) {
+        const std::string& name = backendLabels[backend];
+        uint64_t failures = sum(&MetricsShard::upstreamFailures, backend);
+        if (failures > 0) out += "f\t" + name + "\t" + std::to_string(failures) + "\n";
+        uint64_t tunnels = sum(&MetricsShard::tunnels, backend);
+        if (tunnels > 0) out += "t\t" + name + "\t" + std::to_string(tunnels) + "\n";
+        for (int direction = 0; direction < 2; direction++) {
+            uint64_t bytes = sum(&MetricsShard::tunnelBytes, backend * 2 + direction);
+            if (bytes > 0) {
+                out += "b\t" + name + "\t" + kDirectionLabels[direction] + "\t" + std::to_string(bytes) + "\n";
+            }
+        }
+        HistogramSnapshot upstream;
+        HistogramSnapshot tunnel;
+        for (const auto& shard : shards) {
+            upstream.add(shard->upstreamLatency[backend]);
+            tunnel.add(shard->tunnelDuration[backend]);
+        }
+        exportHistogram(out, "upstream", name, upstream);
+        exportHistogram(out, "tunnel", name, tunnel);
+    }
+    for (size_t priorityClass = 0; priorityClass < classLabels.size(); priorityClass++) {
+        HistogramSnapshot wait;
+        for (const auto& shard : shards) {
+            wait.add(shard->classQueueWait[priorityClass]);
+        }
+        exportHistogram(out, "class_queue", classLabels[priorityClass], wait);
+    }
+    return out;
+}
+
+void MetricsRegistry::importTotals(const std::string& totals) {
+    std::lock_guard<std::mutex> lock(shardsMutex);
+    shards.emplace_back(new MetricsShard(routeLabels.size() + 1, backendLabels.size(), classLabels.size()));
+    MetricsShard& shard = *shards.back();
+    std::vector<std::string> routes = routeLabels;
+    routes.push_back(kUnmatchedRoute);
+
+    std::istringstream lines(totals);
+    std::string line;
+    while (std::getline(lines, line)) {
+        std::vector<std::string> fields;
+        std::istringstream split(line);
+        std::string field;
+        while (std::getline(split, field, '\t')) {
+            fields.push_back(field);
+        }
+        if (fields.size() < 3) continue;
+        const std::string& type = fields[0];
+        uint64_t value = std::strtoull(fields.back().c_str(), nullptr, 10);
+
+        if (type == "c") {
+            for (int c = 0; c < static_cast<int>(Counter::Count); c++) {
+                if (fields[1] == kCounterNames[c]) bumpCell(shard.counters[c], value);
+            }
+        } else if (type == "r" && fields.size() == 4) {
+            long route = indexOf(routes, fields[1]);
+            for (int s = 0; route >= 0 && s < MetricsShard::kStatusClasses; s++) {
+                if (fields[2] == kStatusLabels[s]) {
+                    bumpCell(shard.responses[static_cast<size_t>(route) * MetricsShard::kStatusClasses + s], value);
+                }
+            }
+        } else if (type == "f" || type == "t") {
+            long backend = indexOf(backendLabels, fields[1]);
+            if (backend < 0) continue;
+            bumpCell((type == "f" ? shard.upstreamFailures : shard.tunnels)[backend], value);
+        } else if (type == "b" && fields.size() == 4) {
+            long backend = indexOf(backendLabels, fields[1]);
+            for (int direction = 0; backend >= 0 && direction < 2; direction++) {
+                if (fields[2] == kDirectionLabels[direction]) {
+                    bumpCell(shard.tunnelBytes[backend * 2 + direction], value);
+                }
+            }
+        } else if (type == "h" && fields.size() == 5) {
+            const std::string& kind = fields[1];
+            bool perRoute = kind == "duration" || kind == "queue";
+            bool perClass = kind == "class_queue";
+            long index = indexOf(perRoute ? routes : perClass ? classLabels : backendLabels, fields[2]);
+            if (index < 0) continue;
+            LatencyHistogram* histogram = nullptr;
+            if (kind == "duration") histogram = &shard.requestDuration[index];
+            if (kind == "queue") histogram = &shard.queueWait[index];
+            if (kind == "upstream") histogram = &shard.upstreamLatency[index];
+            if (kind == "tunnel") histogram = &shard.tunnelDuration[index];
+            if (kind == "class_queue") histogram = &shard.classQueueWait[index];
+            if (histogram != nullptr) importHistogram(*histogram, fields[3], fields[4]);
+        }
+    }
+}
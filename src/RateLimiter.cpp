@@ -0,0 +1,282 @@
+#include "RateLimiter.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <cstdlib>
+#include <new>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+namespace {
+
+// Slab alignment, so transparent huge pages can back the whole table
+constexpr size_t kSlabAlignment = 2 * 1024 * 1024;
+
+// Largest burst whose token count still fits the 32-bit half of a slot
+constexpr uint32_t kMaxBurst = 4000000;
+
+size_t roundUpToPowerOfTwo(size_t value) {
+    size_t result = 1;
+    while (result < value) {
+        result <<= 1;
+    }
+    return result;
+}
+
+// 64x64->128 multiply folded to 64 bits; the core of the key hash
+inline uint64_t multiplyFold(uint64_t a, uint64_t b) {
+#if defined(__SIZEOF_INT128__)
+    __uint128_t product = static_cast<__uint128_t>(a) * b;
+    return static_cast<uint64_t>(product) ^ static_cast<uint64_t>(product >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    uint64_t high;
+    uint64_t low = _umul128(a, b, &high);
+    return low ^ high;
+#else
+    uint64_t product = a * b;
+    return product ^ (product >> 29) ^ ((a >> 32) * (b >> 32));
+#endif
+}
+
+inline uint64_t read64(const char* p) {
+    uint64_t value;
+    memcpy(&value, p, 8);
+    return value;
+}
+
+inline uint64_t read32(const char* p) {
+    uint32_t value;
+    memcpy(&value, p, 4);
+    return value;
+}
+
+constexpr uint64_t kHashSecret0 = 0xa0761d6478bd642fULL;
+constexpr uint64_t kHashSecret1 = 0xe7037ed1a0b428dbULL;
+constexpr uint64_t kHashSecret2 = 0x8ebc6af09c88c6e3ULL;
+
+inline uint64_t pack(uint64_t tokens, uint32_t timeMs) {
+    return (tokens << 32) | timeMs;
+}
+
+// How far apart two workers' clock readings can be when racing on a slot
+constexpr uint32_t kClockSkewMs = 60000;
+
+// Milliseconds since a slot's 32-bit timestamp. The clock wraps every 49.7
+// days, so the difference is read modulo 2^32: only a reading just behind
+// the slot's is another worker being ahead, anything else is real idle time.
+inline uint32_t elapsedSince(uint32_t now, uint32_t last) {
+    uint32_t elapsed = now - last;
+    return elapsed > UINT32_MAX - kClockSkewMs ? 0 : elapsed;
+}
+
+} // namespace
+
+RateLimiter::Policy::Policy(double requestsPerSecond, uint32_t burst)
+    : rate(requestsPerSecond > 0.0 ? requestsPerSecond : 0.0),
+      capacity(static_cast<uint64_t>(std::min(burst, kMaxBurst)) * kTokenUnit),
+      refillPerMsQ16(0),
+      fillTimeMs(0) {
+    if (rate > 0.0) {
+        double perMs = rate * static_cast<double>(kTokenUnit) / 1000.0;
+        refillPerMsQ16 = std::max<uint64_t>(1, static_cast<uint64_t>(std::llround(perMs * 65536.0)));
+        double fill = std::ceil(static_cast<double>(capacity << 16) / static_cast<double>(refillPerMsQ16));
+        fillTimeMs = static_cast<uint32_t>(std::min(fill, 1e9));
+    }
+}
+
+RateLimiter::RateLimiter(size_t capacity, size_t requestedShards) {
+    shardCount = roundUpToPowerOfTwo(std::max<size_t>(1, requestedShards));
+    shardSize = roundUpToPowerOfTwo(std::max<size_t>(kProbeLimit, (capacity + shardCount - 1) / shardCount));
+
+    size_t slotCount = shardCount * shardSize;
+    size_t bytes = slotCount * sizeof(Slot);
+    void* memory = nullptr;
+#ifdef _WIN32
+    memory = _aligned_malloc(bytes, kSlabAlignment);
+#else
+    if (posix_memalign(&memory, kSlabAlignment, bytes) != 0) {
+        memory = nullptr;
+    }
+#endif
+    if (memory == nullptr) {
+        throw std::bad_alloc();
+    }
+#ifdef MADV_HUGEPAGE
+    // Every check is a random access; 2MB pages keep those off the page walker
+    madvise(memory, bytes, MADV_HUGEPAGE);
+#endif
+
+    Slot* slots = static_cast<Slot*>(memory);
+    for (size_t i = 0; i < slotCount; i++) {
+        new (&slots[i]) Slot();
+    }
+    slab = std::unique_ptr<Slot, SlabDeleter>(slots, SlabDeleter());
+
+    shards.reset(new Shard[shardCount]);
+    for (size_t i = 0; i < shardCount; i++) {
+        shards[i].slots = slots + i * shardSize;
+    }
+}
+
+void RateLimiter::SlabDeleter::operator()(Slot* slots) const {
+    // Slot is trivially destructible; only the memory needs releasing
+#ifdef _WIN32
+    _aligned_free(slots);
+#else
+    free(slots);
+#endif
+}
+
+uint64_t RateLimiter::hashKey(uint64_t seed, const char* data, size_t length) {
+    // Keys are mostly IP addresses and API keys: short inputs are read as
+    // two overlapping words so hashing costs a couple of multiplies
+    seed ^= kHashSecret0;
+    uint64_t a = 0;
+    uint64_t b = 0;
+    if (length >= 8 && length <= 16) {
+        a = read64(data);
+        b = read64(data + length - 8);
+    } else if (length >= 4 && length < 8) {
+        a = (read32(data) << 32) | read32(data + length - 4);
+    } else if (length > 0 && length < 4) {
+        a = (static_cast<uint64_t>(static_cast<unsigned char>(data[0])) << 16) |
+            (static_cast<uint64_t>(static_cast<unsigned char>(data[length >> 1])) << 8) |
+            static_cast<unsigned char>(data[length - 1]);
+    } else if (length > 16) {
+        size_t remaining = length;
+        const char* p = data;
+        while (remaining > 16) {
+            seed = multiplyFold(read64(p) ^ kHashSecret1, read64(p + 8) ^ seed);
+            p += 16;
+            remaining -= 16;
+        }
+        a = read64(data + length - 16);
+        b = read64(data + length - 8);
+    }
+    return multiplyFold(kHashSecret1 ^ length, multiplyFold(a ^ kHashSecret1, b ^ seed ^ kHashSecret2));
+}
+
+RateLimiter::Slot& RateLimiter::findSlot(Shard& shard, uint64_t keyHash, uint32_t now, bool& fresh) {
+    size_t mask = shardSize - 1;
+    size_t start = static_cast<size_t>(keyHash) & mask;
+
+    Slot* victim = nullptr;
+    uint32_t victimAge = 0;
+    for (size_t i = 0; i < kProbeLimit; i++) {
+        Slot& slot = shard.slots[(start + i) & mask];
+        uint64_t key = slot.key.load(std::memory_order_acquire);
+        if (key == keyHash) {
+            fresh = false;
+            return slot;
+        }
+        if (key == 0) {
+            uint64_t expected = 0;
+            if (slot.key.compare_exchange_strong(expected, keyHash, std::memory_order_acq_rel)) {
+                shard.keys.fetch_add(1, std::memory_order_relaxed);
+                fresh = true;
+                return slot;
+            }
+            if (expected == keyHash) {
+                fresh = false;
+                return slot;
+            }
+        }
+
+        // Keys are never removed, only replaced, so probing can't stop early
+        uint32_t age = elapsedSince(now, static_cast<uint32_t>(slot.state.load(std::memory_order_relaxed)));
+        if (victim == nullptr || age > victimAge) {
+            victim = &slot;
+            victimAge = age;
+        }
+    }
+
+    victim->key.store(keyHash, std::memory_order_release);
+    shard.evictions.fetch_add(1, std::memory_order_relaxed);
+    fresh = true;
+    return *victim;
+}
+
+bool RateLimiter::refill(uint64_t& state, const Policy& policy, uint32_t now, uint32_t& retryAfterMs) {
+    uint64_t tokens = state >> 32;
+    uint32_t last = static_cast<uint32_t>(state);
+    uint32_t elapsed = elapsedSince(now, last);
+
+    if (elapsed >= policy.fillTimeMs) {
+        tokens = policy.capacity;
+        last = now;
+    } else {
+        uint64_t added = (static_cast<uint64_t>(elapsed) * policy.refillPerMsQ16) >> 16;
+        if (tokens + added >= policy.capacity) {
+            tokens = policy.capacity;
+            last = now;
+        } else {
+            // Advance only by the time the added tokens account for, so
+            // frequent checks at low rates don't discard fractional refill
+            tokens += added;
+            last += static_cast<uint32_t>((added << 16) / policy.refillPerMsQ16);
+        }
+    }
+
+    bool allowed = tokens >= kTokenUnit;
+    if (allowed) {
+        tokens -= kTokenUnit;
+    } else {
+        uint64_t missing = (kTokenUnit - tokens) << 16;
+        retryAfterMs = static_cast<uint32_t>((missing + policy.refillPerMsQ16 - 1) / policy.refillPerMsQ16);
+    }
+    state = pack(tokens, last);
+    return allowed;
+}
+
+bool RateLimiter::tryAcquire(uint64_t keyHash, const Policy& policy, uint64_t nowMs, uint32_t& retryAfterMs) {
+    if (!policy.isEnabled()) return true;
+
+    keyHash |= (keyHash == 0);  // 0 marks an empty slot
+    Shard& shard = shards[(keyHash >> 40) & (shardCount - 1)];
+    uint32_t now = static_cast<uint32_t>(nowMs);
+
+    bool fresh = false;
+    Slot& slot = findSlot(shard, keyHash, now, fresh);
+    if (fresh) {
+        // New keys start with a full bucket, less this request
+        slot.state.store(pack(policy.capacity - kTokenUnit, now), std::memory_order_relaxed);
+        return true;
+    }
+
+    uint64_t current = slot.state.load(std::memory_order_relaxed);
+    for (;;) {
+        uint64_t next = current;
+        bool allowed = refill(next, policy, now, retryAfterMs);
+        if (slot.state.compare_exchange_weak(current, next, std::memory_order_relaxed)) {
+            if (!allowed) {
+                shard.limited.fetch_add(1, std::memory_order_relaxed);
+            }
+            return allowed;
+        }
+    }
+}
+
+size_t RateLimiter::getKeyCount() const {
+    uint64_t total = 0;
+    for (size_t i = 0; i < shardCount; i++) {
+        total += shards[i].keys.load(std::memory_order_relaxed);
+    }
+    return static_cast<size_t>(total);
+}
+
+uint64_t RateLimiter::getEvictions() const {
+    uint64_t total = 0;
+    for (size_t i = 0; i < shardCount; i++) {
+        total += shards[i].evictions.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+uint64_t RateLimiter::getLimited() const {
+    uint64_t total = 0;
+    for (size_t i = 0; i < shardCount; i++) {
+        total += shards[i].limited.load(std::memory_order_relaxed);
+    }
+    return total;
+}
@@ -0,0 +1,647 @@
+#include "RequestPipeline.h"
+
+#ifdef PROXY_HAS_COROUTINES
+#include "Exchange.h"
+#include "Worker.h"
+#include "Server.h"
+#include "Http.h"
+#include "ResponseWriter.h"
+#include "AdmissionControl.h"
+#include "RetryControl.h"
+#include "Probes.h"
+#include "TcpTunnel.h"
+#include "Http2.h"
+#include "StaticFiles.h"
+#include "SocketTuning.h"
+#include <algorithm>
+
+namespace {
+
+constexpr size_t kReadChunk = 16 * 1024;
+
+enum class ReadStatus {
+    Data,
+    Closed,
+    TimedOut,
+    Failed
+};
+
+// Why an upstream attempt failed, and the answer if it is not retried
+struct Failure {
+    int statusCode = 502;
+    std::string body;
+    bool retryable = false;
+    bool clientSide = false;   // the client stalled, left (statusCode 0) or sent a bad body
+};
+
+// One try at getting the response from a backend
+struct Attempt {
+    BackendServer* backend = nullptr;
+    ConcurrencyLimiter* limiter = nullptr;
+    std::string url;
+    bool started = false;      // counted in the balancer's connection count
+    uint64_t startUs = 0;
+    uint64_t latencyUs = 0;    // time to first byte, once it arrived
+    uint64_t startTsc = 0;
+    uint64_t connectedTsc = 0;
+    uint64_t sentTsc = 0;
+};
+
+// Everything one client connection carries between co_awaits; the request
+// itself is handled by the Exchange shared with the callback Connection
+struct Session : Exchange {
+    Session(Worker& w, SOCKET socket);
+    ~Session();
+
+    EventLoop& loop;
+    const Config& config;
+    AsyncSocket client;
+    std::string chunk;             // receive buffer, shared by both sockets
+    uint64_t deadlineMs;           // on the loop clock
+    bool globalAdmitted;
+    bool upgraded;                 // sockets and connection slot handed to a TcpTunnel or Http2Session
+    Attempt attempt;
+    std::string upstreamInput;
+
+    void startClock();
+    uint64_t budgetMs(int phaseTimeoutMs) const;
+    bool deadlinePassed() const { return requestStartUs != 0 && loop.now() >= deadlineMs; }
+
+    void adoptAttemptTrace();
+    void releaseAttempt(bool sample, bool dropped);
+    void releaseAdmission(bool sample, bool dropped);
+};
+
+Session::Session(Worker& w, SOCKET socket)
+    : Exchange(w, socket, this), loop(w.getLoop()), config(w.getServer().getConfig()), client(w.getLoop(), socket),
+      chunk(kReadChunk, '\0'), deadlineMs(0), globalAdmitted(false), upgraded(false) {
+    // Only plain-text clients are served here, so only the proxy listener applies
+    client.setQuickAck(config.getSockets().listener.quickAck);
+}
+
+Session::~Session() {
+    worker.unwatchIdle(client);   // destroyed mid-wait at worker shutdown
+    recordRequestEnd(0);
+    releaseAttempt(false, false);
+    releaseAdmission(false, false);
+    client.close();
+    if (!upgraded) {
+        server.releaseConnection();
+    }
+}
+
+void Session::startClock() {
+    beginRequest();
+    deadlineMs = loop.now() + static_cast<uint64_t>(config.getRequestTimeout());
+}
+
+uint64_t Session::budgetMs(int phaseTimeoutMs) const {
+    uint64_t budget = static_cast<uint64_t>(phaseTimeoutMs);
+    if (requestStartUs == 0) return budget;
+    uint64_t now = loop.now();
+    return std::min(budget, deadlineMs > now ? deadlineMs - now : 1);
+}
+
+void Session::adoptAttemptTrace() {
+    trace.set(TraceMark::UpstreamStart, attempt.startTsc);
+    trace.set(TraceMark::UpstreamConnected, attempt.connectedTsc);
+    trace.set(TraceMark::RequestSent, attempt.sentTsc);
+}
+
+void Session::releaseAttempt(bool sample, bool dropped) {
+    if (attempt.backend != nullptr && attempt.started) {
+        server.getLoadBalancer().decrementConnections(attempt.backend->host, attempt.backend->port);
+    }
+    if (attempt.limiter != nullptr) {
+        if (sample && (dropped || attempt.latencyUs > 0)) {
+            attempt.limiter->release(attempt.latencyUs, dropped);
+        } else {
+            attempt.limiter->releaseWithoutSample();
+        }
+    }
+    uint64_t latencyUs = attempt.latencyUs;
+    attempt = Attempt();
+    attempt.latencyUs = latencyUs;   // still needed for the global sample
+}
+
+void Session::releaseAdmission(bool sample, bool dropped) {
+    if (!globalAdmitted) return;
+
+    ConcurrencyLimiter& global = server.getAdmission().getGlobalLimiter();
+    if (sample && (attempt.latencyUs > 0 || dropped)) {
+        global.release(attempt.latencyUs, dropped);
+    } else {
+        global.releaseWithoutSample();
+    }
+    globalAdmitted = false;
+}
+
+Failure deadlineFailure(Session& s) {
+    s.countDeadline();
+    return Failure{504, "Gateway Timeout - request deadline exceeded", false};
+}
+
+// Appends whatever the client sends next to the session input
+Task<ReadStatus> readClient(Session& s, int phaseTimeoutMs) {
+    IoResult result = co_await withTimeout(s.loop, s.budgetMs(phaseTimeoutMs), s.client.read(&s.chunk[0], s.chunk.size()));
+    if (result.timedOut) co_return ReadStatus::TimedOut;
+    if (result.error != 0) {
+        s.logger.warning("Failed to receive data from client " + s.clientIP);
+        co_return ReadStatus::Failed;
+    }
+    if (result.bytes == 0) {
+        if (!s.requestBuffer.empty()) {
+            s.logger.warning("Client " + s.clientIP + " closed connection mid-request");
+        }
+        co_return ReadStatus::Closed;
+    }
+
+    if (s.requestStartUs == 0) {
+        s.startClock();
+    }
+    s.requestBuffer.append(s.chunk.data(), static_cast<size_t>(result.bytes));
+    co_return ReadStatus::Data;
+}
+
+Task<bool> writeClient(Session& s, const char* data, size_t length) {
+    IoResult result = co_await withTimeout(s.loop, s.budgetMs(s.config.getRequestTimeout()), s.client.write(data, length));
+    if (result.bytes > 0) {
+        s.worker.getMetrics().add(Counter::ResponseBytes, static_cast<uint64_t>(result.bytes));
+    }
+    if (!result.ok()) {
+        s.logger.warning("Failed to send response to client " + s.clientIP);
+        co_return false;
+    }
+    co_return true;
+}
+
+// Error responses end the connection; a 5xx from the gateway is a dropped sample
+Task<void> sendError(Session& s, int statusCode, const std::string& body, const std::string& extraHeaders = "") {
+    s.releaseAttempt(statusCode >= 502, statusCode >= 502);
+    s.releaseAdmission(statusCode >= 502, statusCode >= 502);
+    s.keepAlive = false;
+    s.recordRequestEnd(statusCode);
+
+    ResponseWriter::Frame frame;
+    ResponseWriter::build(frame, statusCode, body.data(), body.length(), extraHeaders.data(), extraHeaders.length());
+    std::string response;
+    for (size_t i = 0; i < frame.count; i++) {
+        response.append(frame.slices[i].data, frame.slices[i].length);
+    }
+    co_await writeClient(s, response.data(), response.size());
+}
+
+// Sends the rest of a streamed body, reading the client as it goes; the
+// upstream write completing is the backpressure. Half duplex: an early
+// answer from the backend is only read once the whole body is out.
+Task<bool> streamRequestBody(Session& s, AsyncSocket& upstream, Failure& failure) {
+    while (true) {
+        if (!s.decodeRequestBody()) {
+            failure = Failure{400, "Bad Request", false, true};
+            co_return false;
+        }
+        if (!s.requestBody.empty()) {
+            s.requestBodySent = true;
+            IoResult sent = co_await withTimeout(s.loop, s.budgetMs(s.config.getRequestTimeout()),
+                                                 upstream.write(s.requestBody.data(), s.requestBody.size()));
+            if (sent.bytes > 0) {
+                s.worker.getMetrics().add(Counter::RequestBytes, static_cast<uint64_t>(sent.bytes));
+            }
+            if (sent.timedOut) {
+                failure = deadlineFailure(s);
+                co_return false;
+            }
+            if (!sent.ok()) {
+                s.logger.error("Failed to send request body to backend " + s.attempt.url);
+                failure = Failure{502, "Bad Gateway - backend write failed", false};
+                co_return false;
+            }
+            s.requestBody.clear();
+            continue;
+        }
+        if (s.requestDecoder.isComplete()) co_return true;
+
+        // A streamed body only has to keep moving
+        ReadStatus status = co_await readClient(s, s.config.getClientHeaderTimeout());
+        if (status == ReadStatus::TimedOut) {
+            if (s.deadlinePassed()) {
+                failure = deadlineFailure(s);
+            } else {
+                s.server.getTimeoutCounters().clientHeader.fetch_add(1, std::memory_order_relaxed);
+                s.logger.warning("Client body timeout for " + s.clientIP);
+                failure = Failure{408, "Request Timeout", false, true};
+            }
+            co_return false;
+        }
+        if (status != ReadStatus::Data) {
+            failure = Failure{0, "", false, true};
+            co_return false;
+        }
+    }
+}
+
+// Connect, send the request and wait for the first response bytes
+Task<bool> startAttempt(Session& s, const std::string& output, AsyncSocket& upstream, Failure& failure) {
+    Attempt& attempt = s.attempt;
+    BackendServer* backend = attempt.backend;
+    TimeoutCounters& counters = s.server.getTimeoutCounters();
+    bool replayable = Http::isIdempotentMethod(s.request.method);
+
+    attempt.url = s.beginAttempt(backend, false);
+    attempt.started = true;
+    attempt.startUs = EventLoop::monotonicUs();
+
+    SocketAddress address;
+    if (!s.server.resolveBackend(backend, address)) {
+        s.logger.error("Failed to resolve backend " + attempt.url);
+        failure = Failure{502, "Bad Gateway - backend unresolvable", true};
+        co_return false;
+    }
+    attempt.startTsc = Tsc::now();
+    PROXY_PROBE3(upstream_start, &s, attempt.url.c_str(), false);
+
+    if (!upstream.open(address.family())) {
+        s.logger.error("Failed to create upstream socket");
+        failure = Failure{502, "Bad Gateway", false};
+        co_return false;
+    }
+    SocketTuning::applyUpstream(upstream.get(), s.config.getSockets().upstream);
+    upstream.setQuickAck(s.config.getSockets().upstream.quickAck);
+
+    IoResult connected = co_await withTimeout(s.loop, s.budgetMs(s.config.getUpstreamConnectTimeout()),
+                                              upstream.connect(address));
+    if (connected.timedOut) {
+        if (s.deadlinePassed()) {
+            failure = deadlineFailure(s);
+        } else {
+            counters.upstreamConnect.fetch_add(1, std::memory_order_relaxed);
+            s.logger.warning("Upstream connect timeout for backend " + attempt.url);
+            failure = Failure{504, "Gateway Timeout - backend connect timed out", true};
+        }
+        co_return false;
+    }
+    if (!connected.ok()) {
+        s.logger.error("Failed to connect to backend " + attempt.url);
+        failure = Failure{502, "Bad Gateway - backend unreachable", true};
+        co_return false;
+    }
+    attempt.connectedTsc = Tsc::now();
+    PROXY_PROBE2(upstream_connected, &s, attempt.url.c_str());
+
+    IoResult sent = co_await withTimeout(s.loop, s.budgetMs(s.config.getRequestTimeout()),
+                                         upstream.write(output.data(), output.size()));
+    if (sent.bytes > 0) {
+        s.worker.getMetrics().add(Counter::RequestBytes, static_cast<uint64_t>(sent.bytes));
+    }
+    if (sent.timedOut) {
+        failure = deadlineFailure(s);
+        co_return false;
+    }
+    if (!sent.ok()) {
+        // Only idempotent requests may reach the backend twice
+        s.logger.error("Failed to send request to backend " + attempt.url);
+        failure = Failure{502, "Bad Gateway - backend write failed", replayable};
+        co_return false;
+    }
+    if (s.requestStreaming && !co_await streamRequestBody(s, upstream, failure)) {
+        co_return false;
+    }
+    attempt.sentTsc = Tsc::now();
+    PROXY_PROBE2(request_sent, &s, attempt.url.c_str());
+
+    IoResult first = co_await withTimeout(s.loop, s.budgetMs(s.config.getUpstreamFirstByteTimeout()),
+                                          upstream.read(&s.chunk[0], s.chunk.size()));
+    if (first.timedOut) {
+        if (s.deadlinePassed()) {
+            failure = deadlineFailure(s);
+        } else {
+            counters.upstreamFirstByte.fetch_add(1, std::memory_order_relaxed);
+            s.logger.warning("Upstream first-byte timeout for backend " + attempt.url);
+            failure = Failure{504, "Gateway Timeout - backend did not respond", false};
+        }
+        co_return false;
+    }
+    if (!first.ok()) {
+        s.logger.error("Failed to read response from backend " + attempt.url);
+        failure = Failure{502, "Bad Gateway - backend read failed", replayable};
+        co_return false;
+    }
+    if (first.bytes == 0) {
+        s.logger.error("Backend " + attempt.url + " closed connection without a response");
+        failure = Failure{502, "Bad Gateway - empty backend response", replayable};
+        co_return false;
+    }
+
+    s.upstreamInput.assign(s.chunk.data(), static_cast<size_t>(first.bytes));
+    co_return true;
+}
+
+// After a 101 the sockets go to a TcpTunnel, with the bytes already read
+// from either side queued ahead of the relayed ones
+void upgradeToTunnel(Session& s, AsyncSocket& upstream, const HttpHead& response) {
+    std::string toClient;
+    Http::appendClientResponseHead(response, false, false, toClient);
+    toClient.append(s.upstreamInput, response.headLength, std::string::npos);
+
+    s.logger.info("Upgraded connection from " + s.clientIP + " to backend " + s.attempt.url + " (" +
+                  *s.request.findHeader("Upgrade") + ")");
+
+    BackendServer* backend = s.attempt.backend;
+    s.attempt.started = false;   // stays counted until the tunnel closes
+    s.recordRequestEnd(101);
+    s.releaseAttempt(true, false);
+    s.releaseAdmission(true, false);
+    s.upgraded = true;
+    s.worker.adoptTunnel(new TcpTunnel(s.worker, s.client.release(), upstream.release(), backend, std::move(toClient),
+                                       std::move(s.requestBuffer)));
+}
+
+// Relays the response whose first bytes are in upstreamInput; returns the
+// status sent, or 0 when the response was cut short and the client must go
+Task<int> relayResponse(Session& s, AsyncSocket& upstream) {
+    HttpHead response;
+    ParseResult parsed;
+    while ((parsed = Http::parseResponseHead(s.upstreamInput.data(), s.upstreamInput.size(), response)) ==
+           ParseResult::Incomplete) {
+        IoResult more = co_await withTimeout(s.loop, s.budgetMs(s.config.getRequestTimeout()),
+                                             upstream.read(&s.chunk[0], s.chunk.size()));
+        if (more.timedOut) {
+            Failure failure = deadlineFailure(s);
+            co_await sendError(s, failure.statusCode, failure.body);
+            co_return 0;
+        }
+        if (!more.ok() || more.bytes == 0) {
+            s.logger.error("Backend " + s.backendUrl + " closed connection mid response head");
+            co_await sendError(s, 502, "Bad Gateway - truncated backend response");
+            co_return 0;
+        }
+        s.upstreamInput.append(s.chunk.data(), static_cast<size_t>(more.bytes));
+    }
+    if (parsed == ParseResult::Invalid) {
+        s.logger.error("Invalid response from backend " + s.backendUrl);
+        co_await sendError(s, 502, "Bad Gateway - invalid backend response");
+        co_return 0;
+    }
+    if (response.statusCode == 101) {
+        if (!s.request.isUpgrade()) {
+            s.logger.error("Unexpected protocol switch from backend " + s.backendUrl);
+            co_await sendError(s, 502, "Bad Gateway - invalid backend response");
+            co_return 0;
+        }
+        // The request body went out whole before the response was read
+        upgradeToTunnel(s, upstream, response);
+        co_return 0;
+    }
+
+    BodyDecoder body;
+    std::string output;
+    output.reserve(response.headLength + 64);
+    bool chunked = s.startResponse(response, body, output);
+    const char* data = s.upstreamInput.data() + response.headLength;
+    size_t length = s.upstreamInput.size() - response.headLength;
+
+    // The write completing is the backpressure: a slow client slows the reads
+    while (true) {
+        if (!s.decodeResponseBody(body, chunked, data, length, output)) {
+            s.recordRequestEnd(0);
+            co_return 0;
+        }
+        if (!output.empty() && !co_await writeClient(s, output.data(), output.size())) {
+            s.recordRequestEnd(0);
+            co_return 0;
+        }
+        output.clear();
+        if (body.isComplete()) break;
+
+        IoResult more = co_await withTimeout(s.loop, s.budgetMs(s.config.getRequestTimeout()),
+                                             upstream.read(&s.chunk[0], s.chunk.size()));
+        if (more.timedOut) {
+            deadlineFailure(s);
+            s.recordRequestEnd(0);
+            co_return 0;
+        }
+        if (!more.ok()) {
+            s.logger.error("Failed to read response from backend " + s.backendUrl);
+            s.recordRequestEnd(0);
+            co_return 0;
+        }
+        if (more.bytes == 0) {
+            s.endResponseAtEof(body, chunked, output);
+            if (!output.empty() && !co_await writeClient(s, output.data(), output.size())) {
+                s.recordRequestEnd(0);
+                co_return 0;
+            }
+            break;
+        }
+        data = s.chunk.data();
+        length = static_cast<size_t>(more.bytes);
+    }
+    s.upstreamInput.clear();
+    co_return response.statusCode;
+}
+
+// select -> proxy; returns the status sent, or 0 when the client must go
+Task<int> forwardToBackend(Session& s) {
+    AdmissionController& admission = s.server.getAdmission();
+    RetryController& retries = s.server.getRetryControl();
+    MetricsShard& metrics = s.worker.getMetrics();
+
+    // No wait queue here: a saturated limiter answers at once
+    if (admission.isEnabled()) {
+        if (!admission.getGlobalLimiter().tryAcquire()) {
+            s.logger.warning("Overloaded, rejecting " + s.request.method + " " + s.request.path + " from " + s.clientIP);
+            co_await sendError(s, 503, "Service Unavailable - overloaded");
+            co_return 0;
+        }
+        s.globalAdmitted = true;
+    }
+    Exchange::Selection selection = s.selectBackend(s.attempt.backend, s.attempt.limiter);
+    if (selection != Exchange::Selection::Selected) {
+        s.releaseAdmission(false, false);
+    }
+    if (selection == Exchange::Selection::Saturated) {
+        s.logger.warning("Overloaded, rejecting " + s.request.method + " " + s.request.path + " from " + s.clientIP);
+        co_await sendError(s, 503, "Service Unavailable - overloaded");
+        co_return 0;
+    }
+    if (selection == Exchange::Selection::NoBackend) {
+        s.logger.error("No healthy backend servers available");
+        co_await sendError(s, 503, "Service Unavailable - No backend servers");
+        co_return 0;
+    }
+    if (s.globalAdmitted) {
+        admission.getStats().admitted.fetch_add(1, std::memory_order_relaxed);
+    }
+    s.trace.mark(TraceMark::Admitted);
+    PROXY_PROBE1(request_admitted, &s);
+    retries.onRequest();
+
+    std::string output;
+    s.appendUpstreamRequest(output);
+
+    AsyncSocket upstream(s.loop);
+    Failure failure;
+    while (!co_await startAttempt(s, output, upstream, failure)) {
+        if (failure.clientSide) {
+            s.adoptAttemptTrace();
+            s.releaseAttempt(false, false);
+            if (failure.statusCode == 0) co_return 0;
+            co_await sendError(s, failure.statusCode, failure.body);
+            co_return 0;
+        }
+
+        const BackendServer* failedBackend = s.attempt.backend;
+        std::string failedUrl = s.attempt.url;
+        metrics.recordUpstreamFailure(s.server.getLoadBalancer().indexOf(failedBackend));
+        s.adoptAttemptTrace();
+        s.releaseAttempt(true, true);
+        upstream.close();
+
+        if (s.retryAfterFailure(failure.retryable, failedBackend, nullptr, failedUrl, s.attempt.backend,
+                                s.attempt.limiter)) {
+            continue;
+        }
+        co_await sendError(s, failure.statusCode, failure.body);
+        co_return 0;
+    }
+
+    Attempt& attempt = s.attempt;
+    attempt.latencyUs = EventLoop::monotonicUs() - attempt.startUs;
+    s.adoptAttemptTrace();
+    s.recordFirstByte(attempt.backend, attempt.url, attempt.latencyUs);
+
+    int statusCode = co_await relayResponse(s, upstream);
+    if (statusCode == 0) co_return 0;
+
+    s.recordRequestEnd(statusCode);
+    s.releaseAttempt(true, false);
+    s.releaseAdmission(true, false);
+    s.logger.info("Backend " + s.backendUrl + " processed request successfully");
+    co_return statusCode;
+}
+
+// Static route: head and short bodies with one write, a file body with sendfile()
+Task<int> serveStatic(Session& s) {
+    s.trace.mark(TraceMark::Admitted);
+    StaticResponse response;
+    s.server.getStaticFiles().respond(*s.route, s.request, response);
+    int statusCode = response.head.statusCode;
+    // Unread body bytes cannot be told apart from the next request
+    if (!s.requestDecoder.isComplete()) s.keepAlive = false;
+
+    std::string head;
+    Http::appendClientResponseHead(response.head, s.keepAlive, false, head);
+    head += response.body;
+    s.trace.mark(TraceMark::FirstResponseByte);
+    if (!co_await writeClient(s, head.data(), head.size())) co_return 0;
+    if (response.length > 0) {
+        IoResult sent = co_await withTimeout(s.loop, s.budgetMs(s.config.getRequestTimeout()),
+                                             s.client.sendFile(*response.file, response.offset, response.length));
+        if (sent.bytes > 0) {
+            s.worker.getMetrics().add(Counter::ResponseBytes, static_cast<uint64_t>(sent.bytes));
+        }
+        if (!sent.ok()) {
+            s.logger.warning("Failed to send static file to client " + s.clientIP);
+            co_return 0;
+        }
+    }
+
+    s.recordRequestEnd(statusCode);
+    co_return statusCode;
+}
+
+} // namespace
+
+namespace RequestPipeline {
+
+Task<void> serve(Worker& worker, SOCKET clientSocket) {
+    Session s(worker, clientSocket);
+    TimeoutCounters& counters = s.server.getTimeoutCounters();
+    bool idle = false;   // between keep-alive requests
+
+    while (true) {
+        // Parse: wait for a complete request head
+        if (!s.requestBuffer.empty() && s.requestStartUs == 0) {
+            s.startClock();   // pipelined request already buffered
+        }
+        Exchange::HeadStatus head;
+        while ((head = s.parseRequestHead()) == Exchange::HeadStatus::Incomplete) {
+            bool waitingIdle = idle && s.requestBuffer.empty();
+            int waitMs = waitingIdle ? s.config.getIdleKeepAliveTimeout() : s.config.getClientHeaderTimeout();
+            if (waitingIdle) {
+                // Hot restart: a short grace once draining; waits already under
+                // way are ended by Worker::closeIdleClients
+                if (s.server.isDraining()) waitMs = std::min(waitMs, static_cast<int>(Worker::kDrainIdleGraceMs));
+                s.worker.watchIdle(s.client);
+            }
+            ReadStatus status = co_await readClient(s, waitMs);
+            if (waitingIdle) s.worker.unwatchIdle(s.client);
+            if (status == ReadStatus::TimedOut) {
+                if (waitingIdle) {
+                    counters.idleKeepAlive.fetch_add(1, std::memory_order_relaxed);
+                    s.logger.debug("Idle keep-alive timeout for " + s.clientIP);
+                    co_return;
+                }
+                if (s.deadlinePassed()) {
+                    s.countDeadline();
+                } else {
+                    counters.clientHeader.fetch_add(1, std::memory_order_relaxed);
+                    s.logger.warning("Client header timeout for " + s.clientIP);
+                }
+                co_await sendError(s, 408, "Request Timeout");
+                co_return;
+            }
+            if (status != ReadStatus::Data) co_return;
+        }
+        if (head == Exchange::HeadStatus::Http2Preface) {
+            s.requestStartUs = 0;
+            s.upgraded = true;
+            s.worker.adoptSession(new Http2Session(s.worker, s.client.release(), nullptr, std::move(s.requestBuffer)));
+            co_return;
+        }
+        if (head == Exchange::HeadStatus::Invalid) {
+            co_await sendError(s, 400, "Bad Request");
+            co_return;
+        }
+
+        uint32_t retryAfterSeconds = 0;
+        if (!s.checkRateLimit(retryAfterSeconds)) {
+            co_await sendError(s, 429, "Too Many Requests", "Retry-After: " + std::to_string(retryAfterSeconds) + "\r\n");
+            co_return;
+        }
+
+        // A body larger than the buffer is streamed once a backend is connected
+        s.startRequestBody();
+        bool invalidBody = !s.decodeRequestBody();
+        if (!invalidBody && s.wantsContinue()) {
+            if (!co_await writeClient(s, Exchange::kContinue, sizeof(Exchange::kContinue) - 1)) co_return;
+        }
+        while (!invalidBody && !s.requestBodyReady()) {
+            ReadStatus status = co_await readClient(s, s.config.getClientHeaderTimeout());
+            if (status == ReadStatus::TimedOut) {
+                if (s.deadlinePassed()) s.countDeadline();
+                co_await sendError(s, 408, "Request Timeout");
+                co_return;
+            }
+            if (status != ReadStatus::Data) co_return;
+            invalidBody = !s.decodeRequestBody();
+        }
+        if (invalidBody) {
+            co_await sendError(s, 400, "Bad Request");
+            co_return;
+        }
+
+        s.onRequestRead();
+        int statusCode = s.route != nullptr && s.route->config.isStatic() ? co_await serveStatic(s)
+                                                                            : co_await forwardToBackend(s);
+        if (statusCode == 0 || !s.keepAlive) co_return;
+
+        s.resetRequest();
+        s.attempt = Attempt();
+        idle = true;
+    }
+}
+
+} // namespace RequestPipeline
+
+#endif // PROXY_HAS_COROUTINES
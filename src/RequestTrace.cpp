@@ -0,0 +1,170 @@
+#include "RequestTrace.h"
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <iomanip>
+#include <sstream>
+#include <thread>
+#include <type_traits>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+static_assert(std::is_trivially_copyable<SlowRequest>::value, "SlowRequest is copied as raw words");
+static_assert(sizeof(SlowRequest) % sizeof(uint64_t) == 0, "SlowRequest must be a whole number of words");
+
+bool Tsc::invariant = false;
+double Tsc::usPerTick = 0.001;   // steady_clock nanoseconds until calibrated
+
+namespace {
+
+bool hasInvariantTsc() {
+#if defined(_MSC_VER) && defined(_M_X64)
+    int info[4];
+    __cpuid(info, 0x80000000);
+    if (static_cast<unsigned>(info[0]) < 0x80000007u) return false;
+    __cpuid(info, 0x80000007);
+    return (info[3] & (1 << 8)) != 0;
+#elif defined(__x86_64__) || defined(__i386__)
+    unsigned eax = 0, ebx = 0, ecx = 0, edx = 0;
+    if (__get_cpuid_max(0x80000000u, nullptr) < 0x80000007u ||
+        !__get_cpuid(0x80000007u, &eax, &ebx, &ecx, &edx)) {
+        return false;
+    }
+    return (edx & (1u << 8)) != 0;
+#else
+    return false;
+#endif
+}
+
+const char* const kPhaseNames[RequestTrace::kPhases] = {
+    "accept", "header_read", "body_read", "admission", "backend_select",
+    "connect", "send", "backend", "response_write"
+};
+
+} // namespace
+
+void Tsc::calibrate() {
+    if (!hasInvariantTsc()) return;
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64)
+    auto wallStart = std::chrono::steady_clock::now();
+    uint64_t ticksStart = __rdtsc();
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    auto wallEnd = std::chrono::steady_clock::now();
+    uint64_t ticksEnd = __rdtsc();
+
+    double elapsedUs = std::chrono::duration<double, std::micro>(wallEnd - wallStart).count();
+    if (ticksEnd <= ticksStart || elapsedUs <= 0.0) return;
+    usPerTick = elapsedUs / static_cast<double>(ticksEnd - ticksStart);
+    invariant = true;
+#endif
+}
+
+void RequestTrace::phaseDurations(uint32_t (&phaseUs)[kPhases]) const {
+    for (int phase = 0; phase < kPhases; phase++) {
+        phaseUs[phase] = 0;
+        if (marks[phase] == 0) continue;
+
+        for (int next = phase + 1; next < kMarks; next++) {
+            if (marks[next] == 0) continue;
+            uint64_t ticks = marks[next] > marks[phase] ? marks[next] - marks[phase] : 0;
+            phaseUs[phase] = static_cast<uint32_t>(std::min<uint64_t>(Tsc::toUs(ticks), UINT32_MAX));
+            break;
+        }
+    }
+}
+
+const char* RequestTrace::phaseName(int phase) {
+    return phase >= 0 && phase < kPhases ? kPhaseNames[phase] : "unknown";
+}
+
+void SlowRequest::copyString(char* target, size_t size, const std::string& value) {
+    size_t length = std::min(value.size(), size - 1);
+    memcpy(target, value.data(), length);
+    memset(target + length, 0, size - length);
+}
+
+SlowRequestLog::SlowRequestLog(size_t capacity, uint64_t threshold)
+    : thresholdUs(threshold) {
+    size_t size = 1;
+    while (size < capacity) size <<= 1;
+    slots.reset(new Slot[size]);
+    mask = size - 1;
+}
+
+void SlowRequestLog::record(SlowRequest& entry) {
+    entry.sequence = head.fetch_add(1, std::memory_order_relaxed);
+    Slot& slot = slots[entry.sequence & mask];
+
+    // A writer a full lap ahead still owns this slot: drop rather than wait
+    uint64_t version = slot.version.load(std::memory_order_relaxed);
+    if ((version & 1) != 0 ||
+        !slot.version.compare_exchange_strong(version, version + 1, std::memory_order_relaxed)) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+
+    uint64_t words[kWords];
+    memcpy(words, &entry, sizeof(entry));
+    for (size_t i = 0; i < kWords; i++) {
+        slot.words[i].store(words[i], std::memory_order_relaxed);
+    }
+    slot.version.store(version + 2, std::memory_order_release);
+}
+
+std::vector<SlowRequest> SlowRequestLog::snapshot() const {
+    std::vector<SlowRequest> entries;
+    uint64_t recorded = head.load(std::memory_order_acquire);
+    size_t retained = static_cast<size_t>(std::min<uint64_t>(recorded, mask + 1));
+    entries.reserve(retained);
+
+    for (size_t s = 0; s <= mask; s++) {
+        const Slot& slot = slots[s];
+        uint64_t before = slot.version.load(std::memory_order_acquire);
+        if (before == 0 || (before & 1) != 0) continue;
+
+        uint64_t words[kWords];
+        for (size_t i = 0; i < kWords; i++) {
+            words[i] = slot.words[i].load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.version.load(std::memory_order_relaxed) != before) continue;   // torn copy
+
+        SlowRequest entry;
+        memcpy(&entry, words, sizeof(entry));
+        entries.push_back(entry);
+    }
+
+    std::sort(entries.begin(), entries.end(),
+              [](const SlowRequest& a, const SlowRequest& b) { return a.sequence < b.sequence; });
+    return entries;
+}
+
+std::string SlowRequestLog::render() const {
+    std::vector<SlowRequest> entries = snapshot();
+
+    std::ostringstream out;
+    out << "# " << entries.size() << " slow requests (>= " << thresholdUs / 1000 << "ms; "
+        << getRecorded() << " recorded, " << getDropped() << " dropped); phases in microseconds\n";
+    for (const SlowRequest& entry : entries) {
+        std::time_t seconds = static_cast<std::time_t>(entry.finishedAtMs / 1000);
+        out << std::put_time(std::localtime(&seconds), "%Y-%m-%d %H:%M:%S") << "."
+            << std::setfill('0') << std::setw(3) << entry.finishedAtMs % 1000 << std::setfill(' ')
+            << " worker=" << entry.worker << " " << entry.method << " " << entry.path
+            << " status=" << entry.status
+            << " backend=" << (entry.backend[0] != '\0' ? entry.backend : "-")
+            << " client=" << entry.client
+            << " retries=" << static_cast<int>(entry.retries)
+            << " hedged=" << static_cast<int>(entry.hedged)
+            << " total=" << entry.totalUs;
+        for (int phase = 0; phase < RequestTrace::kPhases; phase++) {
+            out << " " << RequestTrace::phaseName(phase) << "=" << entry.phaseUs[phase];
+        }
+        out << "\n";
+    }
+    return out.str();
+}
@@ -0,0 +1,239 @@
+#include "Resolver.h"
+#include "Logger.h"
+#include "LoadBalancer.h"
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <iostream>
+
+namespace {
+
+uint64_t nowMs() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+bool sameAddress(const SocketAddress& a, const SocketAddress& b) {
+    return a.length == b.length && memcmp(&a.storage, &b.storage, a.length) == 0;
+}
+
+bool sameAddresses(const std::vector<SocketAddress>& a, const std::vector<SocketAddress>& b) {
+    return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), sameAddress);
+}
+
+std::string formatList(const std::vector<SocketAddress>& addresses) {
+    std::string list;
+    for (const SocketAddress& address : addresses) {
+        if (!list.empty()) list += ", ";
+        list += Resolver::format(address);
+    }
+    return list;
+}
+
+} // namespace
+
+Resolver::Resolver(Logger& log) : logger(log), stopping(false) {
+}
+
+Resolver::~Resolver() {
+    stop();
+}
+
+void Resolver::configure(const Config& serverConfig, const LoadBalancer& loadBalancer) {
+    stop();
+    config = serverConfig.getResolver();
+    entries.clear();
+    for (size_t i = 0; i < loadBalancer.getBackendCount(); i++) {
+        const BackendServer* backend = loadBalancer.getBackend(i);
+        std::unique_ptr<Entry> entry(new Entry());
+        entry->host = backend->host;
+        entry->port = backend->port;
+        entry->nextRefreshMs = 0;
+        entry->failing = false;
+        SocketAddress address;
+        entry->numeric = parseNumeric(backend->host, backend->port, address);
+        if (entry->numeric) {
+            entry->addresses.push_back(address);
+        }
+        entries.push_back(std::move(entry));
+    }
+}
+
+void Resolver::start() {
+    bool hostnames = false;
+    for (const auto& entry : entries) {
+        if (entry->numeric) continue;
+        hostnames = true;
+        resolve(*entry);
+    }
+    if (!hostnames) return;
+
+    stopping = false;
+    thread = std::thread(&Resolver::run, this);
+}
+
+void Resolver::stop() {
+    {
+        std::lock_guard<std::mutex> lock(wakeMutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+void Resolver::run() {
+    std::unique_lock<std::mutex> lock(wakeMutex);
+    while (!stopping) {
+        uint64_t nextMs = UINT64_MAX;
+        for (const auto& entry : entries) {
+            if (entry->numeric) continue;
+            if (entry->nextRefreshMs <= nowMs()) {
+                // getaddrinfo may take seconds; stop() must not wait on the lock meanwhile
+                lock.unlock();
+                resolve(*entry);
+                lock.lock();
+                if (stopping) return;
+            }
+            nextMs = std::min(nextMs, entry->nextRefreshMs);
+        }
+        uint64_t now = nowMs();
+        if (nextMs > now) {
+            wake.wait_for(lock, std::chrono::milliseconds(nextMs - now));
+        }
+    }
+}
+
+bool Resolver::resolve(Entry& entry) {
+    addrinfo hints{};
+    hints.ai_family = config.family == "ipv4" ? AF_INET : config.family == "ipv6" ? AF_INET6 : AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    std::string port = std::to_string(entry.port);
+    addrinfo* result = nullptr;
+    int status = getaddrinfo(entry.host.c_str(), port.c_str(), &hints, &result);
+
+    std::vector<SocketAddress> addresses;
+    for (addrinfo* info = result; status == 0 && info != nullptr; info = info->ai_next) {
+        if ((info->ai_family != AF_INET && info->ai_family != AF_INET6) ||
+            info->ai_addrlen > sizeof(sockaddr_storage)) {
+            continue;
+        }
+        SocketAddress address;
+        memcpy(&address.storage, info->ai_addr, info->ai_addrlen);
+        address.length = static_cast<socklen_t>(info->ai_addrlen);
+        // The same record comes back once per protocol on some systems
+        bool duplicate = std::any_of(addresses.begin(), addresses.end(),
+                                     [&address](const SocketAddress& seen) { return sameAddress(seen, address); });
+        if (!duplicate) {
+            addresses.push_back(address);
+        }
+    }
+    if (result != nullptr) {
+        freeaddrinfo(result);
+    }
+
+    if (addresses.empty()) {
+        failures.fetch_add(1, std::memory_order_relaxed);
+        entry.nextRefreshMs = nowMs() + static_cast<uint64_t>(config.retryS) * 1000;
+        std::lock_guard<std::mutex> lock(entry.mutex);
+        std::string message = "Failed to resolve backend " + entry.host + ": " +
+                              (status != 0 ? std::string(gai_strerror(status)) : std::string("no usable address")) +
+                              (entry.addresses.empty() ? "" : "; keeping " + formatList(entry.addresses));
+        // Once per outage; the retries after it only at debug level
+        if (entry.failing) {
+            logger.debug(message);
+        } else {
+            logger.warning(message);
+        }
+        entry.failing = true;
+        return false;
+    }
+    entry.nextRefreshMs = nowMs() + static_cast<uint64_t>(config.refreshS) * 1000;
+    entry.failing = false;
+
+    std::lock_guard<std::mutex> lock(entry.mutex);
+    if (!sameAddresses(entry.addresses, addresses)) {
+        logger.info("Backend " + entry.host + (entry.addresses.empty() ? " resolves to " : " now resolves to ") +
+                    formatList(addresses));
+    }
+    entry.addresses.swap(addresses);
+    return true;
+}
+
+bool Resolver::lookup(size_t backend, SocketAddress& address) const {
+    if (backend >= entries.size()) return false;
+    const Entry& entry = *entries[backend];
+    // Numeric hosts never change after configure
+    if (entry.numeric) {
+        address = entry.addresses.front();
+        return true;
+    }
+    std::lock_guard<std::mutex> lock(entry.mutex);
+    if (entry.addresses.empty()) return false;
+    size_t next = entry.nextAddress.fetch_add(1, std::memory_order_relaxed);
+    address = entry.addresses[next % entry.addresses.size()];
+    return true;
+}
+
+size_t Resolver::getAddressCount(size_t backend) const {
+    if (backend >= entries.size()) return 0;
+    std::lock_guard<std::mutex> lock(entries[backend]->mutex);
+    return entries[backend]->addresses.size();
+}
+
+void Resolver::printStatus() const {
+    bool hostnames = std::any_of(entries.begin(), entries.end(),
+                                 [](const std::unique_ptr<Entry>& entry) { return !entry->numeric; });
+    if (!hostnames) return;
+
+    std::cout << "\n=== Resolver Status ===" << std::endl;
+    std::cout << "Refresh: every " << config.refreshS << "s, after failures every " << config.retryS << "s ("
+              << config.family << ")" << std::endl;
+    for (const auto& entry : entries) {
+        if (entry->numeric) continue;
+        std::lock_guard<std::mutex> lock(entry->mutex);
+        std::cout << "  " << entry->host << ":" << entry->port << " -> "
+                  << (entry->addresses.empty() ? "unresolved" : formatList(entry->addresses)) << std::endl;
+    }
+    std::cout << "=======================\n" << std::endl;
+}
+
+bool Resolver::parseNumeric(const std::string& host, int port, SocketAddress& address) {
+    address = SocketAddress();
+    uint16_t networkPort = htons(static_cast<uint16_t>(port));
+    sockaddr_in* v4 = reinterpret_cast<sockaddr_in*>(&address.storage);
+    if (inet_pton(AF_INET, host.c_str(), &v4->sin_addr) == 1) {
+        v4->sin_family = AF_INET;
+        v4->sin_port = networkPort;
+        address.length = sizeof(sockaddr_in);
+        return true;
+    }
+    // "[::1]" as well as "::1"
+    std::string bare = host.size() > 2 && host.front() == '[' && host.back() == ']'
+                           ? host.substr(1, host.size() - 2) : host;
+    sockaddr_in6* v6 = reinterpret_cast<sockaddr_in6*>(&address.storage);
+    if (inet_pton(AF_INET6, bare.c_str(), &v6->sin6_addr) == 1) {
+        v6->sin6_family = AF_INET6;
+        v6->sin6_port = networkPort;
+        address.length = sizeof(sockaddr_in6);
+        return true;
+    }
+    return false;
+}
+
+std::string Resolver::format(const SocketAddress& address) {
+    char text[INET6_ADDRSTRLEN] = "";
+    if (address.family() == AF_INET) {
+        const sockaddr_in* v4 = reinterpret_cast<const sockaddr_in*>(&address.storage);
+        inet_ntop(AF_INET, &v4->sin_addr, text, sizeof(text));
+        return std::string(text) + ":" + std::to_string(ntohs(v4->sin_port));
+    }
+    if (address.family() == AF_INET6) {
+        const sockaddr_in6* v6 = reinterpret_cast<const sockaddr_in6*>(&address.storage);
+        inet_ntop(AF_INET6, &v6->sin6_addr, text, sizeof(text));
+        return std::string("[") + text + "]:" + std::to_string(ntohs(v6->sin6_port));
+    }
+    return "?";
+}
@@ -0,0 +1,287 @@
+#include "ResponseWriter.h"
+#include <cstring>
+#include <ctime>
+
+namespace {
+
+#define STATUS_LINE(code, text) "HTTP/1.1 " #code " " text "\r\n"
+
+const char kStatus200[] = STATUS_LINE(200, "OK");
+const char kStatus206[] = STATUS_LINE(206, "Partial Content");
+const char kStatus301[] = STATUS_LINE(301, "Moved Permanently");
+const char kStatus304[] = STATUS_LINE(304, "Not Modified");
+const char kStatus400[] = STATUS_LINE(400, "Bad Request");
+const char kStatus403[] = STATUS_LINE(403, "Forbidden");
+const char kStatus404[] = STATUS_LINE(404, "Not Found");
+const char kStatus405[] = STATUS_LINE(405, "Method Not Allowed");
+const char kStatus408[] = STATUS_LINE(408, "Request Timeout");
+const char kStatus411[] = STATUS_LINE(411, "Length Required");
+const char kStatus413[] = STATUS_LINE(413, "Payload Too Large");
+const char kStatus416[] = STATUS_LINE(416, "Range Not Satisfiable");
+const char kStatus429[] = STATUS_LINE(429, "Too Many Requests");
+const char kStatus500[] = STATUS_LINE(500, "Internal Server Error");
+const char kStatus502[] = STATUS_LINE(502, "Bad Gateway");
+const char kStatus503[] = STATUS_LINE(503, "Service Unavailable");
+const char kStatus504[] = STATUS_LINE(504, "Gateway Timeout");
+
+#undef STATUS_LINE
+
+const char kCommonHeaders[] =
+    "Content-Type: application/json\r\n"
+    "Connection: close\r\n"
+    "Server: ReverseProxy/1.0\r\n";
+
+const char kContentLengthPrefix[] = "Content-Length: ";
+const char kUnknownPrefix[] = "HTTP/1.1 ";
+const char kUnknownSuffix[] = " Unknown\r\n";
+
+// Worst case of each part written into Frame::scratch
+constexpr size_t kMaxUnknownStatusLine = sizeof(kUnknownPrefix) - 1 + 3 + sizeof(kUnknownSuffix) - 1;
+constexpr size_t kMaxDynamicHeaders = sizeof(kContentLengthPrefix) - 1 + 20 + 2 +
+                                      sizeof("Date: Sun, 06 Nov 1994 08:49:37 GMT\r\n") - 1 + 2;
+static_assert(kMaxUnknownStatusLine + kMaxDynamicHeaders <= ResponseWriter::kScratchSize,
+              "Frame::scratch cannot hold an unknown status line and the dynamic headers");
+
+// "Date: Sun, 06 Nov 1994 08:49:37 GMT\r\n" re-rendered at most once per second
+struct DateCache {
+    time_t second = 0;
+    char text[48];
+    size_t length = 0;
+};
+
+thread_local DateCache dateCache;
+
+const DateCache& currentDate() {
+    time_t now = time(nullptr);
+    if (now != dateCache.second || dateCache.length == 0) {
+        struct tm gmt;
+#ifdef _WIN32
+        gmtime_s(&gmt, &now);
+#else
+        gmtime_r(&now, &gmt);
+#endif
+        dateCache.length = strftime(dateCache.text, sizeof(dateCache.text),
+                                    "Date: %a, %d %b %Y %H:%M:%S GMT\r\n", &gmt);
+        dateCache.second = now;
+    }
+    return dateCache;
+}
+
+size_t formatDecimal(char* out, size_t value) {
+    char digits[20];
+    size_t count = 0;
+    do {
+        digits[count++] = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+
+    for (size_t i = 0; i < count; i++) {
+        out[i] = digits[count - 1 - i];
+    }
+    return count;
+}
+
+} // namespace
+
+const char* ResponseWriter::statusText(int statusCode) {
+    switch (statusCode) {
+        case 200: return "OK";
+        case 206: return "Partial Content";
+        case 301: return "Moved Permanently";
+        case 304: return "Not Modified";
+        case 400: return "Bad Request";
+        case 403: return "Forbidden";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 408: return "Request Timeout";
+        case 411: return "Length Required";
+        case 413: return "Payload Too Large";
+        case 416: return "Range Not Satisfiable";
+        case 429: return "Too Many Requests";
+        case 500: return "Internal Server Error";
+        case 502: return "Bad Gateway";
+        case 503: return "Service Unavailable";
+        case 504: return "Gateway Timeout";
+        default: return "Unknown";
+    }
+}
+
+ResponseWriter::Slice ResponseWriter::statusLine(int statusCode) {
+    switch (statusCode) {
+        case 200: return {kStatus200, sizeof(kStatus200) - 1};
+        case 206: return {kStatus206, sizeof(kStatus206) - 1};
+        case 301: return {kStatus301, sizeof(kStatus301) - 1};
+        case 304: return {kStatus304, sizeof(kStatus304) - 1};
+        case 400: return {kStatus400, sizeof(kStatus400) - 1};
+        case 403: return {kStatus403, sizeof(kStatus403) - 1};
+        case 404: return {kStatus404, sizeof(kStatus404) - 1};
+        case 405: return {kStatus405, sizeof(kStatus405) - 1};
+        case 408: return {kStatus408, sizeof(kStatus408) - 1};
+        case 411: return {kStatus411, sizeof(kStatus411) - 1};
+        case 413: return {kStatus413, sizeof(kStatus413) - 1};
+        case 416: return {kStatus416, sizeof(kStatus416) - 1};
+        case 429: return {kStatus429, sizeof(kStatus429) - 1};
+        case 500: return {kStatus500, sizeof(kStatus500) - 1};
+        case 502: return {kStatus502, sizeof(kStatus502) - 1};
+        case 503: return {kStatus503, sizeof(kStatus503) - 1};
+        case 504: return {kStatus504, sizeof(kStatus504) - 1};
+        default: return {nullptr, 0};
+    }
+}
+
+size_t ResponseWriter::formatDynamicHeaders(char* buffer, size_t contentLength) {
+    char* out = buffer;
+
+    memcpy(out, kContentLengthPrefix, sizeof(kContentLengthPrefix) - 1);
+    out += sizeof(kContentLengthPrefix) - 1;
+    out += formatDecimal(out, contentLength);
+    *out++ = '\r';
+    *out++ = '\n';
+
+    const DateCache& date = currentDate();
+    memcpy(out, date.text, date.length);
+    out += date.length;
+
+    *out++ = '\r';
+    *out++ = '\n';
+    return static_cast<size_t>(out - buffer);
+}
+
+void ResponseWriter::build(Frame& frame, int statusCode, const char* body, size_t bodyLength,
+                           const char* extraHeaders, size_t extraHeadersLength) {
+    frame.count = 0;
+    frame.totalLength = 0;
+
+    // A status code has three digits; anything else is our bug, answered as 500
+    if (statusCode < 100 || statusCode > 999) {
+        statusCode = 500;
+    }
+
+    size_t scratchUsed = 0;
+    Slice status = statusLine(statusCode);
+    if (status.data == nullptr) {
+        // Codes statusText() does not know are rendered on the fly, within kMaxUnknownStatusLine
+        char* out = frame.scratch;
+        memcpy(out, kUnknownPrefix, sizeof(kUnknownPrefix) - 1);
+        out += sizeof(kUnknownPrefix) - 1;
+        out += formatDecimal(out, static_cast<size_t>(statusCode));
+        memcpy(out, kUnknownSuffix, sizeof(kUnknownSuffix) - 1);
+        out += sizeof(kUnknownSuffix) - 1;
+        scratchUsed = static_cast<size_t>(out - frame.scratch);
+        status = {frame.scratch, scratchUsed};
+    }
+
+    size_t dynamicLength = formatDynamicHeaders(frame.scratch + scratchUsed, bodyLength);
+
+    frame.slices[frame.count++] = status;
+    frame.slices[frame.count++] = {kCommonHeaders, sizeof(kCommonHeaders) - 1};
+    if (extraHeadersLength > 0) {
+        frame.slices[frame.count++] = {extraHeaders, extraHeadersLength};
+    }
+    frame.slices[frame.count++] = {frame.scratch + scratchUsed, dynamicLength};
+    if (bodyLength > 0) {
+        frame.slices[frame.count++] = {body, bodyLength};
+    }
+
+    for (size_t i = 0; i < frame.count; i++) {
+        frame.totalLength += frame.slices[i].length;
+    }
+}
+
+bool ResponseWriter::send(SOCKET socket, int statusCode, const std::string& body) {
+    Frame frame;
+    build(frame, statusCode, body.data(), body.length());
+    return writeFrame(socket, frame);
+}
+
+std::string ResponseWriter::render(int statusCode, const std::string& body) {
+    Frame frame;
+    build(frame, statusCode, body.data(), body.length());
+
+    std::string out;
+    out.reserve(frame.totalLength);
+    for (size_t i = 0; i < frame.count; i++) {
+        out.append(frame.slices[i].data, frame.slices[i].length);
+    }
+    return out;
+}
+
+long ResponseWriter::gatherWrite(SOCKET socket, const Frame& frame) {
+#ifdef _WIN32
+    WSABUF buffers[kMaxSlices];
+    DWORD bufferCount = 0;
+    for (size_t i = 0; i < frame.count; i++) {
+        buffers[bufferCount].buf = const_cast<char*>(frame.slices[i].data);
+        buffers[bufferCount].len = static_cast<ULONG>(frame.slices[i].length);
+        bufferCount++;
+    }
+    DWORD sentBytes = 0;
+    if (WSASend(socket, buffers, bufferCount, &sentBytes, 0, nullptr, nullptr) != 0) {
+        return -1;
+    }
+    return static_cast<long>(sentBytes);
+#else
+    struct iovec iov[kMaxSlices];
+    size_t iovCount = 0;
+    for (size_t i = 0; i < frame.count; i++) {
+        iov[iovCount].iov_base = const_cast<char*>(frame.slices[i].data);
+        iov[iovCount].iov_len = frame.slices[i].length;
+        iovCount++;
+    }
+    struct msghdr message{};
+    message.msg_iov = iov;
+    message.msg_iovlen = iovCount;
+
+    return static_cast<long>(sendmsg(socket, &message, MSG_NOSIGNAL));
+#endif
+}
+
+void ResponseWriter::advance(Frame& frame, size_t sent) {
+    frame.totalLength -= sent;
+
+    // Drop fully written slices and trim the partially written one
+    size_t first = 0;
+    while (sent > 0 && first < frame.count) {
+        if (sent >= frame.slices[first].length) {
+            sent -= frame.slices[first].length;
+            first++;
+        } else {
+            frame.slices[first].data += sent;
+            frame.slices[first].length -= sent;
+            sent = 0;
+        }
+    }
+
+    if (first > 0) {
+        for (size_t i = first; i < frame.count; i++) {
+            frame.slices[i - first] = frame.slices[i];
+        }
+        frame.count -= first;
+    }
+}
+
+bool ResponseWriter::writeFrame(SOCKET socket, Frame& frame) {
+    while (frame.totalLength > 0) {
+        long result = gatherWrite(socket, frame);
+        if (result < 0) {
+            if (isInterrupted(lastSocketError())) continue;
+            return false;
+        }
+        advance(frame, static_cast<size_t>(result));
+    }
+    return true;
+}
+
+bool ResponseWriter::writeSome(SOCKET socket, Frame& frame) {
+    while (frame.totalLength > 0) {
+        long result = gatherWrite(socket, frame);
+        if (result < 0) {
+            int error = lastSocketError();
+            if (isInterrupted(error)) continue;
+            return isWouldBlock(error);
+        }
+        advance(frame, static_cast<size_t>(result));
+        if (result == 0) break;
+    }
+    return true;
+}
@@ -0,0 +1,181 @@
+#include "RetryControl.h"
+#include "Config.h"
+#include "LoadBalancer.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+RetryBudget::RetryBudget(double ratio, int minPerSecond)
+    : depositPerRequest(static_cast<int64_t>(std::llround(std::max(0.0, ratio) * kToken))),
+      floorPerSecond(static_cast<int64_t>(std::max(0, minPerSecond)) * kToken),
+      maxBalance(std::max<int64_t>(10 * kToken, floorPerSecond * 10)),
+      balance(floorPerSecond),
+      lastRefillMs(0) {
+}
+
+void RetryBudget::onRequest() {
+    int64_t current = balance.load(std::memory_order_relaxed);
+    while (current < maxBalance) {
+        int64_t next = std::min(maxBalance, current + depositPerRequest);
+        if (balance.compare_exchange_weak(current, next, std::memory_order_relaxed)) {
+            break;
+        }
+    }
+}
+
+bool RetryBudget::tryWithdraw(uint64_t nowMs) {
+    // Time-based floor, credited lazily by whichever caller sees time move
+    uint64_t last = lastRefillMs.load(std::memory_order_relaxed);
+    if (last == 0) {
+        lastRefillMs.compare_exchange_strong(last, nowMs, std::memory_order_relaxed);
+    } else if (nowMs > last && lastRefillMs.compare_exchange_strong(last, nowMs, std::memory_order_relaxed)) {
+        int64_t credit = static_cast<int64_t>(nowMs - last) * floorPerSecond / 1000;
+        int64_t current = balance.load(std::memory_order_relaxed);
+        while (credit > 0 && current < maxBalance) {
+            int64_t next = std::min(maxBalance, current + credit);
+            if (balance.compare_exchange_weak(current, next, std::memory_order_relaxed)) {
+                break;
+            }
+        }
+    }
+
+    int64_t current = balance.load(std::memory_order_relaxed);
+    while (current >= kToken) {
+        if (balance.compare_exchange_weak(current, current - kToken, std::memory_order_relaxed)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+LatencyTracker::LatencyTracker(double q)
+    : quantile(std::max(0.0, std::min(1.0, q))), samples(0), cachedQuantileUs(0) {
+    for (int i = 0; i < kBucketCount; i++) {
+        counts[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+int LatencyTracker::bucketFor(uint64_t latencyUs) {
+    if (latencyUs < kSubBuckets) {
+        return static_cast<int>(latencyUs);
+    }
+
+    int msb = 63;
+    while ((latencyUs >> msb) == 0) {
+        msb--;
+    }
+    int sub = static_cast<int>((latencyUs >> (msb - 3)) & (kSubBuckets - 1));
+    int bucket = kSubBuckets + (msb - 3) * kSubBuckets + sub;
+    return std::min(bucket, kBucketCount - 1);
+}
+
+uint64_t LatencyTracker::bucketUpperBound(int bucket) {
+    if (bucket < kSubBuckets) {
+        return static_cast<uint64_t>(bucket);
+    }
+    int shift = (bucket - kSubBuckets) / kSubBuckets;
+    uint64_t sub = static_cast<uint64_t>((bucket - kSubBuckets) % kSubBuckets);
+    return ((kSubBuckets + sub + 1) << shift) - 1;
+}
+
+void LatencyTracker::record(uint64_t latencyUs) {
+    counts[bucketFor(latencyUs)].fetch_add(1, std::memory_order_relaxed);
+
+    uint32_t seen = samples.fetch_add(1, std::memory_order_relaxed) + 1;
+    if (seen % kDecaySamples == 0) {
+        recompute(true);
+    } else if (seen % kRecomputeEvery == 0) {
+        recompute(false);
+    }
+}
+
+void LatencyTracker::recompute(bool decay) {
+    // Racing recorders can make this slightly stale; it is only an estimate
+    uint32_t snapshot[kBucketCount];
+    uint64_t total = 0;
+    for (int i = 0; i < kBucketCount; i++) {
+        snapshot[i] = counts[i].load(std::memory_order_relaxed);
+        total += snapshot[i];
+        if (decay && snapshot[i] != 0) {
+            counts[i].store(snapshot[i] / 2, std::memory_order_relaxed);
+        }
+    }
+    if (total < kMinSamples) return;
+
+    uint64_t target = static_cast<uint64_t>(std::ceil(quantile * static_cast<double>(total)));
+    uint64_t seen = 0;
+    for (int i = 0; i < kBucketCount; i++) {
+        seen += snapshot[i];
+        if (seen >= target && seen > 0) {
+            cachedQuantileUs.store(bucketUpperBound(i), std::memory_order_relaxed);
+            return;
+        }
+    }
+}
+
+RetryController::RetryController()
+    : enabled(false), hedgeEnabled(false), maxRetries(0), hedgeMinDelayMs(0),
+      loadBalancer(nullptr), budget(new RetryBudget()) {
+}
+
+void RetryController::configure(const Config& config, LoadBalancer& lb) {
+    const RetryConfig& retry = config.getRetry();
+    enabled = retry.enabled;
+    hedgeEnabled = retry.hedgeEnabled;
+    maxRetries = retry.maxRetries;
+    hedgeMinDelayMs = static_cast<uint64_t>(retry.hedgeMinDelayMs);
+    loadBalancer = &lb;
+    budget.reset(new RetryBudget(retry.budgetPercent / 100.0, retry.minRetriesPerSecond));
+
+    trackers.clear();
+    for (size_t i = 0; i < lb.getBackendCount(); i++) {
+        trackers.emplace_back(new LatencyTracker(retry.hedgePercentile / 100.0));
+    }
+}
+
+bool RetryController::tryExtraAttempt(uint64_t nowMs) {
+    if (budget->tryWithdraw(nowMs)) return true;
+    stats.budgetExhausted.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+LatencyTracker* RetryController::getTracker(const BackendServer* backend) const {
+    if (loadBalancer == nullptr || backend == nullptr) return nullptr;
+
+    size_t index = loadBalancer->indexOf(backend);
+    return index < trackers.size() ? trackers[index].get() : nullptr;
+}
+
+void RetryController::recordLatency(const BackendServer* backend, uint64_t latencyUs) {
+    LatencyTracker* tracker = getTracker(backend);
+    if (tracker != nullptr) {
+        tracker->record(latencyUs);
+    }
+}
+
+uint64_t RetryController::getHedgeDelayMs(const BackendServer* backend) const {
+    LatencyTracker* tracker = getTracker(backend);
+    if (tracker == nullptr) return 0;
+
+    uint64_t quantileUs = tracker->getQuantileUs();
+    if (quantileUs == 0) return 0;
+    return std::max(hedgeMinDelayMs, (quantileUs + 999) / 1000);
+}
+
+void RetryController::printStatus() const {
+    if (!enabled) return;
+
+    std::cout << "\n=== Retries ===" << std::endl;
+    std::cout << "Retries: " << stats.retries.load() << std::endl;
+    std::cout << "Hedged requests: " << stats.hedges.load()
+              << " (hedge answered first: " << stats.hedgeWins.load() << ")" << std::endl;
+    std::cout << "Denied by retry budget: " << stats.budgetExhausted.load() << std::endl;
+    if (hedgeEnabled && loadBalancer != nullptr) {
+        for (size_t i = 0; i < trackers.size(); i++) {
+            const BackendServer* backend = loadBalancer->getBackend(i);
+            std::cout << "  " << backend->host << ":" << backend->port
+                      << " hedge threshold: " << trackers[i]->getQuantileUs() << "us" << std::endl;
+        }
+    }
+    std::cout << "===============\n" << std::endl;
+}
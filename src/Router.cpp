@@ -0,0 +1,39 @@
+#include "Router.h"
+#include <algorithm>
+
+void Router::configure(const Config& config) {
+    routes.clear();
+    for (const RouteConfig& routeConfig : config.getRoutes()) {
+        Route route;
+        route.config = routeConfig;
+        if (routeConfig.rateLimit.enabled) {
+            route.rateLimit = RateLimiter::Policy(routeConfig.rateLimit.requestsPerSecond,
+                                                  static_cast<uint32_t>(routeConfig.rateLimit.burst));
+        }
+        route.keySeed = RateLimiter::hashKey(0, routeConfig.prefix.data(), routeConfig.prefix.length());
+        routes.push_back(route);
+    }
+
+    std::stable_sort(routes.begin(), routes.end(), [](const Route& a, const Route& b) {
+        return a.config.prefix.length() > b.config.prefix.length();
+    });
+    for (size_t i = 0; i < routes.size(); i++) {
+        routes[i].index = i;
+    }
+}
+
+const Route* Router::match(const std::string& path) const {
+    for (const Route& route : routes) {
+        if (path.compare(0, route.config.prefix.length(), route.config.prefix) == 0) {
+            return &route;
+        }
+    }
+    return nullptr;
+}
+
+bool Router::hasRateLimits() const {
+    for (const Route& route : routes) {
+        if (route.rateLimit.isEnabled()) return true;
+    }
+    return false;
+}
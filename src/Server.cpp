@@ -1,10 +1,32 @@
 #include "Server.h"
+#include "Worker.h"
+#include "Coroutine.h"
+#include "Affinity.h"
+#include "SocketTuning.h"
 #include <iostream>
-#include <sstream>
 #include <chrono>
+#include <csignal>
+#include <cstring>
+#include <cstdlib>
+#include <sstream>
+#include <algorithm>
+
+namespace {
+
+// Timeout counters by their metrics label
+const std::pair<const char*, std::atomic<uint64_t> TimeoutCounters::*> kTimeoutKinds[] = {
+    {"client_header", &TimeoutCounters::clientHeader},
+    {"idle_keep_alive", &TimeoutCounters::idleKeepAlive},
+    {"upstream_connect", &TimeoutCounters::upstreamConnect},
+    {"upstream_first_byte", &TimeoutCounters::upstreamFirstByte},
+    {"request_total", &TimeoutCounters::requestTotal},
+    {"tunnel_idle", &TimeoutCounters::tunnelIdle}
+};
+
+} // namespace
 
 Server::Server(Logger& log, LoadBalancer& lb) 
-    : logger(log), loadBalancer(lb), serverSocket(INVALID_SOCKET) {
+    : logger(log), loadBalancer(lb), resolver(log), staticFiles(log) {
     logger.info("Server instance created");
 }
 
@@ -25,6 +47,42 @@ bool Server::configure(const std::string& configFile) {
     
     loadBalancer.configure(config);
     logger.info("Load balancer configured successfully");
+    resolver.configure(config, loadBalancer);
+    
+    admission.configure(config, loadBalancer);
+    router.configure(config);
+    staticFiles.configure(config);
+    // Bucket table memory is only reserved when some route is rate limited
+    size_t rateLimitKeys = router.hasRateLimits() ? static_cast<size_t>(config.getRateLimitMaxKeys()) : 0;
+    rateLimiter.reset(new RateLimiter(rateLimitKeys, static_cast<size_t>(config.getRateLimitShards())));
+    retries.configure(config, loadBalancer);
+    
+    std::vector<std::string> routeLabels;
+    for (const Route& route : router.getRoutes()) {
+        routeLabels.push_back(route.config.prefix);
+    }
+    std::vector<std::string> backendLabels;
+    for (size_t i = 0; i < loadBalancer.getBackendCount(); i++) {
+        const BackendServer* backend = loadBalancer.getBackend(i);
+        backendLabels.push_back(backend->host + ":" + std::to_string(backend->port));
+    }
+    std::vector<std::string> classLabels;
+    const PriorityClassifier& classifier = admission.getClassifier();
+    for (size_t i = 0; i < classifier.getClassCount(); i++) {
+        classLabels.push_back(classifier.getClass(i).name);
+    }
+    metrics.configure(routeLabels, backendLabels, classLabels);
+    
+    const TracingConfig& tracing = config.getTracing();
+    slowRequests.reset();
+    if (tracing.enabled) {
+        Tsc::calibrate();
+        slowRequests.reset(new SlowRequestLog(static_cast<size_t>(tracing.slowRequestLogSize),
+                                              static_cast<uint64_t>(tracing.slowRequestMs) * 1000));
+        if (!Tsc::isInvariant()) {
+            logger.info("No invariant TSC; request tracing uses steady_clock");
+        }
+    }
     
     config.printConfiguration();
     loadBalancer.printStatus();
@@ -53,103 +111,584 @@ void Server::cleanupNetworking() {
 #endif
 }
 
-bool Server::start() {
-    if (!initializeNetworking()) {
-        return false;
-    }
-    
-    serverSocket = socket(AF_INET, SOCK_STREAM, 0);
-    if (serverSocket == INVALID_SOCKET) {
+SOCKET Server::createListenSocket(bool reusePort, int port, const ListenerSocketConfig& options) {
+    SOCKET listenSocket = socket(AF_INET, SOCK_STREAM, 0);
+    if (listenSocket == INVALID_SOCKET) {
         logger.error("Failed to create socket");
-        cleanupNetworking();
-        return false;
+        return INVALID_SOCKET;
     }
     
     int opt = 1;
-    if (setsockopt(serverSocket, SOL_SOCKET, SO_REUSEADDR, (char*)&opt, sizeof(opt)) < 0) {
+    if (setsockopt(listenSocket, SOL_SOCKET, SO_REUSEADDR, (char*)&opt, sizeof(opt)) < 0) {
         logger.warning("Failed to set SO_REUSEADDR");
     }
+#ifdef SO_REUSEPORT
+    if (reusePort && setsockopt(listenSocket, SOL_SOCKET, SO_REUSEPORT, (char*)&opt, sizeof(opt)) < 0) {
+        logger.warning("Failed to set SO_REUSEPORT");
+    }
+#else
+    (void)reusePort;
+#endif
     
     sockaddr_in serverAddr{};
     serverAddr.sin_family = AF_INET;
     serverAddr.sin_addr.s_addr = INADDR_ANY;
-    serverAddr.sin_port = htons(config.getProxyPort());
+    serverAddr.sin_port = htons(static_cast<uint16_t>(port));
     
-    if (bind(serverSocket, (sockaddr*)&serverAddr, sizeof(serverAddr)) == SOCKET_ERROR) {
-        logger.error("Failed to bind socket on port " + std::to_string(config.getProxyPort()));
-        closesocket(serverSocket);
-        cleanupNetworking();
-        return false;
+    if (bind(listenSocket, (sockaddr*)&serverAddr, sizeof(serverAddr)) == SOCKET_ERROR) {
+        logger.error("Failed to bind socket on port " + std::to_string(port));
+        closesocket(listenSocket);
+        return INVALID_SOCKET;
     }
     
-    if (listen(serverSocket, config.getMaxConnections()) == SOCKET_ERROR) {
+    SocketTuning::applyListener(listenSocket, options, logger);
+    if (listen(listenSocket, config.getMaxConnections()) == SOCKET_ERROR) {
         logger.error("Failed to listen on socket");
-        closesocket(serverSocket);
+        closesocket(listenSocket);
+        return INVALID_SOCKET;
+    }
+    
+    if (!setNonBlocking(listenSocket)) {
+        logger.error("Failed to make listening socket non-blocking");
+        closesocket(listenSocket);
+        return INVALID_SOCKET;
+    }
+    
+    return listenSocket;
+}
+
+// One socket per worker with SO_REUSEPORT, otherwise one shared by all;
+// sockets inherited in a hot restart count towards them and take this
+// process's socket options
+bool Server::openListeners(std::vector<SOCKET>& sockets, int count, bool reusePort, int port,
+                           const ListenerSocketConfig& options) {
+    for (SOCKET inherited : sockets) {
+        SocketTuning::applyListener(inherited, options, logger);
+    }
+    for (int i = static_cast<int>(sockets.size()); i < (reusePort ? count : 1); i++) {
+        SOCKET listenSocket = createListenSocket(reusePort, port, options);
+        if (listenSocket == INVALID_SOCKET) {
+            return false;
+        }
+        sockets.push_back(listenSocket);
+    }
+    return true;
+}
+
+// Inherited sockets bound elsewhere (the port was changed) are closed
+void Server::keepListenersOnPort(std::vector<SOCKET>& sockets, int port) {
+    std::vector<SOCKET> kept;
+    for (SOCKET listenSocket : sockets) {
+        sockaddr_in address{};
+        socklen_t length = sizeof(address);
+        if (getsockname(listenSocket, (sockaddr*)&address, &length) == 0 && ntohs(address.sin_port) == port) {
+            kept.push_back(listenSocket);
+        } else {
+            if (port != 0) {
+                logger.warning("Closing an inherited listening socket not bound to port " + std::to_string(port));
+            }
+            closesocket(listenSocket);
+        }
+    }
+    sockets.swap(kept);
+}
+
+// Worker i takes socket i, and every workerCount-th socket after it when a
+// hot restart inherited more than there are workers; a single (shared)
+// socket goes to every worker
+void Server::assignListeners(Worker& worker, int workerCount) {
+    for (std::vector<SOCKET>* sockets : {&listenSockets, &tlsListenSockets}) {
+        bool tlsListener = sockets == &tlsListenSockets;
+        if (sockets->size() == 1) {
+            worker.addListener(sockets->front(), tlsListener);
+            continue;
+        }
+        size_t step = static_cast<size_t>(workerCount);
+        for (size_t i = static_cast<size_t>(worker.getId()); i < sockets->size(); i += step) {
+            worker.addListener((*sockets)[i], tlsListener);
+        }
+    }
+}
+
+// The CPU of every worker, cycling through affinity.cpus; empty when the
+// workers are not pinned
+std::vector<int> Server::workerCpus(int workerCount) {
+    const AffinityConfig& affinity = config.getAffinity();
+    std::vector<int> assigned;
+    if (!affinity.enabled) return assigned;
+    
+    std::vector<int> allowed = CpuAffinity::allowedCpus();
+    if (allowed.empty()) {
+        logger.warning("CPU affinity is not supported on this platform; workers are not pinned");
+        return assigned;
+    }
+    std::vector<int> cpus;
+    if (affinity.cpus.empty() || !CpuAffinity::parseCpuList(affinity.cpus, cpus)) {
+        cpus = allowed;
+    }
+    std::vector<int> usable;
+    for (int cpu : cpus) {
+        if (std::find(allowed.begin(), allowed.end(), cpu) != allowed.end()) {
+            usable.push_back(cpu);
+        } else {
+            logger.warning("CPU " + std::to_string(cpu) + " is offline or outside this process's CPU set; skipped");
+        }
+    }
+    if (usable.empty()) {
+        logger.warning("No usable CPU in affinity.cpus; workers are not pinned");
+        return assigned;
+    }
+    if (static_cast<size_t>(workerCount) > usable.size()) {
+        logger.warning("More workers than CPUs: " + std::to_string(workerCount) + " workers share " +
+                       std::to_string(usable.size()) + " CPU(s)");
+    }
+    
+    std::string list;
+    for (int i = 0; i < workerCount; i++) {
+        assigned.push_back(usable[static_cast<size_t>(i) % usable.size()]);
+        if (i > 0) list += ",";
+        list += std::to_string(assigned.back());
+    }
+    logger.info("Workers pinned to CPUs " + list);
+    return assigned;
+}
+
+// Worker i accepts on socket i of each reuseport group; connections go to
+// the worker on the CPU that took the packet, so the accept, the request
+// and the reply all stay on that core
+void Server::steerListeners(const std::vector<int>& cpus) {
+    if (cpus.empty() || !config.getAffinity().steerConnections || listenSockets.size() < 2) return;
+    
+    std::vector<int> sorted(cpus);
+    std::sort(sorted.begin(), sorted.end());
+    if (std::adjacent_find(sorted.begin(), sorted.end()) != sorted.end()) {
+        logger.warning("Connection steering needs one worker per CPU; the kernel's hash spreads accepts instead");
+        return;
+    }
+    for (std::vector<SOCKET>* sockets : {&listenSockets, &tlsListenSockets}) {
+        if (sockets->size() < 2) continue;
+        if (!CpuAffinity::steerByCpu(*sockets, cpus)) {
+            logger.warning("Failed to attach the reuseport CPU steering program");
+            return;
+        }
+    }
+    logger.info("Connections steered to the worker on the receiving CPU");
+}
+
+void Server::startDraining() {
+    logger.info("Hot restart: handed over; draining " +
+                std::to_string(activeConnections.load(std::memory_order_relaxed)) + " connection(s)");
+    std::cout << "Hot restart: new process accepting, draining connections" << std::endl;
+    draining.store(true);
+    for (auto& worker : workers) {
+        worker->startDraining();
+    }
+    if (admin) {
+        admin->stop();
+        admin->join();
+        admin.reset();
+    }
+    hotRestart->notifyDraining();
+}
+
+void Server::closeListenSockets() {
+    for (SOCKET listenSocket : listenSockets) {
+        closesocket(listenSocket);
+    }
+    listenSockets.clear();
+    for (SOCKET listenSocket : tlsListenSockets) {
+        closesocket(listenSocket);
+    }
+    tlsListenSockets.clear();
+}
+
+bool Server::start() {
+    if (!initializeNetworking()) {
+        return false;
+    }
+    
+#ifndef _WIN32
+    // Peer resets must surface as EPIPE, not kill the process
+    signal(SIGPIPE, SIG_IGN);
+#endif
+    
+    // Backend hostnames are looked up here, once, before any request needs them
+    resolver.start();
+    resolver.printStatus();
+    staticFiles.start();
+    
+    int workerCount = config.getWorkerCount();
+    const HotRestartConfig& restartConfig = config.getHotRestart();
+#ifdef SO_REUSEPORT
+    // Each worker gets its own listening socket so the kernel spreads accepts;
+    // always with hot restart, so the next process may run more workers
+    bool reusePort = workerCount > 1 || restartConfig.enabled;
+#else
+    bool reusePort = false;
+#endif
+    
+    if (restartConfig.enabled) {
+        hotRestart.reset(new HotRestart(restartConfig, logger));
+        if (hotRestart->inherit(listenSockets, tlsListenSockets)) {
+            keepListenersOnPort(listenSockets, config.getProxyPort());
+        }
+    }
+    
+    const SocketConfig& sockets = config.getSockets();
+    if (!openListeners(listenSockets, workerCount, reusePort, config.getProxyPort(), sockets.listener)) {
+        closeListenSockets();
         cleanupNetworking();
         return false;
     }
     
+    const TlsConfig& tlsConfig = config.getTls();
+    if (tlsConfig.enabled && config.isTcpMode()) {
+        logger.warning("TLS termination needs server.mode \"http\"; tcp mode relays TLS untouched");
+    } else if (tlsConfig.enabled) {
+        keepListenersOnPort(tlsListenSockets, tlsConfig.port);
+        tls = TlsContext::create(tlsConfig, logger, config.getHttp2().enabled);
+#ifdef PROXY_HAS_TLS
+        if (!tls) {
+            closeListenSockets();
+            cleanupNetworking();
+            return false;
+        }
+#endif
+        if (tls && !openListeners(tlsListenSockets, workerCount, reusePort, tlsConfig.port, sockets.tlsListener)) {
+            tls.reset();
+            closeListenSockets();
+            cleanupNetworking();
+            return false;
+        }
+    }
+    if (!tls && !tlsListenSockets.empty()) {
+        logger.warning("Closing inherited TLS listening sockets; TLS is not enabled");
+        keepListenersOnPort(tlsListenSockets, 0);
+    }
+    SocketTuning::checkSystem(sockets, tls != nullptr, logger);
+    
+#ifndef PROXY_HAS_COROUTINES
+    if (config.getPipeline() == "coroutine" && !config.isTcpMode()) {
+        logger.warning("Coroutine pipeline needs a C++20 build; serving requests with the callback pipeline");
+    }
+#else
+    // Not errors: the settings still apply to TLS clients, which the callback pipeline serves
+    if (config.getPipeline() == "coroutine" && !config.isTcpMode()) {
+        const AdmissionConfig& admission = config.getAdmission();
+        if (admission.enabled && (admission.queueSize > 0 || !admission.classes.empty())) {
+            logger.warning("Coroutine pipeline: admission.queue_size and admission.classes are ignored; "
+                           "a saturated limiter answers 503 at once");
+        }
+        if (config.getRetry().enabled && config.getRetry().hedgeEnabled) {
+            logger.warning("Coroutine pipeline: retries.hedge_enabled is ignored; requests are not hedged");
+        }
+    }
+#endif
+    
+    std::vector<int> cpus = workerCpus(workerCount);
+    steerListeners(cpus);
+    bool numaLocal = !cpus.empty() && config.getAffinity().numaLocal;
+    
     running.store(true);
-    logger.info("Server started successfully on port " + std::to_string(config.getProxyPort()));
+    
+    for (int i = 0; i < workerCount; i++) {
+        // Built under the policy of the worker's node, so its loop, metrics
+        // shard and balancer shard start out in that node's memory
+        int node = numaLocal ? CpuAffinity::nodeOfCpu(cpus[i]) : -1;
+        if (node >= 0 && !CpuAffinity::setMemoryNode(node)) {
+            logger.warning("Failed to set the memory policy for NUMA node " + std::to_string(node));
+            node = -1;
+        }
+        workers.push_back(std::unique_ptr<Worker>(new Worker(*this, i)));
+        if (node >= 0) {
+            CpuAffinity::setMemoryNode(-1);
+        }
+        if (!cpus.empty()) {
+            workers.back()->pinTo(cpus[i]);
+        }
+        assignListeners(*workers.back(), workerCount);
+        if (!workers.back()->start()) {
+            running.store(false);
+            workers.clear();
+            closeListenSockets();
+            cleanupNetworking();
+            return false;
+        }
+    }
+    
+    if (hotRestart) {
+        // The previous process stops accepting and gives up the admin port
+        if (hotRestart->hasPredecessor()) {
+            hotRestart->confirmInherited();
+        }
+        hotRestart->listen();
+    }
+    startAdmin();
+    
+    logger.info("Server started successfully on port " + std::to_string(config.getProxyPort()) +
+                " with " + std::to_string(workerCount) + " worker(s)");
     std::cout << "Reverse Proxy Server listening on port " << config.getProxyPort() << std::endl;
+    if (tls) {
+        std::cout << "TLS listening on port " << tlsConfig.port << std::endl;
+    }
     std::cout << "Algorithm: " << config.algorithmToString() << std::endl;
     std::cout << "Backend servers: " << loadBalancer.getBackendCount() << std::endl;
-    std::cout << "Send HTTP requests to test the load balancing!" << std::endl;
+    if (config.isTcpMode()) {
+        std::cout << "Mode: tcp (connections relayed to backends without HTTP parsing)" << std::endl;
+    } else {
+        std::cout << "Send HTTP requests to test the load balancing!" << std::endl;
+    }
     std::cout << "Press Ctrl+C to stop the server" << std::endl;
     
+    // The main thread only waits for shutdown, printing slow requests on demand
+    // and, with hot restart, handing over to a new process
+    uint64_t drainDeadlineMs = 0;
     while (running.load()) {
-        sockaddr_in clientAddr{};
-        socklen_t clientAddrLen = sizeof(clientAddr);
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        if (slowRequestDumpRequested.exchange(false)) {
+            printSlowRequests();
+        }
+        if (!hotRestart) continue;
         
-        SOCKET clientSocket = accept(serverSocket, (sockaddr*)&clientAddr, &clientAddrLen);
-        if (clientSocket == INVALID_SOCKET) {
-            if (running.load()) {
-                logger.warning("Failed to accept client connection");
+        std::string stats;
+        if (hotRestart->pollStats(stats)) {
+            importStats(stats);
+        }
+        if (!isDraining() && hotRestart->pollSuccessor(listenSockets, tlsListenSockets)) {
+            startDraining();
+            drainDeadlineMs = EventLoop::monotonicMs() + static_cast<uint64_t>(restartConfig.drainTimeoutMs);
+        }
+        if (isDraining()) {
+            int remaining = activeConnections.load(std::memory_order_relaxed);
+            if (remaining == 0) {
+                logger.info("Hot restart: all connections drained");
+                running.store(false);
+            } else if (EventLoop::monotonicMs() >= drainDeadlineMs) {
+                logger.warning("Hot restart: drain timeout with " + std::to_string(remaining) +
+                               " connection(s) still open; closing them");
+                running.store(false);
             }
-            continue;
         }
-        
-        handleClient(clientSocket);
-        closesocket(clientSocket);
+    }
+    
+    for (auto& worker : workers) {
+        worker->join();
+    }
+    workers.clear();
+    resolver.stop();
+    staticFiles.stop();
+    if (admin) {
+        admin->stop();
+        admin->join();
+        admin.reset();
+    }
+    if (hotRestart) {
+        // Counted after the workers stopped, so nothing is missed
+        if (isDraining()) {
+            hotRestart->sendStats(restartConfig.transferStats ? exportStats() : std::string());
+        }
+        hotRestart.reset();
+    }
+    closeListenSockets();
+    printTimeoutCounters();
+    admission.printStatus();
+    printRateLimitStatus();
+    retries.printStatus();
+    staticFiles.printStatus();
+    metrics.printStatus();
+    if (tls) {
+        tls->printStatus();
+        tls.reset();
     }
     
     return true;
 }
 
-void Server::handleClient(SOCKET clientSocket) {
-    char buffer[4096];
-    
-    std::string clientIP = getClientIP(clientSocket);
-    
-    // Receive HTTP request
-    int bytesReceived = recv(clientSocket, buffer, sizeof(buffer) - 1, 0);
-    if (bytesReceived <= 0) {
-        logger.warning("Failed to receive data from client " + clientIP);
-        return;
+void Server::startAdmin() {
+    const AdminConfig& adminConfig = config.getAdmin();
+    if (!adminConfig.enabled) return;
+    
+    admin.reset(new AdminServer(logger));
+    admin->addEndpoint("/metrics", "text/plain; version=0.0.4; charset=utf-8", [this] { return renderMetrics(); });
+    if (slowRequests) {
+        admin->addEndpoint("/slow_requests", "text/plain; charset=utf-8", [this] { return slowRequests->render(); });
+    }
+    if (!admin->start(adminConfig, running)) {
+        // Serving traffic matters more than exposing it
+        logger.warning("Admin endpoints unavailable; continuing without /metrics");
+        admin.reset();
+    }
+}
+
+std::string Server::renderMetrics() {
+    std::string out;
+    out.reserve(64 * 1024);
+    PrometheusWriter writer(out);
+    metrics.render(writer);
+    
+    writer.family("reverse_proxy_open_connections", "Client connections currently open", "gauge");
+    writer.sample("reverse_proxy_open_connections", std::string(),
+                  static_cast<double>(activeConnections.load(std::memory_order_relaxed)));
+    
+    writer.family("reverse_proxy_timeouts_total", "Expired timeouts by kind", "counter");
+    for (const auto& timeout : kTimeoutKinds) {
+        writer.sample("reverse_proxy_timeouts_total", PrometheusWriter::label("kind", timeout.first),
+                      static_cast<uint64_t>((timeoutCounters.*timeout.second).load()));
     }
     
-    buffer[bytesReceived] = '\0';
-    std::string request(buffer);
-    
-    logger.debug("Received HTTP request from " + clientIP + " (" + std::to_string(bytesReceived) + " bytes)");
+    if (admission.isEnabled()) {
+        AdmissionStats& stats = admission.getStats();
+        const std::pair<const char*, const std::atomic<uint64_t>*> outcomes[] = {
+            {"admitted", &stats.admitted},
+            {"queued", &stats.queued},
+            {"queue_full", &stats.rejectedQueueFull},
+            {"shed", &stats.shed},
+            {"queue_timeout", &stats.queueTimeouts}
+        };
+        writer.family("reverse_proxy_admission_total", "Admission decisions by outcome", "counter");
+        for (const auto& outcome : outcomes) {
+            writer.sample("reverse_proxy_admission_total", PrometheusWriter::label("outcome", outcome.first),
+                          static_cast<uint64_t>(outcome.second->load()));
+        }
+        
+        const PriorityClassifier& classifier = admission.getClassifier();
+        writer.family("reverse_proxy_class_admission_total", "Admission decisions by priority class and outcome",
+                      "counter");
+        for (size_t i = 0; i < classifier.getClassCount(); i++) {
+            PriorityClassStats& classStats = admission.getClassStats(i);
+            const std::pair<const char*, const std::atomic<uint64_t>*> classOutcomes[] = {
+                {"admitted", &classStats.admitted},
+                {"queued", &classStats.queued},
+                {"queue_full", &classStats.rejectedQueueFull},
+                {"shed", &classStats.shed},
+                {"queue_timeout", &classStats.queueTimeouts}
+            };
+            for (const auto& outcome : classOutcomes) {
+                writer.sample("reverse_proxy_class_admission_total",
+                              PrometheusWriter::label("class", classifier.getClass(i).name) + "," +
+                                  PrometheusWriter::label("outcome", outcome.first),
+                              static_cast<uint64_t>(outcome.second->load()));
+            }
+        }
+        
+        writer.family("reverse_proxy_concurrency_limit", "Current adaptive in-flight limit", "gauge");
+        writer.sample("reverse_proxy_concurrency_limit", PrometheusWriter::label("scope", "global"),
+                      static_cast<double>(admission.getGlobalLimiter().getLimit()));
+        for (size_t i = 0; i < loadBalancer.getBackendCount(); i++) {
+            BackendServer* backend = loadBalancer.getBackend(i);
+            ConcurrencyLimiter* limiter = admission.getBackendLimiter(backend);
+            if (limiter == nullptr) continue;
+            writer.sample("reverse_proxy_concurrency_limit",
+                          PrometheusWriter::label("scope", backend->host + ":" + std::to_string(backend->port)),
+                          static_cast<double>(limiter->getLimit()));
+        }
+    }
     
-    std::pair<std::string, std::string> parsedRequest = parseHttpRequest(request);
-    std::string method = parsedRequest.first;
-    std::string path = parsedRequest.second;
+    writer.family("reverse_proxy_backend_active_connections", "Upstream connections open per backend", "gauge");
+    for (size_t i = 0; i < loadBalancer.getBackendCount(); i++) {
+        const BackendServer* backend = loadBalancer.getBackend(i);
+        writer.sample("reverse_proxy_backend_active_connections",
+                      PrometheusWriter::label("backend", backend->host + ":" + std::to_string(backend->port)),
+                      static_cast<double>(loadBalancer.getActiveConnections(i)));
+    }
+    writer.family("reverse_proxy_backend_addresses", "Addresses the backend's host resolves to", "gauge");
+    for (size_t i = 0; i < loadBalancer.getBackendCount(); i++) {
+        const BackendServer* backend = loadBalancer.getBackend(i);
+        writer.sample("reverse_proxy_backend_addresses",
+                      PrometheusWriter::label("backend", backend->host + ":" + std::to_string(backend->port)),
+                      static_cast<double>(resolver.getAddressCount(i)));
+    }
+    writer.family("reverse_proxy_resolver_failures_total", "Backend hostname lookups that failed", "counter");
+    writer.sample("reverse_proxy_resolver_failures_total", "", resolver.getFailures());
+    const StaticFileStats& staticStats = staticFiles.getStats();
+    writer.family("reverse_proxy_static_cache_lookups_total", "Static file lookups by cache result", "counter");
+    writer.sample("reverse_proxy_static_cache_lookups_total", PrometheusWriter::label("result", "hit"),
+                  staticStats.hits.load(std::memory_order_relaxed));
+    writer.sample("reverse_proxy_static_cache_lookups_total", PrometheusWriter::label("result", "miss"),
+                  staticStats.misses.load(std::memory_order_relaxed));
+    writer.family("reverse_proxy_static_cache_evictions_total", "Cached static files dropped for space", "counter");
+    writer.sample("reverse_proxy_static_cache_evictions_total", "",
+                  staticStats.evictions.load(std::memory_order_relaxed));
+    writer.family("reverse_proxy_static_cache_invalidations_total", "Cached static files dropped because they changed",
+                  "counter");
+    writer.sample("reverse_proxy_static_cache_invalidations_total", "",
+                  staticStats.invalidations.load(std::memory_order_relaxed));
+    writer.family("reverse_proxy_static_cache_files", "Static files held open in the cache", "gauge");
+    writer.sample("reverse_proxy_static_cache_files", "", static_cast<double>(staticFiles.getCachedFiles()));
+    writer.family("reverse_proxy_backend_healthy", "1 when the backend is eligible for selection", "gauge");
+    for (size_t i = 0; i < loadBalancer.getBackendCount(); i++) {
+        const BackendServer* backend = loadBalancer.getBackend(i);
+        writer.sample("reverse_proxy_backend_healthy",
+                      PrometheusWriter::label("backend", backend->host + ":" + std::to_string(backend->port)),
+                      backend->isHealthy ? 1.0 : 0.0);
+    }
     
-    if (method.empty() || path.empty()) {
-        logger.warning("Invalid HTTP request format from " + clientIP);
-        std::string response = createHttpResponse(400, "Bad Request");
-        send(clientSocket, response.c_str(), response.length(), 0);
-        return;
+    if (router.hasRateLimits()) {
+        writer.family("reverse_proxy_rate_limited_total", "Requests answered 429 by the rate limiter", "counter");
+        writer.sample("reverse_proxy_rate_limited_total", std::string(), rateLimiter->getLimited());
+        writer.family("reverse_proxy_rate_limiter_keys", "Client keys tracked by the rate limiter", "gauge");
+        writer.sample("reverse_proxy_rate_limiter_keys", std::string(), static_cast<double>(rateLimiter->getKeyCount()));
     }
     
-    logger.info("Request: " + method + " " + path + " from " + clientIP);
+    if (retries.isEnabled()) {
+        RetryStats& stats = retries.getStats();
+        writer.family("reverse_proxy_upstream_extra_attempts_total", "Retries and hedges sent", "counter");
+        writer.sample("reverse_proxy_upstream_extra_attempts_total", PrometheusWriter::label("kind", "retry"),
+                      static_cast<uint64_t>(stats.retries.load()));
+        writer.sample("reverse_proxy_upstream_extra_attempts_total", PrometheusWriter::label("kind", "hedge"),
+                      static_cast<uint64_t>(stats.hedges.load()));
+        writer.family("reverse_proxy_hedge_wins_total", "Hedged requests answered by the hedge", "counter");
+        writer.sample("reverse_proxy_hedge_wins_total", std::string(), static_cast<uint64_t>(stats.hedgeWins.load()));
+        writer.family("reverse_proxy_retry_budget_exhausted_total", "Extra attempts denied by the retry budget", "counter");
+        writer.sample("reverse_proxy_retry_budget_exhausted_total", std::string(),
+                      static_cast<uint64_t>(stats.budgetExhausted.load()));
+    }
     
-    std::string backendResponse = forwardToBackend(method, path, request, clientIP);
+    if (tls) {
+        TlsStats& stats = tls->getStats();
+        const std::pair<const char*, const std::atomic<uint64_t>*> handshakes[] = {
+            {"full", &stats.fullHandshakes},
+            {"resumed", &stats.resumedHandshakes},
+            {"failed", &stats.failedHandshakes}
+        };
+        writer.family("reverse_proxy_tls_handshakes_total", "TLS handshakes by kind", "counter");
+        for (const auto& handshake : handshakes) {
+            writer.sample("reverse_proxy_tls_handshakes_total", PrometheusWriter::label("kind", handshake.first),
+                          static_cast<uint64_t>(handshake.second->load()));
+        }
+        
+        const std::pair<const char*, const std::atomic<uint64_t>*> lookups[] = {
+            {"hit", &stats.cacheHits},
+            {"miss", &stats.cacheMisses},
+            {"store", &stats.cacheStores},
+            {"eviction", &stats.cacheEvictions}
+        };
+        writer.family("reverse_proxy_tls_session_cache_total", "Session cache operations by outcome", "counter");
+        for (const auto& lookup : lookups) {
+            writer.sample("reverse_proxy_tls_session_cache_total", PrometheusWriter::label("outcome", lookup.first),
+                          static_cast<uint64_t>(lookup.second->load()));
+        }
+        writer.family("reverse_proxy_tls_session_cache_entries", "Sessions held for resumption", "gauge");
+        writer.sample("reverse_proxy_tls_session_cache_entries", std::string(),
+                      static_cast<double>(tls->getCachedSessions()));
+        
+        writer.family("reverse_proxy_tls_kernel_offload_total", "Connections handed to kernel TLS", "counter");
+        writer.sample("reverse_proxy_tls_kernel_offload_total", PrometheusWriter::label("direction", "send"),
+                      static_cast<uint64_t>(stats.kernelSend.load()));
+        writer.sample("reverse_proxy_tls_kernel_offload_total", PrometheusWriter::label("direction", "receive"),
+                      static_cast<uint64_t>(stats.kernelReceive.load()));
+    }
     
-    send(clientSocket, backendResponse.c_str(), backendResponse.length(), 0);
-    logger.debug("Response sent to client " + clientIP);
+    return out;
+}
+
+bool Server::tryAcquireConnection() {
+    int previous = activeConnections.fetch_add(1, std::memory_order_relaxed);
+    if (previous >= config.getMaxConnections()) {
+        activeConnections.fetch_sub(1, std::memory_order_relaxed);
+        return false;
+    }
+    return true;
 }
 
 std::string Server::getClientIP(SOCKET clientSocket) {
@@ -169,81 +708,73 @@ std::string Server::getClientIP(SOCKET clientSocket) {
     return "unknown";
 }
 
-std::pair<std::string, std::string> Server::parseHttpRequest(const std::string& request) {
-    std::istringstream iss(request);
-    std::string method, path, version;
-    
-    if (iss >> method >> path >> version) {
-        return {method, path};
+void Server::printRateLimitStatus() const {
+    if (!router.hasRateLimits()) return;
+    
+    std::cout << "\n=== Rate Limiting ===" << std::endl;
+    std::cout << "Limited (429): " << rateLimiter->getLimited() << std::endl;
+    std::cout << "Tracked keys: " << rateLimiter->getKeyCount()
+              << " (capacity " << rateLimiter->getCapacity() << ")" << std::endl;
+    std::cout << "Evictions: " << rateLimiter->getEvictions() << std::endl;
+    std::cout << "=====================\n" << std::endl;
+}
+
+// Counters carried over a hot restart; gauges describe the old process only
+std::string Server::exportStats() const {
+    std::string stats = metrics.exportTotals();
+    for (const auto& timeout : kTimeoutKinds) {
+        uint64_t value = (timeoutCounters.*timeout.second).load();
+        if (value > 0) {
+            stats += std::string("timeout\t") + timeout.first + "\t" + std::to_string(value) + "\n";
+        }
     }
-    
-    return {"", ""};
+    return stats;
 }
 
-std::string Server::forwardToBackend(const std::string& method, const std::string& path, 
-                                    const std::string& headers, const std::string& clientIP) {
-    BackendServer* backend = loadBalancer.getNextBackend(clientIP);
-    
-    if (backend == nullptr) {
-        logger.error("No healthy backend servers available");
-        return createHttpResponse(503, "Service Unavailable - No backend servers");
+void Server::importStats(const std::string& stats) {
+    metrics.importTotals(stats);
+    std::istringstream lines(stats);
+    std::string line;
+    while (std::getline(lines, line)) {
+        if (line.compare(0, 8, "timeout\t") != 0) continue;
+        size_t tab = line.find('\t', 8);
+        if (tab == std::string::npos) continue;
+        std::string kind = line.substr(8, tab - 8);
+        for (const auto& timeout : kTimeoutKinds) {
+            if (kind == timeout.first) {
+                (timeoutCounters.*timeout.second).fetch_add(std::strtoull(line.c_str() + tab + 1, nullptr, 10));
+            }
+        }
     }
-    
-    std::string backendUrl = backend->host + ":" + std::to_string(backend->port);
-    logger.info("Forwarding " + method + " " + path + " to backend: " + backendUrl + 
-                " (algorithm: " + config.algorithmToString() + ")");
-    
-    loadBalancer.incrementConnections(backend->host, backend->port);
-    
-    std::string responseBody = "{\n";
-    responseBody += "  \"message\": \"Request processed successfully\",\n";
-    responseBody += "  \"method\": \"" + method + "\",\n";
-    responseBody += "  \"path\": \"" + path + "\",\n";
-    responseBody += "  \"backend\": \"" + backendUrl + "\",\n";
-    responseBody += "  \"client_ip\": \"" + clientIP + "\",\n";
-    responseBody += "  \"algorithm\": \"" + config.algorithmToString() + "\",\n";
-    responseBody += "  \"backend_weight\": " + std::to_string(backend->weight) + ",\n";
-    responseBody += "  \"backend_connections\": " + std::to_string(backend->activeConnections.load()) + ",\n";
-    responseBody += "  \"timestamp\": \"" + std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count()) + "\"\n";
-    responseBody += "}";
-    
-    loadBalancer.decrementConnections(backend->host, backend->port);
-    
-    logger.info("Backend " + backendUrl + " processed request successfully");
-    return createHttpResponse(200, responseBody);
+    logger.info("Hot restart: imported counters from the previous process");
 }
 
-std::string Server::createHttpResponse(int statusCode, const std::string& body) {
-    std::string statusText;
-    switch (statusCode) {
-        case 200: statusText = "OK"; break;
-        case 400: statusText = "Bad Request"; break;
-        case 503: statusText = "Service Unavailable"; break;
-        default: statusText = "Unknown"; break;
+void Server::printTimeoutCounters() const {
+    std::cout << "\n=== Timeouts ===" << std::endl;
+    std::cout << "Client header: " << timeoutCounters.clientHeader.load() << std::endl;
+    std::cout << "Idle keep-alive: " << timeoutCounters.idleKeepAlive.load() << std::endl;
+    std::cout << "Upstream connect: " << timeoutCounters.upstreamConnect.load() << std::endl;
+    std::cout << "Upstream first byte: " << timeoutCounters.upstreamFirstByte.load() << std::endl;
+    std::cout << "Request total: " << timeoutCounters.requestTotal.load() << std::endl;
+    std::cout << "Tunnel idle: " << timeoutCounters.tunnelIdle.load() << std::endl;
+    std::cout << "================\n" << std::endl;
+}
+
+void Server::printSlowRequests() const {
+    std::cout << "\n=== Slow Requests ===" << std::endl;
+    if (slowRequests) {
+        std::cout << slowRequests->render();
+    } else {
+        std::cout << "Tracing disabled" << std::endl;
     }
-    
-    std::ostringstream response;
-    response << "HTTP/1.1 " << statusCode << " " << statusText << "\r\n";
-    response << "Content-Type: application/json\r\n";
-    response << "Content-Length: " << body.length() << "\r\n";
-    response << "Connection: close\r\n";
-    response << "Server: ReverseProxy/1.0\r\n";
-    response << "\r\n";
-    response << body;
-    
-    return response.str();
+    std::cout << "=====================\n" << std::endl;
 }
 
 void Server::stop() {
     if (running.load()) {
         running.store(false);
         logger.info("Server stopping...");
-        
-        if (serverSocket != INVALID_SOCKET) {
-            closesocket(serverSocket);
-            serverSocket = INVALID_SOCKET;
-        }
-        
         logger.info("Server stopped successfully");
     }
 }
+
@@ -0,0 +1,117 @@
+#include "SocketTuning.h"
+#include "Logger.h"
+#include <fstream>
+#include <string>
+
+namespace {
+
+bool setOption(SOCKET socket, int level, int option, int value) {
+    return setsockopt(socket, level, option, reinterpret_cast<char*>(&value), sizeof(value)) == 0;
+}
+
+void setBuffers(SOCKET socket, int sendKb, int receiveKb, Logger* logger) {
+    if (sendKb > 0 && !setOption(socket, SOL_SOCKET, SO_SNDBUF, sendKb * 1024) && logger != nullptr) {
+        logger->warning("Failed to set SO_SNDBUF to " + std::to_string(sendKb) + " KB");
+    }
+    if (receiveKb > 0 && !setOption(socket, SOL_SOCKET, SO_RCVBUF, receiveKb * 1024) && logger != nullptr) {
+        logger->warning("Failed to set SO_RCVBUF to " + std::to_string(receiveKb) + " KB");
+    }
+}
+
+#ifdef __linux__
+// A sysctl under /proc/sys as a number; -1 when it cannot be read
+long readSysctl(const char* path) {
+    std::ifstream file(path);
+    long value = -1;
+    if (!(file >> value)) return -1;
+    return value;
+}
+#endif
+
+} // namespace
+
+void SocketTuning::applyListener(SOCKET socket, const ListenerSocketConfig& config, Logger& logger) {
+    // Before listen() so the window scale offered in the SYN-ACK fits them
+    setBuffers(socket, config.sendBufferKb, config.receiveBufferKb, &logger);
+
+    // Set either way: a socket inherited in a hot restart may carry the old value
+    if (!setOption(socket, IPPROTO_TCP, TCP_NODELAY, config.noDelay ? 1 : 0)) {
+        logger.warning("Failed to set TCP_NODELAY on a listening socket");
+    }
+
+#ifdef TCP_DEFER_ACCEPT
+    if (!setOption(socket, IPPROTO_TCP, TCP_DEFER_ACCEPT, config.deferAcceptS)) {
+        logger.warning("Failed to set TCP_DEFER_ACCEPT");
+    }
+#else
+    if (config.deferAcceptS > 0) logger.warning("TCP_DEFER_ACCEPT is not available on this platform");
+#endif
+
+#ifdef TCP_FASTOPEN
+    if (config.fastOpenQueue > 0 && !setOption(socket, IPPROTO_TCP, TCP_FASTOPEN, config.fastOpenQueue)) {
+        logger.warning("Failed to enable TCP Fast Open on a listening socket");
+    }
+#else
+    if (config.fastOpenQueue > 0) logger.warning("TCP Fast Open is not available on this platform");
+#endif
+
+#ifdef SO_BUSY_POLL
+    // Raising it above net.core.busy_read needs CAP_NET_ADMIN
+    if (config.busyPollUs > 0 && !setOption(socket, SOL_SOCKET, SO_BUSY_POLL, config.busyPollUs)) {
+        logger.warning("Failed to set SO_BUSY_POLL (needs CAP_NET_ADMIN above net.core.busy_read)");
+    }
+#else
+    if (config.busyPollUs > 0) logger.warning("SO_BUSY_POLL is not available on this platform");
+#endif
+}
+
+void SocketTuning::applyUpstream(SOCKET socket, const UpstreamSocketConfig& config) {
+    setBuffers(socket, config.sendBufferKb, config.receiveBufferKb, nullptr);
+    if (config.noDelay) {
+        setOption(socket, IPPROTO_TCP, TCP_NODELAY, 1);
+    }
+#ifdef TCP_FASTOPEN_CONNECT
+    // connect() then returns at once and the first send() carries the SYN
+    if (config.fastOpen) {
+        setOption(socket, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, 1);
+    }
+#endif
+}
+
+SOCKET SocketTuning::accept(SOCKET listener, sockaddr* address, socklen_t* length) {
+#ifdef __linux__
+    return ::accept4(listener, address, length, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+    SOCKET socket = ::accept(listener, address, length);
+    if (socket != INVALID_SOCKET && !setNonBlocking(socket)) {
+        closesocket(socket);
+        return INVALID_SOCKET;
+    }
+    return socket;
+#endif
+}
+
+void SocketTuning::checkSystem(const SocketConfig& config, bool tlsListener, Logger& logger) {
+#ifdef __linux__
+    // 0x1 enables Fast Open for connect(), 0x2 for listeners
+    long fastOpen = readSysctl("/proc/sys/net/ipv4/tcp_fastopen");
+    bool serverFastOpen = config.listener.fastOpenQueue > 0 || (tlsListener && config.tlsListener.fastOpenQueue > 0);
+    if (serverFastOpen && fastOpen >= 0 && (fastOpen & 2) == 0) {
+        logger.warning("Listener fast_open_queue is set but net.ipv4.tcp_fastopen (" + std::to_string(fastOpen) +
+                       ") lacks 0x2; SYN data is ignored until it is set");
+    }
+    if (config.upstream.fastOpen && fastOpen >= 0 && (fastOpen & 1) == 0) {
+        logger.warning("Upstream fast_open is set but net.ipv4.tcp_fastopen (" + std::to_string(fastOpen) +
+                       ") lacks 0x1; backend connections use a normal handshake");
+    }
+    bool busyPoll = config.listener.busyPollUs > 0 || (tlsListener && config.tlsListener.busyPollUs > 0);
+    if (busyPoll && readSysctl("/proc/sys/net/core/busy_poll") == 0) {
+        logger.warning("Listener busy_poll_us is set but net.core.busy_poll is 0; epoll_wait still sleeps "
+                       "and only reads busy-poll");
+    }
+#else
+    (void)config;
+    (void)tlsListener;
+    (void)logger;
+#endif
+}
@@ -0,0 +1,784 @@
+#include "StaticFiles.h"
+#include "Router.h"
+#include "ResponseWriter.h"
+#include "Logger.h"
+#include "EventLoop.h"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#if defined(SYS_openat2) && defined(__has_include)
+#if __has_include(<linux/openat2.h>)
+#include <linux/openat2.h>
+#define STATIC_FILES_OPENAT2 1
+#endif
+#endif
+#endif
+
+namespace {
+
+// Without inotify a cached file is trusted for this long after a stat
+constexpr uint64_t kRevalidateMs = 1000;
+constexpr size_t kCopyChunk = 16 * 1024;
+
+#ifdef __linux__
+constexpr uint32_t kWatchMask = IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+                                IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF;
+#endif
+
+struct ContentType {
+    const char* extension;
+    const char* type;
+};
+
+const ContentType kContentTypes[] = {
+    {"html", "text/html; charset=utf-8"},
+    {"htm", "text/html; charset=utf-8"},
+    {"css", "text/css; charset=utf-8"},
+    {"js", "text/javascript; charset=utf-8"},
+    {"mjs", "text/javascript; charset=utf-8"},
+    {"json", "application/json"},
+    {"map", "application/json"},
+    {"txt", "text/plain; charset=utf-8"},
+    {"xml", "application/xml"},
+    {"svg", "image/svg+xml"},
+    {"png", "image/png"},
+    {"jpg", "image/jpeg"},
+    {"jpeg", "image/jpeg"},
+    {"gif", "image/gif"},
+    {"webp", "image/webp"},
+    {"avif", "image/avif"},
+    {"ico", "image/x-icon"},
+    {"woff", "font/woff"},
+    {"woff2", "font/woff2"},
+    {"ttf", "font/ttf"},
+    {"otf", "font/otf"},
+    {"pdf", "application/pdf"},
+    {"wasm", "application/wasm"},
+    {"mp4", "video/mp4"},
+    {"webm", "video/webm"},
+    {"mp3", "audio/mpeg"},
+};
+
+const char* contentTypeOf(const std::string& path) {
+    size_t dot = path.rfind('.');
+    if (dot == std::string::npos || path.find('/', dot) != std::string::npos) return "application/octet-stream";
+    std::string extension = path.substr(dot + 1);
+    std::transform(extension.begin(), extension.end(), extension.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    for (const ContentType& entry : kContentTypes) {
+        if (extension == entry.extension) return entry.type;
+    }
+    return "application/octet-stream";
+}
+
+std::string httpDate(time_t time) {
+    struct tm gmt;
+#ifdef _WIN32
+    gmtime_s(&gmt, &time);
+#else
+    gmtime_r(&time, &gmt);
+#endif
+    char text[40];
+    size_t length = strftime(text, sizeof(text), "%a, %d %b %Y %H:%M:%S GMT", &gmt);
+    return std::string(text, length);
+}
+
+// Rendered at most once per second per thread
+const std::string& currentDate() {
+    thread_local time_t second = 0;
+    thread_local std::string text;
+    time_t now = time(nullptr);
+    if (now != second || text.empty()) {
+        text = httpDate(now);
+        second = now;
+    }
+    return text;
+}
+
+bool parseHttpDate(const std::string& text, time_t& time) {
+#ifdef _WIN32
+    (void)text;
+    (void)time;
+    return false;
+#else
+    struct tm parsed{};
+    const char* end = strptime(text.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &parsed);
+    if (end == nullptr || *end != '\0') return false;
+    time = timegm(&parsed);
+    return time != static_cast<time_t>(-1);
+#endif
+}
+
+std::string trim(const std::string& text) {
+    size_t begin = text.find_first_not_of(" \t");
+    if (begin == std::string::npos) return std::string();
+    return text.substr(begin, text.find_last_not_of(" \t") - begin + 1);
+}
+
+// If-None-Match: weak comparison against every tag in the list, or "*"
+bool matchesAnyTag(const std::string& header, const std::string& etag) {
+    size_t start = 0;
+    while (true) {
+        size_t comma = header.find(',', start);
+        std::string tag = trim(header.substr(start, comma == std::string::npos ? std::string::npos : comma - start));
+        if (tag == "*") return true;
+        if (tag.compare(0, 2, "W/") == 0) tag.erase(0, 2);
+        if (tag == etag) return true;
+        if (comma == std::string::npos) return false;
+        start = comma + 1;
+    }
+}
+
+// If-Range: the range only applies to the version the client already has,
+// named by a strong tag or the exact Last-Modified date
+bool rangeStillApplies(const HttpHead& request, const StaticFile& file) {
+    const std::string* ifRange = request.findHeader("If-Range");
+    if (ifRange == nullptr) return true;
+    std::string value = trim(*ifRange);
+    if (!value.empty() && value[0] == '"') return value == file.etag;
+    return value == file.lastModified;
+}
+
+bool parseNumber(const std::string& text, uint64_t& value) {
+    if (text.empty() || text.size() > 18) return false;
+    value = 0;
+    for (char c : text) {
+        if (c < '0' || c > '9') return false;
+        value = value * 10 + static_cast<uint64_t>(c - '0');
+    }
+    return true;
+}
+
+int hexValue(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+std::string directoryOf(const std::string& path) {
+    size_t slash = path.rfind('/');
+    return slash == std::string::npos ? std::string(".") : slash == 0 ? std::string("/") : path.substr(0, slash);
+}
+
+#ifndef _WIN32
+// Opens relative (no "..", see mapPath) below the root directory without
+// leaving it: openat2 refuses a symlink out of the root with EXDEV, the
+// fallback follows no symlink at all and fails with ELOOP or ENOTDIR
+int openBeneath(int root, const std::string& relative, int flags) {
+#ifdef STATIC_FILES_OPENAT2
+    // ENOSYS before Linux 5.6; EPERM when a seccomp filter blocks it
+    static std::atomic<bool> unsupported{false};
+    if (!unsupported.load(std::memory_order_relaxed)) {
+        open_how how{};
+        how.flags = static_cast<uint64_t>(flags);
+        how.resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS;
+        int fd = static_cast<int>(syscall(SYS_openat2, root, relative.c_str(), &how, sizeof(how)));
+        if (fd >= 0 || (errno != ENOSYS && errno != EPERM)) return fd;
+        unsupported.store(true, std::memory_order_relaxed);
+    }
+#endif
+    int directory = root;
+    size_t start = 0;
+    while (true) {
+        size_t slash = relative.find('/', start);
+        bool last = slash == std::string::npos;
+        std::string name = relative.substr(start, last ? std::string::npos : slash - start);
+        int fd = openat(directory, name.c_str(),
+                        last ? flags | O_NOFOLLOW : O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        int failure = errno;
+        if (directory != root) ::close(directory);
+        if (fd < 0 || last) {
+            errno = failure;
+            return fd;
+        }
+        directory = fd;
+        start = slash + 1;
+    }
+}
+#endif
+
+} // namespace
+
+StaticFile::~StaticFile() {
+#ifndef _WIN32
+    if (data != nullptr) {
+        munmap(const_cast<char*>(data), static_cast<size_t>(size));
+    }
+    if (fd >= 0) {
+        ::close(fd);
+    }
+#endif
+}
+
+StaticFiles::StaticFiles(Logger& log)
+    : logger(log), enabled(false), shardCapacity(1), notifyFd(-1), wakeFds{-1, -1} {
+}
+
+StaticFiles::~StaticFiles() {
+    stop();
+    closeRoots();
+}
+
+void StaticFiles::configure(const Config& serverConfig) {
+    stop();
+    config = serverConfig.getStaticFiles();
+    enabled = false;
+    closeRoots();
+    for (const RouteConfig& route : serverConfig.getRoutes()) {
+        if (!route.isStatic()) continue;
+        enabled = true;
+        const std::string& root = route.staticFiles.root;
+        if (roots.count(root) > 0) continue;
+#ifdef _WIN32
+        roots[root] = -1;
+#else
+        roots[root] = ::open(root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (roots[root] < 0) {
+            logger.warning("Static route " + route.prefix + ": " + root + " is not a directory");
+        }
+#endif
+    }
+
+    shards.clear();
+    size_t shardCount = static_cast<size_t>(config.cacheShards);
+    shardCapacity = std::max<size_t>(1, static_cast<size_t>(config.maxOpenFiles) / shardCount);
+    for (size_t i = 0; i < shardCount; i++) {
+        shards.push_back(std::unique_ptr<Shard>(new Shard()));
+    }
+}
+
+void StaticFiles::start() {
+    if (!enabled) return;
+#ifdef _WIN32
+    logger.warning("Static routes need a POSIX build; they answer 404");
+#else
+#ifdef __linux__
+    notifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (notifyFd >= 0 && pipe2(wakeFds, O_CLOEXEC) == 0) {
+        thread = std::thread(&StaticFiles::run, this);
+        return;
+    }
+    stop();
+#endif
+    logger.warning("Static files: changes are not watched; cached files are re-checked every " +
+                   std::to_string(kRevalidateMs) + " ms");
+#endif
+}
+
+void StaticFiles::stop() {
+#ifndef _WIN32
+    if (thread.joinable()) {
+        char wake = 0;
+        if (write(wakeFds[1], &wake, 1) < 0) {
+            logger.warning("Static files: failed to wake the watcher thread");
+        }
+        thread.join();
+    }
+    int* descriptors[] = {&notifyFd, &wakeFds[0], &wakeFds[1]};
+    for (int* fd : descriptors) {
+        if (*fd >= 0) {
+            ::close(*fd);
+            *fd = -1;
+        }
+    }
+#endif
+    std::lock_guard<std::mutex> lock(watchMutex);
+    watches.clear();
+}
+
+void StaticFiles::closeRoots() {
+#ifndef _WIN32
+    for (const auto& root : roots) {
+        if (root.second >= 0) ::close(root.second);
+    }
+#endif
+    roots.clear();
+}
+
+void StaticFiles::respond(const Route& route, const HttpHead& request, StaticResponse& response) {
+    const StaticRouteConfig& settings = route.config.staticFiles;
+    HttpHead& head = response.head;
+    head.version = "HTTP/1.1";
+
+    if (request.method != "GET" && request.method != "HEAD") {
+        error(response, 405);
+        head.headers.emplace_back("Allow", "GET, HEAD");
+        return;
+    }
+
+    std::string relative;
+    if (!mapPath(request.path, route.config.prefix.size(), settings.index, relative)) {
+        error(response, 404);
+        return;
+    }
+    std::string path = settings.root;
+    if (path.back() != '/') path += '/';
+    path += relative;
+
+    auto root = roots.find(settings.root);
+    int failure = ENOENT;
+    std::shared_ptr<const StaticFile> file;
+    if (root != roots.end() && root->second >= 0) {
+        file = lookup(path, root->second, relative, failure);
+    }
+    if (!file) {
+        if (failure == EISDIR) {
+            // A directory named without its slash: relative links inside need it
+            size_t query = request.path.find('?');
+            std::string location = request.path.substr(0, query) + "/";
+            if (query != std::string::npos) location += request.path.substr(query);
+            error(response, 301);
+            head.headers.emplace_back("Location", location);
+        } else if (failure == EACCES) {
+            error(response, 403);
+        } else if (failure == ENOENT || failure == ENOTDIR || failure == ENAMETOOLONG || failure == ELOOP ||
+                   failure == EXDEV) {
+            error(response, 404);
+        } else {
+            logger.error("Failed to open static file " + path + ": " + strerror(failure));
+            error(response, 500);
+        }
+        return;
+    }
+
+    head.headers.emplace_back("Date", currentDate());
+    head.headers.emplace_back("Last-Modified", file->lastModified);
+    head.headers.emplace_back("ETag", file->etag);
+
+    // If-None-Match takes precedence; If-Modified-Since only applies without it
+    bool notModified = false;
+    const std::string* ifNoneMatch = request.findHeader("If-None-Match");
+    const std::string* ifModifiedSince = request.findHeader("If-Modified-Since");
+    time_t since = 0;
+    if (ifNoneMatch != nullptr) {
+        notModified = matchesAnyTag(*ifNoneMatch, file->etag);
+    } else if (ifModifiedSince != nullptr && parseHttpDate(trim(*ifModifiedSince), since)) {
+        notModified = file->modified <= since;
+    }
+    if (notModified) {
+        head.statusCode = 304;
+        head.reason = ResponseWriter::statusText(304);
+        return;
+    }
+
+    uint64_t first = 0;
+    uint64_t last = 0;
+    Range range = Range::None;
+    const std::string* rangeHeader = request.findHeader("Range");
+    if (rangeHeader != nullptr && request.method == "GET" && rangeStillApplies(request, *file)) {
+        range = parseRange(*rangeHeader, file->size, first, last);
+    }
+    if (range == Range::Unsatisfiable) {
+        head.headers.clear();
+        error(response, 416);
+        head.headers.emplace_back("Content-Range", "bytes */" + std::to_string(file->size));
+        return;
+    }
+
+    uint64_t length = file->size;
+    if (range == Range::Satisfiable) {
+        length = last - first + 1;
+        head.statusCode = 206;
+        head.headers.emplace_back("Content-Range", "bytes " + std::to_string(first) + "-" + std::to_string(last) +
+                                                   "/" + std::to_string(file->size));
+    } else {
+        head.statusCode = 200;
+    }
+    head.reason = ResponseWriter::statusText(head.statusCode);
+    head.headers.emplace_back("Accept-Ranges", "bytes");
+    head.headers.emplace_back("Content-Type", file->contentType);
+    head.headers.emplace_back("Content-Length", std::to_string(length));
+
+    response.offset = first;
+    response.length = request.method == "HEAD" ? 0 : length;
+    if (response.length > 0) {
+        response.file = std::move(file);
+    }
+}
+
+void StaticFiles::error(StaticResponse& response, int statusCode) {
+    HttpHead& head = response.head;
+    head.statusCode = statusCode;
+    head.reason = ResponseWriter::statusText(statusCode);
+    response.body = head.reason;
+    head.headers.emplace_back("Date", currentDate());
+    head.headers.emplace_back("Content-Type", "text/plain");
+    head.headers.emplace_back("Content-Length", std::to_string(response.body.size()));
+}
+
+bool StaticFiles::mapPath(const std::string& requestPath, size_t prefixLength, const std::string& index,
+                          std::string& relative) {
+    size_t end = std::min(requestPath.find('?'), requestPath.find('#'));
+    if (end == std::string::npos) end = requestPath.size();
+    if (prefixLength > end) return false;
+
+    // Decoded segment by segment; a decoded '/' or NUL never reaches the file system
+    relative.clear();
+    std::string segment;
+    bool directory = true;
+    for (size_t i = prefixLength; i <= end; i++) {
+        if (i == end || requestPath[i] == '/') {
+            if (segment == "..") return false;
+            if (!segment.empty() && segment != ".") {
+                if (!relative.empty()) relative += '/';
+                relative += segment;
+            }
+            directory = segment.empty() || segment == ".";
+            segment.clear();
+            continue;
+        }
+        char c = requestPath[i];
+        if (c == '%') {
+            int high = i + 2 < end ? hexValue(requestPath[i + 1]) : -1;
+            int low = high >= 0 ? hexValue(requestPath[i + 2]) : -1;
+            if (low < 0) return false;
+            c = static_cast<char>(high * 16 + low);
+            if (c == '/' || c == '\0') return false;
+            i += 2;
+        }
+        segment += c;
+    }
+
+    if (directory) {
+        if (!relative.empty()) relative += '/';
+        relative += index;
+    }
+    return true;
+}
+
+StaticFiles::Range StaticFiles::parseRange(const std::string& header, uint64_t size, uint64_t& first,
+                                           uint64_t& last) {
+    std::string value = trim(header);
+    if (value.compare(0, 6, "bytes=") != 0 || value.find(',') != std::string::npos) return Range::None;
+    std::string spec = trim(value.substr(6));
+    size_t dash = spec.find('-');
+    if (dash == std::string::npos) return Range::None;
+
+    uint64_t number = 0;
+    if (dash == 0) {
+        // Suffix: the last N bytes
+        if (!parseNumber(spec.substr(1), number)) return Range::None;
+        if (number == 0 || size == 0) return Range::Unsatisfiable;
+        first = number < size ? size - number : 0;
+        last = size - 1;
+        return Range::Satisfiable;
+    }
+
+    if (!parseNumber(spec.substr(0, dash), first)) return Range::None;
+    last = size > 0 ? size - 1 : 0;
+    if (dash + 1 < spec.size()) {
+        if (!parseNumber(spec.substr(dash + 1), number)) return Range::None;
+        if (number < first) return Range::None;
+        last = std::min(last, number);
+    }
+    if (first >= size) return Range::Unsatisfiable;
+    return Range::Satisfiable;
+}
+
+StaticFiles::Shard& StaticFiles::shardFor(const std::string& path) {
+    return *shards[std::hash<std::string>()(path) % shards.size()];
+}
+
+std::shared_ptr<const StaticFile> StaticFiles::lookup(const std::string& path, int root, const std::string& relative,
+                                                      int& error) {
+    Shard& shard = shardFor(path);
+    uint64_t generation;
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto found = shard.files.find(path);
+        if (found != shard.files.end() && unchanged(path, found->second)) {
+            shard.order.splice(shard.order.end(), shard.order, found->second.position);
+            stats.hits.fetch_add(1, std::memory_order_relaxed);
+            return found->second.file;
+        }
+        generation = shard.generation;
+    }
+    stats.misses.fetch_add(1, std::memory_order_relaxed);
+
+    // Watched before it is opened, so a change in between is not missed
+    bool watched = watch(path);
+    std::shared_ptr<const StaticFile> file = open(path, root, relative, error);
+    if (!file) return nullptr;
+
+    // Dropped outside the lock: closing the last reference is a syscall
+    std::shared_ptr<const StaticFile> dropped;
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    // An invalidation since the miss may be for this file, already read
+    // from its old version: serve it this once, but do not cache it
+    if (shard.generation != generation) return file;
+    auto found = shard.files.find(path);
+    if (found != shard.files.end()) {
+        // Stale, or opened by another worker at the same time
+        dropped = std::move(found->second.file);
+        found->second.file = file;
+        found->second.watched = watched;
+        found->second.validatedMs = EventLoop::monotonicMs();
+        shard.order.splice(shard.order.end(), shard.order, found->second.position);
+        return file;
+    }
+    if (shard.files.size() >= shardCapacity) {
+        auto oldest = shard.files.find(shard.order.front());
+        dropped = std::move(oldest->second.file);
+        shard.files.erase(oldest);
+        shard.order.pop_front();
+        stats.evictions.fetch_add(1, std::memory_order_relaxed);
+    }
+    shard.order.push_back(path);
+    shard.files.emplace(path, Entry{file, std::prev(shard.order.end()), watched, EventLoop::monotonicMs()});
+    return file;
+}
+
+// Called with the shard locked; only files whose directory is not watched
+// are checked, at most once per kRevalidateMs
+bool StaticFiles::unchanged(const std::string& path, Entry& entry) {
+    if (entry.watched) return true;
+    uint64_t now = EventLoop::monotonicMs();
+    if (now - entry.validatedMs < kRevalidateMs) return true;
+#ifndef _WIN32
+    struct stat status;
+    const StaticFile& file = *entry.file;
+    if (stat(path.c_str(), &status) == 0 && static_cast<uint64_t>(status.st_size) == file.size &&
+        static_cast<uint64_t>(status.st_ino) == file.inode && status.st_mtime == file.modified) {
+        entry.validatedMs = now;
+        return true;
+    }
+#endif
+    stats.invalidations.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+std::shared_ptr<const StaticFile> StaticFiles::open(const std::string& path, int root, const std::string& relative,
+                                                    int& error) {
+#ifdef _WIN32
+    (void)path;
+    (void)root;
+    (void)relative;
+    error = ENOENT;
+    return nullptr;
+#else
+    // Non-blocking, so a FIFO under the root cannot stall the worker
+    int fd = openBeneath(root, relative, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+        error = errno;
+        return nullptr;
+    }
+    std::shared_ptr<StaticFile> file(new StaticFile());
+    file->fd = fd;
+
+    struct stat status;
+    if (fstat(fd, &status) != 0) {
+        error = errno;
+        return nullptr;
+    }
+    if (!S_ISREG(status.st_mode)) {
+        error = S_ISDIR(status.st_mode) ? EISDIR : ENOENT;
+        return nullptr;
+    }
+
+    file->size = static_cast<uint64_t>(status.st_size);
+    file->inode = static_cast<uint64_t>(status.st_ino);
+    file->modified = status.st_mtime;
+    char etag[48];
+    snprintf(etag, sizeof(etag), "\"%llx-%llx\"", static_cast<unsigned long long>(status.st_mtime),
+             static_cast<unsigned long long>(status.st_size));
+    file->etag = etag;
+    file->lastModified = httpDate(status.st_mtime);
+    file->contentType = contentTypeOf(path);
+
+    if (file->size > 0 && file->size <= static_cast<uint64_t>(config.mmapMaxKb) * 1024) {
+        size_t length = static_cast<size_t>(file->size);
+        void* region = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (region != MAP_FAILED) {
+            if (read(*file, 0, static_cast<char*>(region), length) && mprotect(region, length, PROT_READ) == 0) {
+                file->data = static_cast<const char*>(region);
+            } else {
+                munmap(region, length);
+            }
+        }
+    }
+    return file;
+#endif
+}
+
+long StaticFiles::send(SOCKET socket, const StaticFile& file, uint64_t offset, size_t length) {
+#ifdef _WIN32
+    (void)socket;
+    (void)file;
+    (void)offset;
+    (void)length;
+    return -1;
+#else
+    if (file.data != nullptr) {
+        return ::send(socket, file.data + offset, length, MSG_NOSIGNAL);
+    }
+#ifdef __linux__
+    off_t position = static_cast<off_t>(offset);
+    return sendfile(socket, file.fd, &position, length);
+#else
+    char buffer[kCopyChunk];
+    size_t chunk = std::min(length, sizeof(buffer));
+    if (!read(file, offset, buffer, chunk)) return 0;
+    return ::send(socket, buffer, chunk, MSG_NOSIGNAL);
+#endif
+#endif
+}
+
+bool StaticFiles::read(const StaticFile& file, uint64_t offset, char* buffer, size_t length) {
+    if (file.data != nullptr) {
+        memcpy(buffer, file.data + offset, length);
+        return true;
+    }
+#ifdef _WIN32
+    (void)buffer;
+    return false;
+#else
+    while (length > 0) {
+        ssize_t count = pread(file.fd, buffer, length, static_cast<off_t>(offset));
+        if (count < 0 && errno == EINTR) continue;
+        // The file shrank since it was cached
+        if (count <= 0) return false;
+        buffer += count;
+        offset += static_cast<uint64_t>(count);
+        length -= static_cast<size_t>(count);
+    }
+    return true;
+#endif
+}
+
+bool StaticFiles::watch(const std::string& path) {
+#ifdef __linux__
+    if (notifyFd < 0) return false;
+    std::string directory = directoryOf(path);
+    int descriptor = inotify_add_watch(notifyFd, directory.c_str(), kWatchMask);
+    if (descriptor < 0) {
+        logger.debug("Static files: cannot watch " + directory + ": " + strerror(errno));
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(watchMutex);
+    watches[descriptor] = directory;
+    return true;
+#else
+    (void)path;
+    return false;
+#endif
+}
+
+void StaticFiles::run() {
+#ifdef __linux__
+    // Aligned for the inotify_event structs read into it
+    alignas(inotify_event) char buffer[16 * 1024];
+    pollfd descriptors[2] = {{notifyFd, POLLIN, 0}, {wakeFds[0], POLLIN, 0}};
+
+    while (true) {
+        if (poll(descriptors, 2, -1) < 0 && errno != EINTR) {
+            logger.error("Static files: watcher poll failed; cached files may go stale");
+            return;
+        }
+        if (descriptors[1].revents != 0) return;
+        if (descriptors[0].revents == 0) continue;
+
+        ssize_t length;
+        while ((length = ::read(notifyFd, buffer, sizeof(buffer))) > 0) {
+            for (char* cursor = buffer; cursor < buffer + length;) {
+                const inotify_event* event = reinterpret_cast<const inotify_event*>(cursor);
+                cursor += sizeof(inotify_event) + event->len;
+                if (event->mask & IN_Q_OVERFLOW) {
+                    // Events were lost: nothing cached can be trusted
+                    invalidateAll();
+                    continue;
+                }
+
+                std::string directory;
+                {
+                    std::lock_guard<std::mutex> lock(watchMutex);
+                    auto found = watches.find(event->wd);
+                    if (found == watches.end()) continue;
+                    directory = found->second;
+                    if (event->mask & IN_IGNORED) watches.erase(found);
+                }
+                if (event->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)) {
+                    invalidate(directory, true);
+                } else if (event->len > 0) {
+                    invalidate(directory + "/" + event->name, (event->mask & IN_ISDIR) != 0);
+                }
+            }
+        }
+    }
+#endif
+}
+
+void StaticFiles::invalidate(const std::string& path, bool directory) {
+    if (!directory) {
+        Shard& shard = shardFor(path);
+        std::shared_ptr<const StaticFile> dropped;
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.generation++;
+        auto found = shard.files.find(path);
+        if (found == shard.files.end()) return;
+        dropped = std::move(found->second.file);
+        shard.order.erase(found->second.position);
+        shard.files.erase(found);
+        stats.invalidations.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    std::string below = path + "/";
+    for (const auto& shard : shards) {
+        std::vector<std::shared_ptr<const StaticFile>> dropped;
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        shard->generation++;
+        for (auto entry = shard->files.begin(); entry != shard->files.end();) {
+            if (entry->first.compare(0, below.size(), below) != 0) {
+                ++entry;
+                continue;
+            }
+            dropped.push_back(std::move(entry->second.file));
+            shard->order.erase(entry->second.position);
+            entry = shard->files.erase(entry);
+            stats.invalidations.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+}
+
+void StaticFiles::invalidateAll() {
+    for (const auto& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        shard->generation++;
+        stats.invalidations.fetch_add(shard->files.size(), std::memory_order_relaxed);
+        shard->files.clear();
+        shard->order.clear();
+    }
+}
+
+size_t StaticFiles::getCachedFiles() const {
+    size_t total = 0;
+    for (const auto& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        total += shard->files.size();
+    }
+    return total;
+}
+
+void StaticFiles::printStatus() const {
+    if (!enabled) return;
+    std::cout << "\n=== Static Files Status ===" << std::endl;
+    std::cout << "Cached: " << getCachedFiles() << " of " << shardCapacity * shards.size() << " files" << std::endl;
+    std::cout << "Hits: " << stats.hits.load() << ", misses: " << stats.misses.load() << std::endl;
+    std::cout << "Evictions: " << stats.evictions.load() << ", invalidations: " << stats.invalidations.load()
+              << std::endl;
+    std::cout << "===========================\n" << std::endl;
+}
@@ -0,0 +1,462 @@
+#include "TcpTunnel.h"
+#include "Worker.h"
+#include "Server.h"
+#include "Tls.h"
+#include <algorithm>
+#include <cstring>
+#ifdef __linux__
+#include <fcntl.h>
+#endif
+
+namespace {
+
+// fill/drain results besides a byte count
+constexpr long kWouldBlock = -1;
+constexpr long kFailed = -2;
+
+// Fill/drain rounds per event before yielding to other sockets on the loop
+constexpr int kMaxRounds = 16;
+
+#ifdef _WIN32
+constexpr int kShutdownWrite = SD_SEND;
+#else
+constexpr int kShutdownWrite = SHUT_WR;
+#endif
+
+}
+
+void TcpTunnel::Endpoint::onEvent(uint32_t events) {
+    if (tunnel.closed) return;
+    tunnel.onEvent(upstream, events);
+}
+
+TcpTunnel::Direction::Direction(bool backendBound)
+    : toBackend(backendBound), eof(false), shutDown(false), stalled(false), queued(0), bytes(0), preambleOffset(0),
+      spliced(false), offset(0) {
+#ifdef __linux__
+    pipe[0] = -1;
+    pipe[1] = -1;
+#endif
+}
+
+TcpTunnel::TcpTunnel(Worker& w, SOCKET socket)
+    : worker(w), server(w.getServer()), logger(w.getServer().getLogger()),
+      clientSocket(socket), upstreamSocket(INVALID_SOCKET), relayScheduled(false),
+      clientEndpoint(*this, false), upstreamEndpoint(*this, true), clientEvents(0), upstreamEvents(0),
+      connecting(false), relaying(false), closed(false),
+      backend(nullptr), backendIndex(0),
+      toBackend(true), toClient(false), capacity(w.getServer().getConfig().getConnectionBufferSize()),
+      startUs(EventLoop::monotonicUs()), lastActivityMs(0) {
+    clientIP = Server::getClientIP(clientSocket);
+    timer.setCallback([this] { onTimer(); });
+}
+
+TcpTunnel::TcpTunnel(Worker& w, SOCKET client, SOCKET upstream, BackendServer* target, std::string toClientData,
+                     std::string toBackendData, std::unique_ptr<TlsStream> clientTls)
+    : TcpTunnel(w, client) {
+    tls = std::move(clientTls);
+    upstreamSocket = upstream;
+    backend = target;
+    backendIndex = server.getLoadBalancer().indexOf(target);
+    backendUrl = target->host + ":" + std::to_string(target->port);
+    toClient.preamble = std::move(toClientData);
+    toBackend.preamble = std::move(toBackendData);
+}
+
+TcpTunnel::~TcpTunnel() {
+    close();
+    server.releaseConnection();
+}
+
+void TcpTunnel::start() {
+    if (upstreamSocket != INVALID_SOCKET) {
+        beginRelay();
+        return;
+    }
+    // The client is not read until the backend connection is up; what it
+    // sends meanwhile waits in its socket buffer
+    connectBackend();
+}
+
+BackendServer* TcpTunnel::pickBackend() {
+    LoadBalancer& loadBalancer = server.getLoadBalancer();
+    if (failed.empty()) {
+        return loadBalancer.getNextBackend(clientIP);
+    }
+
+    // Ask the balancer first; sticky algorithms (IP hash) fall through to a scan
+    size_t count = loadBalancer.getBackendCount();
+    for (size_t i = 0; i < 2 * count; i++) {
+        BackendServer* candidate = i < count ? loadBalancer.getNextBackend(clientIP) : loadBalancer.getBackend(i - count);
+        if (candidate == nullptr || !candidate->isHealthy ||
+            std::find(failed.begin(), failed.end(), candidate) != failed.end()) {
+            continue;
+        }
+        return candidate;
+    }
+    return nullptr;
+}
+
+void TcpTunnel::connectBackend() {
+    LoadBalancer& loadBalancer = server.getLoadBalancer();
+    backend = pickBackend();
+    if (backend == nullptr) {
+        logger.error("No healthy backend available for tunnel from " + clientIP);
+        close();
+        return;
+    }
+    backendIndex = loadBalancer.indexOf(backend);
+    backendUrl = backend->host + ":" + std::to_string(backend->port);
+    // Counted from the start of the connect so LEAST_CONNECTIONS sees live tunnels
+    loadBalancer.incrementConnections(backend->host, backend->port);
+    logger.info("Tunneling " + clientIP + " to backend: " + backendUrl + " (algorithm: " +
+                server.getConfig().algorithmToString() + ")");
+
+    SocketAddress backendAddr;
+    if (!server.resolveBackend(backend, backendAddr)) {
+        connectFailed("unresolvable");
+        return;
+    }
+
+    upstreamSocket = socket(backendAddr.family(), SOCK_STREAM, 0);
+    if (upstreamSocket == INVALID_SOCKET || !setNonBlocking(upstreamSocket)) {
+        connectFailed("socket creation failed");
+        return;
+    }
+    if (connect(upstreamSocket, backendAddr.get(), backendAddr.length) == SOCKET_ERROR &&
+        !isConnectInProgress(lastSocketError())) {
+        connectFailed("unreachable");
+        return;
+    }
+    if (!worker.getLoop().add(upstreamSocket, EventLoop::Writable, &upstreamEndpoint)) {
+        connectFailed("event registration failed");
+        return;
+    }
+    upstreamEvents = EventLoop::Writable;
+    connecting = true;
+    worker.getLoop().timers().schedule(timer, static_cast<uint64_t>(server.getConfig().getUpstreamConnectTimeout()));
+}
+
+void TcpTunnel::connectFailed(const std::string& reason) {
+    logger.error("Failed to connect tunnel to backend " + backendUrl + ": " + reason);
+    worker.getMetrics().recordUpstreamFailure(backendIndex);
+    failed.push_back(backend);
+
+    timer.cancel();
+    connecting = false;
+    if (upstreamSocket != INVALID_SOCKET) {
+        if (upstreamEvents != 0) {
+            worker.getLoop().remove(upstreamSocket);
+            upstreamEvents = 0;
+        }
+        closesocket(upstreamSocket);
+        upstreamSocket = INVALID_SOCKET;
+    }
+    releaseBackend();
+
+    // Nothing has been read from the client yet, so any other backend will do
+    connectBackend();
+}
+
+void TcpTunnel::onConnected() {
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if (getsockopt(upstreamSocket, SOL_SOCKET, SO_ERROR, reinterpret_cast<char*>(&error), &length) != 0 || error != 0) {
+        connectFailed("unreachable");
+        return;
+    }
+    connecting = false;
+    beginRelay();
+}
+
+void TcpTunnel::beginRelay() {
+#ifdef __linux__
+    // TLS input is decrypted by the library; output can be spliced once
+    // the kernel encrypts it
+    toBackend.spliced = !tls;
+    toClient.spliced = !tls || tls->sendsInKernel();
+    for (Direction* direction : {&toBackend, &toClient}) {
+        if (!direction->spliced) continue;
+        if (pipe2(direction->pipe, O_NONBLOCK | O_CLOEXEC) != 0) {
+            logger.error("Failed to create tunnel pipe");
+            close();
+            return;
+        }
+        // Best effort: the default pipe holds 64 KB, and unprivileged
+        // processes are capped at /proc/sys/fs/pipe-max-size
+        fcntl(direction->pipe[1], F_SETPIPE_SZ, static_cast<int>(capacity));
+    }
+    for (Direction* direction : {&toBackend, &toClient}) {
+        int size = direction->spliced ? fcntl(direction->pipe[1], F_GETPIPE_SZ) : 0;
+        if (size > 0) capacity = std::min(capacity, static_cast<size_t>(size));
+    }
+#endif
+    for (Direction* direction : {&toBackend, &toClient}) {
+        if (!direction->spliced) direction->buffer.resize(capacity);
+    }
+
+    // Interactive protocols must not wait on Nagle's algorithm
+    int noDelay = 1;
+    setsockopt(clientSocket, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<char*>(&noDelay), sizeof(noDelay));
+    setsockopt(upstreamSocket, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<char*>(&noDelay), sizeof(noDelay));
+
+    relaying = true;
+    lastActivityMs = EventLoop::monotonicMs();
+    worker.getLoop().timers().schedule(timer, static_cast<uint64_t>(server.getConfig().getTunnelIdleTimeout()));
+    relay();
+}
+
+void TcpTunnel::onEvent(bool upstream, uint32_t events) {
+    if (connecting) {
+        if (upstream && (events & (EventLoop::Writable | EventLoop::Closed))) {
+            onConnected();
+        }
+        return;
+    }
+    relay();
+}
+
+void TcpTunnel::onTimer() {
+    if (connecting) {
+        server.getTimeoutCounters().upstreamConnect.fetch_add(1, std::memory_order_relaxed);
+        connectFailed("connect timed out");
+        return;
+    }
+
+    // Activity only stamps a time; the timer is pushed back when it fires
+    uint64_t idleMs = static_cast<uint64_t>(server.getConfig().getTunnelIdleTimeout());
+    uint64_t quietMs = EventLoop::monotonicMs() - lastActivityMs;
+    if (quietMs < idleMs) {
+        worker.getLoop().timers().schedule(timer, idleMs - quietMs);
+        return;
+    }
+    server.getTimeoutCounters().tunnelIdle.fetch_add(1, std::memory_order_relaxed);
+    logger.info("Tunnel from " + clientIP + " to " + backendUrl + " idle timeout");
+    close();
+}
+
+void TcpTunnel::relay() {
+    Pump upward = pump(toBackend, clientSocket, upstreamSocket);
+    Pump downward = upward == Pump::Failed ? Pump::Failed : pump(toClient, upstreamSocket, clientSocket);
+    if (upward == Pump::Failed || downward == Pump::Failed) {
+        logger.debug("Tunnel from " + clientIP + " to " + backendUrl + " reset");
+        close();
+        return;
+    }
+    if (upward == Pump::Progress || downward == Pump::Progress) {
+        lastActivityMs = EventLoop::monotonicMs();
+    }
+    if (toBackend.shutDown && toClient.shutDown) {
+        close();
+        return;
+    }
+    updateEvents();
+
+    // Input the TLS layer already decrypted raises no readiness
+    if (!closed && tls && tls->hasPending() && toBackend.queued < capacity && !relayScheduled) {
+        relayScheduled = true;
+        worker.getLoop().defer([this] {
+            relayScheduled = false;
+            if (!closed) relay();
+        });
+    }
+}
+
+TcpTunnel::Pump TcpTunnel::pump(Direction& direction, SOCKET from, SOCKET to) {
+    bool progressed = false;
+    for (int round = 0; round < kMaxRounds; round++) {
+        bool moved = false;
+        if (direction.hasOutput()) {
+            long written = drain(direction, to);
+            if (written == kFailed) return Pump::Failed;
+            if (written > 0) {
+                direction.bytes += static_cast<uint64_t>(written);
+                direction.stalled = false;
+                worker.getMetrics().addTunnelBytes(backendIndex, direction.toBackend, static_cast<uint64_t>(written));
+                moved = true;
+            }
+        }
+        if (!direction.eof && !direction.stalled && direction.queued < capacity) {
+            long read = fill(direction, from);
+            if (read == kFailed) return Pump::Failed;
+            if (read == 0) {
+                direction.eof = true;
+                moved = true;
+            } else if (read > 0) {
+                moved = true;
+            } else if (direction.queued > 0) {
+                // Either the socket is empty or the pipe ran out of slots
+                // before bytes; both wait for the writer to drain
+                direction.stalled = true;
+            }
+        }
+        if (!moved) break;
+        progressed = true;
+    }
+
+    if (direction.eof && !direction.hasOutput() && !direction.shutDown) {
+        if (tls && to == clientSocket) tls->shutdown();
+        shutdown(to, kShutdownWrite);
+        direction.shutDown = true;
+        progressed = true;
+    }
+    return progressed ? Pump::Progress : Pump::Idle;
+}
+
+long TcpTunnel::fill(Direction& direction, SOCKET from) {
+    size_t room = capacity - direction.queued;
+#ifdef __linux__
+    if (direction.spliced) {
+        ssize_t moved = splice(from, nullptr, direction.pipe[1], nullptr, room, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (moved < 0) {
+            int error = errno;
+            return isWouldBlock(error) || isInterrupted(error) ? kWouldBlock : kFailed;
+        }
+        direction.queued += static_cast<size_t>(moved);
+        return static_cast<long>(moved);
+    }
+#endif
+    if (direction.queued == 0) {
+        direction.offset = 0;
+    } else if (direction.offset + direction.queued == capacity) {
+        std::memmove(&direction.buffer[0], &direction.buffer[direction.offset], direction.queued);
+        direction.offset = 0;
+    }
+    room = std::min(room, capacity - direction.offset - direction.queued);
+    long moved = receive(from, &direction.buffer[direction.offset + direction.queued], room);
+    if (moved < 0) {
+        int error = lastSocketError();
+        return isWouldBlock(error) || isInterrupted(error) ? kWouldBlock : kFailed;
+    }
+    direction.queued += static_cast<size_t>(moved);
+    return moved;
+}
+
+long TcpTunnel::drain(Direction& direction, SOCKET to) {
+    if (direction.preambleOffset < direction.preamble.size()) {
+        long sent = transmit(to, direction.preamble.data() + direction.preambleOffset,
+                             direction.preamble.size() - direction.preambleOffset);
+        if (sent < 0) {
+            int error = lastSocketError();
+            return isWouldBlock(error) || isInterrupted(error) ? kWouldBlock : kFailed;
+        }
+        direction.preambleOffset += static_cast<size_t>(sent);
+        if (direction.preambleOffset == direction.preamble.size()) {
+            std::string().swap(direction.preamble);
+            direction.preambleOffset = 0;
+        }
+        return sent;
+    }
+
+#ifdef __linux__
+    if (direction.spliced) {
+        ssize_t moved = splice(direction.pipe[0], nullptr, to, nullptr, direction.queued,
+                               SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (moved < 0) {
+            int error = errno;
+            return isWouldBlock(error) || isInterrupted(error) ? kWouldBlock : kFailed;
+        }
+        direction.queued -= static_cast<size_t>(moved);
+        return static_cast<long>(moved);
+    }
+#endif
+    long moved = transmit(to, &direction.buffer[direction.offset], direction.queued);
+    if (moved < 0) {
+        int error = lastSocketError();
+        return isWouldBlock(error) || isInterrupted(error) ? kWouldBlock : kFailed;
+    }
+    direction.offset += static_cast<size_t>(moved);
+    direction.queued -= static_cast<size_t>(moved);
+    return moved;
+}
+
+long TcpTunnel::receive(SOCKET from, char* buffer, size_t length) {
+    if (tls && from == clientSocket) return tls->read(buffer, length);
+    return recv(from, buffer, static_cast<int>(length), 0);
+}
+
+long TcpTunnel::transmit(SOCKET to, const char* data, size_t length) {
+    if (tls && to == clientSocket) return tls->write(data, length);
+    return send(to, data, static_cast<int>(length), MSG_NOSIGNAL);
+}
+
+uint32_t TcpTunnel::wantedEvents(const Direction& reading, const Direction& writing) const {
+    uint32_t events = 0;
+    if (!reading.eof && !reading.stalled && reading.queued < capacity) {
+        events |= EventLoop::Readable;
+    }
+    if (writing.hasOutput()) {
+        events |= EventLoop::Writable;
+    }
+    return events;
+}
+
+bool TcpTunnel::setEvents(SOCKET socket, uint32_t& current, uint32_t wanted, Endpoint& endpoint) {
+    if (wanted == current) return true;
+
+    // A socket with nothing to wait for leaves the loop entirely: a peer
+    // that has hung up would otherwise be reported on every wait
+    bool ok = true;
+    if (current == 0) {
+        ok = worker.getLoop().add(socket, wanted, &endpoint);
+    } else if (wanted == 0) {
+        worker.getLoop().remove(socket);
+    } else {
+        ok = worker.getLoop().modify(socket, wanted, &endpoint);
+    }
+    current = ok ? wanted : current;
+    return ok;
+}
+
+void TcpTunnel::updateEvents() {
+    if (!setEvents(clientSocket, clientEvents, wantedEvents(toBackend, toClient), clientEndpoint) ||
+        !setEvents(upstreamSocket, upstreamEvents, wantedEvents(toClient, toBackend), upstreamEndpoint)) {
+        logger.error("Failed to update tunnel events");
+        close();
+    }
+}
+
+void TcpTunnel::releaseBackend() {
+    if (backend == nullptr) return;
+    server.getLoadBalancer().decrementConnections(backend->host, backend->port);
+    backend = nullptr;
+}
+
+void TcpTunnel::close() {
+    if (closed) return;
+    closed = true;
+    timer.cancel();
+
+    if (relaying) {
+        uint64_t durationUs = EventLoop::monotonicUs() - startUs;
+        worker.getMetrics().recordTunnel(backendIndex, durationUs);
+        logger.info("Tunnel from " + clientIP + " to " + backendUrl + " closed after " +
+                    std::to_string(durationUs / 1000) + "ms: " + std::to_string(toBackend.bytes) + " bytes in, " +
+                    std::to_string(toClient.bytes) + " bytes out");
+    }
+    releaseBackend();
+    tls.reset();
+
+    for (SOCKET* end : {&clientSocket, &upstreamSocket}) {
+        if (*end == INVALID_SOCKET) continue;
+        uint32_t& events = end == &clientSocket ? clientEvents : upstreamEvents;
+        if (events != 0) {
+            worker.getLoop().remove(*end);
+            events = 0;
+        }
+        closesocket(*end);
+        *end = INVALID_SOCKET;
+    }
+#ifdef __linux__
+    for (Direction* direction : {&toBackend, &toClient}) {
+        for (int& fd : direction->pipe) {
+            if (fd >= 0) {
+                ::close(fd);
+                fd = -1;
+            }
+        }
+    }
+#endif
+
+    worker.release(this);
+}
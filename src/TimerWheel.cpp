@@ -0,0 +1,154 @@
+#include "TimerWheel.h"
+
+void TimerWheel::Timer::cancel() {
+    if (wheel != nullptr && next != nullptr) {
+        wheel->unlink(*this);
+    }
+}
+
+TimerWheel::TimerWheel(uint64_t start, uint32_t tick)
+    : currentTick(0), startMs(start), tickMs(tick == 0 ? 1 : tick), armedCount(0) {
+}
+
+TimerWheel::~TimerWheel() {
+    // Detach anything still armed so owners outliving the wheel don't touch it
+    auto detach = [](Slot& slot) {
+        while (!slot.empty()) {
+            Timer* timer = slot.head.next;
+            slot.head.next = timer->next;
+            timer->prev = timer->next = nullptr;
+            timer->wheel = nullptr;
+        }
+        slot.head.prev = &slot.head;
+    };
+    for (auto& slot : level0) detach(slot);
+    for (auto& level : levels) {
+        for (auto& slot : level) detach(slot);
+    }
+}
+
+void TimerWheel::schedule(Timer& timer, uint64_t delayMs) {
+    if (timer.isArmed()) {
+        timer.cancel();
+    }
+
+    uint64_t ticks = (delayMs + tickMs - 1) / tickMs;
+    timer.expiry = currentTick + (ticks == 0 ? 1 : ticks);
+    timer.wheel = this;
+    insert(timer);
+    armedCount++;
+}
+
+void TimerWheel::insert(Timer& timer) {
+    uint64_t delta = timer.expiry > currentTick ? timer.expiry - currentTick : 0;
+    Slot* slot;
+
+    if (delta < kLevel0Size) {
+        slot = &level0[timer.expiry & (kLevel0Size - 1)];
+    } else {
+        int level = 1;
+        while (level < kLevels - 1 && delta >= (uint64_t(1) << (kLevel0Bits + kLevelBits * level))) {
+            level++;
+        }
+        uint64_t maxDelta = (uint64_t(1) << (kLevel0Bits + kLevelBits * (kLevels - 1))) - 1;
+        if (delta > maxDelta) {
+            timer.expiry = currentTick + maxDelta;
+        }
+        int shift = kLevel0Bits + kLevelBits * (level - 1);
+        slot = &levels[level - 1][(timer.expiry >> shift) & (kLevelSize - 1)];
+    }
+
+    Timer& head = slot->head;
+    timer.prev = head.prev;
+    timer.next = &head;
+    head.prev->next = &timer;
+    head.prev = &timer;
+}
+
+void TimerWheel::unlink(Timer& timer) {
+    timer.prev->next = timer.next;
+    timer.next->prev = timer.prev;
+    timer.prev = timer.next = nullptr;
+    armedCount--;
+}
+
+void TimerWheel::spliceInto(Slot& from, Slot& to) {
+    if (from.empty()) return;
+
+    Timer* first = from.head.next;
+    Timer* last = from.head.prev;
+    first->prev = to.head.prev;
+    to.head.prev->next = first;
+    last->next = &to.head;
+    to.head.prev = last;
+
+    from.head.next = from.head.prev = &from.head;
+}
+
+void TimerWheel::cascade(int level, size_t index) {
+    Slot pending;
+    spliceInto(levels[level - 1][index], pending);
+
+    while (!pending.empty()) {
+        Timer* timer = pending.head.next;
+        timer->prev->next = timer->next;
+        timer->next->prev = timer->prev;
+        insert(*timer);
+    }
+}
+
+size_t TimerWheel::advance(uint64_t nowMs) {
+    if (nowMs < startMs) return 0;
+
+    uint64_t targetTick = (nowMs - startMs) / tickMs;
+    size_t fired = 0;
+
+    while (currentTick < targetTick) {
+        currentTick++;
+
+        size_t index = currentTick & (kLevel0Size - 1);
+        if (index == 0) {
+            for (int level = 1; level < kLevels; level++) {
+                int shift = kLevel0Bits + kLevelBits * (level - 1);
+                size_t levelIndex = (currentTick >> shift) & (kLevelSize - 1);
+                cascade(level, levelIndex);
+                if (levelIndex != 0) break;
+            }
+        }
+
+        if (armedCount == 0) {
+            // Nothing left to fire; jump straight to the target
+            currentTick = targetTick;
+            break;
+        }
+
+        // Callbacks may arm or cancel timers, so detach the slot first
+        Slot expired;
+        spliceInto(level0[index], expired);
+        while (!expired.empty()) {
+            Timer* timer = expired.head.next;
+            unlink(*timer);
+            fired++;
+            if (timer->callback) {
+                timer->callback();
+            }
+        }
+    }
+
+    return fired;
+}
+
+int TimerWheel::nextTimeoutMs(uint64_t nowMs) const {
+    if (armedCount == 0) return -1;
+
+    uint64_t nextTick = currentTick + 1;
+    for (size_t i = 1; i <= kLevel0Size; i++, nextTick++) {
+        size_t index = nextTick & (kLevel0Size - 1);
+        if (index == 0 || !level0[index].empty()) {
+            break;
+        }
+    }
+
+    uint64_t dueMs = startMs + nextTick * tickMs;
+    return dueMs > nowMs ? static_cast<int>(dueMs - nowMs) : 0;
+}
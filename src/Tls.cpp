@@ -0,0 +1,439 @@
+#include "Tls.h"
+#include "Logger.h"
+#include <iostream>
+#include <algorithm>
+#include <functional>
+
+#ifdef PROXY_HAS_TLS
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+namespace {
+
+constexpr unsigned char kSessionIdContext[] = "reverse_proxy";
+
+// Oldest queued OpenSSL error, for log lines
+std::string lastTlsError() {
+    unsigned long code = ERR_get_error();
+    ERR_clear_error();
+    if (code == 0) return "unknown error";
+    char text[256];
+    ERR_error_string_n(code, text, sizeof(text));
+    return text;
+}
+
+void setSocketError(int error) {
+#ifdef _WIN32
+    WSASetLastError(error);
+#else
+    errno = error;
+#endif
+}
+
+}
+
+// ---------------------------------------------------------------------------
+// TlsSessionCache
+
+TlsSessionCache::TlsSessionCache(size_t capacity, size_t shardCount, TlsStats& s)
+    : shardCapacity(std::max<size_t>(1, capacity / shardCount)), stats(s) {
+    for (size_t i = 0; i < shardCount; i++) {
+        shards.push_back(std::unique_ptr<Shard>(new Shard()));
+    }
+}
+
+TlsSessionCache::~TlsSessionCache() {
+    for (auto& shard : shards) {
+        for (auto& entry : shard->sessions) {
+            SSL_SESSION_free(entry.second.session);
+        }
+    }
+}
+
+TlsSessionCache::Shard& TlsSessionCache::shardFor(const std::string& id) {
+    return *shards[std::hash<std::string>()(id) % shards.size()];
+}
+
+void TlsSessionCache::store(SSL_SESSION* session) {
+    unsigned int length = 0;
+    const unsigned char* id = SSL_SESSION_get_id(session, &length);
+    std::string key(reinterpret_cast<const char*>(id), length);
+    Shard& shard = shardFor(key);
+
+    SSL_SESSION* evicted = nullptr;
+    SSL_SESSION* replaced = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto found = shard.sessions.find(key);
+        if (found != shard.sessions.end()) {
+            replaced = found->second.session;
+            found->second.session = session;
+            shard.order.splice(shard.order.end(), shard.order, found->second.position);
+        } else {
+            if (shard.sessions.size() >= shardCapacity) {
+                auto oldest = shard.sessions.find(shard.order.front());
+                evicted = oldest->second.session;
+                shard.sessions.erase(oldest);
+                shard.order.pop_front();
+            }
+            shard.order.push_back(key);
+            shard.sessions.emplace(key, Entry{session, std::prev(shard.order.end())});
+        }
+    }
+
+    // Freed outside the lock; the last reference may take a while to tear down
+    if (replaced != nullptr) SSL_SESSION_free(replaced);
+    if (evicted != nullptr) {
+        SSL_SESSION_free(evicted);
+        stats.cacheEvictions.fetch_add(1, std::memory_order_relaxed);
+    }
+    stats.cacheStores.fetch_add(1, std::memory_order_relaxed);
+}
+
+SSL_SESSION* TlsSessionCache::lookup(const unsigned char* id, size_t length) {
+    std::string key(reinterpret_cast<const char*>(id), length);
+    Shard& shard = shardFor(key);
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto found = shard.sessions.find(key);
+    if (found == shard.sessions.end()) {
+        stats.cacheMisses.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    shard.order.splice(shard.order.end(), shard.order, found->second.position);
+    // Referenced under the lock so a concurrent remove cannot free it first
+    SSL_SESSION_up_ref(found->second.session);
+    stats.cacheHits.fetch_add(1, std::memory_order_relaxed);
+    return found->second.session;
+}
+
+void TlsSessionCache::remove(const unsigned char* id, size_t length) {
+    std::string key(reinterpret_cast<const char*>(id), length);
+    Shard& shard = shardFor(key);
+
+    SSL_SESSION* removed = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto found = shard.sessions.find(key);
+        if (found == shard.sessions.end()) return;
+        removed = found->second.session;
+        shard.order.erase(found->second.position);
+        shard.sessions.erase(found);
+    }
+    SSL_SESSION_free(removed);
+}
+
+size_t TlsSessionCache::size() const {
+    size_t total = 0;
+    for (const auto& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        total += shard->sessions.size();
+    }
+    return total;
+}
+
+// ---------------------------------------------------------------------------
+// TlsContext
+
+std::unique_ptr<TlsContext> TlsContext::create(const TlsConfig& config, Logger& logger, bool offerHttp2) {
+    std::unique_ptr<TlsContext> tls(new TlsContext(config, logger, offerHttp2));
+    if (!tls->initialize()) {
+        return nullptr;
+    }
+    return tls;
+}
+
+TlsContext::TlsContext(const TlsConfig& c, Logger& log, bool http2)
+    : config(c), logger(log), offerHttp2(http2), context(nullptr) {}
+
+TlsContext::~TlsContext() {
+    if (context != nullptr) {
+        SSL_CTX_free(context);
+    }
+    // Sessions still referenced by the cache are released with it
+    cache.reset();
+}
+
+bool TlsContext::initialize() {
+    context = SSL_CTX_new(TLS_server_method());
+    if (context == nullptr) {
+        logger.error("Failed to create TLS context: " + lastTlsError());
+        return false;
+    }
+    SSL_CTX_set_min_proto_version(context, TLS1_2_VERSION);
+    SSL_CTX_set_app_data(context, this);
+
+    if (SSL_CTX_use_certificate_chain_file(context, config.certificate.c_str()) != 1) {
+        logger.error("Failed to load TLS certificate " + config.certificate + ": " + lastTlsError());
+        return false;
+    }
+    if (SSL_CTX_use_PrivateKey_file(context, config.privateKey.c_str(), SSL_FILETYPE_PEM) != 1 ||
+        SSL_CTX_check_private_key(context) != 1) {
+        logger.error("Failed to load TLS private key " + config.privateKey + ": " + lastTlsError());
+        return false;
+    }
+
+    // Client output may grow (and move) between retries of a partial write
+    SSL_CTX_set_mode(context, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER |
+                              SSL_MODE_RELEASE_BUFFERS);
+
+    uint64_t options = SSL_OP_NO_COMPRESSION | SSL_OP_CIPHER_SERVER_PREFERENCE;
+    if (!config.sessionTickets) {
+        // TLS 1.2 resumes by session id; TLS 1.3 tickets become cache keys
+        options |= SSL_OP_NO_TICKET;
+    }
+#ifdef SSL_OP_ENABLE_KTLS
+    if (config.ktls) {
+        options |= SSL_OP_ENABLE_KTLS;
+    }
+#endif
+    SSL_CTX_set_options(context, options);
+
+    SSL_CTX_set_session_id_context(context, kSessionIdContext, sizeof(kSessionIdContext) - 1);
+    SSL_CTX_set_timeout(context, static_cast<long>(config.sessionTimeoutS));
+    if (config.sessionCacheSize > 0) {
+        cache.reset(new TlsSessionCache(static_cast<size_t>(config.sessionCacheSize),
+                                        static_cast<size_t>(config.sessionCacheShards), stats));
+        // OpenSSL's own cache is one locked table; ours replaces it
+        SSL_CTX_set_session_cache_mode(context, SSL_SESS_CACHE_SERVER | SSL_SESS_CACHE_NO_INTERNAL);
+        SSL_CTX_sess_set_new_cb(context, onNewSession);
+        SSL_CTX_sess_set_get_cb(context, onGetSession);
+        SSL_CTX_sess_set_remove_cb(context, onRemoveSession);
+    } else {
+        SSL_CTX_set_session_cache_mode(context, SSL_SESS_CACHE_OFF);
+    }
+
+    SSL_CTX_set_alpn_select_cb(context, onSelectProtocol, this);
+
+#ifndef SSL_OP_ENABLE_KTLS
+    if (config.ktls) {
+        logger.warning("OpenSSL " + std::string(OpenSSL_version(OPENSSL_VERSION)) +
+                       " has no kernel TLS support; records are encrypted in user space");
+    }
+#endif
+    logger.info("TLS context ready (" + std::string(OpenSSL_version(OPENSSL_VERSION)) + ")");
+    return true;
+}
+
+SSL* TlsContext::newSession(SOCKET socket) {
+    SSL* ssl = SSL_new(context);
+    if (ssl == nullptr) {
+        logger.warning("Failed to create TLS session: " + lastTlsError());
+        return nullptr;
+    }
+    // The socket BIO does not close the descriptor; its owner does
+    if (SSL_set_fd(ssl, static_cast<int>(socket)) != 1) {
+        logger.warning("Failed to attach TLS session to socket: " + lastTlsError());
+        SSL_free(ssl);
+        return nullptr;
+    }
+    SSL_set_accept_state(ssl);
+    return ssl;
+}
+
+// Our preference order wins; clients that offer none of it go without ALPN
+int TlsContext::onSelectProtocol(SSL*, const unsigned char** out, unsigned char* outLength, const unsigned char* in,
+                                 unsigned int inLength, void* arg) {
+    static const unsigned char kWithHttp2[] = "\x02h2\x08http/1.1";
+    static const unsigned char kHttp1[] = "\x08http/1.1";
+    TlsContext* tls = static_cast<TlsContext*>(arg);
+    const unsigned char* offered = tls->offerHttp2 ? kWithHttp2 : kHttp1;
+    unsigned int offeredLength = tls->offerHttp2 ? sizeof(kWithHttp2) - 1 : sizeof(kHttp1) - 1;
+
+    unsigned char* selected = nullptr;
+    if (SSL_select_next_proto(&selected, outLength, offered, offeredLength, in, inLength) != OPENSSL_NPN_NEGOTIATED) {
+        return SSL_TLSEXT_ERR_NOACK;
+    }
+    *out = selected;
+    return SSL_TLSEXT_ERR_OK;
+}
+
+int TlsContext::onNewSession(SSL* ssl, SSL_SESSION* session) {
+    TlsContext* tls = static_cast<TlsContext*>(SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl)));
+    // Stateless TLS 1.3 tickets carry the session themselves
+    if (SSL_version(ssl) == TLS1_3_VERSION && (SSL_get_options(ssl) & SSL_OP_NO_TICKET) == 0) {
+        return 0;
+    }
+    tls->cache->store(session);
+    return 1;
+}
+
+SSL_SESSION* TlsContext::onGetSession(SSL* ssl, const unsigned char* id, int length, int* copy) {
+    TlsContext* tls = static_cast<TlsContext*>(SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl)));
+    // lookup() already added the reference OpenSSL takes over
+    *copy = 0;
+    return tls->cache->lookup(id, static_cast<size_t>(length));
+}
+
+void TlsContext::onRemoveSession(SSL_CTX* ctx, SSL_SESSION* session) {
+    TlsContext* tls = static_cast<TlsContext*>(SSL_CTX_get_app_data(ctx));
+    unsigned int length = 0;
+    const unsigned char* id = SSL_SESSION_get_id(session, &length);
+    tls->cache->remove(id, length);
+}
+
+// ---------------------------------------------------------------------------
+// TlsStream
+
+TlsStream::TlsStream(TlsContext& c, SOCKET socket) : context(c), ssl(c.newSession(socket)), established(false) {}
+
+TlsStream::~TlsStream() {
+    if (ssl != nullptr) {
+        SSL_free(ssl);
+    }
+}
+
+TlsStream::Handshake TlsStream::handshake() {
+    ERR_clear_error();
+    int result = SSL_do_handshake(ssl);
+    if (result == 1) {
+        established = true;
+        TlsStats& stats = context.getStats();
+        (isResumed() ? stats.resumedHandshakes : stats.fullHandshakes).fetch_add(1, std::memory_order_relaxed);
+        if (sendsInKernel()) stats.kernelSend.fetch_add(1, std::memory_order_relaxed);
+        if (receivesInKernel()) stats.kernelReceive.fetch_add(1, std::memory_order_relaxed);
+        return Handshake::Done;
+    }
+
+    switch (SSL_get_error(ssl, result)) {
+        case SSL_ERROR_WANT_READ:
+            return Handshake::WantRead;
+        case SSL_ERROR_WANT_WRITE:
+            return Handshake::WantWrite;
+        default:
+            ERR_clear_error();
+            context.getStats().failedHandshakes.fetch_add(1, std::memory_order_relaxed);
+            return Handshake::Failed;
+    }
+}
+
+long TlsStream::read(char* buffer, size_t length) {
+    ERR_clear_error();
+    setSocketError(0);
+    size_t received = 0;
+    int result = SSL_read_ex(ssl, buffer, length, &received);
+    if (result == 1) return static_cast<long>(received);
+    return failed(result);
+}
+
+long TlsStream::write(const char* data, size_t length) {
+    ERR_clear_error();
+    setSocketError(0);
+    size_t sent = 0;
+    int result = SSL_write_ex(ssl, data, length, &sent);
+    if (result == 1) return static_cast<long>(sent);
+    return failed(result);
+}
+
+// Maps a failed read or write onto recv()/send() results
+long TlsStream::failed(int result) {
+    switch (SSL_get_error(ssl, result)) {
+        case SSL_ERROR_WANT_READ:
+        case SSL_ERROR_WANT_WRITE:
+#ifdef _WIN32
+            setSocketError(WSAEWOULDBLOCK);
+#else
+            setSocketError(EAGAIN);
+#endif
+            return -1;
+        case SSL_ERROR_ZERO_RETURN:
+            return 0;   // close_notify
+        case SSL_ERROR_SYSCALL:
+            // errno already describes it; a bare EOF without close_notify reads as a close
+            ERR_clear_error();
+            return lastSocketError() == 0 ? 0 : -1;
+        default:
+            ERR_clear_error();
+#ifdef _WIN32
+            setSocketError(WSAECONNRESET);
+#else
+            setSocketError(ECONNRESET);
+#endif
+            return -1;
+    }
+}
+
+void TlsStream::shutdown() {
+    if (!established) return;
+    ERR_clear_error();
+    SSL_shutdown(ssl);
+    ERR_clear_error();
+}
+
+bool TlsStream::hasPending() const {
+    return SSL_pending(ssl) > 0;
+}
+
+bool TlsStream::isResumed() const {
+    return SSL_session_reused(ssl) == 1;
+}
+
+bool TlsStream::sendsInKernel() const {
+    return BIO_get_ktls_send(SSL_get_wbio(ssl)) ? true : false;
+}
+
+bool TlsStream::receivesInKernel() const {
+    return BIO_get_ktls_recv(SSL_get_rbio(ssl)) ? true : false;
+}
+
+std::string TlsStream::describe() const {
+    return std::string(SSL_get_version(ssl)) + " " + SSL_get_cipher_name(ssl) + (isResumed() ? ", resumed" : "") +
+           (sendsInKernel() ? ", kTLS send" : "") + (receivesInKernel() ? ", kTLS receive" : "") +
+           (selectedProtocol().empty() ? "" : ", ALPN " + selectedProtocol());
+}
+
+std::string TlsStream::selectedProtocol() const {
+    const unsigned char* protocol = nullptr;
+    unsigned int length = 0;
+    SSL_get0_alpn_selected(ssl, &protocol, &length);
+    if (protocol == nullptr) return std::string();
+    return std::string(reinterpret_cast<const char*>(protocol), length);
+}
+
+#else  // !PROXY_HAS_TLS
+
+TlsSessionCache::TlsSessionCache(size_t, size_t, TlsStats& s) : shardCapacity(0), stats(s) {}
+TlsSessionCache::~TlsSessionCache() {}
+void TlsSessionCache::store(ssl_session_st*) {}
+ssl_session_st* TlsSessionCache::lookup(const unsigned char*, size_t) { return nullptr; }
+void TlsSessionCache::remove(const unsigned char*, size_t) {}
+size_t TlsSessionCache::size() const { return 0; }
+
+std::unique_ptr<TlsContext> TlsContext::create(const TlsConfig&, Logger& logger, bool) {
+    logger.warning("TLS needs a build with OpenSSL (PROXY_HAS_TLS); the TLS listener is disabled");
+    return nullptr;
+}
+
+TlsContext::TlsContext(const TlsConfig& c, Logger& log, bool http2)
+    : config(c), logger(log), offerHttp2(http2), context(nullptr) {}
+TlsContext::~TlsContext() {}
+bool TlsContext::initialize() { return false; }
+ssl_st* TlsContext::newSession(SOCKET) { return nullptr; }
+
+TlsStream::TlsStream(TlsContext& c, SOCKET) : context(c), ssl(nullptr), established(false) {}
+TlsStream::~TlsStream() {}
+TlsStream::Handshake TlsStream::handshake() { return Handshake::Failed; }
+long TlsStream::read(char*, size_t) { return -1; }
+long TlsStream::write(const char*, size_t) { return -1; }
+long TlsStream::failed(int) { return -1; }
+void TlsStream::shutdown() {}
+bool TlsStream::hasPending() const { return false; }
+bool TlsStream::isResumed() const { return false; }
+bool TlsStream::sendsInKernel() const { return false; }
+bool TlsStream::receivesInKernel() const { return false; }
+std::string TlsStream::describe() const { return std::string(); }
+std::string TlsStream::selectedProtocol() const { return std::string(); }
+
+#endif  // PROXY_HAS_TLS
+
+void TlsContext::printStatus() const {
+    std::cout << "\n=== TLS ===" << std::endl;
+    std::cout << "Handshakes: " << stats.fullHandshakes.load() << " full, " << stats.resumedHandshakes.load()
+              << " resumed, " << stats.failedHandshakes.load() << " failed" << std::endl;
+    std::cout << "Session cache: " << getCachedSessions() << " sessions (" << stats.cacheHits.load() << " hits, "
+              << stats.cacheMisses.load() << " misses, " << stats.cacheStores.load() << " stored, "
+              << stats.cacheEvictions.load() << " evicted)" << std::endl;
+    std::cout << "Kernel TLS: " << stats.kernelSend.load() << " send, " << stats.kernelReceive.load()
+              << " receive offloads" << std::endl;
+    std::cout << "===========\n" << std::endl;
+}
@@ -0,0 +1,211 @@
+#include "TrafficCapture.h"
+#include "EventLoop.h"
+#include "Hpack.h"
+#include "Logger.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <type_traits>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+static_assert(sizeof(CaptureFileHeader) == 64, "capture file header is 64 bytes");
+static_assert(sizeof(CaptureRecord) == 40, "capture record header is 40 bytes");
+static_assert(std::is_trivially_copyable<CaptureRecord>::value, "records are copied as raw bytes");
+
+namespace {
+
+const char kMagic[8] = {'R', 'P', 'C', 'A', 'P', '0', '1', '\0'};
+constexpr uint32_t kVersion = 1;
+
+size_t padded(size_t size) {
+    return (size + 7) & ~static_cast<size_t>(7);
+}
+
+// Copies a request head line by line, overwriting credential header values
+// with '*' so they never reach the segment; the length is unchanged
+void copyRedacted(char* out, const char* head, size_t length) {
+    size_t line = 0;
+    while (line < length) {
+        const char* newline = static_cast<const char*>(memchr(head + line, '\n', length - line));
+        size_t next = newline != nullptr ? static_cast<size_t>(newline - head) + 1 : length;
+        memcpy(out + line, head + line, next - line);
+
+        const char* colon = static_cast<const char*>(memchr(head + line, ':', next - line));
+        if (line > 0 && colon != nullptr && Hpack::isSensitive(head + line, static_cast<size_t>(colon - head) - line)) {
+            size_t value = static_cast<size_t>(colon - head) + 1;
+            size_t end = next;
+            while (end > value && (head[end - 1] == '\n' || head[end - 1] == '\r')) end--;
+            while (value < end && (head[value] == ' ' || head[value] == '\t')) value++;
+            memset(out + value, '*', end - value);
+        }
+        line = next;
+    }
+}
+
+} // namespace
+
+TrafficCapture::TrafficCapture(const CaptureConfig& c, int w, Logger& l)
+    : config(c), worker(w), logger(l),
+      random(0x9E3779B97F4A7C15ull ^ (static_cast<uint64_t>(w) << 32) ^ EventLoop::monotonicUs()),
+      nextConnection(1), recorded(0), dropped(0),
+      fd(-1), mapping(nullptr), mappingSize(static_cast<size_t>(c.segmentSizeMb) << 20), used(0), segment(0) {
+#ifdef _WIN32
+    logger.warning("Traffic capture is not supported on Windows; disabled");
+#else
+    ::mkdir(config.directory.c_str(), 0755);
+    openSegment();
+#endif
+}
+
+TrafficCapture::~TrafficCapture() {
+    closeSegment();
+    if (recorded > 0 || dropped > 0) {
+        logger.info("Traffic capture: worker " + std::to_string(worker) + " recorded " + std::to_string(recorded) +
+                    " requests (" + std::to_string(dropped) + " dropped)");
+    }
+}
+
+uint64_t TrafficCapture::sampleConnection() {
+    if (mapping == nullptr) return 0;
+    if (config.sampleRate < 1.0) {
+        // xorshift64*: cheap, and only this worker's thread draws from it
+        random ^= random >> 12;
+        random ^= random << 25;
+        random ^= random >> 27;
+        double draw = static_cast<double>((random * 2685821657736338717ull) >> 11) / 9007199254740992.0;
+        if (draw >= config.sampleRate) return 0;
+    }
+    // Worker in the top bits keeps ids unique across workers
+    return (static_cast<uint64_t>(worker) << 48) | nextConnection++;
+}
+
+void TrafficCapture::record(uint64_t connectionId, uint32_t requestIndex, uint64_t timestampUs,
+                            const char* head, size_t headLength, long long bodyLength) {
+    size_t size = padded(sizeof(CaptureRecord) + headLength);
+    if (mapping == nullptr || size > mappingSize - sizeof(CaptureFileHeader)) {
+        dropped++;
+        return;
+    }
+    if (used + size > mappingSize) {
+        closeSegment();
+        if (!openSegment()) {
+            dropped++;
+            return;
+        }
+    }
+
+    CaptureRecord entry{};
+    entry.size = static_cast<uint32_t>(size);
+    entry.headLength = static_cast<uint32_t>(headLength);
+    entry.timestampUs = timestampUs;
+    entry.connectionId = connectionId;
+    entry.requestIndex = requestIndex;
+    entry.flags = bodyLength < 0 ? static_cast<uint32_t>(CaptureChunkedBody) : 0u;
+    entry.bodyLength = bodyLength > 0 ? static_cast<uint64_t>(bodyLength) : 0;
+
+    // The segment is zero-filled, so the padding is already in place
+    copyRedacted(mapping + used + sizeof(entry), head, headLength);
+    memcpy(mapping + used, &entry, sizeof(entry));
+    used += size;
+    recorded++;
+}
+
+bool TrafficCapture::openSegment() {
+#ifdef _WIN32
+    return false;
+#else
+    char name[64];
+    snprintf(name, sizeof(name), "/capture-%d-w%d-%06u.rpcap", static_cast<int>(getpid()), worker, segment);
+    std::string path = config.directory + name;
+
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0 || ftruncate(fd, static_cast<off_t>(mappingSize)) != 0) {
+        logger.error("Traffic capture: cannot create " + path + ": " + strerror(errno));
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+        return false;
+    }
+    void* address = mmap(nullptr, mappingSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (address == MAP_FAILED) {
+        logger.error("Traffic capture: cannot map " + path + ": " + strerror(errno));
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+    mapping = static_cast<char*>(address);
+
+    CaptureFileHeader header{};
+    memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kVersion;
+    header.headerSize = sizeof(header);
+    header.createdUnixUs = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count());
+    header.createdMonotonicUs = EventLoop::monotonicUs();
+    header.worker = static_cast<uint32_t>(worker);
+    header.segment = segment++;
+    memcpy(mapping, &header, sizeof(header));
+    used = sizeof(header);
+
+    segments.push_back(path);
+    while (segments.size() > static_cast<size_t>(config.maxSegments)) {
+        ::unlink(segments.front().c_str());
+        segments.erase(segments.begin());
+    }
+    logger.debug("Traffic capture: worker " + std::to_string(worker) + " writing " + path);
+    return true;
+#endif
+}
+
+void TrafficCapture::closeSegment() {
+#ifndef _WIN32
+    if (mapping == nullptr) return;
+    munmap(mapping, mappingSize);
+    mapping = nullptr;
+    // Trim the unused tail so finished segments take only what they hold
+    if (ftruncate(fd, static_cast<off_t>(used)) != 0) {
+        logger.warning("Traffic capture: cannot trim segment: " + std::string(strerror(errno)));
+    }
+    ::close(fd);
+    fd = -1;
+#endif
+}
+
+bool CaptureReader::readSegment(const std::string& path, std::vector<CapturedRequest>& requests, std::string& error) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        error = "cannot open " + path;
+        return false;
+    }
+    CaptureFileHeader header;
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 || header.version != kVersion) {
+        error = path + " is not a capture segment";
+        return false;
+    }
+    file.seekg(header.headerSize);
+
+    CaptureRecord entry;
+    while (file.read(reinterpret_cast<char*>(&entry), sizeof(entry)) && entry.size != 0) {
+        if (entry.size < sizeof(entry) + entry.headLength) {
+            error = path + ": corrupt record";
+            return false;
+        }
+        CapturedRequest request;
+        request.timestampUs = entry.timestampUs;
+        request.connectionId = entry.connectionId;
+        request.requestIndex = entry.requestIndex;
+        request.flags = entry.flags;
+        request.bodyLength = entry.bodyLength;
+        request.head.resize(entry.headLength);
+        if (!file.read(&request.head[0], entry.headLength)) break;   // cut short by a crash
+        file.seekg(entry.size - sizeof(entry) - entry.headLength, std::ios::cur);
+        requests.push_back(std::move(request));
+    }
+    return true;
+}
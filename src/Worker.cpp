@@ -0,0 +1,388 @@
+#include "Worker.h"
+#include "Server.h"
+#include "Connection.h"
+#include "ResponseWriter.h"
+#include "RequestPipeline.h"
+#include "TcpTunnel.h"
+#include "Http2.h"
+#include "Affinity.h"
+#include "SocketTuning.h"
+
+namespace {
+
+#ifdef _WIN32
+constexpr int kShutdownRead = SD_RECEIVE;
+#else
+constexpr int kShutdownRead = SHUT_RD;
+#endif
+
+} // namespace
+
+Worker::Worker(Server& s, int workerId)
+    : server(s), id(workerId), cpu(-1), accepting(false), metrics(s.getMetrics().getShard(workerId)),
+      tcpMode(s.getConfig().isTcpMode()),
+      queuedRequests(0), currentClass(0), drainScheduled(false), coroutinePipeline(false) {
+    const PriorityClassifier& classifier = s.getAdmission().getClassifier();
+    for (size_t i = 0; i < classifier.getClassCount(); i++) {
+        queues.emplace_back(classifier.getClass(i), s.getConfig().getAdmission().queueIntervalMs);
+    }
+    queueTimer.setCallback([this] { drainQueue(); });
+    s.getLoadBalancer().createShard(static_cast<size_t>(workerId));
+#ifdef PROXY_HAS_COROUTINES
+    idleDrainTimer.setCallback([this] { closeIdleClients(); });
+#endif
+    if (s.getConfig().getCapture().enabled) {
+        capture.reset(new TrafficCapture(s.getConfig().getCapture(), workerId, s.getLogger()));
+    }
+#ifdef PROXY_HAS_COROUTINES
+    coroutinePipeline = s.getConfig().getPipeline() == "coroutine";
+#endif
+}
+
+Worker::~Worker() {
+    join();
+
+#ifdef PROXY_HAS_COROUTINES
+    // Closes the sockets of clients still being served; frames go back to the pool
+    tasks.destroyAll();
+#endif
+    const FramePool::Stats& frames = framePool.getStats();
+    if (frames.allocations > 0) {
+        server.getLogger().debug("Worker " + std::to_string(id) + " coroutine frames: " +
+                                 std::to_string(frames.allocations) + " allocated, peak " +
+                                 std::to_string(frames.peakLive) + " live, " + std::to_string(frames.heapFallbacks) +
+                                 " from the heap, " + std::to_string(frames.slabBytes / 1024) + " KB of slabs");
+    }
+
+    // Connections unregister themselves on close; detach the set first
+    std::unordered_set<Connection*> remaining;
+    remaining.swap(connections);
+    for (Connection* connection : remaining) {
+        delete connection;
+    }
+    std::unordered_set<TcpTunnel*> remainingTunnels;
+    remainingTunnels.swap(tunnels);
+    for (TcpTunnel* tunnel : remainingTunnels) {
+        delete tunnel;
+    }
+    std::unordered_set<Http2Session*> remainingSessions;
+    remainingSessions.swap(sessions);
+    for (Http2Session* session : remainingSessions) {
+        delete session;
+    }
+    const Http2StreamPool::Stats& streams = streamPool.getStats();
+    if (streams.acquisitions > 0) {
+        server.getLogger().debug("Worker " + std::to_string(id) + " HTTP/2 streams: " +
+                                 std::to_string(streams.acquisitions) + " served, peak " +
+                                 std::to_string(streams.peakLive) + " live, " + std::to_string(streams.created) +
+                                 " pooled");
+    }
+}
+
+void Worker::addListener(SOCKET listenSocket, bool tls) {
+    acceptors.push_back(std::unique_ptr<Acceptor>(new Acceptor(*this, listenSocket, tls)));
+}
+
+bool Worker::start() {
+    if (!loop.isValid()) {
+        server.getLogger().error("Worker " + std::to_string(id) + ": failed to create event loop");
+        return false;
+    }
+    for (size_t i = 0; i < acceptors.size(); i++) {
+        if (!loop.add(acceptors[i]->getSocket(), EventLoop::Readable, acceptors[i].get())) {
+            server.getLogger().error("Worker " + std::to_string(id) + ": failed to register listening socket");
+            while (i-- > 0) {
+                loop.remove(acceptors[i]->getSocket());
+            }
+            return false;
+        }
+    }
+    accepting = true;
+
+    thread = std::thread(&Worker::run, this);
+    return true;
+}
+
+void Worker::join() {
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+void Worker::run() {
+    // Before the first allocation: pages this thread touches come from the
+    // node it is pinned to
+    if (cpu >= 0 && !CpuAffinity::pinCurrentThread(cpu)) {
+        server.getLogger().warning("Worker " + std::to_string(id) + ": failed to pin to CPU " + std::to_string(cpu));
+    }
+    LoadBalancer::setThreadShard(id);
+    server.getLogger().debug("Worker " + std::to_string(id) + " event loop running" +
+                             (cpu >= 0 ? " on CPU " + std::to_string(cpu) : std::string()));
+    FramePool::setCurrent(&framePool);
+    loop.run(server.getRunningFlag());
+    stopAccepting();
+    FramePool::setCurrent(nullptr);
+}
+
+void Worker::Acceptor::onEvent(uint32_t events) {
+    if (events & EventLoop::Readable) {
+        worker.acceptConnections(socket, tls);
+    }
+}
+
+void Worker::startDraining() {
+    loop.post([this] {
+        stopAccepting();
+        drainClients();
+    });
+}
+
+void Worker::stopAccepting() {
+    if (!accepting) return;
+    accepting = false;
+    for (const auto& acceptor : acceptors) {
+        loop.remove(acceptor->getSocket());
+    }
+}
+
+// Requests in flight finish (without keep-alive, see Server::isDraining);
+// clients waiting for their next request get a short grace, so a request
+// already on its way is still answered rather than met with a close
+void Worker::drainClients() {
+    std::vector<Connection*> current(connections.begin(), connections.end());
+    for (Connection* connection : current) {
+        connection->drain();
+    }
+    std::vector<Http2Session*> currentSessions(sessions.begin(), sessions.end());
+    for (Http2Session* session : currentSessions) {
+        session->drain();
+    }
+#ifdef PROXY_HAS_COROUTINES
+    loop.timers().schedule(idleDrainTimer, kDrainIdleGraceMs);
+#endif
+}
+
+#ifdef PROXY_HAS_COROUTINES
+// The pending read sees end of stream and the task finishes
+void Worker::closeIdleClients() {
+    for (AsyncSocket* client : idleClients) {
+        shutdown(client->get(), kShutdownRead);
+    }
+}
+#endif
+
+// Drains the accept queue; each socket arrives non-blocking
+void Worker::acceptConnections(SOCKET listener, bool tls) {
+    while (true) {
+        sockaddr_in clientAddr{};
+        socklen_t clientAddrLen = sizeof(clientAddr);
+
+        SOCKET clientSocket = SocketTuning::accept(listener, (sockaddr*)&clientAddr, &clientAddrLen);
+        if (clientSocket == INVALID_SOCKET) {
+            int error = lastSocketError();
+            if (isInterrupted(error)) continue;
+            if (!isWouldBlock(error) && server.isRunning()) {
+                server.getLogger().warning("Failed to accept client connection");
+            }
+            return;
+        }
+
+        handleClient(clientSocket, tls);
+    }
+}
+
+void Worker::handleClient(SOCKET clientSocket, bool tls) {
+    if (!server.tryAcquireConnection()) {
+        rejectClient(clientSocket, tls);
+        return;
+    }
+
+    metrics.add(Counter::ConnectionsAccepted);
+    if (tcpMode) {
+        adoptTunnel(new TcpTunnel(*this, clientSocket));
+        return;
+    }
+#ifdef PROXY_HAS_COROUTINES
+    if (coroutinePipeline && !tls) {
+        tasks.spawn(RequestPipeline::serve(*this, clientSocket));
+        return;
+    }
+#endif
+    Connection* connection = new Connection(*this, clientSocket, tls ? server.getTls() : nullptr);
+    connections.insert(connection);
+    if (!connection->start()) {
+        server.getLogger().warning("Failed to register client connection");
+        connections.erase(connection);
+        delete connection;
+    }
+}
+
+void Worker::release(Connection* connection) {
+    if (connections.erase(connection) > 0) {
+        loop.defer([connection] { delete connection; });
+    }
+}
+
+void Worker::adoptTunnel(TcpTunnel* tunnel) {
+    tunnels.insert(tunnel);
+    tunnel->start();
+}
+
+void Worker::release(TcpTunnel* tunnel) {
+    if (tunnels.erase(tunnel) > 0) {
+        loop.defer([tunnel] { delete tunnel; });
+    }
+}
+
+void Worker::adoptSession(Http2Session* session) {
+    sessions.insert(session);
+    if (!session->start()) {
+        server.getLogger().warning("Failed to register HTTP/2 session");
+        sessions.erase(session);
+        delete session;
+        return;
+    }
+    if (server.isDraining()) {
+        session->drain();
+    }
+}
+
+void Worker::release(Http2Session* session) {
+    if (sessions.erase(session) > 0) {
+        loop.defer([session] { delete session; });
+    }
+}
+
+void Worker::rejectClient(SOCKET clientSocket, bool tls) {
+    metrics.add(Counter::ConnectionsRejected);
+    server.getAdmission().getStats().rejectedConnections.fetch_add(1, std::memory_order_relaxed);
+    server.getLogger().warning("Connection limit reached (" + std::to_string(server.getConfig().getMaxConnections()) +
+                               "), rejecting " + Server::getClientIP(clientSocket));
+    if (tcpMode || tls) {
+        // No protocol to answer in (or no handshake yet); the client just sees the connection close
+        closesocket(clientSocket);
+        return;
+    }
+
+    // Best effort: the response fits in an empty socket buffer
+    static const std::string body = "Service Unavailable - too many connections";
+    ResponseWriter::Frame frame;
+    ResponseWriter::build(frame, 503, body.data(), body.length());
+    ResponseWriter::writeSome(clientSocket, frame);
+    closesocket(clientSocket);
+}
+
+bool Worker::enqueue(Connection* connection, size_t priorityClass, QueuePosition& position) {
+    AdmissionStats& stats = server.getAdmission().getStats();
+    PriorityClassStats& classStats = server.getAdmission().getClassStats(priorityClass);
+    ClassQueue& queue = queues[priorityClass];
+
+    if (queue.codel.isShedding()) {
+        stats.shed.fetch_add(1, std::memory_order_relaxed);
+        classStats.shed.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    if (queue.waiting.size() >= queue.capacity) {
+        stats.rejectedQueueFull.fetch_add(1, std::memory_order_relaxed);
+        classStats.rejectedQueueFull.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    position = queue.waiting.insert(queue.waiting.end(), connection);
+    queuedRequests++;
+    updateQueueGauges(priorityClass);
+    stats.queued.fetch_add(1, std::memory_order_relaxed);
+    classStats.queued.fetch_add(1, std::memory_order_relaxed);
+    if (!queueTimer.isArmed()) {
+        loop.timers().schedule(queueTimer, loop.timers().getTickMs());
+    }
+    return true;
+}
+
+void Worker::dequeue(size_t priorityClass, QueuePosition position) {
+    queues[priorityClass].waiting.erase(position);
+    queuedRequests--;
+    updateQueueGauges(priorityClass);
+}
+
+void Worker::updateQueueGauges(size_t priorityClass) {
+    metrics.setGauge(Gauge::QueuedRequests, static_cast<int64_t>(queuedRequests));
+    metrics.setClassQueued(priorityClass, static_cast<int64_t>(queues[priorityClass].waiting.size()));
+}
+
+void Worker::scheduleQueueDrain() {
+    if (drainScheduled || queuedRequests == 0) return;
+    drainScheduled = true;
+    loop.defer([this] { drainQueue(); });
+}
+
+void Worker::drainQueue() {
+    drainScheduled = false;
+    uint64_t now = EventLoop::monotonicMs();
+
+    for (size_t i = 0; i < queues.size(); i++) {
+        expireQueued(i, now);
+    }
+
+    while (queuedRequests > 0) {
+        ClassQueue& queue = queues[currentClass];
+        if (queue.waiting.empty()) {
+            queue.deficit = 0;
+            currentClass = (currentClass + 1) % queues.size();
+            continue;
+        }
+        if (queue.deficit == 0) {
+            queue.deficit = queue.weight;
+        }
+
+        Connection* connection = queue.waiting.front();
+        Connection::Admission result = connection->tryAdmit();
+        // The turn carries over to the next free slot
+        if (result == Connection::Admission::Saturated) break;
+
+        queue.waiting.pop_front();
+        queuedRequests--;
+        if (--queue.deficit == 0) {
+            currentClass = (currentClass + 1) % queues.size();
+        }
+        connection->admitQueued(result);
+    }
+
+    for (size_t i = 0; i < queues.size(); i++) {
+        if (queues[i].waiting.empty()) queues[i].codel.update(0, now);
+        updateQueueGauges(i);
+    }
+    if (queuedRequests == 0) {
+        queueTimer.cancel();
+    } else if (!queueTimer.isArmed()) {
+        loop.timers().schedule(queueTimer, loop.timers().getTickMs());
+    }
+}
+
+void Worker::expireQueued(size_t priorityClass, uint64_t now) {
+    ClassQueue& queue = queues[priorityClass];
+    AdmissionStats& stats = server.getAdmission().getStats();
+    PriorityClassStats& classStats = server.getAdmission().getClassStats(priorityClass);
+
+    while (!queue.waiting.empty()) {
+        Connection* connection = queue.waiting.front();
+        uint64_t waited = now - connection->getQueuedAt();
+        queue.codel.update(waited, now);
+
+        const char* reason = nullptr;
+        if (waited >= queue.deadlineMs) {
+            stats.queueTimeouts.fetch_add(1, std::memory_order_relaxed);
+            classStats.queueTimeouts.fetch_add(1, std::memory_order_relaxed);
+            reason = "Service Unavailable - queue timeout";
+        } else if (queue.codel.isShedding() && waited >= queue.codel.getTargetMs()) {
+            stats.shed.fetch_add(1, std::memory_order_relaxed);
+            classStats.shed.fetch_add(1, std::memory_order_relaxed);
+            reason = "Service Unavailable - overloaded";
+        } else {
+            return;
+        }
+        queue.waiting.pop_front();
+        queuedRequests--;
+        connection->rejectQueued(reason);
+    }
+}
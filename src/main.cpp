@@ -3,6 +3,27 @@
 #include "LoadBalancer.h"
 #include "Config.h"
 #include <iostream>
+#include <csignal>
+
+namespace {
+
+Server* activeServer = nullptr;
+
+void handleShutdownSignal(int) {
+    if (activeServer != nullptr) {
+        activeServer->requestStop();
+    }
+}
+
+#ifndef _WIN32
+void handleDumpSignal(int) {
+    if (activeServer != nullptr) {
+        activeServer->requestSlowRequestDump();
+    }
+}
+#endif
+
+} // namespace
 
 int main(int argc, char* argv[]) {
     std::cout << "=== Reverse Proxy Server with Configuration Management ===" << std::endl;
@@ -49,7 +70,16 @@ int main(int argc, char* argv[]) {
     std::cout << "\nPress Ctrl+C to stop the server" << std::endl;
     std::cout << "================================================" << std::endl;
     
+    activeServer = &proxyServer;
+    std::signal(SIGINT, handleShutdownSignal);
+    std::signal(SIGTERM, handleShutdownSignal);
+#ifndef _WIN32
+    // kill -USR1 <pid> prints the slow-request log
+    std::signal(SIGUSR1, handleDumpSignal);
+#endif
+    
     bool success = proxyServer.start();
+    activeServer = nullptr;
     
     if (!success) {
         logger.error("Failed to start reverse proxy server");